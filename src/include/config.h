@@ -47,6 +47,15 @@
 /* Brotli compression support */
 #define MZIP_ENABLE_BROTLI 1
 
+/* Hardware CRC-32 (PCLMULQDQ folding on x86-64, selected at runtime) */
+#define MZIP_ENABLE_CRC32_SIMD 1
+
+/* Use POSIX threads for parallel work, e.g. the CRC of large entries */
+#define MZIP_ENABLE_THREADS 1
+
+/* Read archives opened read-only through mmap instead of stdio */
+#define MZIP_ENABLE_MMAP 1
+
 /* Future algorithms that could be supported */
 
 /* 
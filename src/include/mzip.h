@@ -8,17 +8,39 @@
  *   zip_close
  *   zip_get_num_files
  *   zip_name_locate
- *   zip_fopen_index    (returns the **whole** uncompressed file in memory)
+ *   zip_stat_index
+ *   zip_get_name
+ *   zip_fopen_index    (streaming handle, read with zip_fread)
+ *   zip_fread / zip_fseek / zip_ftell
+ *   zip_fopen_index_view (zero-copy view of a stored entry, mzip extension)
  *   zip_fclose
  *   zip_source_buffer  (for adding files)
+ *   zip_source_file / zip_source_filep (stream a file or pipe into the archive)
+ *   zip_source_free    (release a source zip_file_add did not take)
  *   zip_file_add       (add file to archive)
+ *   zip_files_add_batch (add many files at once, mzip extension)
  *   zip_set_file_compression (set compression method)
  *
  * Supported archives
  * ------------------
  *  • Single-disk, non-spanned ZIP files created with the standard PKZIP spec.
  *  • Compression methods 0 (stored) and 8 (deflate).
- *  • No encrypted entries, no ZIP64, no data descriptors (general flag bit 3).
+ *  • ZIP64 (sizes/offsets past 4 GiB, more than 65535 entries).
+ *  • No encrypted entries.
+ *  • Data descriptors (general flag bit 3) are read, and written for entries
+ *    added from a file source (zip_source_file / zip_source_filep).
+ *  • Stored, deflate, zstd (93) and LZMA (14) entries stream both ways: zip_fread
+ *    decodes them piece by piece, and file sources are compressed as they
+ *    are read. Other methods are decoded whole by zip_fopen_index and read
+ *    whole from file sources, which caps them at 2 GiB.
+ *
+ * Threads
+ * -------
+ *  An archive opened with ZIP_RDONLY can be read from several threads at
+ *  once: each thread opens its own entries with zip_fopen_index and reads
+ *  them with zip_fread / zip_fseek. Data is read with pread and never moves
+ *  a shared file position. zip_name_locate builds its index on first use,
+ *  so call it once before sharing the handle if threads look up names.
  *
  * License: MIT / 0-BSD – do whatever you want; attribution appreciated.
  */
@@ -66,47 +88,108 @@ static inline void mzip_write_le64(uint8_t *p, uint64_t v) {
 
 typedef uint64_t zip_uint64_t;
 typedef int64_t  zip_int64_t;
-typedef int      zip_flags_t;    /* we don't interpret any flags for now */
+typedef int      zip_flags_t;    /* only ZIP_FL_NOCASE is interpreted */
 typedef int32_t  zip_int32_t;
+typedef int8_t   zip_int8_t;
 typedef uint32_t zip_uint32_t;
+typedef uint16_t zip_uint16_t;
 
 /* an in-memory representation of a single directory entry */
 struct mzip_entry {
-    char      *name;                /* zero-terminated filename              */
-    uint32_t   local_hdr_ofs;       /* offset of corresponding LFH          */
-    uint32_t   comp_size;
-    uint32_t   uncomp_size;
+    uint64_t   name_ofs;            /* zero-terminated filename in za->names */
+    uint64_t   local_hdr_ofs;       /* offset of corresponding LFH          */
+    uint64_t   data_ofs;            /* data past the LFH, 0 until known     */
+    uint64_t   comp_size;
+    uint64_t   uncomp_size;
+    uint16_t   flags;               /* general purpose bit flag             */
     uint16_t   method;              /* 0=store, 8=deflate                   */
+    uint16_t   name_len;
     uint32_t   crc32;               /* CRC-32 checksum of uncompressed data */
     uint16_t   file_time;           /* DOS format file time */
     uint16_t   file_date;           /* DOS format file date */
     uint32_t   external_attr;       /* External file attributes (permissions) */
 };
 
+/* open-addressing (linear probing) table over entry names; each slot
+ * holds entry index + 1, 0 marks an empty slot */
+struct mzip_name_index {
+    uint32_t  *slots;
+    uint32_t   mask;                /* capacity - 1 (capacity is a power of 2) */
+    uint32_t   used;
+};
+
+/* all entry names back to back, each zero-terminated; grows by doubling */
+struct mzip_names {
+    char      *buf;
+    size_t     len;
+    size_t     cap;
+};
+
+/* archive output staged in memory, see mzip_out_write */
+struct mzip_out {
+    uint8_t      *buf;              /* allocated on the first write */
+    size_t        len;              /* staged bytes not written yet */
+    zip_uint64_t  pos;              /* archive offset of the next byte */
+    int           err;              /* a write failed; zip_close reports it */
+};
+
+struct mzip_pool;                   /* background compression, see zip_file_add */
+
 struct mzip_archive {
     FILE               *fp;
+    zip_uint64_t        size;       /* file size: fstat at open, then kept
+                                     * up to date by our own writes      */
+    const uint8_t      *map;        /* read-only mapping of size bytes, or NULL */
     struct mzip_entry  *entries;
+    struct mzip_names   names;
     zip_uint64_t        n_entries;
+    zip_uint64_t        entries_cap; /* allocated slots, grows by doubling */
+    struct mzip_name_index name_index;   /* built on first zip_name_locate   */
+    struct mzip_name_index nocase_index; /* same, over ASCII case-folded names */
     int                 mode;       /* 0=read-only, 1=write */
     zip_uint64_t        next_index; /* Next available index for adding files */
     uint16_t            default_method; /* Default compression method for new entries */
+    struct mzip_pool   *pool;       /* started by the first zip_file_add, or NULL */
+    struct mzip_out     out;        /* write mode only */
 };
 
+/* an open entry, read incrementally through zip_fread */
 struct mzip_file {
-    uint8_t   *data;   /* complete uncompressed data                 */
-    uint32_t   size;
+    struct mzip_archive *za;
+    zip_uint64_t index;
+    zip_uint64_t size;      /* uncompressed size                          */
+    zip_uint64_t pos;       /* current uncompressed offset (zip_ftell)    */
+    zip_uint64_t data_ofs;  /* archive offset of the compressed data      */
+    zip_uint64_t comp_pos;  /* compressed bytes handed to the decoder     */
+    uint16_t     method;
+    uint8_t     *data;      /* whole entry, for codecs decoded in one go  */
+    void        *strm;      /* decoder state (z_stream) of a streamed entry */
+    uint8_t     *in_buf;    /* compressed input when the file is not mapped */
+    uint32_t     crc;       /* running CRC-32 of a sequential read        */
+    int          crc_valid;
+    int          eof;       /* decoder saw the end of the stream          */
+    int          err;
 };
 
 struct mzip_src_buf { 
     const void *buf;
     zip_uint64_t len;
     int freep;
+    FILE *fp;           /* file source: streamed by zip_file_add (NULL for buffers) */
+    zip_int64_t flen;   /* bytes to read from fp, -1 = until EOF */
 };
 
 typedef struct mzip_archive   zip_t;      /* opaque archive handle        */
-typedef struct mzip_file      zip_file_t; /* opaque file-in-memory handle */
+typedef struct mzip_file      zip_file_t; /* opaque open-entry handle      */
 typedef struct mzip_src_buf   zip_source_t;/* stub                          */
 
+/* one file for zip_files_add_batch (mzip extension) */
+typedef struct mzip_batch_entry {
+    const char   *name;
+    zip_source_t *source;
+    zip_int32_t   method;   /* MZIP_METHOD_*, or -1 for the archive default */
+} zip_batch_entry_t;
+
 /* Only flag we meaningfully accept at the moment. */
 #ifndef ZIP_RDONLY
 #define ZIP_RDONLY 0
@@ -124,6 +207,34 @@ typedef struct mzip_src_buf   zip_source_t;/* stub                          */
 #define ZIP_TRUNCATE 8
 #endif
 
+/* zip_name_locate flags */
+#ifndef ZIP_FL_NOCASE
+#define ZIP_FL_NOCASE 1
+#endif
+
+/* zip_fopen_index_view flag (mzip extension): check the CRC-32 of the
+ * viewed bytes, as mzip_verify_crc does for zip_fopen_index */
+#define MZIP_FL_VERIFY_CRC 0x1000
+
+/* zip_stat_t.valid bits (same values as libzip) */
+#define ZIP_STAT_NAME        0x0001u
+#define ZIP_STAT_INDEX       0x0002u
+#define ZIP_STAT_SIZE        0x0004u
+#define ZIP_STAT_COMP_SIZE   0x0008u
+#define ZIP_STAT_CRC         0x0020u
+#define ZIP_STAT_COMP_METHOD 0x0040u
+
+/* Subset of libzip's struct zip_stat */
+typedef struct zip_stat {
+    zip_uint64_t valid;       /* ZIP_STAT_* bits of the fields filled in   */
+    const char  *name;        /* as zip_get_name                           */
+    zip_uint64_t index;
+    zip_uint64_t size;        /* uncompressed size                         */
+    zip_uint64_t comp_size;
+    zip_uint32_t crc;
+    zip_uint16_t comp_method;
+} zip_stat_t;
+
 /* ----------------------------  public API  ----------------------------- */
 
 #ifdef __cplusplus
@@ -135,12 +246,50 @@ int            zip_close         (zip_t *za);
 
 zip_uint64_t   zip_get_num_files (zip_t *za);
 zip_int64_t    zip_name_locate   (zip_t *za, const char *fname, zip_flags_t flags);
+/* Fill *st with the entry's name, sizes, CRC and method; 0 or -1 */
+int            zip_stat_index    (zip_t *za, zip_uint64_t index, zip_flags_t flags, zip_stat_t *st);
+/* Name of entry index, valid until the next zip_file_add or zip_close */
+const char *   zip_get_name      (zip_t *za, zip_uint64_t index, zip_flags_t flags);
 
 zip_file_t *   zip_fopen_index   (zip_t *za, zip_uint64_t index, zip_flags_t flags);
+zip_int64_t    zip_fread         (zip_file_t *zf, void *buf, zip_uint64_t nbytes);
+zip_int8_t     zip_fseek         (zip_file_t *zf, zip_int64_t offset, int whence);
+zip_int64_t    zip_ftell         (zip_file_t *zf);
 int            zip_fclose        (zip_file_t *zf);
 
+/* Point *data at the bytes of a stored (MZIP_METHOD_STORE) entry inside the
+ * memory-mapped archive; no allocation, no copy. Only available for
+ * archives opened with ZIP_RDONLY that could be mapped. The view stays
+ * valid until zip_close. Returns 0 on success, -1 otherwise (not mapped,
+ * not stored, malformed or, with MZIP_FL_VERIFY_CRC, a CRC mismatch);
+ * callers can then fall back to zip_fopen_index. */
+int            zip_fopen_index_view(zip_t *za, zip_uint64_t index, zip_flags_t flags,
+                                    const uint8_t **data, zip_uint64_t *size);
+
 zip_source_t * zip_source_buffer (zip_t *za, const void *data, zip_uint64_t len, int freep);
+/* File sources are read from start for len bytes (-1 = to EOF) when added,
+ * so pipes work. */
+zip_source_t * zip_source_file   (zip_t *za, const char *fname, zip_uint64_t start, zip_int64_t len);
+zip_source_t * zip_source_filep  (zip_t *za, FILE *file, zip_uint64_t start, zip_int64_t len);
+/* Release a source that zip_file_add did not take: closes its FILE and,
+ * for buffers created with freep, frees the data. */
+void           zip_source_free   (zip_source_t *src);
+/* Returns the new entry's index. On success the archive takes the source
+ * and releases it; on failure (-1) it stays with the caller, who must
+ * release it with zip_source_free. A file source may already have been
+ * read, so it cannot be added again.
+ * With mzip_threads != 1, in-memory sources are compressed in the
+ * background and written in the order they were added; the returned index
+ * is valid at once, and zip_close waits for the pending entries (and
+ * returns -1 if any of them could not be compressed). */
 zip_int64_t    zip_file_add      (zip_t *za, const char *name, zip_source_t *src, zip_flags_t flags);
+/* Add n files in order, as zip_file_add would one by one, but reserving
+ * the entries once and stamping them all with the same time (mzip
+ * extension). Returns how many were added, or -1 on bad arguments. The
+ * archive takes the sources of the files added; the source of the file
+ * that failed and those after it stay with the caller, as with a failed
+ * zip_file_add. */
+zip_int64_t    zip_files_add_batch(zip_t *za, const zip_batch_entry_t *files, zip_uint64_t n, zip_flags_t flags);
 int            zip_set_file_compression(zip_t *za, zip_uint64_t index, zip_int32_t comp, zip_uint32_t comp_flags);
 
 #ifdef __cplusplus
@@ -150,6 +299,10 @@ int            zip_set_file_compression(zip_t *za, zip_uint64_t index, zip_int32
 /* Global flag: when non-zero, verify CRC32 on extraction and fail on mismatch. */
 extern int mzip_verify_crc;
 
+/* Global: number of threads used for parallel work (large CRCs, ...).
+ * 0 (default) uses one per online CPU, 1 keeps everything on the caller. */
+extern int mzip_threads;
+
 /* Zipbomb / expansion protection globals.
  * - mzip_max_expansion_ratio: maximum allowed multiplier (out <= in * ratio + slack)
  * - mzip_max_expansion_slack: additional bytes allowed regardless of ratio
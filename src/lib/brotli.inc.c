@@ -26,12 +26,7 @@ static int clamp_quality(int lvl) {
 }
 
 static uint32_t my_crc32(const uint8_t *data, size_t len, uint32_t crc) {
-    extern const uint32_t crc32_table[256];
-    crc = ~crc;
-    for (size_t i = 0; i < len; i++) {
-        crc = crc32_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
-    }
-    return ~crc;
+    return mzip_crc32(crc, data, len);
 }
 
 static size_t simple_compress(const uint8_t *input, size_t input_len,
@@ -1,314 +1,392 @@
 /* ----------- Decoder-specific data structures ----------- */
 
+#define INFLATE_LEN_BITS     10  /* Primary table index bits, literal/length */
+#define INFLATE_DIST_BITS    8   /* Primary table index bits, distance */
+#define INFLATE_CODE_BITS    7   /* Code length codes are at most 7 bits */
+/* Table sizes: 1332 is zlib's enough(286, 10, 15). A complete distance code
+ * has at most 15 sub-tables (each needs two symbols) of at most 2^7 entries. */
+#define INFLATE_ENOUGH_LENS  1332
+#define INFLATE_ENOUGH_DISTS ((1 << INFLATE_DIST_BITS) + 15 * (1 << (15 - INFLATE_DIST_BITS)))
+
+/* Decoding table entry.
+ * op is one of:
+ *   INFLATE_OP_LIT         sym is a literal byte (or a code length symbol)
+ *   INFLATE_OP_BASE | n    sym is a length/distance base followed by n extra bits
+ *   INFLATE_OP_EOB         end of block
+ *   INFLATE_OP_LINK | n    sym is the offset of an n-bit sub-table
+ *   INFLATE_OP_BAD         invalid code
+ * bits is the total code length (the root size for links). */
+typedef struct {
+	uint8_t op;
+	uint8_t bits;
+	uint16_t sym;
+} inflate_code;
+
+#define INFLATE_OP_LIT  0x00
+#define INFLATE_OP_BASE 0x10
+#define INFLATE_OP_EOB  0x20
+#define INFLATE_OP_LINK 0x40
+#define INFLATE_OP_BAD  0x80
+
+typedef enum {
+	INFLATE_CODES,
+	INFLATE_LENS,
+	INFLATE_DISTS
+} inflate_table_kind;
+
+typedef enum {
+	INFLATE_HEADER,    /* BFINAL and BTYPE */
+	INFLATE_STORED,    /* LEN and NLEN of a stored block */
+	INFLATE_COPY,      /* Copying stored bytes */
+	INFLATE_TABLE,     /* HLIT, HDIST, HCLEN */
+	INFLATE_LENLENS,   /* Code length code lengths */
+	INFLATE_CODELENS,  /* Literal/length and distance code lengths */
+	INFLATE_LEN,       /* Literal/length code */
+	INFLATE_LENEXT,    /* Length extra bits */
+	INFLATE_DIST,      /* Distance code */
+	INFLATE_DISTEXT,   /* Distance extra bits */
+	INFLATE_MATCH,     /* Copying a match */
+	INFLATE_LIT,       /* Writing a literal */
+	INFLATE_DONE,      /* Final block processed */
+	INFLATE_BAD        /* Data error */
+} inflate_mode;
+
 /* Internal state for inflate */
 typedef struct {
-	/* Input state */
-    uint32_t bit_buffer;     /* Bit buffer */
-    uint32_t bits_in_buffer; /* Number of bits in buffer */
-    int final_block;         /* Is this the final block? */
-
-	/* Huffman tables */
-	huffman_table literals;  /* Literal/length codes */
-	huffman_table distances; /* Distance codes */
-
-	/* Current state */
-	int state;              /* Current state of processing */
-	block_type btype;       /* Current block type */
-
-	/* Output state */
-	uint8_t *window;        /* Sliding window for LZ77 */
-	uint32_t window_size;   /* Size of window */
-	uint32_t window_pos;    /* Current position in window */
+	inflate_mode mode;
+	int final_block;         /* Is this the final block? */
+
+	/* Input state: bits are consumed from the low end of hold */
+	uint64_t hold;
+	uint32_t bits;
+
+	/* Current symbol */
+	uint32_t length;         /* Literal, match length or stored bytes left */
+	uint32_t offset;         /* Match distance */
+	uint32_t extra;          /* Extra bits still to read */
+
+	/* Dynamic block header */
+	uint32_t nlen;           /* Number of literal/length code lengths */
+	uint32_t ndist;          /* Number of distance code lengths */
+	uint32_t ncode;          /* Number of code length code lengths */
+	uint32_t have;           /* Code lengths read so far */
+	uint8_t lens[320];
+
+	/* Decoding tables; the code length table reuses len_table */
+	inflate_code len_table[INFLATE_ENOUGH_LENS];
+	inflate_code dist_table[INFLATE_ENOUGH_DISTS];
+
+	/* Output history for matches reaching before this call's output */
+	uint8_t *window;         /* Sliding window for LZ77 */
+	uint32_t window_size;    /* Size of window */
+	uint32_t window_pos;     /* Next write position in window */
+	uint32_t window_have;    /* Valid bytes in window */
 } inflate_state;
 
-/* Get a bit from the input stream */
-
-static int get_bit(z_stream *strm, inflate_state *state) {
-	if (state->bits_in_buffer == 0) {
-		/* Need to load a new byte */
-		if (strm->avail_in == 0) {
-			return -1; /* No more input */
+/* Length and distance bases are shared with the encoder (deflate-enc.inc.c) */
+
+static const uint8_t inflate_cl_order[19] = {
+	16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
+/* ----------- Decoder-specific functions ----------- */
+
+/* Decoding table entry for symbol `sym` of a code of length `len` */
+static inflate_code inflate_entry(inflate_table_kind kind, uint32_t sym, uint32_t len) {
+	inflate_code here = { INFLATE_OP_BAD, (uint8_t)len, 0 };
+	switch (kind) {
+	case INFLATE_CODES:
+		here.op = INFLATE_OP_LIT;
+		here.sym = (uint16_t)sym;
+		break;
+	case INFLATE_LENS:
+		if (sym < 256) {
+			here.op = INFLATE_OP_LIT;
+			here.sym = (uint16_t)sym;
+		} else if (sym == 256) {
+			here.op = INFLATE_OP_EOB;
+		} else if (sym < 286) {
+			here.op = (uint8_t)(INFLATE_OP_BASE | deflate_length_extra[sym - 257]);
+			here.sym = deflate_length_base[sym - 257];
 		}
-
-		state->bit_buffer = *strm->next_in++;
-		strm->avail_in--;
-		strm->total_in++;
-		state->bits_in_buffer = 8;
-	}
-
-	int bit = state->bit_buffer & 1;
-	state->bit_buffer >>= 1;
-	state->bits_in_buffer--;
-	return bit;
-}
-
-
-/* Get n bits from the input stream (right-aligned) */
-static int get_bits(z_stream *strm, inflate_state *state, int n) {
-    /* Fast path: if we have enough bits in buffer, use them directly */
-    if (state->bits_in_buffer >= (uint32_t)n) {
-        int result = state->bit_buffer & ((1 << n) - 1);
-        state->bit_buffer >>= n;
-        state->bits_in_buffer -= (uint32_t)n;
-        return result;
-    }
-	
-	/* Slow path: need to get more bits from input */
-	int result = 0;
-	for (int i = 0; i < n; i++) {
-		int bit = get_bit(strm, state);
-		if (bit < 0) {
-			return -1; /* Error - not enough input */
+		break;
+	case INFLATE_DISTS:
+		if (sym < 30) {
+			here.op = (uint8_t)(INFLATE_OP_BASE | deflate_dist_extra[sym]);
+			here.sym = deflate_dist_base[sym];
 		}
-		result |= (bit << i);
+		break;
 	}
-	return result;
+	return here;
 }
 
-
-/* Build Huffman tree from code lengths */
-static int build_huffman_tree(huffman_table *table, const uint8_t *lengths, int num_codes) {
-	/* Count the number of codes for each code length */
-	uint16_t bl_count[16] = {0};
-	int max_length = 0;
-	for (int i = 0; i < num_codes; i++) {
-		if (lengths[i] > 15) {
-			return Z_DATA_ERROR; /* Invalid code length */
-		}
-		if (lengths[i] > 0) {
-			bl_count[lengths[i]]++;
-			max_length = lengths[i] > max_length ? lengths[i] : max_length;
-		}
+/* Build a two-level decoding table from code lengths.
+ * Codes up to `root` bits are resolved by one lookup of the low root bits;
+ * longer codes go through a sub-table sized for the longest code sharing
+ * that prefix. Returns 0 on success, -1 for an over-subscribed code or an
+ * incomplete one (only a single one-bit code may be incomplete). */
+static int inflate_build_table(inflate_code *table, uint32_t table_size, uint32_t root,
+		const uint8_t *lens, uint32_t n, inflate_table_kind kind) {
+	uint16_t count[16] = {0};
+	uint16_t next_code[16];
+	uint8_t sub_len[1 << INFLATE_LEN_BITS];
+	uint32_t max = 0;
+
+	for (uint32_t sym = 0; sym < n; sym++) {
+		count[lens[sym]]++;
 	}
-
-	/* Find the numerical value of the smallest code for each code length */
-	uint16_t next_code[16] = {0};
-	uint16_t code = 0;
-	for (int bits = 1; bits <= 15; bits++) {
-		code = (code + bl_count[bits - 1]) << 1;
-		next_code[bits] = code;
+	count[0] = 0;
+	for (uint32_t len = 1; len <= 15; len++) {
+		if (count[len]) max = len;
 	}
 
-	/* Assign codes to symbols */
-	for (int i = 0; i < num_codes; i++) {
-		if (lengths[i] > 0) {
-			table->codes[i] = next_code[lengths[i]]++;
-			table->lengths[i] = lengths[i];
-		} else {
-			table->lengths[i] = 0;
-		}
+	/* Unused entries decode as invalid after one bit */
+	const inflate_code bad = { INFLATE_OP_BAD, 1, 0 };
+	for (uint32_t i = 0; i < (1u << root); i++) {
+		table[i] = bad;
+	}
+	if (max == 0) {
+		return 0; /* No codes: e.g. a block without distances */
 	}
-	table->count = num_codes;
-	return Z_OK;
-}
 
-/* Read dynamic Huffman tables */
-static int read_dynamic_huffman(z_stream *strm, inflate_state *state) {
-	/* Read number of literal/length codes */
-	int hlit = get_bits(strm, state, 5);
-	if (hlit < 0) return Z_DATA_ERROR;
-	hlit += 257;  /* 257-286 codes */
-
-	/* Read number of distance codes */
-	int hdist = get_bits(strm, state, 5);
-	if (hdist < 0) return Z_DATA_ERROR;
-	hdist += 1;  /* 1-32 codes */
-
-	/* Read number of code length codes */
-	int hclen = get_bits(strm, state, 4);
-	if (hclen < 0) return Z_DATA_ERROR;
-	hclen += 4;  /* 4-19 codes */
-
-	/* Read code lengths for code length alphabet */
-	uint8_t cl_lengths[19] = {0};
-	static const uint8_t cl_order[19] = {
-		16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
-	};
-
-	for (int i = 0; i < hclen; i++) {
-		int len = get_bits(strm, state, 3);
-		if (len < 0) return Z_DATA_ERROR;
-		cl_lengths[cl_order[i]] = len;
+	int32_t left = 1;
+	for (uint32_t len = 1; len <= 15; len++) {
+		left <<= 1;
+		left -= count[len];
+		if (left < 0) return -1; /* Over-subscribed */
+	}
+	if (left > 0 && (kind == INFLATE_CODES || max != 1)) {
+		return -1; /* Incomplete */
 	}
 
-	/* Build code lengths Huffman tree */
-	huffman_table cl_table;
-	if (build_huffman_tree(&cl_table, cl_lengths, 19) != Z_OK) {
-		return Z_DATA_ERROR;
+	uint32_t code = 0;
+	next_code[0] = 0;
+	for (uint32_t len = 1; len <= 15; len++) {
+		code = (code + count[len - 1]) << 1;
+		next_code[len] = (uint16_t)code;
 	}
 
-	/* Read literal/length and distance code lengths */
-	uint8_t ll_lengths[286 + 32] = {0};  /* Literal/length + distance code lengths */
-	int index = 0;
-	while (index < hlit + hdist) {
-		/* Decode code length */
-		int code = 0;
-		int len = 0;
-
-		/* Decode Huffman code */
-		for (len = 1; len <= 15; len++) {
-			int bit = get_bit(strm, state);
-			if (bit < 0) return Z_DATA_ERROR;
-			code = (code << 1) | bit;
-
-			/* Check if this code matches */
-			int found = -1;
-			for (int i = 0; i < 19; i++) {
-				if (cl_table.lengths[i] == len && cl_table.codes[i] == code) {
-					found = i;
-					break;
-				}
-			}
-			if (found >= 0) {
-				code = found;
-				break;
+	/* First pass: size the sub-table of each root prefix */
+	uint32_t used = 1u << root;
+	if (max > root) {
+		uint16_t nc[16];
+		memcpy(nc, next_code, sizeof(nc));
+		memset(sub_len, 0, (size_t)1 << root);
+		for (uint32_t sym = 0; sym < n; sym++) {
+			uint32_t len = lens[sym];
+			if (len == 0) continue;
+			uint32_t rev = deflate_bit_reverse(nc[len]++, (int)len);
+			if (len > root) {
+				uint32_t p = rev & ((1u << root) - 1);
+				if (len > sub_len[p]) sub_len[p] = (uint8_t)len;
 			}
 		}
-
-		if (len > 15) return Z_DATA_ERROR;  /* Invalid Huffman code */
-
-		/* Process code */
-		if (code < 16) {
-			/* Literal code length */
-			ll_lengths[index++] = code;
-		} else {
-			/* Repeat code */
-			uint8_t repeat_value;
-			int repeat_count;
-
-			switch (code) {
-			case 16:  /* Repeat previous code length 3-6 times */
-				if (index == 0) return Z_DATA_ERROR;  /* No previous code */
-				repeat_value = ll_lengths[index - 1];
-				repeat_count = get_bits(strm, state, 2);
-				if (repeat_count < 0) return Z_DATA_ERROR;
-				repeat_count += 3;
-				break;
-
-			case 17:  /* Repeat zero 3-10 times */
-				repeat_value = 0;
-				repeat_count = get_bits(strm, state, 3);
-				if (repeat_count < 0) return Z_DATA_ERROR;
-				repeat_count += 3;
-				break;
-
-			case 18:  /* Repeat zero 11-138 times */
-				repeat_value = 0;
-				repeat_count = get_bits(strm, state, 7);
-				if (repeat_count < 0) return Z_DATA_ERROR;
-				repeat_count += 11;
-				break;
-
-			default:
-				return Z_DATA_ERROR;  /* Should never happen */
+		for (uint32_t p = 0; p < (1u << root); p++) {
+			if (!sub_len[p]) continue;
+			uint32_t sub_bits = sub_len[p] - root;
+			if (used + (1u << sub_bits) > table_size) return -1;
+			table[p].op = (uint8_t)(INFLATE_OP_LINK | sub_bits);
+			table[p].bits = (uint8_t)root;
+			table[p].sym = (uint16_t)used;
+			for (uint32_t i = 0; i < (1u << sub_bits); i++) {
+				table[used + i] = bad;
 			}
+			used += 1u << sub_bits;
+		}
+	}
 
-			/* Check for index overflow */
-			if (index + repeat_count > hlit + hdist) {
-				return Z_DATA_ERROR;
+	/* Second pass: replicate each code over the entries it covers */
+	for (uint32_t sym = 0; sym < n; sym++) {
+		uint32_t len = lens[sym];
+		if (len == 0) continue;
+		uint32_t rev = deflate_bit_reverse(next_code[len]++, (int)len);
+		inflate_code here = inflate_entry(kind, sym, len);
+		if (len <= root) {
+			for (uint32_t i = rev; i < (1u << root); i += 1u << len) {
+				table[i] = here;
 			}
-
-			/* Fill repeated values */
-			for (int i = 0; i < repeat_count; i++) {
-				ll_lengths[index++] = repeat_value;
+		} else {
+			const inflate_code *link = &table[rev & ((1u << root) - 1)];
+			uint32_t sub_bits = link->op & 0x0F;
+			inflate_code *sub = table + link->sym;
+			for (uint32_t i = rev >> root; i < (1u << sub_bits); i += 1u << (len - root)) {
+				sub[i] = here;
 			}
 		}
 	}
+	return 0;
+}
 
-	/* Build literal/length Huffman tree */
-	if (build_huffman_tree(&state->literals, ll_lengths, hlit) != Z_OK) {
-		return Z_DATA_ERROR;
+/* Look up the next code in `hold`. Returns 1 when the code is complete
+ * within the `bits` available, 0 if more input is needed. */
+static inline int inflate_lookup(const inflate_code *table, uint32_t root,
+		uint64_t hold, uint32_t bits, inflate_code *here) {
+	*here = table[hold & ((1u << root) - 1)];
+	if (here->op & INFLATE_OP_LINK) {
+		*here = table[here->sym + ((uint32_t)(hold >> root) & ((1u << (here->op & 0x0F)) - 1))];
 	}
+	return here->bits <= bits;
+}
 
-	/* Build distance Huffman tree */
-	if (build_huffman_tree(&state->distances, ll_lengths + hlit, hdist) != Z_OK) {
-		return Z_DATA_ERROR;
+/* Copy `len` bytes from `dist` bytes back in the output */
+static inline uint8_t *inflate_copy_match(uint8_t *out, uint32_t dist, uint32_t len) {
+	const uint8_t *from = out - dist;
+	if (dist >= 8) {
+		/* Source and destination words never overlap */
+		while (len >= 8) {
+			uint64_t w;
+			memcpy(&w, from, 8);
+			memcpy(out, &w, 8);
+			out += 8;
+			from += 8;
+			len -= 8;
+		}
 	}
-
-	return Z_OK;
+	while (len--) {
+		*out++ = *from++;
+	}
+	return out;
 }
 
-/* Read an uncompressed block */
-static int read_uncompressed_block(z_stream *strm, inflate_state *state) {
-	/* Skip any remaining bits in current byte */
-	state->bits_in_buffer = 0;
-
-	/* Read length and negated length */
-	if (strm->avail_in < 4) {
-		return Z_DATA_ERROR; /* Not enough input */
+/* Copy up to `len` bytes of history starting `back` bytes before the
+ * output of the current call. Returns the number of bytes copied. */
+static uint32_t inflate_copy_window(const inflate_state *state, uint8_t *out, uint32_t back, uint32_t len) {
+	uint32_t n = back < len ? back : len;
+	uint32_t pos = state->window_pos >= back ? state->window_pos - back
+		: state->window_pos + state->window_size - back;
+	for (uint32_t i = 0; i < n; i++) {
+		out[i] = state->window[pos];
+		if (++pos == state->window_size) pos = 0;
 	}
+	return n;
+}
 
-	uint16_t len = strm->next_in[0] | (strm->next_in[1] << 8);
-	uint16_t nlen = strm->next_in[2] | (strm->next_in[3] << 8);
-
-	strm->next_in += 4;
-	strm->avail_in -= 4;
-	strm->total_in += 4;
+/* Append the output of the current call to the window */
+static void inflate_update_window(inflate_state *state, const uint8_t *end, uint32_t produced) {
+	uint32_t wsize = state->window_size;
+	if (produced >= wsize) {
+		memcpy(state->window, end - wsize, wsize);
+		state->window_pos = 0;
+		state->window_have = wsize;
+		return;
+	}
+	uint32_t first = wsize - state->window_pos;
+	if (first > produced) first = produced;
+	memcpy(state->window + state->window_pos, end - produced, first);
+	memcpy(state->window, end - produced + first, produced - first);
+	state->window_pos = (state->window_pos + produced) & (wsize - 1);
+	state->window_have += produced;
+	if (state->window_have > wsize) state->window_have = wsize;
+}
 
-	/* Verify length */
-    /* Compare length with bitwise complement of nlen while avoiding
-     * signed/unsigned promotion warnings by casting nlen to uint16_t
-     * before applying ~. */
-    if (len != (uint16_t)(~(uint16_t)nlen)) {
-        return Z_DATA_ERROR; /* Length check failed */
-    }
+/* Load 8 bytes little-endian from a possibly unaligned pointer */
+static inline uint64_t inflate_load64(const uint8_t *p) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	uint64_t v;
+	memcpy(&v, p, 8);
+	return v;
+#else
+	return (uint64_t)p[0] | ((uint64_t)p[1] << 8) | ((uint64_t)p[2] << 16) |
+		((uint64_t)p[3] << 24) | ((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40) |
+		((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
+#endif
+}
 
-	/* Check if we have enough input */
-	if (strm->avail_in < len) {
-		return Z_DATA_ERROR; /* Not enough input */
-	}
+/* Decode literal/length and distance codes while at least 8 input bytes
+ * and 258 output bytes are available. The bit buffer is refilled with one
+ * unaligned 64-bit load per symbol, which always covers the longest
+ * length + distance sequence (48 bits). Whole unused bytes are returned
+ * to the input on exit. */
+static void inflate_fast(z_stream *strm, inflate_state *state, const uint8_t *out_start) {
+	const uint8_t *in = strm->next_in;
+	const uint8_t *in_last = in + strm->avail_in - 8;
+	uint8_t *out = strm->next_out;
+	uint8_t *out_last = out + strm->avail_out - DEFLATE_MAX_MATCH;
+	uint64_t hold = state->hold;
+	uint32_t bits = state->bits;
+	const inflate_code *lcode = state->len_table;
+	const inflate_code *dcode = state->dist_table;
+	inflate_code here;
+
+	do {
+		if (bits < 56) {
+			hold |= inflate_load64(in) << bits;
+			in += (63 - bits) >> 3;
+			bits |= 56;
+		}
 
-	/* Check if we have enough output space */
-	if (strm->avail_out < len) {
-		return Z_BUF_ERROR; /* Not enough output space */
-	}
+		inflate_lookup(lcode, INFLATE_LEN_BITS, hold, bits, &here);
+		hold >>= here.bits;
+		bits -= here.bits;
+		if (here.op == INFLATE_OP_LIT) {
+			*out++ = (uint8_t)here.sym;
+			continue;
+		}
+		if (here.op == INFLATE_OP_EOB) {
+			state->mode = INFLATE_HEADER;
+			break;
+		}
+		if (here.op & INFLATE_OP_BAD) {
+			state->mode = INFLATE_BAD;
+			break;
+		}
 
-	/* Copy data directly to output */
-	memcpy(strm->next_out, strm->next_in, len);
-	strm->next_in += len;
-	strm->avail_in -= len;
-	strm->total_in += len;
-	strm->next_out += len;
-	strm->avail_out -= len;
-	strm->total_out += len;
-
-	/* Also store in window */
-	for (uint16_t i = 0; i < len; i++) {
-		state->window[state->window_pos] = strm->next_out[-(len - i)];
-		state->window_pos = (state->window_pos + 1) & (state->window_size - 1);
-	}
+		uint32_t op = here.op & 0x0F;
+		uint32_t len = here.sym + ((uint32_t)hold & ((1u << op) - 1));
+		hold >>= op;
+		bits -= op;
 
-	return Z_OK;
+		inflate_lookup(dcode, INFLATE_DIST_BITS, hold, bits, &here);
+		hold >>= here.bits;
+		bits -= here.bits;
+		if (here.op & INFLATE_OP_BAD) {
+			state->mode = INFLATE_BAD;
+			break;
+		}
+		op = here.op & 0x0F;
+		uint32_t dist = here.sym + ((uint32_t)hold & ((1u << op) - 1));
+		hold >>= op;
+		bits -= op;
+
+		uint32_t produced = (uint32_t)(out - out_start);
+		if (dist > produced) {
+			uint32_t back = dist - produced;
+			if (back > state->window_have) {
+				state->mode = INFLATE_BAD; /* Distance too far back */
+				break;
+			}
+			uint32_t n = inflate_copy_window(state, out, back, len);
+			out += n;
+			len -= n;
+		}
+		out = inflate_copy_match(out, dist, len);
+	} while (in <= in_last && out <= out_last);
+
+	/* Return unused bytes */
+	in -= bits >> 3;
+	bits &= 7;
+	hold &= ((uint64_t)1 << bits) - 1;
+
+	strm->avail_in -= (uint32_t)(in - strm->next_in);
+	strm->total_in += (uint32_t)(in - strm->next_in);
+	strm->next_in = (uint8_t *)in;
+	strm->avail_out -= (uint32_t)(out - strm->next_out);
+	strm->total_out += (uint32_t)(out - strm->next_out);
+	strm->next_out = out;
+	state->hold = hold;
+	state->bits = bits;
 }
 
-/* Initialize fixed Huffman tables */
-static void init_fixed_huffman(inflate_state *state) {
-	/* Fixed tables as per deflate specification */
-	/* Literal/length codes */
-	for (int i = 0; i < 144; i++) {
-		state->literals.codes[i] = i;
-		state->literals.lengths[i] = 8;
-	}
-	for (int i = 144; i < 256; i++) {
-		state->literals.codes[i] = i;
-		state->literals.lengths[i] = 9;
-	}
-	for (int i = 256; i < 280; i++) {
-		state->literals.codes[i] = i;
-		state->literals.lengths[i] = 7;
-	}
-	for (int i = 280; i < 288; i++) {
-		state->literals.codes[i] = i;
-		state->literals.lengths[i] = 8;
-	}
-	state->literals.count = 288;
-
-	/* Distance codes */
-	for (int i = 0; i < 32; i++) {
-		state->distances.codes[i] = i;
-		state->distances.lengths[i] = 5;
-	}
-	state->distances.count = 32;
+/* Fixed literal/length and distance tables (RFC 1951 3.2.6) */
+static void inflate_fixed_tables(inflate_state *state) {
+	uint8_t lens[288];
+	memset(lens, 8, 144);
+	memset(lens + 144, 9, 112);
+	memset(lens + 256, 7, 24);
+	memset(lens + 280, 8, 8);
+	inflate_build_table(state->len_table, INFLATE_ENOUGH_LENS, INFLATE_LEN_BITS, lens, 288, INFLATE_LENS);
+	memset(lens, 5, 32);
+	inflate_build_table(state->dist_table, INFLATE_ENOUGH_DISTS, INFLATE_DIST_BITS, lens, 32, INFLATE_DISTS);
 }
 
 /* ----------- Main decoder API functions ----------- */
@@ -325,7 +403,10 @@ int inflateInit2(z_stream *strm, int windowBits) {
 		return Z_STREAM_ERROR;
 	}
 	/* Handle windowBits - negative means no header */
-	int window_size = 1 << ((windowBits < 0) ? -windowBits : windowBits);
+	int abs_windowBits = windowBits < 0 ? -windowBits : windowBits;
+	if (abs_windowBits < 8 || abs_windowBits > 15) {
+		return Z_STREAM_ERROR;
+	}
 
 	/* Allocate state */
 	inflate_state *state = (inflate_state *)calloc(1, sizeof(inflate_state));
@@ -334,19 +415,13 @@ int inflateInit2(z_stream *strm, int windowBits) {
 	}
 
 	/* Allocate window buffer */
-	state->window = (uint8_t *)malloc(window_size);
+	state->window_size = 1u << abs_windowBits;
+	state->window = (uint8_t *)malloc(state->window_size);
 	if (!state->window) {
 		free(state);
 		return Z_MEM_ERROR;
 	}
-
-	/* Initialize state */
-	state->window_size = window_size;
-	state->window_pos = 0;
-	state->bit_buffer = 0;
-	state->bits_in_buffer = 0;
-	state->final_block = 0;
-	state->state = 0; /* Start at block header */
+	state->mode = INFLATE_HEADER;
 
 	strm->state = state;
 	strm->total_in = 0;
@@ -355,313 +430,326 @@ int inflateInit2(z_stream *strm, int windowBits) {
 	return Z_OK;
 }
 
+/* Helpers for the decoder loop; they work on the local copies of the
+ * stream pointers and leave inflate() when input runs out. */
+#define INFLATE_PULLBYTE() do { \
+	if (have == 0) goto leave; \
+	have--; \
+	hold |= (uint64_t)(*next++) << bits; \
+	bits += 8; \
+} while (0)
+
+#define INFLATE_NEEDBITS(n) do { \
+	while (bits < (uint32_t)(n)) INFLATE_PULLBYTE(); \
+} while (0)
+
+#define INFLATE_BITS(n) ((uint32_t)hold & ((1u << (n)) - 1))
+
+#define INFLATE_DROPBITS(n) do { \
+	hold >>= (n); \
+	bits -= (uint32_t)(n); \
+} while (0)
+
+#define INFLATE_LOAD() do { \
+	next = strm->next_in; have = strm->avail_in; \
+	put = strm->next_out; left = strm->avail_out; \
+	hold = state->hold; bits = state->bits; \
+} while (0)
+
+#define INFLATE_RESTORE() do { \
+	strm->total_in += (uint32_t)(next - strm->next_in); \
+	strm->total_out += (uint32_t)(put - strm->next_out); \
+	strm->next_in = (uint8_t *)next; strm->avail_in = have; \
+	strm->next_out = put; strm->avail_out = left; \
+	state->hold = hold; state->bits = bits; \
+} while (0)
+
 int inflate(z_stream *strm, int flush) {
-	if (!strm || !strm->state) {
+	if (!strm || !strm->state || !strm->next_out || (!strm->next_in && strm->avail_in)) {
 		return Z_STREAM_ERROR;
 	}
 	inflate_state *state = (inflate_state *)strm->state;
-	int ret = Z_OK;
-
-	/* Main decompression loop */
-	while (strm->avail_in > 0 && strm->avail_out > 0) {
-		/* Process based on current state */
-		switch (state->state) {
-		case 0: /* Block header */
-			/* Read block header */
-			state->final_block = get_bit (strm, state);
-			if (state->final_block < 0) {
-				return Z_DATA_ERROR;
+	uint8_t *out_start = strm->next_out;
+	uint32_t in_before = strm->avail_in;
+	uint32_t out_before = strm->avail_out;
+	const uint8_t *next;
+	uint8_t *put;
+	uint32_t have, left, bits;
+	uint64_t hold;
+	inflate_code here;
+
+	INFLATE_LOAD();
+	for (;;) {
+		switch (state->mode) {
+		case INFLATE_HEADER:
+			if (state->final_block) {
+				/* Skip to a byte boundary and stop */
+				INFLATE_DROPBITS(bits & 7);
+				state->mode = INFLATE_DONE;
+				break;
 			}
-			/* Get block type */
-			state->btype = (block_type)get_bits (strm, state, 2);
-			if (state->btype < 0) {
-				return Z_DATA_ERROR;
+			INFLATE_NEEDBITS(3);
+			state->final_block = (int)INFLATE_BITS(1);
+			INFLATE_DROPBITS(1);
+			switch ((block_type)INFLATE_BITS(2)) {
+			case BLOCK_UNCOMPRESSED:
+				state->mode = INFLATE_STORED;
+				break;
+			case BLOCK_FIXED:
+				inflate_fixed_tables(state);
+				state->mode = INFLATE_LEN;
+				break;
+			case BLOCK_DYNAMIC:
+				state->mode = INFLATE_TABLE;
+				break;
+			default:
+				state->mode = INFLATE_BAD;
+				break;
 			}
+			INFLATE_DROPBITS(2);
+			break;
 
-			/* Move to block data state */
-			state->state = 1;
+		case INFLATE_STORED:
+			INFLATE_DROPBITS(bits & 7);
+			INFLATE_NEEDBITS(32);
+			if ((hold & 0xFFFF) != ((hold >> 16 & 0xFFFF) ^ 0xFFFF)) {
+				state->mode = INFLATE_BAD; /* LEN and NLEN do not match */
+				break;
+			}
+			state->length = (uint32_t)hold & 0xFFFF;
+			INFLATE_DROPBITS(32);
+			state->mode = INFLATE_COPY;
 			break;
 
-		case 1: /* Block data */
-			/* Process based on block type */
-			switch (state->btype) {
-			case BLOCK_UNCOMPRESSED:
-				ret = read_uncompressed_block(strm, state);
-				if (ret != Z_OK) {
-					return ret;
+		case INFLATE_COPY: {
+			/* The bit buffer is empty here: codes never leave a whole
+			 * byte behind, so the stored bytes come straight from input */
+			uint32_t copy = state->length;
+			if (copy > have) copy = have;
+			if (copy > left) copy = left;
+			if (copy == 0) {
+				if (state->length == 0) {
+					state->mode = INFLATE_HEADER;
+					break;
 				}
-				/* Move to next block header */
-				state->state = 0;
-				break;
+				goto leave;
+			}
+			memcpy(put, next, copy);
+			have -= copy;
+			next += copy;
+			left -= copy;
+			put += copy;
+			state->length -= copy;
+			break;
+		}
 
-			case BLOCK_FIXED:
-				/* Initialize fixed Huffman tables */
-				init_fixed_huffman(state);
-				/* Go to process literals state */
-				state->state = 2;
+		case INFLATE_TABLE:
+			INFLATE_NEEDBITS(14);
+			state->nlen = INFLATE_BITS(5) + 257;
+			INFLATE_DROPBITS(5);
+			state->ndist = INFLATE_BITS(5) + 1;
+			INFLATE_DROPBITS(5);
+			state->ncode = INFLATE_BITS(4) + 4;
+			INFLATE_DROPBITS(4);
+			if (state->nlen > 286 || state->ndist > 30) {
+				state->mode = INFLATE_BAD; /* Too many length or distance symbols */
 				break;
+			}
+			state->have = 0;
+			state->mode = INFLATE_LENLENS;
+			break;
 
-			case BLOCK_DYNAMIC:
-				/* Read dynamic Huffman tables */
-				if (read_dynamic_huffman(strm, state) != Z_OK) {
-					return Z_DATA_ERROR;
-				}
-				/* Go to process literals state */
-				state->state = 2;
+		case INFLATE_LENLENS:
+			while (state->have < state->ncode) {
+				INFLATE_NEEDBITS(3);
+				state->lens[inflate_cl_order[state->have++]] = (uint8_t)INFLATE_BITS(3);
+				INFLATE_DROPBITS(3);
+			}
+			while (state->have < 19) {
+				state->lens[inflate_cl_order[state->have++]] = 0;
+			}
+			if (inflate_build_table(state->len_table, INFLATE_ENOUGH_LENS, INFLATE_CODE_BITS,
+					state->lens, 19, INFLATE_CODES) != 0) {
+				state->mode = INFLATE_BAD; /* Invalid code lengths set */
 				break;
-
-			case BLOCK_INVALID:
-				return Z_DATA_ERROR;
 			}
+			state->have = 0;
+			state->mode = INFLATE_CODELENS;
 			break;
 
-		case 2: /* Process literals/lengths */
-			/* This is a simplified implementation to handle fixed Huffman codes */
-			{
-				/* Get a code */
-				int code = 0;
-				int length = 0;
-
-				/* Decode Huffman code based on current block type */
-				if (state->btype == BLOCK_FIXED) {
-					/* For fixed Huffman, we know the bit patterns */
-					if (get_bit(strm, state) == 0) {
-						/* 0xxx xxxx - 8 bit code for values 0-143 */
-						code = get_bits (strm, state, 7);
-						if (code < 0) {
-							return Z_DATA_ERROR;
-						}
-						code = (0 << 7) | code; /* Add the 0 bit we already read */
-					} else {
-						int next_bit = get_bit (strm, state);
-						if (next_bit < 0) {
-							return Z_DATA_ERROR;
-						}
-						if (next_bit == 0) {
-							/* 10xx xxxx - 8 bit code for values 144-255 */
-							code = get_bits (strm, state, 6);
-							if (code < 0) {
-								return Z_DATA_ERROR;
-							}
-							code = (0b10 << 6) | code; /* Add the 10 bits we already read */
-							code += 144; /* Adjust to actual value */
-						} else {
-							int third_bit = get_bit(strm, state);
-							if (third_bit < 0) {
-								return Z_DATA_ERROR;
-							}
-							
-							if (third_bit == 0) {
-								/* 110x xxxx - 7 bit code for values 256-279 */
-								code = get_bits (strm, state, 4);
-								if (code < 0) {
-									return Z_DATA_ERROR;
-								}
-								code = (0b110 << 4) | code; /* Add the 110 bits we already read */
-								code = code - (0b110 << 4) + 256; /* Adjust to actual value */
-							} else {
-								/* 111x xxxx - 8 bit code for values 280-287 */
-								code = get_bits (strm, state, 4);
-								if (code < 0) {
-									return Z_DATA_ERROR;
-								}
-								code = (0b111 << 4) | code; /* Add the 111 bits we already read */
-								code = code - (0b111 << 4) + 280; /* Adjust to actual value */
-							}
-						}
-					}
-				} else if (state->btype == BLOCK_DYNAMIC) {
-					/* For dynamic Huffman, use the constructed tables */
-					code = 0;
-					for (length = 1; length <= 15; length++) {
-						int bit = get_bit(strm, state);
-						if (bit < 0) {
-							return Z_DATA_ERROR;
-						}
-						code = (code << 1) | bit;
-						
-						/* Look for matching code */
-						int found = -1;
-						for (int i = 0; i < state->literals.count; i++) {
-							if (state->literals.lengths[i] == length && 
-								state->literals.codes[i] == code) {
-								found = i;
-								break;
-							}
-						}
-						if (found >= 0) {
-							code = found;
-							break;
-						}
-					}
-					
-					if (length > 15) {
-						return Z_DATA_ERROR; /* Invalid Huffman code */
+		case INFLATE_CODELENS:
+			while (state->have < state->nlen + state->ndist) {
+				while (!inflate_lookup(state->len_table, INFLATE_CODE_BITS, hold, bits, &here)) {
+					INFLATE_PULLBYTE();
+				}
+				if (here.op & INFLATE_OP_BAD) {
+					state->mode = INFLATE_BAD;
+					break;
+				}
+				if (here.sym < 16) {
+					INFLATE_DROPBITS(here.bits);
+					state->lens[state->have++] = (uint8_t)here.sym;
+					continue;
+				}
+				uint32_t repeat, value = 0;
+				if (here.sym == 16) {
+					INFLATE_NEEDBITS(here.bits + 2);
+					INFLATE_DROPBITS(here.bits);
+					if (state->have == 0) {
+						state->mode = INFLATE_BAD; /* Repeat with no previous length */
+						break;
 					}
+					value = state->lens[state->have - 1];
+					repeat = 3 + INFLATE_BITS(2);
+					INFLATE_DROPBITS(2);
+				} else if (here.sym == 17) {
+					INFLATE_NEEDBITS(here.bits + 3);
+					INFLATE_DROPBITS(here.bits);
+					repeat = 3 + INFLATE_BITS(3);
+					INFLATE_DROPBITS(3);
 				} else {
-					return Z_DATA_ERROR; /* Invalid block type */
+					INFLATE_NEEDBITS(here.bits + 7);
+					INFLATE_DROPBITS(here.bits);
+					repeat = 11 + INFLATE_BITS(7);
+					INFLATE_DROPBITS(7);
 				}
+				if (state->have + repeat > state->nlen + state->ndist) {
+					state->mode = INFLATE_BAD; /* Repeat past the end */
+					break;
+				}
+				while (repeat--) {
+					state->lens[state->have++] = (uint8_t)value;
+				}
+			}
+			if (state->mode == INFLATE_BAD) {
+				break;
+			}
+			if (state->lens[256] == 0) {
+				state->mode = INFLATE_BAD; /* Missing end-of-block code */
+				break;
+			}
+			if (inflate_build_table(state->len_table, INFLATE_ENOUGH_LENS, INFLATE_LEN_BITS,
+					state->lens, state->nlen, INFLATE_LENS) != 0 ||
+					inflate_build_table(state->dist_table, INFLATE_ENOUGH_DISTS, INFLATE_DIST_BITS,
+					state->lens + state->nlen, state->ndist, INFLATE_DISTS) != 0) {
+				state->mode = INFLATE_BAD; /* Invalid literal/length or distance code */
+				break;
+			}
+			state->mode = INFLATE_LEN;
+			break;
 
-				/* Process the code */
-				if (code < 256) {
-					/* Literal byte */
-					*strm->next_out++ = (uint8_t)code;
-					strm->avail_out--;
-					strm->total_out++;
-
-					/* Add to window */
-					state->window[state->window_pos] = (uint8_t)code;
-					state->window_pos = (state->window_pos + 1) & (state->window_size - 1);
-				} else if (code == 256) {
-					/* End of block */
-					state->state = 0; /* Back to block header */
-					if (state->final_block) {
-						return Z_STREAM_END; /* We're done */
-					}
-				} else if (code <= 285) {
-					/* Length code */
-					/* Determine base length and extra bits */
-					static const uint16_t length_base[] = {
-						3, 4, 5, 6, 7, 8, 9, 10, 11, 13,
-						15, 17, 19, 23, 27, 31, 35, 43, 51, 59,
-						67, 83, 99, 115, 131, 163, 195, 227, 258
-					};
-					static const uint8_t length_extra[] = {
-						0, 0, 0, 0, 0, 0, 0, 0, 1, 1,
-						1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
-						4, 4, 4, 4, 5, 5, 5, 5, 0
-					};
-
-					int length_idx = code - 257;
-					int length = length_base[length_idx];
-					int extra_bits = length_extra[length_idx];
-
-					if (extra_bits > 0) {
-						int extra = get_bits (strm, state, extra_bits);
-						if (extra < 0) {
-							return Z_DATA_ERROR;
-						}
-						length += extra;
-					}
+		case INFLATE_LEN:
+			if (have >= 8 && left >= DEFLATE_MAX_MATCH) {
+				INFLATE_RESTORE();
+				inflate_fast(strm, state, out_start);
+				INFLATE_LOAD();
+				break;
+			}
+			while (!inflate_lookup(state->len_table, INFLATE_LEN_BITS, hold, bits, &here)) {
+				INFLATE_PULLBYTE();
+			}
+			INFLATE_DROPBITS(here.bits);
+			if (here.op == INFLATE_OP_LIT) {
+				state->length = here.sym;
+				state->mode = INFLATE_LIT;
+			} else if (here.op == INFLATE_OP_EOB) {
+				state->mode = INFLATE_HEADER;
+			} else if (here.op & INFLATE_OP_BAD) {
+				state->mode = INFLATE_BAD; /* Invalid literal/length code */
+			} else {
+				state->length = here.sym;
+				state->extra = here.op & 0x0F;
+				state->mode = INFLATE_LENEXT;
+			}
+			break;
 
-					/* Now read distance code */
-					int distance_code;
-					if (state->btype == BLOCK_FIXED) {
-						/* For fixed Huffman, distance code is always 5 bits */
-						distance_code = get_bits (strm, state, 5);
-						if (distance_code < 0) {
-							return Z_DATA_ERROR;
-						}
-					} else if (state->btype == BLOCK_DYNAMIC) {
-						/* For dynamic Huffman, use the distance table */
-						code = 0;
-						int len;
-						for (len = 1; len <= 15; len++) {
-							int bit = get_bit(strm, state);
-							if (bit < 0) {
-								return Z_DATA_ERROR;
-							}
-							code = (code << 1) | bit;
-							
-							/* Look for matching distance code */
-							int found = -1;
-							for (int i = 0; i < state->distances.count; i++) {
-								if (state->distances.lengths[i] == len && 
-									state->distances.codes[i] == code) {
-									found = i;
-									break;
-								}
-							}
-							if (found >= 0) {
-								distance_code = found;
-								break;
-							}
-						}
-						if (len > 15) {
-							return Z_DATA_ERROR; /* Invalid Huffman code */
-						}
-					} else {
-						return Z_DATA_ERROR; /* Invalid block type */
-					}
-					/* Convert to actual distance */
-					static const uint16_t dist_base[] = {
-						1, 2, 3, 4, 5, 7, 9, 13, 17, 25,
-						33, 49, 65, 97, 129, 193, 257, 385, 513, 769,
-						1025, 1537, 2049, 3073, 4097, 6145,
-						8193, 12289, 16385, 24577
-					};
-					static const uint8_t dist_extra[] = {
-						0, 0, 0, 0, 1, 1, 2, 2, 3, 3,
-						4, 4, 5, 5, 6, 6, 7, 7, 8, 8,
-						9, 9, 10, 10, 11, 11,
-						12, 12, 13, 13
-					};
-
-					int distance = dist_base[distance_code];
-					int dist_extra_bits = dist_extra[distance_code];
-
-					if (dist_extra_bits > 0) {
-						int extra = get_bits (strm, state, dist_extra_bits);
-						if (extra < 0) {
-							return Z_DATA_ERROR;
-						}
-						distance += extra;
-					}
+		case INFLATE_LENEXT:
+			INFLATE_NEEDBITS(state->extra);
+			state->length += INFLATE_BITS(state->extra);
+			INFLATE_DROPBITS(state->extra);
+			state->mode = INFLATE_DIST;
+			break;
 
-					/* Copy bytes from window */
-                if ((uint32_t)distance > state->window_size) {
-                    return Z_DATA_ERROR; /* Distance too far back */
-                }
-
-					/* Make sure we have enough output space */
-                if (strm->avail_out < (uint32_t)length) {
-                    return Z_BUF_ERROR;
-                }
-
-					/* Copy the bytes */
-					for (int i = 0; i < length; i++) {
-						uint8_t byte = state->window[(state->window_pos - distance) & (state->window_size - 1)];
-						*strm->next_out++ = byte;
-						strm->avail_out--;
-						strm->total_out++;
-
-						/* Add to window */
-						state->window[state->window_pos] = byte;
-						state->window_pos = (state->window_pos + 1) & (state->window_size - 1);
-					}
-				} else {
-					/* Invalid code */
-					return Z_DATA_ERROR;
-				}
+		case INFLATE_DIST:
+			while (!inflate_lookup(state->dist_table, INFLATE_DIST_BITS, hold, bits, &here)) {
+				INFLATE_PULLBYTE();
 			}
+			INFLATE_DROPBITS(here.bits);
+			if (here.op & INFLATE_OP_BAD) {
+				state->mode = INFLATE_BAD; /* Invalid distance code */
+				break;
+			}
+			state->offset = here.sym;
+			state->extra = here.op & 0x0F;
+			state->mode = INFLATE_DISTEXT;
 			break;
 
-		default:
-			return Z_STREAM_ERROR; /* Invalid state */
-		}
+		case INFLATE_DISTEXT:
+			INFLATE_NEEDBITS(state->extra);
+			state->offset += INFLATE_BITS(state->extra);
+			INFLATE_DROPBITS(state->extra);
+			if (state->offset > (uint32_t)(put - out_start) + state->window_have) {
+				state->mode = INFLATE_BAD; /* Distance too far back */
+				break;
+			}
+			state->mode = INFLATE_MATCH;
+			break;
 
-		/* Check if we're done */
-		if (state->final_block && state->state == 0) {
-			return Z_STREAM_END;
+		case INFLATE_MATCH: {
+			if (left == 0) goto leave;
+			uint32_t copy = state->length < left ? state->length : left;
+			uint32_t produced = (uint32_t)(put - out_start);
+			if (state->offset > produced) {
+				copy = inflate_copy_window(state, put, state->offset - produced, copy);
+				put += copy;
+			} else {
+				put = inflate_copy_match(put, state->offset, copy);
+			}
+			left -= copy;
+			state->length -= copy;
+			if (state->length == 0) {
+				state->mode = INFLATE_LEN;
+			}
+			break;
 		}
 
-		/* Check if we should stop */
-		if (flush == Z_FINISH && strm->avail_in == 0) {
-			if (!state->final_block || state->state != 0) {
-				return Z_BUF_ERROR; /* Need more input to finish */
-			}
-			return Z_STREAM_END;
+		case INFLATE_LIT:
+			if (left == 0) goto leave;
+			*put++ = (uint8_t)state->length;
+			left--;
+			state->mode = INFLATE_LEN;
+			break;
+
+		case INFLATE_DONE:
+		case INFLATE_BAD:
+			goto leave;
 		}
 	}
 
-	/* If we get here, we've run out of input or output space */
-	if (strm->avail_out == 0) {
+leave:
+	INFLATE_RESTORE();
+	if (strm->next_out != out_start) {
+		inflate_update_window(state, strm->next_out, (uint32_t)(strm->next_out - out_start));
+	}
+	if (state->mode == INFLATE_BAD) {
+		return Z_DATA_ERROR;
+	}
+	if (state->mode == INFLATE_DONE) {
+		return Z_STREAM_END;
+	}
+	if ((in_before == strm->avail_in && out_before == strm->avail_out) || flush == Z_FINISH) {
 		return Z_BUF_ERROR;
 	}
-
-	return ret;
+	return Z_OK;
 }
 
+#undef INFLATE_PULLBYTE
+#undef INFLATE_NEEDBITS
+#undef INFLATE_BITS
+#undef INFLATE_DROPBITS
+#undef INFLATE_LOAD
+#undef INFLATE_RESTORE
+
 int inflateEnd(z_stream *strm) {
 	if (!strm || !strm->state) {
 		return Z_STREAM_ERROR;
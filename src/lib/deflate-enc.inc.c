@@ -1,181 +1,828 @@
 /* ----------- Encoder-specific data structures ----------- */
 
+#define DEFLATE_MIN_MATCH     3
+#define DEFLATE_MAX_MATCH     258
+#define DEFLATE_MIN_LOOKAHEAD (DEFLATE_MAX_MATCH + DEFLATE_MIN_MATCH + 1)
+#define DEFLATE_HASH_BITS     15
+#define DEFLATE_NIL           0
+#define DEFLATE_TOO_FAR       4096 /* drop length-3 matches further than this */
+#define DEFLATE_LIT_BUFSIZE   16384 /* symbols buffered per block */
+#define DEFLATE_MAX_STORED    65535 /* largest stored block payload */
+#define DEFLATE_MAX_BITS      15    /* longest literal/length or distance code */
+#define DEFLATE_MAX_BL_BITS   7     /* longest code length code */
+#define DEFLATE_L_CODES       286   /* literal/length symbols that can be sent */
+#define DEFLATE_D_CODES       30    /* distance symbols that can be sent */
+#define DEFLATE_BL_CODES      19    /* code length symbols */
+#define DEFLATE_END_BLOCK     256
+
+/* Per-level match finder tuning (same semantics as zlib's configuration_table):
+ *  good_length - reduce the chain search once we already have a match this long
+ *  max_lazy    - do not try a lazy match when the current one is at least this long
+ *                (for the fast strategy: only insert new strings below this length)
+ *  nice_length - stop searching as soon as a match this long is found
+ *  max_chain   - maximum number of hash chain entries visited per search
+ */
+typedef struct {
+	uint16_t good_length;
+	uint16_t max_lazy;
+	uint16_t nice_length;
+	uint16_t max_chain;
+	uint8_t  lazy;          /* 0 = greedy (deflate_fast), 1 = lazy evaluation */
+} deflate_config;
+
+static const deflate_config deflate_config_table[10] = {
+	/*  good lazy nice chain lazy */
+	{    0,    0,    0,    0, 0 }, /* 0: store only */
+	{    4,    4,    8,    4, 0 }, /* 1: max speed, no lazy matches */
+	{    4,    5,   16,    8, 0 },
+	{    4,    6,   32,   32, 0 },
+	{    4,    4,   16,   16, 1 }, /* 4: lazy matches */
+	{    8,   16,   32,   32, 1 },
+	{    8,   16,  128,  128, 1 }, /* 6: default */
+	{    8,   32,  128,  256, 1 },
+	{   32,  128,  258, 1024, 1 },
+	{   32,  258,  258, 4096, 1 }  /* 9: max compression */
+};
+
+/* Result of one run of the block compressor */
+typedef enum {
+	DEFLATE_NEED_MORE,       /* more input or more output space is needed */
+	DEFLATE_BLOCK_DONE,      /* a block was flushed (or nothing to do) */
+	DEFLATE_FINISH_DONE      /* the last block has been emitted */
+} deflate_block_state;
+
 /* Internal state for deflate */
 typedef struct {
 	/* Compression parameters */
 	int level;              /* Compression level */
-	int is_last_block;      /* Is this the final block? */
+	int finished;           /* Last block has been written to pending */
 
-	/* Sliding window for LZ77 */
+	/* Sliding window for LZ77: 2 * w_size bytes, the upper half is filled
+	 * with lookahead and slid down once strstart gets close to the end. */
 	uint8_t *window;        /* Sliding window buffer */
-	uint32_t window_size;   /* Window size (power of 2) */
-	uint32_t window_mask;   /* Window mask (window_size - 1) */
-	uint32_t window_pos;    /* Current position in window */
-
-	/* Hash table for fast string matching */
-	uint16_t *hash_table;   /* Hash table for finding matches */
+	uint32_t w_size;        /* LZ77 window size (power of 2) */
+	uint32_t w_mask;        /* w_size - 1 */
+	uint32_t window_size;   /* Allocated window buffer size (2 * w_size) */
+	int64_t  block_start;   /* Window offset of the current block; negative
+	                         * once the block start has been slid out */
+
+	/* Hash chains: head[h] is the most recent position with hash h,
+	 * prev[pos & w_mask] links to the previous position with the same hash.
+	 * Positions are window offsets; 0 is used as the end-of-chain marker. */
+	uint16_t *head;
+	uint16_t *prev;
 	uint32_t hash_size;     /* Size of hash table */
 	uint32_t hash_mask;     /* Hash mask (hash_size - 1) */
-
-	/* Output state */
-	uint32_t bit_buffer;     /* Bit buffer */
+	uint32_t hash_shift;    /* 32 - log2(hash_size) */
+
+	/* Match state */
+	uint32_t strstart;      /* Start of string to insert */
+	uint32_t lookahead;     /* Number of valid bytes ahead of strstart */
+	uint32_t match_start;   /* Start of the current match */
+	uint32_t match_length;  /* Length of the current match */
+	uint32_t prev_length;   /* Length of the best match at the previous step */
+	uint32_t prev_match;    /* Start of the previous match */
+	int match_available;    /* Set if a literal at strstart - 1 is pending */
+
+	/* Level dependent tuning, copied from deflate_config_table */
+	uint32_t good_match;
+	uint32_t max_lazy_match;
+	uint32_t nice_match;
+	uint32_t max_chain_length;
+	int lazy;
+
+	/* Symbols of the current block: l_buf holds a literal or length - 3,
+	 * d_buf the match distance (0 for literals). */
+	uint8_t  *l_buf;
+	uint16_t *d_buf;
+	uint32_t sym_next;
+	uint32_t lit_freq[DEFLATE_L_CODES];
+	uint32_t dist_freq[DEFLATE_D_CODES];
+
+	/* Output state: bits are collected in a 64-bit accumulator and moved to
+	 * the pending buffer one 32-bit word at a time. */
+	uint64_t bit_buffer;     /* Bit buffer */
 	uint32_t bits_in_buffer; /* Number of bits in buffer */
+	uint8_t *pending_buf;    /* Encoded bytes not yet copied to next_out */
+	uint32_t pending_size;
+	uint32_t pending;        /* Bytes in pending_buf */
+	uint32_t pending_out;    /* Next byte of pending_buf to copy out */
 
 	/* Huffman tables */
-	huffman_table literals;  /* Literal/length codes */
-	huffman_table distances; /* Distance codes */
+	huffman_table literals;      /* Fixed literal/length codes */
+	huffman_table distances;     /* Fixed distance codes */
+	huffman_table dyn_literals;  /* Literal/length codes of the current block */
+	huffman_table dyn_distances; /* Distance codes of the current block */
+	huffman_table bl_codes;      /* Code length codes of the current block */
 } deflate_state;
 
+/* Base lengths and extra bits for length codes 257..285 */
+static const uint16_t deflate_length_base[29] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 13,
+	15, 17, 19, 23, 27, 31, 35, 43, 51, 59,
+	67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t deflate_length_extra[29] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1,
+	1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+	4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+
+/* Base distances and extra bits for distance codes 0..29 */
+static const uint16_t deflate_dist_base[30] = {
+	1, 2, 3, 4, 5, 7, 9, 13, 17, 25,
+	33, 49, 65, 97, 129, 193, 257, 385, 513, 769,
+	1025, 1537, 2049, 3073, 4097, 6145,
+	8193, 12289, 16385, 24577
+};
+static const uint8_t deflate_dist_extra[30] = {
+	0, 0, 0, 0, 1, 1, 2, 2, 3, 3,
+	4, 4, 5, 5, 6, 6, 7, 7, 8, 8,
+	9, 9, 10, 10, 11, 11,
+	12, 12, 13, 13
+};
+
+/* Order in which code length code lengths are sent (RFC 1951 3.2.7) */
+static const uint8_t deflate_bl_order[DEFLATE_BL_CODES] = {
+	16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15
+};
+
 /* ----------- Encoder-specific functions ----------- */
 
-/* Find longest match at current position */
-static int find_longest_match(deflate_state *state, const uint8_t *data,
-		uint32_t pos, uint32_t max_len, uint32_t *match_pos) {
-	/* Need at least 3 bytes for a match */
-	if (max_len < 3) return 0;
-
-	/* Calculate hash for current position */
-	uint32_t hash = calculate_hash(data) & state->hash_mask;
-
-    /* Get position of potential match from hash table.
-     * We store positions offset by +1 so that 0 means "no entry".
-     */
-    uint32_t stored = state->hash_table[hash];
-
-    /* Store current position in hash table (save position modulo 64K) */
-    /* Save pos+1 so that 0 remains sentinel for "no previous" */
-    state->hash_table[hash] = (uint16_t)(((pos & 0xFFFF) + 1) & 0xFFFF);
-
-    /* No previous match at this hash */
-    if (stored == 0) return 0;
-
-    /* Recover actual stored position (subtract the +1) */
-    uint32_t chain_pos = (uint32_t)(stored - 1);
-
-    /* Don't look back too far (distance measured in window indices) */
-    const uint32_t max_dist = 32768;
-    if (pos > chain_pos + max_dist) return 0;
-
-	/* Find longest match */
-	uint32_t best_len = 0;
-	*match_pos = 0;
-
-	/* Limit match search for better performance */
-	const int max_chain_length = (state->level >= 8) ? 4096 :
-		(state->level >= 5) ? 512 :
-		(state->level >= 3) ? 128 : 32;
-
-	int chain_len = max_chain_length;
-
-	/* Search for matches */
-	while (chain_pos > 0 && chain_len-- > 0) {
-        /* Quick check for 3-byte match at start.
-         * The previous occurrence is located in the circular sliding window at
-         * index `chain_pos & window_mask`. Compare bytes in the window to the
-         * input buffer `data`.
-         */
-        uint32_t win_idx = chain_pos & state->window_mask;
-        if (state->window[win_idx] == data[0] &&
-                state->window[(win_idx + 1) & state->window_mask] == data[1] &&
-                state->window[(win_idx + 2) & state->window_mask] == data[2]) {
-
-            /* Count matching bytes */
-            uint32_t len = 3;
-            while (len < max_len &&
-                   state->window[(win_idx + len) & state->window_mask] == data[len]) {
-                len++;
-            }
-
-			/* Update best match if better */
-			if (len > best_len) {
-				best_len = len;
-				*match_pos = chain_pos;
-
-				/* Stop if we found a "good enough" match */
-				if (len >= max_len) break;
-			}
-		}
+/* floor(log2(v)) for v > 0 */
+static inline uint32_t deflate_log2(uint32_t v) {
+#if defined(__GNUC__) || defined(__clang__)
+	return 31u - (uint32_t)__builtin_clz(v);
+#else
+	uint32_t n = 0;
+	while (v >>= 1) n++;
+	return n;
+#endif
+}
+
+/* Map a match length (3..258) to its length code index (0..28) */
+static inline uint32_t deflate_length_code(uint32_t len) {
+	uint32_t l = len - DEFLATE_MIN_MATCH;
+	if (l < 8) return l;
+	if (l == 255) return 28;
+	uint32_t n = deflate_log2(l);
+	return 4 * (n - 1) + ((l >> (n - 2)) & 3);
+}
 
-		/* In a full implementation we'd use a proper chain, but for simplicity
-		 * we'll just terminate the search as the code is intended to be minimal */
-		break; /* End the chain search after first match */
+/* Map a match distance (1..32768) to its distance code (0..29) */
+static inline uint32_t deflate_dist_code(uint32_t dist) {
+	uint32_t d = dist - 1;
+	if (d < 4) return d;
+	uint32_t n = deflate_log2(d);
+	return 2 * n + ((d >> (n - 1)) & 1);
+}
+
+/* Reverse the low `len` bits of `code` (Huffman codes are sent MSB first) */
+static inline uint16_t deflate_bit_reverse(uint16_t code, int len) {
+	uint16_t res = 0;
+	while (len-- > 0) {
+		res = (uint16_t)((res << 1) | (code & 1));
+		code >>= 1;
 	}
+	return res;
+}
 
-	return best_len;
+/* Hash of the 3 bytes at `data`, reduced to hash_size buckets */
+static inline uint32_t deflate_hash(const deflate_state *state, const uint8_t *data) {
+	return (calculate_hash(data) * 0x9E3779B1u) >> state->hash_shift;
+}
+
+/* Insert string at `pos` into the hash chains and return the previous head */
+static inline uint32_t insert_string(deflate_state *state, uint32_t pos) {
+	uint32_t h = deflate_hash(state, state->window + pos);
+	uint32_t head = state->head[h];
+	state->prev[pos & state->w_mask] = (uint16_t)head;
+	state->head[h] = (uint16_t)pos;
+	return head;
 }
 
-/* Write bits to output buffer */
-static int write_bits(z_stream *strm, deflate_state *state,
-		uint32_t bits, int num_bits) {
-	/* Add bits to buffer */
-	state->bit_buffer |= (bits << state->bits_in_buffer);
-	state->bits_in_buffer += num_bits;
+/* Find longest match at current position.
+ * Walks the hash chain starting at `cur_match`, never further back than
+ * the window allows, and at most max_chain_length entries. Returns the
+ * best length found (and sets match_start), or prev_length if nothing
+ * better was found. */
+static uint32_t find_longest_match(deflate_state *state, uint32_t cur_match) {
+	uint32_t chain_length = state->max_chain_length;
+	const uint8_t *scan = state->window + state->strstart;
+	uint32_t best_len = state->prev_length;
+	uint32_t nice_match = state->nice_match;
+	const uint32_t max_dist = state->w_size - DEFLATE_MIN_LOOKAHEAD;
+	uint32_t limit = state->strstart > max_dist ? state->strstart - max_dist : DEFLATE_NIL;
+	uint32_t max_len = state->lookahead < DEFLATE_MAX_MATCH ? state->lookahead : DEFLATE_MAX_MATCH;
+
+	/* Do not waste too much time if we already have a good match */
+	if (state->prev_length >= state->good_match) {
+		chain_length >>= 2;
+	}
+	if (nice_match > state->lookahead) nice_match = state->lookahead;
+	if (best_len >= max_len) return best_len;
+
+	do {
+		const uint8_t *match = state->window + cur_match;
+
+		/* Skip candidates that cannot improve on best_len: check the byte
+		 * just past the current best first, then the first two bytes. */
+		if (match[best_len] != scan[best_len] ||
+				match[best_len - 1] != scan[best_len - 1] ||
+				match[0] != scan[0] || match[1] != scan[1]) {
+			continue;
+		}
+
+		uint32_t len = 2;
+		while (len < max_len && match[len] == scan[len]) {
+			len++;
+		}
 
-	/* Fast path: write all full bytes at once */
-	while (state->bits_in_buffer >= 8) {
-		if (strm->avail_out == 0) return Z_BUF_ERROR;
+		if (len > best_len) {
+			state->match_start = cur_match;
+			best_len = len;
+			if (len >= nice_match) break;
+		}
+	} while ((cur_match = state->prev[cur_match & state->w_mask]) > limit &&
+			--chain_length != 0);
 
-		*strm->next_out++ = state->bit_buffer & 0xFF;
-		strm->avail_out--;
-		strm->total_out++;
+	return best_len;
+}
 
+/* Append `num_bits` (<= 32) bits to the accumulator; whole 32-bit words
+ * are moved to the pending buffer. */
+static inline void write_bits(deflate_state *state, uint32_t bits, int num_bits) {
+	state->bit_buffer |= (uint64_t)bits << state->bits_in_buffer;
+	state->bits_in_buffer += (uint32_t)num_bits;
+	if (state->bits_in_buffer >= 32) {
+		uint8_t *p = state->pending_buf + state->pending;
+		uint32_t w = (uint32_t)state->bit_buffer;
+		p[0] = (uint8_t)w;
+		p[1] = (uint8_t)(w >> 8);
+		p[2] = (uint8_t)(w >> 16);
+		p[3] = (uint8_t)(w >> 24);
+		state->pending += 4;
+		state->bit_buffer >>= 32;
+		state->bits_in_buffer -= 32;
+	}
+}
+
+/* Flush remaining bits to pending, padding to a byte boundary */
+static void flush_bits(deflate_state *state) {
+	while (state->bits_in_buffer > 0) {
+		state->pending_buf[state->pending++] = (uint8_t)state->bit_buffer;
 		state->bit_buffer >>= 8;
-		state->bits_in_buffer -= 8;
+		state->bits_in_buffer = state->bits_in_buffer > 8 ? state->bits_in_buffer - 8 : 0;
 	}
+	state->bit_buffer = 0;
+}
 
-	return Z_OK;
+/* Copy as much pending output as fits into next_out */
+static void flush_pending(z_stream *strm, deflate_state *state) {
+	uint32_t len = state->pending - state->pending_out;
+	if (len > strm->avail_out) len = strm->avail_out;
+	if (len == 0) return;
+	memcpy(strm->next_out, state->pending_buf + state->pending_out, len);
+	strm->next_out += len;
+	strm->avail_out -= len;
+	strm->total_out += len;
+	state->pending_out += len;
+	if (state->pending_out == state->pending) {
+		state->pending = state->pending_out = 0;
+	}
+}
+
+/* Assign canonical codes (stored bit-reversed) from code lengths */
+static void deflate_gen_codes(huffman_table *table, int num_codes) {
+	uint16_t bl_count[DEFLATE_MAX_BITS + 1] = {0};
+	uint16_t next_code[DEFLATE_MAX_BITS + 1] = {0};
+	for (int i = 0; i < num_codes; i++) {
+		bl_count[table->lengths[i]]++;
+	}
+	bl_count[0] = 0;
+	uint16_t code = 0;
+	for (int bits = 1; bits <= DEFLATE_MAX_BITS; bits++) {
+		code = (uint16_t)((code + bl_count[bits - 1]) << 1);
+		next_code[bits] = code;
+	}
+	for (int i = 0; i < num_codes; i++) {
+		int len = table->lengths[i];
+		table->codes[i] = len ? deflate_bit_reverse(next_code[len]++, len) : 0;
+	}
+	table->count = (uint16_t)num_codes;
 }
 
-/* Flush remaining bits in buffer */
-static int flush_bits(z_stream *strm, deflate_state *state) {
-	/* Flush any remaining bits */
-	if (state->bits_in_buffer > 0) {
-		if (strm->avail_out == 0) return Z_BUF_ERROR;
+/* Compute Huffman code lengths for `freq`, limited to `max_bits`.
+ * Uses the two-queue construction over symbols sorted by frequency and,
+ * if the tree is too deep, clamps lengths and repairs the Kraft sum by
+ * lengthening the cheapest codes. At least two codes are always assigned
+ * so every tree is complete. */
+static void deflate_build_lengths(const uint32_t *freq, int num_codes, int max_bits, uint8_t *lengths) {
+	uint64_t sorted[DEFLATE_L_CODES];
+	uint32_t weight[2 * DEFLATE_L_CODES];
+	uint16_t parent[2 * DEFLATE_L_CODES];
+	uint8_t depth[2 * DEFLATE_L_CODES];
+	int n = 0;
+
+	memset(lengths, 0, (size_t)num_codes);
+	for (int i = 0; i < num_codes; i++) {
+		if (freq[i]) sorted[n++] = ((uint64_t)freq[i] << 16) | (uint64_t)i;
+	}
+	if (n < 2) {
+		int s = n ? (int)(sorted[0] & 0xFFFF) : 0;
+		lengths[s] = 1;
+		lengths[s == 0 ? 1 : 0] = 1;
+		return;
+	}
 
-		*strm->next_out++ = state->bit_buffer & 0xFF;
-		strm->avail_out--;
-		strm->total_out++;
+	/* Insertion sort by (freq, symbol); alphabets are small */
+	for (int i = 1; i < n; i++) {
+		uint64_t v = sorted[i];
+		int j = i - 1;
+		while (j >= 0 && sorted[j] > v) {
+			sorted[j + 1] = sorted[j];
+			j--;
+		}
+		sorted[j + 1] = v;
+	}
 
-		state->bit_buffer = 0;
-		state->bits_in_buffer = 0;
+	/* Leaves are 0..n-1 (ascending weight), internal nodes n..2n-2 are
+	 * created in non-decreasing weight order. */
+	for (int i = 0; i < n; i++) weight[i] = (uint32_t)(sorted[i] >> 16);
+	int leaf = 0, node = n;
+	for (int k = n; k < 2 * n - 1; k++) {
+		int pick[2];
+		for (int p = 0; p < 2; p++) {
+			if (leaf < n && (node >= k || weight[leaf] <= weight[node])) {
+				pick[p] = leaf++;
+			} else {
+				pick[p] = node++;
+			}
+		}
+		weight[k] = weight[pick[0]] + weight[pick[1]];
+		parent[pick[0]] = parent[pick[1]] = (uint16_t)k;
+	}
+	depth[2 * n - 2] = 0;
+	int overflow = 0;
+	for (int k = 2 * n - 3; k >= 0; k--) {
+		depth[k] = (uint8_t)(depth[parent[k]] + 1);
+		if (k < n && depth[k] > max_bits) overflow = 1;
 	}
 
-	return Z_OK;
+	if (overflow) {
+		/* Clamp, then restore Kraft's inequality (sum of 2^-len <= 1) */
+		uint32_t kraft = 0;
+		const uint32_t target = 1u << max_bits;
+		for (int i = 0; i < n; i++) {
+			if (depth[i] > max_bits) depth[i] = (uint8_t)max_bits;
+			kraft += 1u << (max_bits - depth[i]);
+		}
+		while (kraft > target) {
+			/* Lengthen the least frequent of the longest non-maximal codes */
+			int best = -1;
+			for (int i = 0; i < n; i++) {
+				if (depth[i] < max_bits && (best < 0 || depth[i] > depth[best])) best = i;
+			}
+			kraft -= 1u << (max_bits - depth[best] - 1);
+			depth[best]++;
+		}
+		/* Use any leftover code space to shorten the most frequent codes */
+		for (int i = n - 1; i >= 0; i--) {
+			while (depth[i] > 1 && kraft + (1u << (max_bits - depth[i])) <= target) {
+				kraft += 1u << (max_bits - depth[i]);
+				depth[i]--;
+			}
+		}
+	}
+
+	for (int i = 0; i < n; i++) {
+		lengths[sorted[i] & 0xFFFF] = depth[i];
+	}
 }
 
-/* Initialize static Huffman tables for deflate */
+/* Initialize static Huffman tables for deflate.
+ * Codes are stored bit-reversed so they can be emitted LSB first. */
 static void init_fixed_huffman_deflate(deflate_state *state) {
-	/* Same tables as used in inflate */
-	for (int i = 0; i < 144; i++) {
-		state->literals.codes[i] = 0x30 + i; /* 8 bits, 00110000 + i */
-		state->literals.lengths[i] = 8;
+	for (int i = 0; i < 144; i++) state->literals.lengths[i] = 8;
+	for (int i = 144; i < 256; i++) state->literals.lengths[i] = 9;
+	for (int i = 256; i < 280; i++) state->literals.lengths[i] = 7;
+	for (int i = 280; i < 288; i++) state->literals.lengths[i] = 8;
+	deflate_gen_codes(&state->literals, 288);
+
+	/* Distance codes */
+	for (int i = 0; i < 32; i++) state->distances.lengths[i] = 5;
+	deflate_gen_codes(&state->distances, 32);
+}
+
+/* Record a literal; returns non-zero when the symbol buffer is full */
+static inline int tally_literal(deflate_state *state, uint8_t c) {
+	state->d_buf[state->sym_next] = 0;
+	state->l_buf[state->sym_next++] = c;
+	state->lit_freq[c]++;
+	return state->sym_next == DEFLATE_LIT_BUFSIZE - 1;
+}
+
+/* Record a match; returns non-zero when the symbol buffer is full */
+static inline int tally_match(deflate_state *state, uint32_t dist, uint32_t len) {
+	state->d_buf[state->sym_next] = (uint16_t)dist;
+	state->l_buf[state->sym_next++] = (uint8_t)(len - DEFLATE_MIN_MATCH);
+	state->lit_freq[257 + deflate_length_code(len)]++;
+	state->dist_freq[deflate_dist_code(dist)]++;
+	return state->sym_next == DEFLATE_LIT_BUFSIZE - 1;
+}
+
+/* Emit the buffered symbols with the given literal/length and distance codes */
+static void deflate_compress_block(deflate_state *state, const huffman_table *ltree, const huffman_table *dtree) {
+	for (uint32_t i = 0; i < state->sym_next; i++) {
+		uint32_t dist = state->d_buf[i];
+		uint32_t lc = state->l_buf[i];
+		if (dist == 0) {
+			write_bits(state, ltree->codes[lc], ltree->lengths[lc]);
+			continue;
+		}
+		uint32_t code = deflate_length_code(lc + DEFLATE_MIN_MATCH);
+		write_bits(state, ltree->codes[257 + code], ltree->lengths[257 + code]);
+		if (deflate_length_extra[code]) {
+			write_bits(state, lc + DEFLATE_MIN_MATCH - deflate_length_base[code], deflate_length_extra[code]);
+		}
+		code = deflate_dist_code(dist);
+		write_bits(state, dtree->codes[code], dtree->lengths[code]);
+		if (deflate_dist_extra[code]) {
+			write_bits(state, dist - deflate_dist_base[code], deflate_dist_extra[code]);
+		}
+	}
+	write_bits(state, ltree->codes[DEFLATE_END_BLOCK], ltree->lengths[DEFLATE_END_BLOCK]);
+}
+
+/* Emit raw bytes as one or more stored blocks */
+static void emit_stored_blocks(deflate_state *state, const uint8_t *buf, uint32_t len, int last) {
+	do {
+		uint32_t chunk = len > DEFLATE_MAX_STORED ? DEFLATE_MAX_STORED : len;
+		len -= chunk;
+		write_bits(state, (last && len == 0) ? 1 : 0, 3); /* BFINAL + BTYPE 00 */
+		flush_bits(state);
+		uint8_t *p = state->pending_buf + state->pending;
+		p[0] = (uint8_t)chunk;
+		p[1] = (uint8_t)(chunk >> 8);
+		p[2] = (uint8_t)~chunk;
+		p[3] = (uint8_t)(~chunk >> 8);
+		if (chunk) memcpy(p + 4, buf, chunk);
+		state->pending += 4 + chunk;
+		buf += chunk;
+	} while (len > 0);
+}
+
+/* Exact size in bits of `len` bytes sent as stored blocks at the current bit offset */
+static uint64_t stored_cost(const deflate_state *state, uint32_t len) {
+	uint64_t bits = state->bits_in_buffer;
+	do {
+		uint32_t chunk = len > DEFLATE_MAX_STORED ? DEFLATE_MAX_STORED : len;
+		len -= chunk;
+		bits = ((bits + 3 + 7) & ~(uint64_t)7) + 32 + 8 * (uint64_t)chunk;
+	} while (len > 0);
+	return bits - state->bits_in_buffer;
+}
+
+/* Emit the current block, choosing the cheapest of stored, fixed and
+ * dynamic Huffman encoding by exact bit count. */
+static void flush_block(deflate_state *state, int last) {
+	const uint8_t *buf = state->block_start >= 0 ? state->window + state->block_start : NULL;
+	uint32_t stored_len = (uint32_t)((int64_t)state->strstart - state->block_start);
+
+	state->lit_freq[DEFLATE_END_BLOCK] = 1;
+
+	/* Extra bits are the same for fixed and dynamic codes */
+	uint64_t extra_bits = 0;
+	for (int i = 0; i < 29; i++) {
+		extra_bits += (uint64_t)state->lit_freq[257 + i] * deflate_length_extra[i];
 	}
-	for (int i = 144; i < 256; i++) {
-		state->literals.codes[i] = 0x190 + (i - 144); /* 9 bits, 110010000 + (i - 144) */
-		state->literals.lengths[i] = 9;
+	for (int i = 0; i < DEFLATE_D_CODES; i++) {
+		extra_bits += (uint64_t)state->dist_freq[i] * deflate_dist_extra[i];
 	}
-	for (int i = 256; i < 280; i++) {
-		state->literals.codes[i] = 0 + (i - 256); /* 7 bits, 0000000 + (i - 256) */
-		state->literals.lengths[i] = 7;
+
+	uint64_t fixed_bits = 3 + extra_bits;
+	for (int i = 0; i < DEFLATE_L_CODES; i++) {
+		fixed_bits += (uint64_t)state->lit_freq[i] * state->literals.lengths[i];
 	}
-	for (int i = 280; i < 288; i++) {
-		state->literals.codes[i] = 0xC0 + (i - 280); /* 8 bits, 11000000 + (i - 280) */
-		state->literals.lengths[i] = 8;
+	for (int i = 0; i < DEFLATE_D_CODES; i++) {
+		fixed_bits += (uint64_t)state->dist_freq[i] * state->distances.lengths[i];
 	}
-	state->literals.count = 288;
 
-	/* Distance codes */
-	for (int i = 0; i < 32; i++) {
-		state->distances.codes[i] = i; /* 5 bits */
-		state->distances.lengths[i] = 5;
+	/* Dynamic trees */
+	huffman_table *lt = &state->dyn_literals;
+	huffman_table *dt = &state->dyn_distances;
+	deflate_build_lengths(state->lit_freq, DEFLATE_L_CODES, DEFLATE_MAX_BITS, lt->lengths);
+	deflate_build_lengths(state->dist_freq, DEFLATE_D_CODES, DEFLATE_MAX_BITS, dt->lengths);
+	deflate_gen_codes(lt, DEFLATE_L_CODES);
+	deflate_gen_codes(dt, DEFLATE_D_CODES);
+
+	int hlit = DEFLATE_L_CODES;
+	while (hlit > 257 && lt->lengths[hlit - 1] == 0) hlit--;
+	int hdist = DEFLATE_D_CODES;
+	while (hdist > 1 && dt->lengths[hdist - 1] == 0) hdist--;
+
+	/* Run-length encode the concatenated code lengths (symbols 16/17/18) */
+	uint8_t all_lengths[DEFLATE_L_CODES + DEFLATE_D_CODES];
+	uint8_t rle_sym[DEFLATE_L_CODES + DEFLATE_D_CODES];
+	uint8_t rle_extra[DEFLATE_L_CODES + DEFLATE_D_CODES];
+	uint32_t bl_freq[DEFLATE_BL_CODES] = {0};
+	int num_lengths = hlit + hdist;
+	int num_rle = 0;
+	memcpy(all_lengths, lt->lengths, (size_t)hlit);
+	memcpy(all_lengths + hlit, dt->lengths, (size_t)hdist);
+	for (int i = 0; i < num_lengths;) {
+		uint8_t v = all_lengths[i];
+		int run = 1;
+		while (i + run < num_lengths && all_lengths[i + run] == v) run++;
+		i += run;
+		if (v == 0) {
+			while (run >= 11) {
+				int r = run > 138 ? 138 : run;
+				rle_sym[num_rle] = 18; rle_extra[num_rle++] = (uint8_t)(r - 11);
+				run -= r;
+			}
+			if (run >= 3) {
+				rle_sym[num_rle] = 17; rle_extra[num_rle++] = (uint8_t)(run - 3);
+				run = 0;
+			}
+		} else {
+			rle_sym[num_rle] = v; rle_extra[num_rle++] = 0;
+			run--;
+			while (run >= 3) {
+				int r = run > 6 ? 6 : run;
+				rle_sym[num_rle] = 16; rle_extra[num_rle++] = (uint8_t)(r - 3);
+				run -= r;
+			}
+		}
+		while (run-- > 0) {
+			rle_sym[num_rle] = v; rle_extra[num_rle++] = 0;
+		}
+	}
+	for (int i = 0; i < num_rle; i++) bl_freq[rle_sym[i]]++;
+
+	huffman_table *bt = &state->bl_codes;
+	deflate_build_lengths(bl_freq, DEFLATE_BL_CODES, DEFLATE_MAX_BL_BITS, bt->lengths);
+	deflate_gen_codes(bt, DEFLATE_BL_CODES);
+	int hclen = DEFLATE_BL_CODES;
+	while (hclen > 4 && bt->lengths[deflate_bl_order[hclen - 1]] == 0) hclen--;
+
+	uint64_t dyn_bits = 3 + 5 + 5 + 4 + 3 * (uint64_t)hclen + extra_bits;
+	for (int i = 0; i < num_rle; i++) {
+		uint8_t s = rle_sym[i];
+		dyn_bits += bt->lengths[s] + (s == 16 ? 2 : s == 17 ? 3 : s == 18 ? 7 : 0);
+	}
+	for (int i = 0; i < DEFLATE_L_CODES; i++) {
+		dyn_bits += (uint64_t)state->lit_freq[i] * lt->lengths[i];
+	}
+	for (int i = 0; i < DEFLATE_D_CODES; i++) {
+		dyn_bits += (uint64_t)state->dist_freq[i] * dt->lengths[i];
+	}
+
+	/* Level 0 records no symbols: its blocks can only be stored */
+	uint64_t stored_bits = buf ? stored_cost(state, stored_len) : UINT64_MAX;
+	if (state->level == 0 && stored_len > 0) {
+		fixed_bits = dyn_bits = UINT64_MAX;
+	}
+
+	if (stored_bits <= fixed_bits && stored_bits <= dyn_bits) {
+		emit_stored_blocks(state, buf, stored_len, last);
+	} else if (fixed_bits <= dyn_bits) {
+		write_bits(state, (uint32_t)((1 << 1) | (last ? 1 : 0)), 3);
+		deflate_compress_block(state, &state->literals, &state->distances);
+	} else {
+		write_bits(state, (uint32_t)((2 << 1) | (last ? 1 : 0)), 3);
+		write_bits(state, (uint32_t)(hlit - 257), 5);
+		write_bits(state, (uint32_t)(hdist - 1), 5);
+		write_bits(state, (uint32_t)(hclen - 4), 4);
+		for (int i = 0; i < hclen; i++) {
+			write_bits(state, bt->lengths[deflate_bl_order[i]], 3);
+		}
+		for (int i = 0; i < num_rle; i++) {
+			uint8_t s = rle_sym[i];
+			write_bits(state, bt->codes[s], bt->lengths[s]);
+			if (s == 16) write_bits(state, rle_extra[i], 2);
+			else if (s == 17) write_bits(state, rle_extra[i], 3);
+			else if (s == 18) write_bits(state, rle_extra[i], 7);
+		}
+		deflate_compress_block(state, lt, dt);
+	}
+	if (last) {
+		flush_bits(state);
+	}
+
+	/* Start a new block */
+	memset(state->lit_freq, 0, sizeof(state->lit_freq));
+	memset(state->dist_freq, 0, sizeof(state->dist_freq));
+	state->sym_next = 0;
+	state->block_start = state->strstart;
+}
+
+/* Flush the current block and try to hand it to the caller. Used by the
+ * compressors below: leaves the compressor when the output is full. */
+#define FLUSH_BLOCK(strm, state, last) do { \
+	flush_block((state), (last)); \
+	flush_pending((strm), (state)); \
+	if ((strm)->avail_out == 0) return (last) ? DEFLATE_FINISH_DONE : DEFLATE_NEED_MORE; \
+} while (0)
+
+/* Slide the window down by w_size bytes and rebase the hash chains */
+static void slide_window(deflate_state *state) {
+	uint32_t wsize = state->w_size;
+	memcpy(state->window, state->window + wsize, wsize);
+	state->match_start = state->match_start >= wsize ? state->match_start - wsize : 0;
+	state->strstart -= wsize;
+	state->block_start -= wsize;
+	for (uint32_t i = 0; i < state->hash_size; i++) {
+		uint32_t m = state->head[i];
+		state->head[i] = (uint16_t)(m >= wsize ? m - wsize : DEFLATE_NIL);
+	}
+	for (uint32_t i = 0; i < wsize; i++) {
+		uint32_t m = state->prev[i];
+		state->prev[i] = (uint16_t)(m >= wsize ? m - wsize : DEFLATE_NIL);
 	}
-	state->distances.count = 32;
 }
 
-/* Write a Huffman code to output */
-static int write_huffman_code(z_stream *strm, deflate_state *state,
-		uint16_t code, uint8_t code_length) {
-	return write_bits(strm, state, code, code_length);
+/* Window must slide before more input can be read */
+static inline int window_full(const deflate_state *state) {
+	return state->strstart >= state->w_size + (state->w_size - DEFLATE_MIN_LOOKAHEAD);
+}
+
+/* Fill the window with input while there is room for more lookahead */
+static void fill_window(z_stream *strm, deflate_state *state) {
+	do {
+		uint32_t more = state->window_size - state->lookahead - state->strstart;
+		if (window_full(state)) {
+			slide_window(state);
+			more += state->w_size;
+		}
+		if (strm->avail_in == 0) break;
+
+		uint32_t n = strm->avail_in < more ? strm->avail_in : more;
+		memcpy(state->window + state->strstart + state->lookahead, strm->next_in, n);
+		strm->next_in += n;
+		strm->avail_in -= n;
+		strm->total_in += n;
+		state->lookahead += n;
+	} while (state->lookahead < DEFLATE_MIN_LOOKAHEAD && strm->avail_in != 0);
+}
+
+/* Level 0: copy input into the window and emit it as stored blocks */
+static deflate_block_state deflate_stored(z_stream *strm, deflate_state *state, int flush) {
+	for (;;) {
+		/* Stored blocks need their bytes, so flush before they slide out */
+		if (window_full(state) && (int64_t)state->strstart > state->block_start) {
+			FLUSH_BLOCK(strm, state, 0);
+		}
+		if (state->lookahead == 0) {
+			fill_window(strm, state);
+			if (state->lookahead == 0) {
+				if (flush == Z_NO_FLUSH) return DEFLATE_NEED_MORE;
+				break;
+			}
+		}
+		state->strstart += state->lookahead;
+		state->lookahead = 0;
+		if ((int64_t)state->strstart - state->block_start >= DEFLATE_MAX_STORED) {
+			FLUSH_BLOCK(strm, state, 0);
+		}
+	}
+	if (flush == Z_FINISH) {
+		FLUSH_BLOCK(strm, state, 1);
+		return DEFLATE_FINISH_DONE;
+	}
+	if ((int64_t)state->strstart > state->block_start) {
+		FLUSH_BLOCK(strm, state, 0);
+	}
+	return DEFLATE_BLOCK_DONE;
+}
+
+/* Greedy matching for the fast levels (1-3): take the first match found
+ * and only insert strings of short matches into the hash chains. */
+static deflate_block_state deflate_fast(z_stream *strm, deflate_state *state, int flush) {
+	for (;;) {
+		if (state->lookahead < DEFLATE_MIN_LOOKAHEAD) {
+			fill_window(strm, state);
+			if (state->lookahead < DEFLATE_MIN_LOOKAHEAD && flush == Z_NO_FLUSH) {
+				return DEFLATE_NEED_MORE;
+			}
+			if (state->lookahead == 0) break;
+		}
+
+		uint32_t hash_head = DEFLATE_NIL;
+		if (state->lookahead >= DEFLATE_MIN_MATCH) {
+			hash_head = insert_string(state, state->strstart);
+		}
+		state->match_length = DEFLATE_MIN_MATCH - 1;
+		state->prev_length = DEFLATE_MIN_MATCH - 1;
+		if (hash_head != DEFLATE_NIL &&
+				state->strstart - hash_head <= state->w_size - DEFLATE_MIN_LOOKAHEAD) {
+			state->match_length = find_longest_match(state, hash_head);
+		}
+
+		int bflush;
+		if (state->match_length >= DEFLATE_MIN_MATCH) {
+			bflush = tally_match(state, state->strstart - state->match_start, state->match_length);
+			state->lookahead -= state->match_length;
+			if (state->match_length <= state->max_lazy_match &&
+					state->lookahead >= DEFLATE_MIN_MATCH) {
+				/* Insert the strings covered by the match */
+				state->match_length--;
+				do {
+					state->strstart++;
+					insert_string(state, state->strstart);
+				} while (--state->match_length != 0);
+				state->strstart++;
+			} else {
+				state->strstart += state->match_length;
+				state->match_length = 0;
+			}
+		} else {
+			bflush = tally_literal(state, state->window[state->strstart]);
+			state->lookahead--;
+			state->strstart++;
+		}
+		if (bflush) FLUSH_BLOCK(strm, state, 0);
+	}
+	if (flush == Z_FINISH) {
+		FLUSH_BLOCK(strm, state, 1);
+		return DEFLATE_FINISH_DONE;
+	}
+	if (state->sym_next) FLUSH_BLOCK(strm, state, 0);
+	return DEFLATE_BLOCK_DONE;
+}
+
+/* Lazy matching for levels 4-9: a match is only emitted if the match
+ * starting at the next byte is not longer. */
+static deflate_block_state deflate_slow(z_stream *strm, deflate_state *state, int flush) {
+	for (;;) {
+		if (state->lookahead < DEFLATE_MIN_LOOKAHEAD) {
+			fill_window(strm, state);
+			if (state->lookahead < DEFLATE_MIN_LOOKAHEAD && flush == Z_NO_FLUSH) {
+				return DEFLATE_NEED_MORE;
+			}
+			if (state->lookahead == 0) break;
+		}
+
+		uint32_t hash_head = DEFLATE_NIL;
+		if (state->lookahead >= DEFLATE_MIN_MATCH) {
+			hash_head = insert_string(state, state->strstart);
+		}
+
+		state->prev_length = state->match_length;
+		state->prev_match = state->match_start;
+		state->match_length = DEFLATE_MIN_MATCH - 1;
+
+		if (hash_head != DEFLATE_NIL && state->prev_length < state->max_lazy_match &&
+				state->strstart - hash_head <= state->w_size - DEFLATE_MIN_LOOKAHEAD) {
+			state->match_length = find_longest_match(state, hash_head);
+			if (state->match_length == DEFLATE_MIN_MATCH &&
+					state->strstart - state->match_start > DEFLATE_TOO_FAR) {
+				/* A distant length-3 match costs more than three literals */
+				state->match_length = DEFLATE_MIN_MATCH - 1;
+			}
+		}
+
+		if (state->prev_length >= DEFLATE_MIN_MATCH && state->match_length <= state->prev_length) {
+			/* The previous match is better: emit it */
+			uint32_t max_insert = state->strstart + state->lookahead - DEFLATE_MIN_MATCH;
+			int bflush = tally_match(state, state->strstart - 1 - state->prev_match, state->prev_length);
+			state->lookahead -= state->prev_length - 1;
+			state->prev_length -= 2;
+			do {
+				if (++state->strstart <= max_insert) {
+					insert_string(state, state->strstart);
+				}
+			} while (--state->prev_length != 0);
+			state->match_available = 0;
+			state->match_length = DEFLATE_MIN_MATCH - 1;
+			state->strstart++;
+			if (bflush) FLUSH_BLOCK(strm, state, 0);
+		} else if (state->match_available) {
+			/* No better match: emit the pending literal and keep looking */
+			int bflush = tally_literal(state, state->window[state->strstart - 1]);
+			if (bflush) {
+				flush_block(state, 0);
+				flush_pending(strm, state);
+			}
+			state->strstart++;
+			state->lookahead--;
+			if (strm->avail_out == 0) return DEFLATE_NEED_MORE;
+		} else {
+			state->match_available = 1;
+			state->strstart++;
+			state->lookahead--;
+		}
+	}
+	if (state->match_available) {
+		tally_literal(state, state->window[state->strstart - 1]);
+		state->match_available = 0;
+	}
+	if (flush == Z_FINISH) {
+		FLUSH_BLOCK(strm, state, 1);
+		return DEFLATE_FINISH_DONE;
+	}
+	if (state->sym_next) FLUSH_BLOCK(strm, state, 0);
+	return DEFLATE_BLOCK_DONE;
 }
 
 /* ----------- Main encoder API functions ----------- */
@@ -202,9 +849,15 @@ int deflateInit2(z_stream *strm, int level, int method, int windowBits,
 	if (abs_windowBits < 8 || abs_windowBits > 15) {
 		return Z_STREAM_ERROR;
 	}
+	if (abs_windowBits == 8) {
+		abs_windowBits = 9; /* a 256-byte window cannot hold MIN_LOOKAHEAD */
+	}
 
 	/* Normalize compression level */
 	if (level == Z_DEFAULT_COMPRESSION) level = 6;
+	if (level < 0 || level > 9) {
+		return Z_STREAM_ERROR;
+	}
 
 	/* Allocate state */
 	deflate_state *state = (deflate_state *)calloc(1, sizeof(deflate_state));
@@ -212,33 +865,46 @@ int deflateInit2(z_stream *strm, int level, int method, int windowBits,
 		return Z_MEM_ERROR;
 	}
 
-	/* Calculate window size (2^windowBits) */
-	state->window_size = 1 << abs_windowBits;
-	state->window_mask = state->window_size - 1;
+	/* Calculate window size (2^windowBits); the buffer holds two windows */
+	state->w_size = 1u << abs_windowBits;
+	state->w_mask = state->w_size - 1;
+	state->window_size = 2 * state->w_size;
 
-	/* Allocate sliding window */
-	state->window = (uint8_t *)malloc(state->window_size);
-	if (!state->window) {
-		free(state);
-		return Z_MEM_ERROR;
-	}
+	/* The pending buffer must hold one block: either its raw bytes as
+	 * stored blocks, or a full symbol buffer at the worst fixed-code cost. */
+	state->pending_size = state->window_size + 4 * DEFLATE_LIT_BUFSIZE + 64;
 
-	/* Allocate hash table - size depends on window size */
-	state->hash_size = 1 << (abs_windowBits - 3); /* Smaller than window for memory efficiency */
+	/* Allocate sliding window, hash chains, symbol and output buffers */
+	state->hash_size = 1u << DEFLATE_HASH_BITS;
 	state->hash_mask = state->hash_size - 1;
-	state->hash_table = (uint16_t *)calloc(state->hash_size, sizeof(uint16_t));
-	if (!state->hash_table) {
+	state->hash_shift = 32 - DEFLATE_HASH_BITS;
+	state->window = (uint8_t *)malloc(state->window_size);
+	state->head = (uint16_t *)calloc(state->hash_size, sizeof(uint16_t));
+	state->prev = (uint16_t *)calloc(state->w_size, sizeof(uint16_t));
+	state->l_buf = (uint8_t *)malloc(DEFLATE_LIT_BUFSIZE);
+	state->d_buf = (uint16_t *)malloc(DEFLATE_LIT_BUFSIZE * sizeof(uint16_t));
+	state->pending_buf = (uint8_t *)malloc(state->pending_size);
+	if (!state->window || !state->head || !state->prev ||
+			!state->l_buf || !state->d_buf || !state->pending_buf) {
 		free(state->window);
+		free(state->head);
+		free(state->prev);
+		free(state->l_buf);
+		free(state->d_buf);
+		free(state->pending_buf);
 		free(state);
 		return Z_MEM_ERROR;
 	}
 
 	/* Initialize state */
+	const deflate_config *cfg = &deflate_config_table[level];
 	state->level = level;
-	state->is_last_block = 0;
-	state->window_pos = 0;
-	state->bit_buffer = 0;
-	state->bits_in_buffer = 0;
+	state->good_match = cfg->good_length;
+	state->max_lazy_match = cfg->max_lazy;
+	state->nice_match = cfg->nice_length;
+	state->max_chain_length = cfg->max_chain;
+	state->lazy = cfg->lazy;
+	state->match_length = state->prev_length = DEFLATE_MIN_MATCH - 1;
 
 	/* Initialize Huffman tables */
 	init_fixed_huffman_deflate(state);
@@ -250,278 +916,87 @@ int deflateInit2(z_stream *strm, int level, int method, int windowBits,
 	return Z_OK;
 }
 
+/* Preset dictionary: the last w_size bytes of `dictionary` are placed in
+ * the window as if they had just been compressed, so the first matches can
+ * refer to them. Only valid right after deflateInit2. */
+int deflateSetDictionary(z_stream *strm, const uint8_t *dictionary, uint32_t dictLength) {
+	if (!strm || !strm->state || (!dictionary && dictLength)) {
+		return Z_STREAM_ERROR;
+	}
+	deflate_state *state = (deflate_state *)strm->state;
+	if (strm->total_in != 0 || state->strstart != 0 || state->lookahead != 0) {
+		return Z_STREAM_ERROR;
+	}
+	if (dictLength > state->w_size) {
+		dictionary += dictLength - state->w_size;
+		dictLength = state->w_size;
+	}
+	memcpy(state->window, dictionary, dictLength);
+	for (uint32_t pos = 0; pos + DEFLATE_MIN_MATCH <= dictLength; pos++) {
+		insert_string(state, pos);
+	}
+	state->strstart = dictLength;
+	state->block_start = dictLength;
+	return Z_OK;
+}
+
 int deflate(z_stream *strm, int flush) {
-	if (!strm || !strm->state) {
+	if (!strm || !strm->state || flush < Z_NO_FLUSH || flush > Z_FINISH) {
 		return Z_STREAM_ERROR;
 	}
 	deflate_state *state = (deflate_state *)strm->state;
 
-	/* Check if this is the final block */
-	if (flush == Z_FINISH) {
-		state->is_last_block = 1;
+	/* Hand out output left over from the previous call first */
+	int had_pending = state->pending != 0;
+	flush_pending(strm, state);
+	if (state->pending) {
+		return Z_OK;
+	}
+	if (state->finished) {
+		return Z_STREAM_END;
+	}
+	if (strm->avail_out == 0) {
+		return had_pending ? Z_OK : Z_BUF_ERROR;
 	}
 
-	/* If no compression wanted or very small level, just store uncompressed */
+	deflate_block_state bstate;
 	if (state->level == Z_NO_COMPRESSION) {
-		if (strm->avail_in > 0) {
-			/* Calculate block header size - 3 bits for header + padding to byte boundary */
-			uint32_t header_size = 3;
-			if (header_size % 8 != 0) {
-				header_size = ((header_size / 8) + 1) * 8; /* Round up to next byte */
-			}
-			header_size = header_size / 8; /* Convert to bytes */
-
-			/* Calculate block size - header + length fields + data */
-			uint32_t block_size = header_size + 4 + strm->avail_in;
-
-			/* Check if we have enough output space */
-			if (strm->avail_out < block_size) {
-				return Z_BUF_ERROR;
-			}
-
-			/* Write block header - type 00 (uncompressed) */
-			*strm->next_out++ = state->is_last_block ? 1 : 0; /* Final block bit + type 00 */
-			strm->avail_out--;
-			strm->total_out++;
-
-			/* Pad to byte boundary if needed */
-			for (uint32_t i = 1; i < header_size; i++) {
-				*strm->next_out++ = 0;
-				strm->avail_out--;
-				strm->total_out++;
-			}
-
-			/* Write length and inverted length */
-			uint16_t len = strm->avail_in > 0xFFFF ? 0xFFFF : strm->avail_in;
-			*strm->next_out++ = len & 0xFF;
-			*strm->next_out++ = (len >> 8) & 0xFF;
-			*strm->next_out++ = (~len) & 0xFF;
-			*strm->next_out++ = ((~len) >> 8) & 0xFF;
-			strm->avail_out -= 4;
-			strm->total_out += 4;
-
-			/* Write data */
-			memcpy(strm->next_out, strm->next_in, len);
-			strm->next_in += len;
-			strm->avail_in -= len;
-			strm->total_in += len;
-			strm->next_out += len;
-			strm->avail_out -= len;
-			strm->total_out += len;
-		}
-		return flush == Z_FINISH ? Z_STREAM_END : Z_OK;
+		bstate = deflate_stored(strm, state, flush);
+	} else if (state->lazy) {
+		bstate = deflate_slow(strm, state, flush);
+	} else {
+		bstate = deflate_fast(strm, state, flush);
 	}
 
-	/* Use fixed Huffman codes for simplicity */
-	if (strm->avail_in > 0) {
-		/* Write block header - type 01 (fixed Huffman) */
-		int ret = write_bits(strm, state, state->is_last_block ? 1 : 0, 1); /* Final block bit */
-		if (ret != Z_OK) return ret;
-
-		ret = write_bits(strm, state, 1, 2); /* Block type 01 */
-		if (ret != Z_OK) return ret;
-
-		/* Process all input data */
-		while (strm->avail_in > 0) {
-			/* Ensure we have output space for a worst-case symbol */
-			if (strm->avail_out < 4) { /* Conservative estimate */
-				return Z_BUF_ERROR;
-			}
-
-			/* Look for a match */
-			uint32_t match_pos = 0;
-			uint32_t max_look_ahead = strm->avail_in > 258 ? 258 : strm->avail_in;
-			uint32_t match_len = 0;
-
-			/* Skip match search for level < 3 or not enough data */
-			if (state->level >= 3 && max_look_ahead >= 3) {
-				match_len = find_longest_match(state, strm->next_in, state->window_pos,
-						max_look_ahead, &match_pos);
+	if (bstate == DEFLATE_FINISH_DONE) {
+		state->finished = 1;
+	} else if (bstate == DEFLATE_BLOCK_DONE && flush != Z_NO_FLUSH && flush != Z_FINISH) {
+		if (flush == Z_PARTIAL_FLUSH) {
+			/* Empty fixed block: EOB code only */
+			write_bits(state, 1 << 1, 3);
+			write_bits(state, state->literals.codes[DEFLATE_END_BLOCK],
+					state->literals.lengths[DEFLATE_END_BLOCK]);
+			/* Hand out complete bytes only; the stream stays unaligned */
+			while (state->bits_in_buffer >= 8) {
+				state->pending_buf[state->pending++] = (uint8_t)state->bit_buffer;
+				state->bit_buffer >>= 8;
+				state->bits_in_buffer -= 8;
 			}
-
-			if (match_len >= 3) {
-				/* Encode length/distance pair */
-
-				/* Determine length code */
-				uint16_t length_code;
-				uint8_t extra_bits;
-
-				/* Calculate length code and extra bits more efficiently */
-				if (match_len <= 10) {
-					length_code = 257 + (match_len - 3);
-					extra_bits = 0;
-				} else if (match_len <= 34) {
-					/* Use binary search for mid-range */
-					if (match_len <= 18) {
-						length_code = 265 + ((match_len - 11) >> 1);
-						extra_bits = 1;
-					} else {
-						length_code = 269 + ((match_len - 19) >> 2);
-						extra_bits = 2;
-					}
-				} else if (match_len <= 130) {
-					if (match_len <= 66) {
-						length_code = 273 + ((match_len - 35) >> 3);
-						extra_bits = 3;
-					} else {
-						length_code = 277 + ((match_len - 67) >> 4);
-						extra_bits = 4;
-					}
-				} else {
-					length_code = 281 + ((match_len - 131) >> 5);
-					extra_bits = 5;
-				}
-
-				/* Write length code */
-				write_huffman_code (strm, state,
-						state->literals.codes[length_code],
-						state->literals.lengths[length_code]);
-
-				/* Write extra bits for length if needed */
-				if (extra_bits > 0) {
-					/* Calculate extra bits value - it's just the remainder when dividing by 2^extra_bits */
-                int extra_value = (match_len - (
-                                                extra_bits == 1 ? 11 :
-                                                extra_bits == 2 ? 19 :
-                                                extra_bits == 3 ? 35 :
-                                                extra_bits == 4 ? 67 : 131
-                                        )) & ((1 << extra_bits) - 1);
-					write_bits(strm, state, extra_value, extra_bits);
-				}
-
-				/* Calculate distance */
-				uint32_t distance = state->window_pos - match_pos;
-
-				/* Determine distance code */
-				uint16_t distance_code;
-				uint8_t dist_extra_bits;
-
-				/* Calculate distance code and extra bits - simplify with binary search */
-				if (distance <= 4) {
-					distance_code = distance - 1;
-					dist_extra_bits = 0;
-				} else if (distance <= 256) {
-					/* Use binary search for common case */
-					if (distance <= 32) {
-						if (distance <= 16) {
-							if (distance <= 8) {
-								distance_code = 4 + ((distance - 5) >> 1);
-								dist_extra_bits = 1;
-							} else {
-								distance_code = 6 + ((distance - 9) >> 2);
-								dist_extra_bits = 2;
-							}
-						} else {
-							distance_code = 8 + ((distance - 17) >> 3);
-							dist_extra_bits = 3;
-						}
-					} else if (distance <= 128) {
-						if (distance <= 64) {
-							distance_code = 10 + ((distance - 33) >> 4);
-							dist_extra_bits = 4;
-						} else {
-							distance_code = 12 + ((distance - 65) >> 5);
-							dist_extra_bits = 5;
-						}
-					} else {
-						distance_code = 14 + ((distance - 129) >> 6);
-						dist_extra_bits = 6;
-					}
-				} else {
-					/* Calculate for larger distances */
-					if (distance <= 4096) {
-						if (distance <= 1024) {
-							if (distance <= 512) {
-								distance_code = 16 + ((distance - 257) >> 7);
-								dist_extra_bits = 7;
-							} else {
-								distance_code = 18 + ((distance - 513) >> 8);
-								dist_extra_bits = 8;
-							}
-						} else if (distance <= 2048) {
-							distance_code = 20 + ((distance - 1025) >> 9);
-							dist_extra_bits = 9;
-						} else {
-							distance_code = 22 + ((distance - 2049) >> 10);
-							dist_extra_bits = 10;
-						}
-					} else {
-						if (distance <= 16384) {
-							if (distance <= 8192) {
-								distance_code = 24 + ((distance - 4097) >> 11);
-								dist_extra_bits = 11;
-							} else {
-								distance_code = 26 + ((distance - 8193) >> 12);
-								dist_extra_bits = 12;
-							}
-						} else {
-							distance_code = 28 + ((distance - 16385) >> 13);
-							dist_extra_bits = 13;
-						}
-					}
-				}
-
-				/* Write distance code */
-				write_huffman_code (strm, state,
-						state->distances.codes[distance_code],
-						state->distances.lengths[distance_code]);
-
-				/* Write extra bits for distance if needed */
-				if (dist_extra_bits > 0) {
-					/* Calculate base distance value based on distance code */
-					const uint16_t dist_base_values[] = {1, 5, 9, 17, 33, 65, 129, 257, 513, 1025, 2049, 4097, 8193, 16385};
-					uint16_t base_dist = dist_extra_bits > 0 ? dist_base_values[dist_extra_bits] : 1;
-					
-					/* Get remainder by masking with appropriate bit mask */
-					int extra_value = (distance - base_dist) & ((1 << dist_extra_bits) - 1);
-					write_bits(strm, state, extra_value, dist_extra_bits);
-				}
-
-				/* Update input position and window */
-				for (uint32_t i = 0; i < match_len; i++) {
-					/* Add to sliding window */
-					state->window[state->window_pos] = *strm->next_in;
-					state->window_pos = (state->window_pos + 1) & state->window_mask;
-
-					/* Update input position */
-					strm->next_in++;
-					strm->avail_in--;
-					strm->total_in++;
-
-					/* If we've used all input, we're done */
-					if (strm->avail_in == 0) break;
-				}
-			} else {
-				/* No match, output literal */
-				uint8_t literal = *strm->next_in;
-
-				/* Write literal code */
-				write_huffman_code(strm, state,
-						state->literals.codes[literal],
-						state->literals.lengths[literal]);
-
-				/* Update input position and window */
-				state->window[state->window_pos] = literal;
-				state->window_pos = (state->window_pos + 1) & state->window_mask;
-
-				strm->next_in++;
-				strm->avail_in--;
-				strm->total_in++;
+		} else {
+			/* Sync marker: empty stored block, byte aligned */
+			emit_stored_blocks(state, NULL, 0, 0);
+			if (flush == Z_FULL_FLUSH) {
+				/* Later data must not reference anything before this point */
+				memset(state->head, 0, state->hash_size * sizeof(uint16_t));
 			}
 		}
-
-		/* If this is the end of stream, write end of block marker */
-		if (flush == Z_FINISH) {
-			/* Write end of block symbol (256) */
-			write_huffman_code (strm, state,
-					state->literals.codes[256],
-					state->literals.lengths[256]);
-			/* Flush remaining bits */
-			flush_bits (strm, state);
-		}
 	}
+	flush_pending(strm, state);
 
-	return flush == Z_FINISH ? Z_STREAM_END : Z_OK;
+	if (state->finished) {
+		return state->pending ? Z_OK : Z_STREAM_END;
+	}
+	return Z_OK;
 }
 
 int deflateEnd(z_stream *strm) {
@@ -533,7 +1008,11 @@ int deflateEnd(z_stream *strm) {
 
 	/* Free all allocated memory */
 	free (state->window);
-	free (state->hash_table);
+	free (state->head);
+	free (state->prev);
+	free (state->l_buf);
+	free (state->d_buf);
+	free (state->pending_buf);
 	free (state);
 
 	strm->state = NULL;
@@ -7,13 +7,15 @@
  *   inflate
  *   inflateEnd
  *   deflateInit2
+ *   deflateSetDictionary
  *   deflate
  *   deflateEnd
  *
  * It supports:
  * - Raw inflate/deflate (RFC 1951) with no wrappers
  * - Bare minimum functionality to support ZIP file reading/writing
- * - No checksums, dictionaries, or other advanced features
+ * - Preset dictionaries on the deflate side (for block-parallel compression)
+ * - No checksums or other advanced features
  *
  * Usage:
  *   #define MDEFLATE_IMPLEMENTATION in one source file before including
@@ -99,6 +101,7 @@ extern "C" {
 			int memLevel, int strategy);
 	int deflateInit2_(z_stream *strm, int level, int method, int windowBits,
 			int memLevel, int strategy, const char *version, int stream_size);
+	int deflateSetDictionary(z_stream *strm, const uint8_t *dictionary, uint32_t dictLength);
 	int deflate(z_stream *strm, int flush);
 	int deflateEnd(z_stream *strm);
 
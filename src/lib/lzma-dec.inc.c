@@ -1,5 +1,5 @@
 /* lzma-dec.inc.c - Minimalistic LZMA decoder implementation compatible with zlib-like API
- * Version: 0.1 (2025-07-27)
+ * Version: 0.2 (2025-07-27)
  *
  * This implementation provides LZMA decoder with zlib-compatible wrappers:
  *
@@ -8,12 +8,15 @@
  *   lzmaDecompressEnd
  *
  * It supports:
- * - Basic LZMA decompression
- * - Bare minimum functionality to support ZIP file reading
+ * - LZMA1 streams behind the ZIP method 14 header, as written by 7-Zip,
+ *   Python's zipfile or lzma-enc.inc.c, any lc/lp/pb and dictionary size
+ * - Streams ending with the end marker or simply at the end of the input
+ * - Input and output in pieces of any size; output goes straight to the
+ *   caller's buffer until it stops holding the whole entry
  * - Compatible interface with existing compression implementations
  *
  * Usage:
- *   #define MLZMA_IMPLEMENTATION in one source file before including
+ *   #define MZIP_ENABLE_LZMA and include lzma.inc.c
  *
  * License: MIT / 0-BSD - do whatever you want; attribution appreciated.
  */
@@ -46,31 +49,54 @@
 #define Z_FINISH        4
 
 /* LZMA-specific constants */
-#define LZMA_MAGIC         0x5D
-#define LZMA_HEADER_SIZE   13      /* LZMA properties + size field */
-#define LZMA_PROPS_SIZE    5       /* LZMA properties size */
+#define LZMA_RC_INIT_SIZE  5       /* range decoder start: a zero and the code */
+#define LZMA_REQUIRED_INPUT_MAX 20 /* most input one symbol can take */
 
 /* ------------- Data Structures ------------- */
 
 /* Unified z_stream declaration */
 #include "zstream.h"
 
+/* Decoding stages of lzmaDecompress */
+enum {
+    LZMA_D_HEADER,
+    LZMA_D_RC_INIT,
+    LZMA_D_DATA,
+    LZMA_D_DONE
+};
+
 /* LZMA decompression context */
 typedef struct {
-    uint8_t properties[LZMA_PROPS_SIZE];
-    uint64_t uncompressed_size;
-    uint8_t *dict_buffer;
-    size_t dict_size;
+    int stage;
+    uint8_t header[LZMA_HEADER_SIZE];
+    size_t header_len;
+
+    /* Properties */
+    uint32_t lc, lp, pb;
+    uint32_t dict_size;
+
+    /* Range decoder and model */
+    uint32_t range;
+    uint32_t code;
+    lzma_model model;
+    lzma_prob *literal;
+
+    /* LZ state */
+    uint32_t state;
+    uint32_t rep[4];
+    uint32_t rem_len;       /* bytes of the last match still to copy */
+    uint64_t produced;      /* bytes decoded so far */
+
+    /* The start of a symbol that straddles two calls */
+    uint8_t tmp[LZMA_REQUIRED_INPUT_MAX];
+    size_t tmp_len;
+
+    /* Circular history, once output leaves the caller's buffer */
+    int windowed;
     uint8_t *window_buffer;
     size_t window_size;
     size_t window_pos;
-    uint32_t current_block_size;
-    int current_block_remaining;
-    int is_last_block;
-
-    /* Work buffers */
-    uint8_t *decompress_buffer;
-    size_t decompress_buffer_size;
+    size_t window_out;      /* bytes up to here are handed out */
 } lzma_decompress_context;
 
 /* ------------- Function Prototypes ------------- */
@@ -97,69 +123,560 @@ extern "C" {
 /* ------------- Implementation ------------- */
 #ifdef MZIP_ENABLE_LZMA
 
-/* --- Helper Functions --- */
-
-/* Simple decompression for our LZMA block */
-static int simple_lzma_decompress(const uint8_t *props,
-                                 const uint8_t *src, size_t src_size,
-                                 uint8_t *dst, size_t dst_capacity) {
-    if (!props || !src || !dst || src_size == 0) {
-        return 0;  /* Invalid inputs */
-    }
-    
-    /* We don't actually use the props in this simplified version */
-    (void)props;
-    
-    size_t dst_pos = 0;
-    size_t src_pos = 0;
-    
-    while (src_pos < src_size) {
-        if (src_pos + 2 >= src_size) {
-            return 0;  /* Invalid compressed data */
+/* --- Range decoder --- */
+
+/* Each bit is followed by the renormalization, as on the encoder side, so
+ * that after the last symbol all input is consumed */
+typedef struct {
+    uint32_t range;
+    uint32_t code;
+    const uint8_t *in;
+} lzma_rc_dec;
+
+static void lzma_rc_norm(lzma_rc_dec *rc) {
+    if (rc->range < LZMA_TOP) {
+        rc->range <<= 8;
+        rc->code = rc->code << 8 | *rc->in++;
+    }
+}
+
+static uint32_t lzma_rc_bit(lzma_rc_dec *rc, lzma_prob *p) {
+    uint32_t bound = (rc->range >> LZMA_PROB_BITS) * *p, bit;
+    if (rc->code < bound) {
+        rc->range = bound;
+        *p += ((1 << LZMA_PROB_BITS) - *p) >> LZMA_MOVE_BITS;
+        bit = 0;
+    } else {
+        rc->range -= bound;
+        rc->code -= bound;
+        *p -= *p >> LZMA_MOVE_BITS;
+        bit = 1;
+    }
+    lzma_rc_norm(rc);
+    return bit;
+}
+
+static uint32_t lzma_rc_tree(lzma_rc_dec *rc, lzma_prob *probs, uint32_t bits) {
+    uint32_t m = 1;
+    for (uint32_t i = 0; i < bits; i++) {
+        m = m << 1 | lzma_rc_bit(rc, probs + m);
+    }
+    return m - (1u << bits);
+}
+
+static uint32_t lzma_rc_tree_rev(lzma_rc_dec *rc, lzma_prob *probs, uint32_t bits) {
+    uint32_t m = 1, sym = 0;
+    for (uint32_t i = 0; i < bits; i++) {
+        uint32_t bit = lzma_rc_bit(rc, probs + m);
+        m = m << 1 | bit;
+        sym |= bit << i;
+    }
+    return sym;
+}
+
+static uint32_t lzma_rc_direct(lzma_rc_dec *rc, uint32_t bits) {
+    uint32_t v = 0;
+    while (bits--) {
+        rc->range >>= 1;
+        uint32_t bit = rc->code >= rc->range;
+        rc->code -= rc->range & (0u - bit);
+        v = v << 1 | bit;
+        lzma_rc_norm(rc);
+    }
+    return v;
+}
+
+static uint32_t lzma_dec_len(lzma_rc_dec *rc, lzma_len_probs *lp, uint32_t pos_state) {
+    if (!lzma_rc_bit(rc, &lp->choice)) {
+        return lzma_rc_tree(rc, lp->low[pos_state], 3);
+    }
+    if (!lzma_rc_bit(rc, &lp->choice2)) {
+        return LZMA_LEN_LOW + lzma_rc_tree(rc, lp->mid[pos_state], 3);
+    }
+    return LZMA_LEN_LOW + LZMA_LEN_MID + lzma_rc_tree(rc, lp->high, 8);
+}
+
+/* Literal probabilities for the byte after prev */
+static lzma_prob *lzma_dec_lit_probs(const lzma_decompress_context *ctx, uint32_t prev) {
+    uint32_t pos = (uint32_t)ctx->produced & ((1u << ctx->lp) - 1);
+    return ctx->literal + LZMA_LIT_SIZE * ((pos << ctx->lc) + (prev >> (8 - ctx->lc)));
+}
+
+/* Byte dist + 1 back from pos, the history wrapping at cap */
+static uint32_t lzma_dec_byte_at(const uint8_t *buf, size_t pos, size_t cap, uint32_t dist) {
+    return buf[pos > dist ? pos - dist - 1 : pos + cap - dist - 1];
+}
+
+/* Copy len bytes of the match at rep[0], as many as fit before limit */
+static void lzma_dec_copy(lzma_decompress_context *ctx, uint8_t *buf, size_t *ppos, size_t limit, size_t cap, uint32_t len) {
+    size_t pos = *ppos, dist = ctx->rep[0];
+    size_t src = pos > dist ? pos - dist - 1 : pos + cap - dist - 1;
+    size_t n = len < limit - pos ? len : limit - pos;
+
+    ctx->rem_len = len - (uint32_t)n;
+    ctx->produced += n;
+    if (src + n <= cap && (dist >= n || dist == 0)) {
+        if (dist == 0) {
+            memset(buf + pos, buf[src], n);
+        } else {
+            memcpy(buf + pos, buf + src, n);
         }
-        
-        uint8_t marker = src[src_pos++];
-        
-        if (marker == 0x00) {
-            /* RLE run */
-            uint8_t byte = src[src_pos++];
-            uint8_t length = src[src_pos++];
-            
-            /* Check output capacity */
-            if (dst_pos + length > dst_capacity) {
-                return 0;  /* Output overflow */
+        pos += n;
+    } else {
+        while (n--) {
+            buf[pos++] = buf[src++];
+            if (src == cap) {
+                src = 0;
             }
-            
-            /* Output run */
-            memset(dst + dst_pos, byte, length);
-            dst_pos += length;
-        } else if (marker == 0x01) {
-            /* Literal sequence */
-            uint8_t length = src[src_pos++];
-            
-            if (src_pos + length > src_size || dst_pos + length > dst_capacity) {
-                return 0;  /* Invalid input or output overflow */
+        }
+    }
+    *ppos = pos;
+}
+
+/* --- Symbol decoder --- */
+
+/* Decode symbols to buf[*ppos, limit), whose history wraps at cap, until
+ * the output is full or fewer than LZMA_REQUIRED_INPUT_MAX bytes of input
+ * are left; only one symbol when one is set. Returns 1 after the end
+ * marker, -1 if corrupt, else 0 */
+static int lzma_dec_run(lzma_decompress_context *ctx, const uint8_t **pin, const uint8_t *in_end,
+                        uint8_t *buf, size_t *ppos, size_t limit, size_t cap, int one) {
+    lzma_model *m = &ctx->model;
+    lzma_rc_dec rc = { ctx->range, ctx->code, *pin };
+    uint32_t *rep = ctx->rep, state = ctx->state, pb_mask = (1u << ctx->pb) - 1;
+    size_t pos = *ppos;
+    int ret = 0;
+
+    do {
+        uint32_t pos_state = (uint32_t)ctx->produced & pb_mask, len;
+        if (!lzma_rc_bit(&rc, &m->is_match[state][pos_state])) {
+            lzma_prob *probs = lzma_dec_lit_probs(ctx, ctx->produced ? buf[(pos ? pos : cap) - 1] : 0);
+            uint32_t sym = 1;
+            if (state < 7) {
+                do {
+                    sym = sym << 1 | lzma_rc_bit(&rc, probs + sym);
+                } while (sym < 0x100);
+            } else {
+                /* the byte at rep0 steers until the first differing bit */
+                uint32_t match_byte = lzma_dec_byte_at(buf, pos, cap, rep[0]), offs = 0x100;
+                do {
+                    match_byte <<= 1;
+                    uint32_t mb = match_byte & offs, bit = lzma_rc_bit(&rc, probs + offs + mb + sym);
+                    sym = sym << 1 | bit;
+                    offs &= bit ? mb : ~mb;
+                } while (sym < 0x100);
+            }
+            buf[pos++] = (uint8_t)sym;
+            ctx->produced++;
+            state = lzma_lit_next[state];
+            continue;
+        }
+        if (lzma_rc_bit(&rc, &m->is_rep[state])) {
+            if (!lzma_rc_bit(&rc, &m->is_rep_g0[state])) {
+                if (!lzma_rc_bit(&rc, &m->is_rep0_long[state][pos_state])) {
+                    /* short rep: one byte from rep0 */
+                    if (rep[0] >= ctx->produced) {
+                        ret = -1;
+                        break;
+                    }
+                    buf[pos] = (uint8_t)lzma_dec_byte_at(buf, pos, cap, rep[0]);
+                    pos++;
+                    ctx->produced++;
+                    state = LZMA_SHORTREP_NEXT(state);
+                    continue;
+                }
+            } else {
+                uint32_t dist;
+                if (!lzma_rc_bit(&rc, &m->is_rep_g1[state])) {
+                    dist = rep[1];
+                } else {
+                    if (!lzma_rc_bit(&rc, &m->is_rep_g2[state])) {
+                        dist = rep[2];
+                    } else {
+                        dist = rep[3];
+                        rep[3] = rep[2];
+                    }
+                    rep[2] = rep[1];
+                }
+                rep[1] = rep[0];
+                rep[0] = dist;
             }
-            
-            /* Copy literals */
-            memcpy(dst + dst_pos, src + src_pos, length);
-            dst_pos += length;
-            src_pos += length;
+            len = lzma_dec_len(&rc, &m->rep_len, pos_state);
+            state = LZMA_REP_NEXT(state);
         } else {
-            return 0;  /* Invalid marker */
+            rep[3] = rep[2];
+            rep[2] = rep[1];
+            rep[1] = rep[0];
+            len = lzma_dec_len(&rc, &m->len, pos_state);
+            state = LZMA_MATCH_NEXT(state);
+            uint32_t slot = lzma_rc_tree(&rc, m->dist_slot[LZMA_DIST_STATE(len + LZMA_MATCH_MIN)], 6), dist = slot;
+            if (slot >= LZMA_START_DIST_MODEL) {
+                uint32_t footer = (slot >> 1) - 1;
+                dist = (2 | (slot & 1)) << footer;
+                if (slot < LZMA_END_DIST_MODEL) {
+                    dist += lzma_rc_tree_rev(&rc, m->dist_special + dist - slot - 1, footer);
+                } else {
+                    dist += lzma_rc_direct(&rc, footer - LZMA_ALIGN_BITS) << LZMA_ALIGN_BITS;
+                    dist += lzma_rc_tree_rev(&rc, m->align, LZMA_ALIGN_BITS);
+                }
+            }
+            rep[0] = dist;
+            if (dist == LZMA_END_MARKER) {
+                ret = 1;
+                break;
+            }
+        }
+        if (rep[0] >= ctx->produced || rep[0] >= cap) {
+            ret = -1;
+            break;
         }
+        lzma_dec_copy(ctx, buf, &pos, limit, cap, len + LZMA_MATCH_MIN);
+    } while (!one && pos < limit && in_end - rc.in >= LZMA_REQUIRED_INPUT_MAX);
+
+    ctx->range = rc.range;
+    ctx->code = rc.code;
+    ctx->state = state;
+    *pin = rc.in;
+    *ppos = pos;
+    return ret;
+}
+
+/* --- Dry run --- */
+
+/* Outcome of decoding the next symbol without committing to it */
+enum {
+    LZMA_DRY_NEED_INPUT,
+    LZMA_DRY_OUTPUT,        /* a literal or a match */
+    LZMA_DRY_END            /* the end marker */
+};
+
+typedef struct {
+    uint32_t range;
+    uint32_t code;
+    const uint8_t *in;
+    const uint8_t *end;
+} lzma_rc_dry;
+
+/* lzma_rc_bit leaving the probability alone; -1 when out of input */
+static int lzma_dry_bit(lzma_rc_dry *rc, const lzma_prob *p) {
+    uint32_t bound = (rc->range >> LZMA_PROB_BITS) * *p;
+    int bit = rc->code >= bound;
+    if (bit) {
+        rc->range -= bound;
+        rc->code -= bound;
+    } else {
+        rc->range = bound;
+    }
+    if (rc->range < LZMA_TOP) {
+        if (rc->in == rc->end) {
+            return -1;
+        }
+        rc->range <<= 8;
+        rc->code = rc->code << 8 | *rc->in++;
     }
-    
-    return dst_pos;  /* Return decompressed size */
+    return bit;
 }
 
-/* Read 64-bit little endian integer */
-static uint64_t read_uint64_le(const uint8_t *p) {
-    uint64_t value = 0;
-    for (int i = 0; i < 8; i++) {
-        value |= ((uint64_t)p[i]) << (i * 8);
+static int lzma_dry_tree(lzma_rc_dry *rc, const lzma_prob *probs, uint32_t bits, int reverse, uint32_t *sym) {
+    uint32_t m = 1, v = 0;
+    for (uint32_t i = 0; i < bits; i++) {
+        int bit = lzma_dry_bit(rc, probs + m);
+        if (bit < 0) {
+            return -1;
+        }
+        m = m << 1 | (uint32_t)bit;
+        v |= (uint32_t)bit << i;
+    }
+    *sym = reverse ? v : m - (1u << bits);
+    return 0;
+}
+
+static int lzma_dry_len(lzma_rc_dry *rc, const lzma_len_probs *lp, uint32_t pos_state, uint32_t *len) {
+    int c = lzma_dry_bit(rc, &lp->choice), c2 = 0;
+    if (c > 0) {
+        c2 = lzma_dry_bit(rc, &lp->choice2);
+    }
+    if (c < 0 || c2 < 0) {
+        return -1;
+    }
+    const lzma_prob *probs = !c ? lp->low[pos_state] : !c2 ? lp->mid[pos_state] : lp->high;
+    if (lzma_dry_tree(rc, probs, c2 ? 8 : 3, 0, len) != 0) {
+        return -1;
+    }
+    *len += !c ? 0 : !c2 ? LZMA_LEN_LOW : LZMA_LEN_LOW + LZMA_LEN_MID;
+    return 0;
+}
+
+/* Decode the next symbol from in[0, n) on copies of the coder state, to
+ * learn whether the input holds all of it and whether it is the end
+ * marker; prev and match_byte are the bytes 1 and rep0 + 1 back */
+static int lzma_dry_run(const lzma_decompress_context *ctx, const uint8_t *in, size_t n,
+                        uint32_t prev, uint32_t match_byte) {
+    const lzma_model *m = &ctx->model;
+    lzma_rc_dry rc = { ctx->range, ctx->code, in, in + n };
+    uint32_t state = ctx->state, pos_state = (uint32_t)ctx->produced & ((1u << ctx->pb) - 1), v;
+    int bit;
+
+    if ((bit = lzma_dry_bit(&rc, &m->is_match[state][pos_state])) < 0) {
+        return LZMA_DRY_NEED_INPUT;
+    }
+    if (!bit) {
+        const lzma_prob *probs = lzma_dec_lit_probs(ctx, prev);
+        uint32_t sym = 1, offs = 0x100;
+        do {
+            uint32_t mb = 0;
+            if (state >= 7) {
+                match_byte <<= 1;
+                mb = match_byte & offs;
+            }
+            if ((bit = lzma_dry_bit(&rc, probs + (state >= 7 ? offs + mb : 0) + sym)) < 0) {
+                return LZMA_DRY_NEED_INPUT;
+            }
+            sym = sym << 1 | (uint32_t)bit;
+            offs &= bit ? mb : ~mb;
+        } while (sym < 0x100);
+        return LZMA_DRY_OUTPUT;
+    }
+    if ((bit = lzma_dry_bit(&rc, &m->is_rep[state])) < 0) {
+        return LZMA_DRY_NEED_INPUT;
+    }
+    if (bit) {
+        if ((bit = lzma_dry_bit(&rc, &m->is_rep_g0[state])) < 0) {
+            return LZMA_DRY_NEED_INPUT;
+        }
+        const lzma_prob *p = !bit ? &m->is_rep0_long[state][pos_state] : &m->is_rep_g1[state];
+        int bit2 = lzma_dry_bit(&rc, p);
+        if (bit2 < 0 || (bit && bit2 && lzma_dry_bit(&rc, &m->is_rep_g2[state]) < 0)) {
+            return LZMA_DRY_NEED_INPUT;
+        }
+        if (!bit && !bit2) {
+            return LZMA_DRY_OUTPUT; /* short rep */
+        }
+        return lzma_dry_len(&rc, &m->rep_len, pos_state, &v) ? LZMA_DRY_NEED_INPUT : LZMA_DRY_OUTPUT;
+    }
+    uint32_t slot, dist;
+    if (lzma_dry_len(&rc, &m->len, pos_state, &v) != 0
+            || lzma_dry_tree(&rc, m->dist_slot[LZMA_DIST_STATE(v + LZMA_MATCH_MIN)], 6, 0, &slot) != 0) {
+        return LZMA_DRY_NEED_INPUT;
+    }
+    dist = slot;
+    if (slot >= LZMA_START_DIST_MODEL) {
+        uint32_t footer = (slot >> 1) - 1;
+        dist = (2 | (slot & 1)) << footer;
+        if (slot < LZMA_END_DIST_MODEL) {
+            if (lzma_dry_tree(&rc, m->dist_special + dist - slot - 1, footer, 1, &v) != 0) {
+                return LZMA_DRY_NEED_INPUT;
+            }
+            dist += v;
+        } else {
+            for (uint32_t i = footer - LZMA_ALIGN_BITS; i-- > 0;) {
+                rc.range >>= 1;
+                bit = rc.code >= rc.range;
+                rc.code -= rc.range & (0u - (uint32_t)bit);
+                dist += (uint32_t)bit << (i + LZMA_ALIGN_BITS);
+                if (rc.range < LZMA_TOP) {
+                    if (rc.in == rc.end) {
+                        return LZMA_DRY_NEED_INPUT;
+                    }
+                    rc.range <<= 8;
+                    rc.code = rc.code << 8 | *rc.in++;
+                }
+            }
+            if (lzma_dry_tree(&rc, m->align, LZMA_ALIGN_BITS, 1, &v) != 0) {
+                return LZMA_DRY_NEED_INPUT;
+            }
+            dist += v;
+        }
+    }
+    return dist == LZMA_END_MARKER ? LZMA_DRY_END : LZMA_DRY_OUTPUT;
+}
+
+/* --- Stream --- */
+
+/* Gather n bytes into dst across calls; nonzero once all are there */
+static int lzma_gather(z_stream *strm, uint8_t *dst, size_t *len, size_t n) {
+    size_t take = n - *len;
+    if (take > strm->avail_in) {
+        take = strm->avail_in;
+    }
+    memcpy(dst + *len, strm->next_in, take);
+    *len += take;
+    strm->next_in += take;
+    strm->avail_in -= (uint32_t)take;
+    strm->total_in += (uint32_t)take;
+    return *len == n;
+}
+
+static int lzma_read_header(lzma_decompress_context *ctx) {
+    const uint8_t *h = ctx->header;
+    if ((h[2] | h[3] << 8) != LZMA_PROPS_SIZE
+            || lzma_props_decode(h[4], &ctx->lc, &ctx->lp, &ctx->pb) != 0) {
+        return Z_DATA_ERROR;
+    }
+    ctx->dict_size = (uint32_t)h[5] | (uint32_t)h[6] << 8 | (uint32_t)h[7] << 16 | (uint32_t)h[8] << 24;
+    ctx->window_size = ctx->dict_size > LZMA_DICT_MIN ? ctx->dict_size : LZMA_DICT_MIN;
+    ctx->literal = (lzma_prob *)malloc(((size_t)LZMA_LIT_SIZE << (ctx->lc + ctx->lp)) * sizeof(lzma_prob));
+    if (!ctx->literal) {
+        return Z_MEM_ERROR;
+    }
+    lzma_model_init(&ctx->model, ctx->literal, ctx->lc, ctx->lp);
+    return Z_OK;
+}
+
+/* Move history out of the caller's buffer, which the next call may not
+ * hand back, into our own window */
+static int lzma_to_window(lzma_decompress_context *ctx, const uint8_t *hist_end) {
+    ctx->window_buffer = (uint8_t *)malloc(ctx->window_size);
+    if (!ctx->window_buffer) {
+        return -1;
+    }
+    size_t keep = ctx->produced < ctx->window_size ? (size_t)ctx->produced : ctx->window_size;
+    memcpy(ctx->window_buffer, hist_end - keep, keep);
+    ctx->window_pos = ctx->window_out = keep;
+    ctx->windowed = 1;
+    return 0;
+}
+
+/* One round of data decoding; LZMA_D_DATA means call again */
+static int lzma_decode_data(lzma_decompress_context *ctx, z_stream *strm, int flush) {
+    uint8_t *buf;
+    size_t pos, limit, cap;
+
+    if (ctx->windowed) {
+        /* everything before window_pos is handed out by now */
+        buf = ctx->window_buffer;
+        pos = ctx->window_pos;
+        cap = ctx->window_size;
+        limit = cap - pos < strm->avail_out ? cap : pos + (strm->avail_out ? strm->avail_out : 1);
+    } else {
+        buf = strm->next_out - ctx->produced;
+        pos = (size_t)ctx->produced;
+        cap = SIZE_MAX;
+        limit = pos + strm->avail_out;
+    }
+    size_t start = pos;
+    int ret = 0;
+
+    if (ctx->rem_len) {
+        if (pos == limit) {
+            return Z_OK;
+        }
+        lzma_dec_copy(ctx, buf, &pos, limit, cap, ctx->rem_len);
+    } else {
+        /* a symbol may start in tmp and end in the next input */
+        const uint8_t *in = strm->next_in;
+        size_t n = strm->avail_in;
+        if (ctx->tmp_len || n < LZMA_REQUIRED_INPUT_MAX) {
+            lzma_gather(strm, ctx->tmp, &ctx->tmp_len, LZMA_REQUIRED_INPUT_MAX);
+            in = ctx->tmp;
+            n = ctx->tmp_len;
+        }
+        if (!n) {
+            if (flush != Z_FINISH) {
+                return Z_OK;
+            }
+            /* Without an end marker the data stops with the input, once
+             * the symbols still held in the code are out */
+            if (ctx->code == 0) {
+                ctx->stage = LZMA_D_DONE;
+                return LZMA_D_DATA;
+            }
+        }
+        int one = n < LZMA_REQUIRED_INPUT_MAX || pos == limit;
+        if (one) {
+            uint32_t prev = ctx->produced ? buf[(pos ? pos : cap) - 1] : 0;
+            uint32_t match_byte = ctx->rep[0] < ctx->produced ? lzma_dec_byte_at(buf, pos, cap, ctx->rep[0]) : 0;
+            int dry = lzma_dry_run(ctx, in, n, prev, match_byte);
+            if (dry == LZMA_DRY_NEED_INPUT) {
+                return flush == Z_FINISH && pos < limit ? Z_DATA_ERROR : Z_OK;
+            }
+            if (dry != LZMA_DRY_END && pos == limit) {
+                return Z_OK;
+            }
+        }
+        const uint8_t *p = in;
+        ret = lzma_dec_run(ctx, &p, in + n, buf, &pos, limit, cap, one);
+        size_t used = (size_t)(p - in);
+        if (in == ctx->tmp) {
+            memmove(ctx->tmp, ctx->tmp + used, ctx->tmp_len - used);
+            ctx->tmp_len -= used;
+        } else {
+            strm->next_in += used;
+            strm->avail_in -= (uint32_t)used;
+            strm->total_in += (uint32_t)used;
+        }
+    }
+
+    if (ctx->windowed) {
+        ctx->window_pos = pos;
+    } else {
+        strm->next_out += pos - start;
+        strm->avail_out -= (uint32_t)(pos - start);
+        strm->total_out += (uint32_t)(pos - start);
+    }
+    if (ret < 0 || (ret > 0 && ctx->code != 0)) {
+        return Z_DATA_ERROR;
+    }
+    if (ret > 0) {
+        ctx->stage = LZMA_D_DONE;
+    }
+    return LZMA_D_DATA;
+}
+
+static int lzma_decode(lzma_decompress_context *ctx, z_stream *strm, int flush) {
+    for (;;) {
+        /* Hand out what the window holds first */
+        if (ctx->windowed) {
+            size_t n = ctx->window_pos - ctx->window_out;
+            if (n > strm->avail_out) {
+                n = strm->avail_out;
+            }
+            memcpy(strm->next_out, ctx->window_buffer + ctx->window_out, n);
+            strm->next_out += n;
+            strm->avail_out -= (uint32_t)n;
+            strm->total_out += (uint32_t)n;
+            ctx->window_out += n;
+            if (ctx->window_out < ctx->window_pos) {
+                return Z_OK;
+            }
+            if (ctx->window_pos == ctx->window_size) {
+                ctx->window_pos = ctx->window_out = 0;
+            }
+        }
+
+        int ret;
+        switch (ctx->stage) {
+        case LZMA_D_HEADER:
+            if (!lzma_gather(strm, ctx->header, &ctx->header_len, LZMA_HEADER_SIZE)) {
+                return Z_OK;
+            }
+            if ((ret = lzma_read_header(ctx)) != Z_OK) {
+                return ret;
+            }
+            ctx->stage = LZMA_D_RC_INIT;
+            break;
+        case LZMA_D_RC_INIT:
+            if (!lzma_gather(strm, ctx->tmp, &ctx->tmp_len, LZMA_RC_INIT_SIZE)) {
+                return Z_OK;
+            }
+            if (ctx->tmp[0] != 0) {
+                return Z_DATA_ERROR;
+            }
+            ctx->code = (uint32_t)ctx->tmp[1] << 24 | (uint32_t)ctx->tmp[2] << 16
+                | (uint32_t)ctx->tmp[3] << 8 | ctx->tmp[4];
+            ctx->range = 0xFFFFFFFFu;
+            ctx->tmp_len = 0;
+            ctx->stage = LZMA_D_DATA;
+            break;
+        case LZMA_D_DATA:
+            if ((ret = lzma_decode_data(ctx, strm, flush)) != LZMA_D_DATA) {
+                return ret;
+            }
+            break;
+        default:
+            return Z_STREAM_END;
+        }
     }
-    return value;
 }
 
 /* --- LZMA API Implementation --- */
@@ -167,156 +684,55 @@ static uint64_t read_uint64_le(const uint8_t *p) {
 /* Initialize a decompression stream */
 int lzmaDecompressInit(z_stream *strm) {
     if (!strm) return Z_STREAM_ERROR;
-    
-    /* Allocate decompression context */
+
+    /* Allocate decompression context; the probabilities wait for the
+     * properties and the window for output that comes in pieces */
     lzma_decompress_context *ctx = (lzma_decompress_context *)calloc(1, sizeof(lzma_decompress_context));
     if (!ctx) return Z_MEM_ERROR;
-    
-    /* Initialize context with default values */
-    ctx->window_size = 1 << 16;  /* 64KB window by default */
-    ctx->is_last_block = 0;
-    ctx->uncompressed_size = 0;
-    
-    /* Allocate window buffer */
-    ctx->window_buffer = (uint8_t *)malloc(ctx->window_size);
-    if (!ctx->window_buffer) {
-        free(ctx);
-        return Z_MEM_ERROR;
-    }
-    
-    /* Allocate decompression buffer */
-    ctx->decompress_buffer_size = ctx->window_size;
-    ctx->decompress_buffer = (uint8_t *)malloc(ctx->decompress_buffer_size);
-    if (!ctx->decompress_buffer) {
-        free(ctx->window_buffer);
-        free(ctx);
-        return Z_MEM_ERROR;
-    }
-    
+
     /* Initialize stream */
     strm->state = (void *)ctx;
     strm->total_in = 0;
     strm->total_out = 0;
-    
+
     return Z_OK;
 }
 
 /* Decompress data using LZMA format */
 int lzmaDecompress(z_stream *strm, int flush) {
     if (!strm || !strm->state) return Z_STREAM_ERROR;
-    
+
     lzma_decompress_context *ctx = (lzma_decompress_context *)strm->state;
-    
-    /* Process LZMA header if this is the first call */
-    if (strm->total_in == 0) {
-        /* Need at least the LZMA header */
-        if (strm->avail_in < LZMA_HEADER_SIZE) {
-            return Z_BUF_ERROR;
-        }
-        
-        /* Read LZMA properties */
-        memcpy(ctx->properties, strm->next_in, LZMA_PROPS_SIZE);
-        
-        /* Read uncompressed size */
-        ctx->uncompressed_size = read_uint64_le(strm->next_in + LZMA_PROPS_SIZE);
-        
-        /* Skip header */
-        strm->next_in += LZMA_HEADER_SIZE;
-        strm->avail_in -= LZMA_HEADER_SIZE;
-        strm->total_in += LZMA_HEADER_SIZE;
-    }
-    
-    /* If we have remaining data from a previous block, output it first */
-    if (ctx->current_block_remaining > 0) {
-        size_t copy_size = ctx->current_block_remaining;
-        if (copy_size > strm->avail_out) {
-            copy_size = strm->avail_out;
-        }
-        
-        /* Copy data to output */
-        memcpy(strm->next_out, 
-               ctx->decompress_buffer + (ctx->current_block_size - ctx->current_block_remaining),
-               copy_size);
-        
-        /* Update counters */
-        strm->next_out += copy_size;
-        strm->avail_out -= copy_size;
-        strm->total_out += copy_size;
-        ctx->current_block_remaining -= copy_size;
-        
-        /* If we filled the output buffer, return for more space */
-        if (strm->avail_out == 0) {
-            return Z_OK;
-        }
+    uint32_t avail_in = strm->avail_in, avail_out = strm->avail_out;
+    int ret = lzma_decode(ctx, strm, flush);
+    if (ret != Z_OK) {
+        return ret;
     }
-    
-    /* Process more input if available */
-    if (strm->avail_in > 0) {
-        /* Try to decompress what we have */
-        size_t decomp_size = simple_lzma_decompress(ctx->properties,
-                                                   strm->next_in, strm->avail_in,
-                                                   ctx->decompress_buffer,
-                                                   ctx->decompress_buffer_size);
-        
-        /* If decompression failed, return error */
-        if (decomp_size == 0) {
-            return Z_DATA_ERROR;
-        }
-        
-        /* Update input counters */
-        strm->next_in += strm->avail_in;
-        strm->total_in += strm->avail_in;
-        strm->avail_in = 0;
-        
-        /* Check if we have enough output space */
-        if (strm->avail_out >= decomp_size) {
-            /* Copy all data to output */
-            memcpy(strm->next_out, ctx->decompress_buffer, decomp_size);
-            strm->next_out += decomp_size;
-            strm->avail_out -= decomp_size;
-            strm->total_out += decomp_size;
-        } else {
-            /* Store partial data for later */
-            memcpy(strm->next_out, ctx->decompress_buffer, strm->avail_out);
-            ctx->current_block_size = decomp_size;
-            ctx->current_block_remaining = decomp_size - strm->avail_out;
-            strm->total_out += strm->avail_out;
-            strm->next_out += strm->avail_out;
-            strm->avail_out = 0;
-            return Z_OK;
-        }
+    /* Output written straight to the caller's buffer is history the
+     * next call cannot rely on */
+    if (!ctx->windowed && ctx->produced > 0 && lzma_to_window(ctx, strm->next_out) != 0) {
+        return Z_MEM_ERROR;
     }
-    
-    /* Determine if we're finished */
-    if (ctx->uncompressed_size != 0xFFFFFFFFFFFFFFFF) {
-        /* Known size - check if we've output everything */
-        if (strm->total_out >= ctx->uncompressed_size) {
-            return Z_STREAM_END;
-        }
-    } else {
-        /* Unknown size - check if flush is FINISH and no more input */
-        if (flush == Z_FINISH && strm->avail_in == 0) {
-            return Z_STREAM_END;
-        }
+    if (strm->avail_in == avail_in && strm->avail_out == avail_out) {
+        return Z_BUF_ERROR;
     }
-    
     return Z_OK;
 }
 
 /* End a decompression stream */
 int lzmaDecompressEnd(z_stream *strm) {
     if (!strm || !strm->state) return Z_STREAM_ERROR;
-    
+
     lzma_decompress_context *ctx = (lzma_decompress_context *)strm->state;
-    
+
     /* Free allocated buffers */
+    free(ctx->literal);
     free(ctx->window_buffer);
-    free(ctx->decompress_buffer);
-    
+
     /* Free context */
     free(ctx);
     strm->state = NULL;
-    
+
     return Z_OK;
 }
 
@@ -1,5 +1,5 @@
 /* lzma-enc.inc.c - Minimalistic LZMA encoder implementation compatible with zlib-like API
- * Version: 0.1 (2025-07-27)
+ * Version: 0.2 (2025-07-27)
  *
  * This implementation provides LZMA encoder with zlib-compatible wrappers:
  *
@@ -8,12 +8,17 @@
  *   lzmaEnd
  *
  * It supports:
- * - Basic LZMA compression
- * - Bare minimum functionality to support ZIP file writing
+ * - LZMA1 (lc=3 lp=0 pb=2) behind the ZIP method 14 header, ending with
+ *   the end marker as 7-Zip writes it
+ * - Hash-chain match finder with a per-level dictionary of up to 32 MiB,
+ *   shrunk to the input size when all of it arrives in the first call
+ * - Greedy/lazy parsing for levels 0-1 and price-based optimal parsing
+ *   over literals, matches and the four repeat distances for 2-9
+ * - Input and output in pieces of any size
  * - Compatible interface with existing compression implementations
  *
  * Usage:
- *   #define MLZMA_IMPLEMENTATION in one source file before including
+ *   #define MZIP_ENABLE_LZMA and include lzma.inc.c
  *
  * License: MIT / 0-BSD - do whatever you want; attribution appreciated.
  */
@@ -55,30 +60,105 @@
 #define Z_DEFAULT_COMPRESSION (-1)
 
 /* LZMA-specific constants */
-#define LZMA_MAGIC         0x5D
-#define LZMA_HEADER_SIZE   13      /* LZMA properties + size field */
-#define LZMA_PROPS_SIZE    5       /* LZMA properties size */
 #define LZMA_DEFAULT_LEVEL 5       /* Default compression level */
+#define LZMA_LC            3       /* literal context: high bits of the previous byte */
+#define LZMA_LP            0
+#define LZMA_PB            2       /* position bits for matches */
+#define LZMA_MAX_LEVEL     9
+#define LZMA_OPTS          4096    /* positions the optimal parser looks ahead */
+#define LZMA_LOOKAHEAD     (LZMA_OPTS + LZMA_MATCH_MAX)
+#define LZMA_PRICE_REFRESH 64      /* matches between price table updates */
+#define LZMA_OUT_CHUNK     (1 << 16)
+#define LZMA_INFINITY      (1u << 30)
 
 /* ------------- Data Structures ------------- */
 
 /* Unified z_stream declaration */
 #include "zstream.h"
 
+/* Matches found at one position, longer ones further away */
+typedef struct {
+    uint32_t len;
+    uint32_t dist;          /* distance - 1, as coded */
+} lzma_match;
+
+/* One step of the parse: a literal, a rep or a match */
+typedef struct {
+    uint32_t len;
+    int32_t back;           /* -1 literal, 0-3 rep, else distance + 4 */
+} lzma_step;
+
+/* Optimal parser node: the cheapest way found to reach this position */
+typedef struct {
+    uint32_t price;
+    uint32_t prev;          /* position the last step starts from */
+    int32_t back;           /* -1 literal, 0-3 rep, else distance + 4 */
+    uint32_t state;
+    uint32_t reps[4];
+} lzma_opt;
+
 /* LZMA compression context */
 typedef struct {
     int compression_level;
-    uint8_t properties[LZMA_PROPS_SIZE];
-    uint8_t *dict_buffer;
-    size_t dict_size;
+    int started;            /* header emitted */
+    int finished;           /* range coder flushed */
+    int known;              /* all input came with the first call */
+    int oom;
+    uint32_t dict_size;
+    uint32_t nice_len;
+    uint32_t depth;
+    int optimal;
+
+    /* Input history: matches reach back at most dict_size bytes */
     uint8_t *window_buffer;
     size_t window_size;
-    size_t window_pos;
-    int is_last_block;
+    size_t window_cap;
+    size_t window_len;
+    size_t pos;             /* first byte not encoded yet */
+    size_t next_insert;     /* first position not in the hash chains yet */
+    uint64_t base;          /* bytes slid out of the window */
+
+    /* Hash chain match finder, positions stored + 1 so that 0 is empty */
+    uint32_t *head2;
+    uint32_t *head3;
+    uint32_t *head4;
+    uint32_t *chain_table;
+    uint32_t hash_log;
+    uint32_t chain_mask;
+    lzma_match matches[LZMA_MATCH_MAX + 1];
+    uint32_t n_matches;
+    int cached;             /* matches hold the search at pos already */
 
-    /* Work buffers */
+    /* Range encoder and model */
+    uint64_t low;
+    uint32_t range;
+    uint8_t cache;
+    uint64_t cache_size;
+    lzma_model model;
+    lzma_prob literal[LZMA_LIT_SIZE << (LZMA_LC + LZMA_LP)];
+    uint32_t state;
+    uint32_t reps[4];
+
+    /* Prices, in 1/16 bit */
+    uint32_t bit_prices[(1 << LZMA_PROB_BITS) >> 4];
+    uint32_t len_prices[LZMA_MATCH_MAX - 1][1 << LZMA_POS_BITS_MAX];
+    uint32_t rep_len_prices[LZMA_MATCH_MAX - 1][1 << LZMA_POS_BITS_MAX];
+    uint32_t slot_prices[LZMA_DIST_STATES][LZMA_DIST_SLOTS];
+    uint32_t dist_prices[LZMA_DIST_STATES][LZMA_FULL_DISTANCES];
+    uint32_t align_prices[1 << LZMA_ALIGN_BITS];
+    uint32_t match_count;   /* matches since the last price update */
+
+    /* Optimal parse, and the steps of it not encoded yet */
+    lzma_opt *opt;
+    lzma_step *path;
+    uint32_t path_len;
+    uint32_t path_pos;
+
+    /* Encoded bytes not handed to the caller yet */
     uint8_t *compress_buffer;
     size_t compress_buffer_size;
+    size_t out_len;
+    size_t out_pos;
 } lzma_compress_context;
 
 /* ------------- Function Prototypes ------------- */
@@ -107,62 +187,859 @@ extern "C" {
 /* ------------- Implementation ------------- */
 #ifdef MZIP_ENABLE_LZMA
 
-/* --- Helper Functions --- */
-
-/* Simple Byte-by-byte LZ compression for LZMA blocks */
-static int simple_lzma_compress(const uint8_t *src, size_t src_size,
-                               uint8_t *dst, size_t dst_capacity,
-                               uint8_t *props) {
-    /* This is a very simplified compression that just does basic RLE-like compression */
-    if (src_size == 0 || !src || !dst || dst_capacity < LZMA_HEADER_SIZE + src_size) {
-        return 0;  /* Invalid input or not enough output capacity */
-    }
-
-    (void)props;
-
-    /* For this minimal implementation, we'll do very simple RLE compression */
-    size_t dst_pos = 0;
-    size_t src_pos = 0;
-    
-    while (src_pos < src_size) {
-        /* Check remaining output space */
-        if (dst_pos + 4 > dst_capacity) {
-            return 0;  /* Not enough space */
-        }
-
-        /* Find runs of identical bytes */
-        uint8_t run_byte = src[src_pos];
-        size_t run_length = 1;
-        
-        while (src_pos + run_length < src_size && 
-               src[src_pos + run_length] == run_byte && 
-               run_length < 255) {
-            run_length++;
-        }
-        
-        if (run_length >= 4) {
-            /* Encode run */
-            dst[dst_pos++] = 0x00;        /* RLE marker */
-            dst[dst_pos++] = run_byte;    /* Repeated byte */
-            dst[dst_pos++] = run_length;  /* Length */
-            src_pos += run_length;
+/* --- Compression: parameters --- */
+
+static const struct lzma_level {
+    uint8_t dict_log;
+    uint8_t hash_log;
+    uint8_t chain_log;
+    uint8_t optimal;    /* price every parse instead of the greedy rules */
+    uint16_t depth;     /* chain entries visited per search */
+    uint16_t nice;      /* stop searching at this length */
+} lzma_levels[LZMA_MAX_LEVEL + 1] = {
+    { 16, 15, 16, 0, 4, 16 },
+    { 18, 16, 17, 0, 8, 32 },
+    { 20, 17, 18, 0, 16, 48 },
+    { 21, 18, 19, 0, 24, 64 },
+    { 22, 18, 20, 1, 16, 32 },
+    { 23, 19, 21, 1, 32, 64 },
+    { 23, 20, 22, 1, 48, 96 },
+    { 24, 20, 22, 1, 64, 128 },
+    { 25, 21, 23, 1, 128, 192 },
+    { 25, 21, 24, 1, 256, 273 },
+};
+
+/* --- Compression: range encoder --- */
+
+static void lzma_rc_put(lzma_compress_context *ctx, uint8_t b) {
+    if (ctx->out_len == ctx->compress_buffer_size) {
+        size_t size = 2 * ctx->compress_buffer_size;
+        uint8_t *p = (uint8_t *)realloc(ctx->compress_buffer, size);
+        if (!p) {
+            ctx->oom = 1;
+            return;
+        }
+        ctx->compress_buffer = p;
+        ctx->compress_buffer_size = size;
+    }
+    ctx->compress_buffer[ctx->out_len++] = b;
+}
+
+/* Emit the top byte of low, holding back 0xFF bytes a carry may still
+ * turn into zeros */
+static void lzma_rc_shift_low(lzma_compress_context *ctx) {
+    if ((uint32_t)ctx->low < 0xFF000000u || (ctx->low >> 32) != 0) {
+        uint8_t carry = (uint8_t)(ctx->low >> 32), b = ctx->cache;
+        do {
+            lzma_rc_put(ctx, (uint8_t)(b + carry));
+            b = 0xFF;
+        } while (--ctx->cache_size != 0);
+        ctx->cache = (uint8_t)(ctx->low >> 24);
+    }
+    ctx->cache_size++;
+    ctx->low = (ctx->low & 0x00FFFFFFu) << 8;
+}
+
+static void lzma_rc_enc_bit(lzma_compress_context *ctx, lzma_prob *p, uint32_t bit) {
+    uint32_t bound = (ctx->range >> LZMA_PROB_BITS) * *p;
+    if (!bit) {
+        ctx->range = bound;
+        *p += ((1 << LZMA_PROB_BITS) - *p) >> LZMA_MOVE_BITS;
+    } else {
+        ctx->low += bound;
+        ctx->range -= bound;
+        *p -= *p >> LZMA_MOVE_BITS;
+    }
+    if (ctx->range < LZMA_TOP) {
+        ctx->range <<= 8;
+        lzma_rc_shift_low(ctx);
+    }
+}
+
+static void lzma_rc_enc_tree(lzma_compress_context *ctx, lzma_prob *probs, uint32_t bits, uint32_t sym) {
+    uint32_t m = 1;
+    while (bits--) {
+        uint32_t bit = (sym >> bits) & 1;
+        lzma_rc_enc_bit(ctx, probs + m, bit);
+        m = m << 1 | bit;
+    }
+}
+
+static void lzma_rc_enc_tree_rev(lzma_compress_context *ctx, lzma_prob *probs, uint32_t bits, uint32_t sym) {
+    uint32_t m = 1;
+    while (bits--) {
+        uint32_t bit = sym & 1;
+        sym >>= 1;
+        lzma_rc_enc_bit(ctx, probs + m, bit);
+        m = m << 1 | bit;
+    }
+}
+
+static void lzma_rc_enc_direct(lzma_compress_context *ctx, uint32_t v, uint32_t bits) {
+    while (bits--) {
+        ctx->range >>= 1;
+        ctx->low += ctx->range & (0u - ((v >> bits) & 1));
+        if (ctx->range < LZMA_TOP) {
+            ctx->range <<= 8;
+            lzma_rc_shift_low(ctx);
+        }
+    }
+}
+
+/* --- Compression: prices --- */
+
+/* Cost of coding bit with probability p, in 1/16 bit */
+static uint32_t lzma_price(const lzma_compress_context *ctx, lzma_prob p, uint32_t bit) {
+    return ctx->bit_prices[(p ^ ((0u - bit) & ((1 << LZMA_PROB_BITS) - 1))) >> 4];
+}
+
+/* -log2 of each probability bucket, by repeated squaring */
+static void lzma_init_bit_prices(uint32_t *prices) {
+    for (uint32_t i = 0; i < (1 << LZMA_PROB_BITS) >> 4; i++) {
+        uint32_t w = (i << 4) + (1 << 3), bits = 0;
+        for (int j = 0; j < 4; j++) {
+            w *= w;
+            bits <<= 1;
+            while (w >= (1u << 16)) {
+                w >>= 1;
+                bits++;
+            }
+        }
+        prices[i] = (LZMA_PROB_BITS << 4) - 15 - bits;
+    }
+}
+
+static uint32_t lzma_tree_price(const lzma_compress_context *ctx, const lzma_prob *probs, uint32_t bits, uint32_t sym) {
+    uint32_t price = 0, m = 1;
+    while (bits--) {
+        uint32_t bit = (sym >> bits) & 1;
+        price += lzma_price(ctx, probs[m], bit);
+        m = m << 1 | bit;
+    }
+    return price;
+}
+
+static uint32_t lzma_tree_rev_price(const lzma_compress_context *ctx, const lzma_prob *probs, uint32_t bits, uint32_t sym) {
+    uint32_t price = 0, m = 1;
+    while (bits--) {
+        uint32_t bit = sym & 1;
+        sym >>= 1;
+        price += lzma_price(ctx, probs[m], bit);
+        m = m << 1 | bit;
+    }
+    return price;
+}
+
+/* Literal c after prev; past a match the byte at rep0 steers the coder */
+static uint32_t lzma_lit_price(const lzma_compress_context *ctx, uint32_t prev, int matched,
+                               uint32_t match_byte, uint32_t c) {
+    const lzma_prob *probs = ctx->literal + LZMA_LIT_SIZE * (prev >> (8 - LZMA_LC));
+    uint32_t price = 0, sym = 1, offs = 0x100;
+    for (int i = 7; i >= 0; i--) {
+        uint32_t bit = (c >> i) & 1, mb = 0;
+        if (matched) {
+            match_byte <<= 1;
+            mb = match_byte & offs;
+        }
+        price += lzma_price(ctx, probs[(matched ? offs + mb : 0) + sym], bit);
+        sym = sym << 1 | bit;
+        offs &= bit ? mb : ~mb;
+    }
+    return price;
+}
+
+static void lzma_len_prices(const lzma_compress_context *ctx, const lzma_len_probs *lp,
+                            uint32_t prices[][1 << LZMA_POS_BITS_MAX]) {
+    uint32_t c0 = lzma_price(ctx, lp->choice, 0), c1 = lzma_price(ctx, lp->choice, 1);
+    uint32_t c10 = c1 + lzma_price(ctx, lp->choice2, 0), c11 = c1 + lzma_price(ctx, lp->choice2, 1);
+    for (uint32_t ps = 0; ps < 1u << LZMA_PB; ps++) {
+        for (uint32_t i = 0; i < LZMA_MATCH_MAX - 1; i++) {
+            prices[i][ps] = i < LZMA_LEN_LOW ? c0 + lzma_tree_price(ctx, lp->low[ps], 3, i)
+                : i < LZMA_LEN_LOW + LZMA_LEN_MID ? c10 + lzma_tree_price(ctx, lp->mid[ps], 3, i - LZMA_LEN_LOW)
+                : c11 + lzma_tree_price(ctx, lp->high, 8, i - LZMA_LEN_LOW - LZMA_LEN_MID);
+        }
+    }
+}
+
+static void lzma_dist_prices(lzma_compress_context *ctx) {
+    const lzma_model *m = &ctx->model;
+    for (uint32_t ds = 0; ds < LZMA_DIST_STATES; ds++) {
+        for (uint32_t slot = 0; slot < LZMA_DIST_SLOTS; slot++) {
+            uint32_t price = lzma_tree_price(ctx, m->dist_slot[ds], 6, slot);
+            if (slot >= LZMA_END_DIST_MODEL) {
+                price += ((slot >> 1) - 1 - LZMA_ALIGN_BITS) << 4;
+            }
+            ctx->slot_prices[ds][slot] = price;
+        }
+        for (uint32_t dist = 0; dist < LZMA_FULL_DISTANCES; dist++) {
+            uint32_t slot = lzma_dist_slot(dist), price = ctx->slot_prices[ds][slot];
+            if (slot >= LZMA_START_DIST_MODEL) {
+                uint32_t footer = (slot >> 1) - 1, base = (2 | (slot & 1)) << footer;
+                price += lzma_tree_rev_price(ctx, m->dist_special + base - slot - 1, footer, dist - base);
+            }
+            ctx->dist_prices[ds][dist] = price;
+        }
+    }
+    for (uint32_t i = 0; i < 1 << LZMA_ALIGN_BITS; i++) {
+        ctx->align_prices[i] = lzma_tree_rev_price(ctx, m->align, LZMA_ALIGN_BITS, i);
+    }
+}
+
+static void lzma_update_prices(lzma_compress_context *ctx) {
+    lzma_len_prices(ctx, &ctx->model.len, ctx->len_prices);
+    lzma_len_prices(ctx, &ctx->model.rep_len, ctx->rep_len_prices);
+    lzma_dist_prices(ctx);
+    ctx->match_count = 0;
+}
+
+/* Length and distance of a new match */
+static uint32_t lzma_match_price(const lzma_compress_context *ctx, uint32_t dist, uint32_t len, uint32_t pos_state) {
+    uint32_t ds = LZMA_DIST_STATE(len), price = ctx->len_prices[len - LZMA_MATCH_MIN][pos_state];
+    if (dist < LZMA_FULL_DISTANCES) {
+        return price + ctx->dist_prices[ds][dist];
+    }
+    return price + ctx->slot_prices[ds][lzma_dist_slot(dist)] + ctx->align_prices[dist & ((1 << LZMA_ALIGN_BITS) - 1)];
+}
+
+/* Choosing rep (0-3) for a match of two bytes or more */
+static uint32_t lzma_rep_price(const lzma_compress_context *ctx, uint32_t rep, uint32_t state, uint32_t pos_state) {
+    const lzma_model *m = &ctx->model;
+    if (!rep) {
+        return lzma_price(ctx, m->is_rep_g0[state], 0) + lzma_price(ctx, m->is_rep0_long[state][pos_state], 1);
+    }
+    uint32_t price = lzma_price(ctx, m->is_rep_g0[state], 1);
+    if (rep == 1) {
+        return price + lzma_price(ctx, m->is_rep_g1[state], 0);
+    }
+    return price + lzma_price(ctx, m->is_rep_g1[state], 1) + lzma_price(ctx, m->is_rep_g2[state], rep - 2);
+}
+
+static uint32_t lzma_shortrep_price(const lzma_compress_context *ctx, uint32_t state, uint32_t pos_state) {
+    const lzma_model *m = &ctx->model;
+    return lzma_price(ctx, m->is_rep_g0[state], 0) + lzma_price(ctx, m->is_rep0_long[state][pos_state], 0);
+}
+
+/* --- Compression: match finder --- */
+
+#define LZMA_HASH3(v)      ((((v) & 0xFFFFFFu) * 506832829u) >> 16)
+#define LZMA_HASH4(v, log) (((v) * 2654435761u) >> (32 - (log)))
+
+static uint32_t lzma_read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t lzma_count(const uint8_t *a, const uint8_t *b, size_t limit) {
+    size_t n = 0;
+    while (n + 8 <= limit) {
+        uint64_t x, y;
+        memcpy(&x, a + n, 8);
+        memcpy(&y, b + n, 8);
+        if (x != y) {
+            break;
+        }
+        n += 8;
+    }
+    while (n < limit && a[n] == b[n]) {
+        n++;
+    }
+    return (uint32_t)n;
+}
+
+/* Put the positions before end in the hash chains; the last three of
+ * the input never start a match */
+static void lzma_insert(lzma_compress_context *ctx, size_t end) {
+    size_t last = ctx->window_len > 3 ? ctx->window_len - 3 : 0;
+    for (size_t i = ctx->next_insert; i < end && i < last; i++) {
+        uint32_t v = lzma_read32(ctx->window_buffer + i), h4 = LZMA_HASH4(v, ctx->hash_log);
+        ctx->chain_table[i & ctx->chain_mask] = ctx->head4[h4];
+        ctx->head4[h4] = (uint32_t)i + 1;
+        ctx->head3[LZMA_HASH3(v)] = (uint32_t)i + 1;
+        ctx->head2[v & 0xFFFF] = (uint32_t)i + 1;
+    }
+    if (ctx->next_insert < end) {
+        ctx->next_insert = end;
+    }
+}
+
+/* Collect the matches at idx, each longer than the one before, in
+ * ctx->matches; returns their number */
+static uint32_t lzma_find(lzma_compress_context *ctx, size_t idx) {
+    const uint8_t *buf = ctx->window_buffer, *cur = buf + idx;
+    size_t avail = ctx->window_len - idx;
+    uint32_t n = 0, best = 1;
+
+    lzma_insert(ctx, idx);
+    if (avail > LZMA_MATCH_MAX) {
+        avail = LZMA_MATCH_MAX;
+    }
+    if (avail < 4) {
+        ctx->next_insert = idx + 1;
+        return 0;
+    }
+    uint32_t v = lzma_read32(cur);
+    uint32_t near[2] = { ctx->head2[v & 0xFFFF], ctx->head3[LZMA_HASH3(v)] };
+    for (int i = 0; i < 2; i++) {
+        size_t c = near[i];
+        if (!c || idx - c >= ctx->dict_size || (i && c == near[0])) {
+            continue;
+        }
+        uint32_t len = lzma_count(buf + c - 1, cur, avail);
+        if (len > best) {
+            ctx->matches[n].len = best = len;
+            ctx->matches[n++].dist = (uint32_t)(idx - c);
+        }
+    }
+    size_t c = ctx->head4[LZMA_HASH4(v, ctx->hash_log)];
+    for (uint32_t depth = ctx->depth; c && depth && best < avail && best < ctx->nice_len; depth--) {
+        size_t dist = idx - c;
+        if (dist >= ctx->dict_size || dist >= ctx->chain_mask) {
+            break;
+        }
+        const uint8_t *p = buf + c - 1;
+        if (p[best] == cur[best]) {
+            uint32_t len = lzma_count(p, cur, avail);
+            if (len > best) {
+                ctx->matches[n].len = best = len;
+                ctx->matches[n++].dist = (uint32_t)dist;
+            }
+        }
+        size_t next = ctx->chain_table[(c - 1) & ctx->chain_mask];
+        if (next >= c) {
+            break;
+        }
+        c = next;
+    }
+    lzma_insert(ctx, idx + 1);
+    return n;
+}
+
+/* Matches at ctx->pos, searched ahead of time if the parser did */
+static uint32_t lzma_matches_at_pos(lzma_compress_context *ctx) {
+    if (ctx->cached) {
+        ctx->cached = 0;
+        return ctx->n_matches;
+    }
+    return lzma_find(ctx, ctx->pos);
+}
+
+/* Length of the rep match at idx, 0 if under two bytes */
+static uint32_t lzma_rep_len(const lzma_compress_context *ctx, size_t idx, uint32_t rep, size_t avail) {
+    const uint8_t *p = ctx->window_buffer + idx, *s = p - rep - 1;
+    if (rep >= idx || p[0] != s[0] || p[1] != s[1]) {
+        return 0;
+    }
+    return lzma_count(s, p, avail);
+}
+
+/* --- Compression: parsers --- */
+
+#define LZMA_CHANGE_PAIR(small, big) (((big) >> 7) > (small))
+
+/* Greedy choice with one byte of lookahead, for the fast levels */
+static uint32_t lzma_parse_fast(lzma_compress_context *ctx, int32_t *back) {
+    size_t pos = ctx->pos, avail = ctx->window_len - pos;
+    uint32_t n = lzma_matches_at_pos(ctx), rep_len = 0, rep_index = 0;
+    const lzma_match *mt = ctx->matches;
+
+    *back = -1;
+    if (avail > LZMA_MATCH_MAX) {
+        avail = LZMA_MATCH_MAX;
+    }
+    if (avail < 2) {
+        return 1;
+    }
+    for (uint32_t i = 0; i < 4; i++) {
+        uint32_t len = lzma_rep_len(ctx, pos, ctx->reps[i], avail);
+        if (len > rep_len) {
+            rep_len = len;
+            rep_index = i;
+        }
+    }
+    if (rep_len >= ctx->nice_len) {
+        *back = (int32_t)rep_index;
+        return rep_len;
+    }
+    uint32_t main_len = 0, main_dist = 0;
+    if (n) {
+        main_len = mt[n - 1].len;
+        main_dist = mt[n - 1].dist;
+        if (main_len >= ctx->nice_len) {
+            *back = (int32_t)main_dist + 4;
+            return main_len;
+        }
+        /* one byte shorter but much closer is cheaper */
+        while (n > 1 && main_len == mt[n - 2].len + 1 && LZMA_CHANGE_PAIR(mt[n - 2].dist, main_dist)) {
+            n--;
+            main_len = mt[n - 1].len;
+            main_dist = mt[n - 1].dist;
+        }
+        if (main_len == 2 && main_dist >= 0x80) {
+            main_len = 1;
+        }
+    }
+    if (rep_len >= 2 && (rep_len + 1 >= main_len
+            || (rep_len + 2 >= main_len && main_dist >= (1 << 9))
+            || (rep_len + 3 >= main_len && main_dist >= (1 << 15)))) {
+        *back = (int32_t)rep_index;
+        return rep_len;
+    }
+    if (main_len < 2 || avail <= 2) {
+        return 1;
+    }
+
+    /* A better match one byte on makes this a literal */
+    ctx->n_matches = n = lzma_find(ctx, pos + 1);
+    ctx->cached = 1;
+    if (n) {
+        uint32_t new_len = mt[n - 1].len, new_dist = mt[n - 1].dist;
+        if ((new_len >= main_len && new_dist < main_dist)
+                || (new_len == main_len + 1 && !LZMA_CHANGE_PAIR(main_dist, new_dist))
+                || new_len > main_len + 1
+                || (new_len + 1 >= main_len && main_len >= 3 && LZMA_CHANGE_PAIR(new_dist, main_dist))) {
+            return 1;
+        }
+    }
+    uint32_t limit = main_len > 3 ? main_len - 1 : 2;
+    for (uint32_t i = 0; i < 4; i++) {
+        if (lzma_rep_len(ctx, pos + 1, ctx->reps[i], limit) >= limit) {
+            return 1;
+        }
+    }
+    ctx->cached = 0;
+    *back = (int32_t)main_dist + 4;
+    return main_len;
+}
+
+/* Lay out the cheapest way to reach cur in ctx->path */
+static void lzma_backward(lzma_compress_context *ctx, uint32_t cur) {
+    const lzma_opt *opt = ctx->opt;
+    uint32_t n = 0;
+    for (uint32_t i = cur; i > 0; i = opt[i].prev) {
+        n++;
+    }
+    ctx->path_len = n;
+    ctx->path_pos = 0;
+    for (uint32_t i = cur; i > 0; i = opt[i].prev) {
+        n--;
+        ctx->path[n].len = i - opt[i].prev;
+        ctx->path[n].back = opt[i].back;
+    }
+}
+
+/* Offer reaching opt[to] from opt[from] at price */
+static void lzma_try(lzma_opt *opt, uint32_t to, uint32_t price, uint32_t from, int32_t back) {
+    if (price < opt[to].price) {
+        opt[to].price = price;
+        opt[to].prev = from;
+        opt[to].back = back;
+    }
+}
+
+/* State and reps after the last step of the path to opt[cur] */
+static void lzma_opt_state(lzma_opt *opt, uint32_t cur) {
+    lzma_opt *o = &opt[cur];
+    const lzma_opt *from = &opt[o->prev];
+    if (o->back < 0) {
+        o->state = lzma_lit_next[from->state];
+        memcpy(o->reps, from->reps, sizeof(o->reps));
+    } else if (o->back < 4) {
+        uint32_t b = (uint32_t)o->back;
+        o->state = b == 0 && cur - o->prev == 1 ? LZMA_SHORTREP_NEXT(from->state) : LZMA_REP_NEXT(from->state);
+        o->reps[0] = from->reps[b];
+        for (uint32_t j = 1, k = 0; j < 4; k++) {
+            if (k != b) {
+                o->reps[j++] = from->reps[k];
+            }
+        }
+    } else {
+        o->state = LZMA_MATCH_NEXT(from->state);
+        o->reps[0] = (uint32_t)o->back - 4;
+        memcpy(o->reps + 1, from->reps, 3 * sizeof(uint32_t));
+    }
+}
+
+/* Price the ways through the next positions and follow the cheapest,
+ * handing out one step per call */
+static uint32_t lzma_parse_optimal(lzma_compress_context *ctx, int32_t *back) {
+    if (ctx->path_pos < ctx->path_len) {
+        const lzma_step *st = &ctx->path[ctx->path_pos++];
+        *back = st->back;
+        return st->len;
+    }
+
+    const lzma_model *m = &ctx->model;
+    const uint8_t *buf = ctx->window_buffer;
+    lzma_opt *opt = ctx->opt;
+    lzma_match *mt = ctx->matches;
+    size_t pos = ctx->pos, avail = ctx->window_len - pos;
+    uint32_t n = lzma_matches_at_pos(ctx), rep_lens[4], rep_max = 0, state = ctx->state;
+    uint32_t pb_mask = (1u << LZMA_PB) - 1, pos_state = (uint32_t)(ctx->base + pos) & pb_mask;
+
+    *back = -1;
+    if (avail > LZMA_MATCH_MAX) {
+        avail = LZMA_MATCH_MAX;
+    }
+    if (avail < 2) {
+        return 1;
+    }
+    for (uint32_t i = 0; i < 4; i++) {
+        rep_lens[i] = lzma_rep_len(ctx, pos, ctx->reps[i], avail);
+        if (rep_lens[i] > rep_lens[rep_max]) {
+            rep_max = i;
+        }
+    }
+    if (rep_lens[rep_max] >= ctx->nice_len) {
+        *back = (int32_t)rep_max;
+        return rep_lens[rep_max];
+    }
+    uint32_t main_len = n ? mt[n - 1].len : 0;
+    if (main_len >= ctx->nice_len) {
+        *back = (int32_t)mt[n - 1].dist + 4;
+        return main_len;
+    }
+    uint32_t cur_byte = buf[pos], match_byte = ctx->reps[0] < pos ? buf[pos - ctx->reps[0] - 1] : 0;
+    if (main_len < 2 && cur_byte != match_byte && rep_lens[rep_max] < 2) {
+        return 1;
+    }
+
+    /* Steps from the current position */
+    opt[0].state = state;
+    memcpy(opt[0].reps, ctx->reps, sizeof(ctx->reps));
+    opt[1].price = lzma_price(ctx, m->is_match[state][pos_state], 0)
+        + lzma_lit_price(ctx, pos ? buf[pos - 1] : 0, state >= 7, match_byte, cur_byte);
+    opt[1].prev = 0;
+    opt[1].back = -1;
+    uint32_t match_price = lzma_price(ctx, m->is_match[state][pos_state], 1);
+    uint32_t rep_match_price = match_price + lzma_price(ctx, m->is_rep[state], 1);
+    if (match_byte == cur_byte && ctx->reps[0] < pos) {
+        lzma_try(opt, 1, rep_match_price + lzma_shortrep_price(ctx, state, pos_state), 0, 0);
+    }
+    uint32_t len_end = main_len > rep_lens[rep_max] ? main_len : rep_lens[rep_max];
+    if (len_end < 2) {
+        *back = opt[1].back;
+        return 1;
+    }
+    for (uint32_t len = 2; len <= len_end; len++) {
+        opt[len].price = LZMA_INFINITY;
+    }
+    for (uint32_t i = 0; i < 4; i++) {
+        uint32_t price = rep_match_price + lzma_rep_price(ctx, i, state, pos_state);
+        for (uint32_t len = rep_lens[i]; len >= 2; len--) {
+            lzma_try(opt, len, price + ctx->rep_len_prices[len - 2][pos_state], 0, (int32_t)i);
+        }
+    }
+    uint32_t normal_price = match_price + lzma_price(ctx, m->is_rep[state], 0);
+    uint32_t len = rep_lens[0] >= 2 ? rep_lens[0] + 1 : 2;
+    if (len <= main_len) {
+        uint32_t offs = 0;
+        while (len > mt[offs].len) {
+            offs++;
+        }
+        for (;; len++) {
+            uint32_t dist = mt[offs].dist;
+            lzma_try(opt, len, normal_price + lzma_match_price(ctx, dist, len, pos_state), 0, (int32_t)dist + 4);
+            if (len == mt[offs].len && ++offs == n) {
+                break;
+            }
+        }
+    }
+
+    /* Then from every position reached, until none is left to improve
+     * or a long match ends the search */
+    uint32_t cur = 0;
+    for (;;) {
+        if (++cur == len_end) {
+            break;
+        }
+        size_t idx = pos + cur;
+        uint32_t new_len;
+        ctx->n_matches = n = lzma_find(ctx, idx);
+        new_len = n ? mt[n - 1].len : 0;
+        if (new_len >= ctx->nice_len) {
+            ctx->cached = 1;
+            break;
+        }
+        lzma_opt_state(opt, cur);
+        const lzma_opt *o = &opt[cur];
+        uint32_t cur_state = o->state, cur_price = o->price;
+        pos_state = (uint32_t)(ctx->base + idx) & pb_mask;
+        cur_byte = buf[idx];
+        match_byte = o->reps[0] < idx ? buf[idx - o->reps[0] - 1] : 0;
+
+        lzma_try(opt, cur + 1, cur_price + lzma_price(ctx, m->is_match[cur_state][pos_state], 0)
+                 + lzma_lit_price(ctx, buf[idx - 1], cur_state >= 7, match_byte, cur_byte), cur, -1);
+        match_price = cur_price + lzma_price(ctx, m->is_match[cur_state][pos_state], 1);
+        rep_match_price = match_price + lzma_price(ctx, m->is_rep[cur_state], 1);
+        if (match_byte == cur_byte && o->reps[0] < idx && !(opt[cur + 1].prev < cur && opt[cur + 1].back == 0)) {
+            uint32_t price = rep_match_price + lzma_shortrep_price(ctx, cur_state, pos_state);
+            if (price <= opt[cur + 1].price) {
+                opt[cur + 1].price = price;
+                opt[cur + 1].prev = cur;
+                opt[cur + 1].back = 0;
+            }
+        }
+
+        size_t avail_full = ctx->window_len - idx;
+        if (avail_full > LZMA_OPTS - 1 - cur) {
+            avail_full = LZMA_OPTS - 1 - cur;
+        }
+        if (avail_full < 2) {
+            continue;
+        }
+        uint32_t num_avail = avail_full < ctx->nice_len ? (uint32_t)avail_full : ctx->nice_len;
+        uint32_t start_len = 2;
+        for (uint32_t i = 0; i < 4; i++) {
+            uint32_t rep_len = lzma_rep_len(ctx, idx, o->reps[i], num_avail);
+            if (rep_len < 2) {
+                continue;
+            }
+            while (len_end < cur + rep_len) {
+                opt[++len_end].price = LZMA_INFINITY;
+            }
+            uint32_t price = rep_match_price + lzma_rep_price(ctx, i, cur_state, pos_state);
+            for (uint32_t l = rep_len; l >= 2; l--) {
+                lzma_try(opt, cur + l, price + ctx->rep_len_prices[l - 2][pos_state], cur, (int32_t)i);
+            }
+            if (i == 0) {
+                start_len = rep_len + 1;
+            }
+        }
+
+        if (new_len > num_avail) {
+            new_len = num_avail;
+            for (n = 0; mt[n].len < new_len; n++) {
+            }
+            mt[n++].len = new_len;
+        }
+        if (new_len >= start_len) {
+            normal_price = match_price + lzma_price(ctx, m->is_rep[cur_state], 0);
+            while (len_end < cur + new_len) {
+                opt[++len_end].price = LZMA_INFINITY;
+            }
+            uint32_t offs = 0;
+            while (start_len > mt[offs].len) {
+                offs++;
+            }
+            for (uint32_t l = start_len;; l++) {
+                uint32_t dist = mt[offs].dist;
+                lzma_try(opt, cur + l, normal_price + lzma_match_price(ctx, dist, l, pos_state), cur, (int32_t)dist + 4);
+                if (l == mt[offs].len && ++offs == n) {
+                    break;
+                }
+            }
+        }
+    }
+
+    lzma_backward(ctx, cur);
+    return lzma_parse_optimal(ctx, back);
+}
+
+/* --- Compression: symbols --- */
+
+/* Length - 2 */
+static void lzma_enc_len(lzma_compress_context *ctx, lzma_len_probs *lp, uint32_t len, uint32_t pos_state) {
+    if (len < LZMA_LEN_LOW) {
+        lzma_rc_enc_bit(ctx, &lp->choice, 0);
+        lzma_rc_enc_tree(ctx, lp->low[pos_state], 3, len);
+        return;
+    }
+    lzma_rc_enc_bit(ctx, &lp->choice, 1);
+    len -= LZMA_LEN_LOW;
+    if (len < LZMA_LEN_MID) {
+        lzma_rc_enc_bit(ctx, &lp->choice2, 0);
+        lzma_rc_enc_tree(ctx, lp->mid[pos_state], 3, len);
+    } else {
+        lzma_rc_enc_bit(ctx, &lp->choice2, 1);
+        lzma_rc_enc_tree(ctx, lp->high, 8, len - LZMA_LEN_MID);
+    }
+}
+
+/* Length and distance of a new match, after its is_rep bit */
+static void lzma_enc_match(lzma_compress_context *ctx, uint32_t dist, uint32_t len, uint32_t pos_state) {
+    lzma_model *m = &ctx->model;
+    uint32_t slot = lzma_dist_slot(dist), *reps = ctx->reps;
+    lzma_enc_len(ctx, &m->len, len - LZMA_MATCH_MIN, pos_state);
+    lzma_rc_enc_tree(ctx, m->dist_slot[LZMA_DIST_STATE(len)], 6, slot);
+    if (slot >= LZMA_START_DIST_MODEL) {
+        uint32_t footer = (slot >> 1) - 1, base = (2 | (slot & 1)) << footer, rem = dist - base;
+        if (slot < LZMA_END_DIST_MODEL) {
+            lzma_rc_enc_tree_rev(ctx, m->dist_special + base - slot - 1, footer, rem);
+        } else {
+            lzma_rc_enc_direct(ctx, rem >> LZMA_ALIGN_BITS, footer - LZMA_ALIGN_BITS);
+            lzma_rc_enc_tree_rev(ctx, m->align, LZMA_ALIGN_BITS, rem & ((1 << LZMA_ALIGN_BITS) - 1));
+        }
+    }
+    reps[3] = reps[2];
+    reps[2] = reps[1];
+    reps[1] = reps[0];
+    reps[0] = dist;
+}
+
+/* Encode one step of the parse at ctx->pos: a literal (back -1), a rep
+ * of the four last distances or a new match */
+static void lzma_enc_step(lzma_compress_context *ctx, uint32_t len, int32_t back) {
+    lzma_model *m = &ctx->model;
+    const uint8_t *buf = ctx->window_buffer;
+    size_t pos = ctx->pos;
+    uint32_t state = ctx->state, *reps = ctx->reps;
+    uint32_t pos_state = (uint32_t)(ctx->base + pos) & ((1u << LZMA_PB) - 1);
+
+    if (back < 0) {
+        lzma_prob *probs = ctx->literal + LZMA_LIT_SIZE * ((pos ? buf[pos - 1] : 0) >> (8 - LZMA_LC));
+        uint32_t c = buf[pos];
+        lzma_rc_enc_bit(ctx, &m->is_match[state][pos_state], 0);
+        if (state < 7) {
+            lzma_rc_enc_tree(ctx, probs, 8, c);
         } else {
-            /* Literal */
-            dst[dst_pos++] = 0x01;        /* Literal marker */
-            dst[dst_pos++] = run_length;  /* Number of literals */
-            
-            /* Copy literals */
-            if (dst_pos + run_length > dst_capacity) {
-                return 0;  /* Not enough space */
+            uint32_t match_byte = buf[pos - reps[0] - 1], sym = 1, offs = 0x100;
+            for (int i = 7; i >= 0; i--) {
+                uint32_t bit = (c >> i) & 1;
+                match_byte <<= 1;
+                uint32_t mb = match_byte & offs;
+                lzma_rc_enc_bit(ctx, probs + offs + mb + sym, bit);
+                sym = sym << 1 | bit;
+                offs &= bit ? mb : ~mb;
             }
-            
-            memcpy(dst + dst_pos, src + src_pos, run_length);
-            dst_pos += run_length;
-            src_pos += run_length;
+        }
+        ctx->state = lzma_lit_next[state];
+        ctx->pos++;
+        return;
+    }
+
+    lzma_rc_enc_bit(ctx, &m->is_match[state][pos_state], 1);
+    if (back < 4) {
+        lzma_rc_enc_bit(ctx, &m->is_rep[state], 1);
+        if (back == 0) {
+            lzma_rc_enc_bit(ctx, &m->is_rep_g0[state], 0);
+            lzma_rc_enc_bit(ctx, &m->is_rep0_long[state][pos_state], len != 1);
+        } else {
+            uint32_t dist = reps[back];
+            lzma_rc_enc_bit(ctx, &m->is_rep_g0[state], 1);
+            lzma_rc_enc_bit(ctx, &m->is_rep_g1[state], back != 1);
+            if (back > 1) {
+                lzma_rc_enc_bit(ctx, &m->is_rep_g2[state], back == 3);
+                if (back == 3) {
+                    reps[3] = reps[2];
+                }
+                reps[2] = reps[1];
+            }
+            reps[1] = reps[0];
+            reps[0] = dist;
+        }
+        if (len == 1) {
+            state = LZMA_SHORTREP_NEXT(state);
+        } else {
+            lzma_enc_len(ctx, &m->rep_len, len - LZMA_MATCH_MIN, pos_state);
+            state = LZMA_REP_NEXT(state);
+            ctx->match_count++;
+        }
+    } else {
+        lzma_rc_enc_bit(ctx, &m->is_rep[state], 0);
+        lzma_enc_match(ctx, (uint32_t)back - 4, len, pos_state);
+        state = LZMA_MATCH_NEXT(state);
+        ctx->match_count++;
+    }
+    ctx->state = state;
+    ctx->pos += len;
+}
+
+/* Encode up to end, or until a chunk of output is waiting */
+static void lzma_encode(lzma_compress_context *ctx, size_t end) {
+    while (ctx->pos < end && ctx->out_len < LZMA_OUT_CHUNK && !ctx->oom) {
+        int32_t back;
+        uint32_t len = ctx->optimal ? lzma_parse_optimal(ctx, &back) : lzma_parse_fast(ctx, &back);
+        lzma_enc_step(ctx, len, back);
+        if (ctx->optimal && ctx->match_count >= LZMA_PRICE_REFRESH) {
+            lzma_update_prices(ctx);
+        }
+    }
+}
+
+/* --- Compression: stream --- */
+
+/* Size the dictionary and match finder, and queue the ZIP header */
+static int lzma_setup(lzma_compress_context *ctx, int known, uint64_t size) {
+    const struct lzma_level *lv = &lzma_levels[ctx->compression_level];
+    uint32_t dict = 1u << lv->dict_log, wlog = 16;
+
+    if (known) {
+        /* no use for a dictionary larger than the input; keep it at
+         * 2^n or 3 * 2^n as other decoders may expect */
+        uint32_t d = LZMA_DICT_MIN;
+        while (d < size && d < dict) {
+            d = (d & (d - 1)) ? d / 3 * 4 : d + d / 2;
+        }
+        if (d < dict) {
+            dict = d;
+        }
+    }
+    while (((size_t)1 << wlog) < dict) {
+        wlog++;
+    }
+    ctx->known = known;
+    ctx->dict_size = dict;
+    ctx->window_size = (size_t)1 << wlog;
+    ctx->window_cap = known ? (size_t)size : 2 * ctx->window_size;
+    wlog = 12;
+    while ((1u << wlog) < dict) {
+        wlog++;
+    }
+    ctx->hash_log = lv->hash_log < wlog + 1 ? lv->hash_log : wlog + 1;
+    ctx->chain_mask = (1u << (lv->chain_log < wlog ? lv->chain_log : wlog)) - 1;
+    ctx->nice_len = lv->nice;
+    ctx->depth = lv->depth;
+    ctx->optimal = lv->optimal;
+
+    ctx->window_buffer = (uint8_t *)malloc(ctx->window_cap ? ctx->window_cap : 1);
+    ctx->head2 = (uint32_t *)calloc(1 << 16, sizeof(uint32_t));
+    ctx->head3 = (uint32_t *)calloc(1 << 16, sizeof(uint32_t));
+    ctx->head4 = (uint32_t *)calloc((size_t)1 << ctx->hash_log, sizeof(uint32_t));
+    ctx->chain_table = (uint32_t *)calloc((size_t)ctx->chain_mask + 1, sizeof(uint32_t));
+    ctx->opt = (lzma_opt *)malloc(LZMA_OPTS * sizeof(lzma_opt));
+    ctx->path = (lzma_step *)malloc(LZMA_OPTS * sizeof(lzma_step));
+    if (!ctx->window_buffer || !ctx->head2 || !ctx->head3 || !ctx->head4
+            || !ctx->chain_table || !ctx->opt || !ctx->path) {
+        return -1;
+    }
+
+    ctx->range = 0xFFFFFFFFu;
+    ctx->cache_size = 1;
+    lzma_model_init(&ctx->model, ctx->literal, LZMA_LC, LZMA_LP);
+    lzma_init_bit_prices(ctx->bit_prices);
+    lzma_update_prices(ctx);
+
+    /* ZIP header: LZMA SDK version 9.20, properties size, properties */
+    uint8_t *p = ctx->compress_buffer;
+    *p++ = 9;
+    *p++ = 20;
+    *p++ = LZMA_PROPS_SIZE;
+    *p++ = 0;
+    *p++ = (uint8_t)((LZMA_PB * 5 + LZMA_LP) * 9 + LZMA_LC);
+    for (int i = 0; i < 4; i++) {
+        *p++ = (uint8_t)(dict >> (8 * i));
+    }
+    ctx->out_len = LZMA_HEADER_SIZE;
+    ctx->started = 1;
+    return 0;
+}
+
+/* Drop the oldest window_size bytes of history */
+static void lzma_slide(lzma_compress_context *ctx) {
+    size_t shift = ctx->window_size;
+    memmove(ctx->window_buffer, ctx->window_buffer + shift, ctx->window_len - shift);
+    ctx->window_len -= shift;
+    ctx->pos -= shift;
+    ctx->next_insert -= shift;
+    ctx->base += shift;
+    uint32_t *tables[4] = { ctx->head2, ctx->head3, ctx->head4, ctx->chain_table };
+    size_t sizes[4] = { 1 << 16, 1 << 16, (size_t)1 << ctx->hash_log, (size_t)ctx->chain_mask + 1 };
+    for (int t = 0; t < 4; t++) {
+        for (size_t i = 0; i < sizes[t]; i++) {
+            tables[t][i] = tables[t][i] > shift ? tables[t][i] - (uint32_t)shift : 0;
         }
     }
-    
-    return dst_pos;  /* Return compressed size */
 }
 
 /* --- LZMA API Implementation --- */
@@ -170,152 +1047,133 @@ static int simple_lzma_compress(const uint8_t *src, size_t src_size,
 /* Initialize a compression stream */
 int lzmaInit(z_stream *strm, int level) {
     if (!strm) return Z_STREAM_ERROR;
-    
+
     /* Set default level if needed */
-    if (level == Z_DEFAULT_COMPRESSION) {
+    if (level < 0) {
         level = LZMA_DEFAULT_LEVEL;
+    } else if (level > LZMA_MAX_LEVEL) {
+        level = LZMA_MAX_LEVEL;
     }
-    
-    /* Allocate compression context */
+
+    /* Allocate compression context; the window and match finder wait
+     * for the first input, whose size may bound them */
     lzma_compress_context *ctx = (lzma_compress_context *)calloc(1, sizeof(lzma_compress_context));
     if (!ctx) return Z_MEM_ERROR;
-    
-    /* Initialize context */
     ctx->compression_level = level;
-    ctx->window_size = 1 << 16;  /* 64KB window by default */
-    ctx->is_last_block = 0;
-    
-    /* Set default LZMA properties */
-    ctx->properties[0] = 0x5D;           /* Dictionary size: 2^(0x5D & 1F) = 2^29 = 512MB */
-    ctx->properties[1] = 0x00;           /* LC = 0, LP = 0 */
-    ctx->properties[2] = 0x00;           /* PB = 0 */
-    ctx->properties[3] = 0x00;           /* Reserved */
-    ctx->properties[4] = 0x01;           /* Version */
-    
-    /* Allocate work buffers */
-    ctx->window_buffer = (uint8_t *)malloc(ctx->window_size);
-    if (!ctx->window_buffer) {
-        free(ctx);
-        return Z_MEM_ERROR;
-    }
-    
-    /* Allocate compression buffer. For our simple RLE/literal scheme the
-     * worst-case expansion can be several times the input chunk size, so
-     * allocate a larger working buffer to avoid early failures on random data. */
-    ctx->compress_buffer_size = 4 * ctx->window_size;  /* Larger conservative overestimate */
+
+    /* Header plus a chunk of range coded output; grows if need be */
+    ctx->compress_buffer_size = 2 * LZMA_OUT_CHUNK;
     ctx->compress_buffer = (uint8_t *)malloc(ctx->compress_buffer_size);
     if (!ctx->compress_buffer) {
-        free(ctx->window_buffer);
         free(ctx);
         return Z_MEM_ERROR;
     }
-    
+
     /* Initialize stream */
     strm->state = (void *)ctx;
     strm->total_in = 0;
     strm->total_out = 0;
-    
+
     return Z_OK;
 }
 
 /* Compress data using LZMA format */
 int lzmaCompress(z_stream *strm, int flush) {
     if (!strm || !strm->state) return Z_STREAM_ERROR;
-    
+
     lzma_compress_context *ctx = (lzma_compress_context *)strm->state;
-    
-    /* First call - write LZMA header */
-    if (strm->total_out == 0) {
-        /* We need space for the header */
-        if (strm->avail_out < LZMA_HEADER_SIZE) {
-            return Z_BUF_ERROR;
-        }
-
-        /* Will be updated later */
-        memcpy(strm->next_out, ctx->properties, LZMA_PROPS_SIZE);
-
-        /* Write uncompressed size as 8-byte LE integer.
-         * Use the input size we are about to consume (avail_in) as the known size. */
-        uint64_t uncomp = (uint64_t)strm->avail_in;
-        for (int i = 0; i < 8; i++) {
-            strm->next_out[LZMA_PROPS_SIZE + i] = (uint8_t)((uncomp >> (i * 8)) & 0xFF);
-        }
-        
-        strm->next_out += LZMA_HEADER_SIZE;
-        strm->avail_out -= LZMA_HEADER_SIZE;
-        strm->total_out += LZMA_HEADER_SIZE;
-    }
-    
-    /* Set last block flag if requested */
-    if (flush == Z_FINISH) {
-        ctx->is_last_block = 1;
-    }
-    
-    /* Compress data.  Process in chunks so very large inputs don't require
-     * an oversized temporary buffer. The header (which encodes the full
-     * uncompressed size) is written above using the initial avail_in value.
-     */
-    if (strm->avail_in > 0) {
-        size_t remaining = strm->avail_in;
-        /* Debug: print initial sizes when running under TESTING env */
-        (void)0;
-        /* Work on windows of at most ctx->window_size bytes */
-        while (remaining > 0) {
-            size_t input_size = remaining;
-            if (input_size > ctx->window_size) input_size = ctx->window_size;
-
-            /* Estimate minimal required output for this chunk (conservative)
-             * literals + some overhead. We don't re-add header here because
-             * it was already written on the first call. */
-            size_t need_out = input_size + 32;
-            if (strm->avail_out < need_out) {
-                return Z_BUF_ERROR;
-            }
+    uint32_t avail_out = strm->avail_out;
 
-            int compressed_size = simple_lzma_compress(strm->next_in, input_size,
-                                                      ctx->compress_buffer,
-                                                      ctx->compress_buffer_size,
-                                                      ctx->properties);
-            (void)0;
-            if (compressed_size <= 0) {
-                return Z_DATA_ERROR;
-            }
+    for (;;) {
+        /* Hand out what is already encoded */
+        size_t n = ctx->out_len - ctx->out_pos;
+        if (n > strm->avail_out) {
+            n = strm->avail_out;
+        }
+        memcpy(strm->next_out, ctx->compress_buffer + ctx->out_pos, n);
+        strm->next_out += n;
+        strm->avail_out -= (uint32_t)n;
+        strm->total_out += (uint32_t)n;
+        ctx->out_pos += n;
+        if (ctx->out_pos < ctx->out_len) {
+            return strm->avail_out < avail_out ? Z_OK : Z_BUF_ERROR;
+        }
+        ctx->out_pos = ctx->out_len = 0;
+        if (ctx->oom) {
+            return Z_MEM_ERROR;
+        }
+        if (ctx->finished) {
+            return Z_STREAM_END;
+        }
 
-            if ((size_t)compressed_size > strm->avail_out) {
-                return Z_BUF_ERROR;
+        /* The dictionary is sized to the input when all of it is here */
+        if (!ctx->started) {
+            if (lzma_setup(ctx, flush == Z_FINISH, strm->avail_in) != 0) {
+                return Z_MEM_ERROR;
             }
+            continue;
+        }
 
-            memcpy(strm->next_out, ctx->compress_buffer, compressed_size);
-            strm->next_out += compressed_size;
-            strm->avail_out -= compressed_size;
-            strm->total_out += compressed_size;
-
-            /* Update input pointers/counters */
-            strm->next_in += input_size;
-            strm->avail_in -= input_size;
-            strm->total_in += input_size;
+        /* Take input, sliding the window when full */
+        if (ctx->window_len == ctx->window_cap && strm->avail_in > 0) {
+            if (ctx->known) {
+                return Z_STREAM_ERROR; /* more input than the first call had */
+            }
+            lzma_slide(ctx);
+        }
+        size_t take = ctx->window_cap - ctx->window_len;
+        if (take > strm->avail_in) {
+            take = strm->avail_in;
+        }
+        memcpy(ctx->window_buffer + ctx->window_len, strm->next_in, take);
+        ctx->window_len += take;
+        strm->next_in += take;
+        strm->avail_in -= (uint32_t)take;
+        strm->total_in += (uint32_t)take;
 
-            remaining -= input_size;
+        /* Keep the parser's full lookahead until the input ends */
+        int last = flush == Z_FINISH && strm->avail_in == 0;
+        size_t end = last ? ctx->window_len
+            : ctx->window_len > LZMA_LOOKAHEAD ? ctx->window_len - LZMA_LOOKAHEAD : 0;
+        if (ctx->pos < end) {
+            lzma_encode(ctx, end);
+        } else if (last) {
+            /* end marker, a match at distance 2^32, as 7-Zip writes it
+             * in ZIP entries too */
+            uint32_t pos_state = (uint32_t)(ctx->base + ctx->pos) & ((1u << LZMA_PB) - 1);
+            lzma_rc_enc_bit(ctx, &ctx->model.is_match[ctx->state][pos_state], 1);
+            lzma_rc_enc_bit(ctx, &ctx->model.is_rep[ctx->state], 0);
+            lzma_enc_match(ctx, LZMA_END_MARKER, LZMA_MATCH_MIN, pos_state);
+            for (int i = 0; i < 5; i++) {
+                lzma_rc_shift_low(ctx);
+            }
+            ctx->finished = 1;
+        } else if (strm->avail_in == 0) {
+            return Z_OK;
         }
     }
-    
-    return (ctx->is_last_block && strm->avail_in == 0) ? Z_STREAM_END : Z_OK;
 }
 
 /* End a compression stream */
 int lzmaEnd(z_stream *strm) {
     if (!strm || !strm->state) return Z_STREAM_ERROR;
-    
+
     lzma_compress_context *ctx = (lzma_compress_context *)strm->state;
-    
+
     /* Free allocated buffers */
     free(ctx->window_buffer);
+    free(ctx->head2);
+    free(ctx->head3);
+    free(ctx->head4);
+    free(ctx->chain_table);
+    free(ctx->opt);
+    free(ctx->path);
     free(ctx->compress_buffer);
-    
+
     /* Free context */
     free(ctx);
     strm->state = NULL;
-    
+
     return Z_OK;
 }
 
@@ -1,8 +1,13 @@
 /* lzma.inc.c - Minimalistic LZMA implementation compatible with zlib-like API
- * Version: 0.1 (2025-07-27)
+ * Version: 0.2 (2025-07-27)
  *
  * This implementation provides LZMA compression/decompression with zlib-compatible API
- * by including separate encoder and decoder implementations.
+ * by including separate encoder and decoder implementations, which share the
+ * probability model defined here.
+ *
+ * Streams are laid out as in ZIP entries (method 14): a 2-byte encoder version,
+ * a 2-byte properties size, the 5 properties bytes (lc/lp/pb and dictionary size)
+ * and the LZMA1 range coded data, with or without an end marker.
  *
  * Usage:
  *   #define MZIP_ENABLE_LZMA in one source file before including
@@ -13,8 +18,111 @@
 #ifndef MLZMA_H
 #define MLZMA_H
 
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* ------------- LZMA model (shared by encoder and decoder) ------------- */
+
+#define LZMA_HEADER_SIZE      9       /* ZIP: version, props size, props */
+#define LZMA_PROPS_SIZE       5       /* lc/lp/pb byte + dictionary size */
+#define LZMA_DICT_MIN         4096
+
+#define LZMA_NUM_STATES       12
+#define LZMA_POS_BITS_MAX     4
+#define LZMA_LIT_SIZE         0x300   /* probabilities per literal context */
+#define LZMA_MATCH_MIN        2
+#define LZMA_MATCH_MAX        273
+#define LZMA_LEN_LOW          8       /* lengths 2-9 */
+#define LZMA_LEN_MID          8       /* lengths 10-17 */
+#define LZMA_LEN_HIGH         256     /* lengths 18-273 */
+#define LZMA_DIST_STATES      4
+#define LZMA_DIST_SLOTS       64
+#define LZMA_START_DIST_MODEL 4
+#define LZMA_END_DIST_MODEL   14
+#define LZMA_FULL_DISTANCES   128
+#define LZMA_ALIGN_BITS       4
+#define LZMA_END_MARKER       0xFFFFFFFFu
+
+/* Range coder */
+#define LZMA_PROB_BITS        11
+#define LZMA_PROB_INIT        (1 << (LZMA_PROB_BITS - 1))
+#define LZMA_MOVE_BITS        5
+#define LZMA_TOP              (1u << 24)
+
+typedef uint16_t lzma_prob;
+
+typedef struct {
+    lzma_prob choice;
+    lzma_prob choice2;
+    lzma_prob low[1 << LZMA_POS_BITS_MAX][LZMA_LEN_LOW];
+    lzma_prob mid[1 << LZMA_POS_BITS_MAX][LZMA_LEN_MID];
+    lzma_prob high[LZMA_LEN_HIGH];
+} lzma_len_probs;
+
+/* Every adaptive probability but the literal coders, which depend on lc/lp */
+typedef struct {
+    lzma_prob is_match[LZMA_NUM_STATES][1 << LZMA_POS_BITS_MAX];
+    lzma_prob is_rep[LZMA_NUM_STATES];
+    lzma_prob is_rep_g0[LZMA_NUM_STATES];
+    lzma_prob is_rep_g1[LZMA_NUM_STATES];
+    lzma_prob is_rep_g2[LZMA_NUM_STATES];
+    lzma_prob is_rep0_long[LZMA_NUM_STATES][1 << LZMA_POS_BITS_MAX];
+    lzma_prob dist_slot[LZMA_DIST_STATES][LZMA_DIST_SLOTS];
+    lzma_prob dist_special[LZMA_FULL_DISTANCES - LZMA_END_DIST_MODEL];
+    lzma_prob align[1 << LZMA_ALIGN_BITS];
+    lzma_len_probs len;
+    lzma_len_probs rep_len;
+} lzma_model;
+
+#ifdef MZIP_ENABLE_LZMA
+
+/* State after a literal; states 7 and up follow a match */
+static const uint8_t lzma_lit_next[LZMA_NUM_STATES] = { 0, 0, 0, 0, 1, 2, 3, 4, 5, 6, 4, 5 };
+#define LZMA_MATCH_NEXT(s)    ((s) < 7 ? 7 : 10)
+#define LZMA_REP_NEXT(s)      ((s) < 7 ? 8 : 11)
+#define LZMA_SHORTREP_NEXT(s) ((s) < 7 ? 9 : 11)
+#define LZMA_DIST_STATE(len)  ((len) < LZMA_DIST_STATES + 2 ? (len) - 2 : LZMA_DIST_STATES - 1)
+
+/* Reset the model; literal holds LZMA_LIT_SIZE << (lc + lp) probabilities */
+static void lzma_model_init(lzma_model *m, lzma_prob *literal, uint32_t lc, uint32_t lp) {
+    lzma_prob *p = (lzma_prob *)m;
+    for (size_t i = 0; i < sizeof(*m) / sizeof(lzma_prob); i++) {
+        p[i] = LZMA_PROB_INIT;
+    }
+    for (size_t i = 0; i < (size_t)LZMA_LIT_SIZE << (lc + lp); i++) {
+        literal[i] = LZMA_PROB_INIT;
+    }
+}
+
+/* Split the properties byte; returns -1 if out of range */
+static int lzma_props_decode(uint8_t d, uint32_t *lc, uint32_t *lp, uint32_t *pb) {
+    if (d >= 9 * 5 * 5) {
+        return -1;
+    }
+    *lc = d % 9;
+    d /= 9;
+    *lp = d % 5;
+    *pb = d / 5;
+    return *pb <= LZMA_POS_BITS_MAX ? 0 : -1;
+}
+
+/* Slot of a distance (minus one): its top two bits and bit length */
+static uint32_t lzma_dist_slot(uint32_t dist) {
+    if (dist < LZMA_START_DIST_MODEL) {
+        return dist;
+    }
+    uint32_t n = 31;
+    while (!(dist >> n)) {
+        n--;
+    }
+    return n << 1 | ((dist >> (n - 1)) & 1);
+}
+
+#endif /* MZIP_ENABLE_LZMA */
+
 /* Include encoder and decoder implementations */
 #include "lzma-enc.inc.c"
 #include "lzma-dec.inc.c"
 
-#endif /* MLZMA_H */
\ No newline at end of file
+#endif /* MLZMA_H */
@@ -7,6 +7,9 @@
  */
 
 #define MZIP_IMPLEMENTATION
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L
+#endif
 
 #include <stdint.h>
 #include <stdlib.h>
@@ -14,6 +17,7 @@
 #include <string.h>
 #include <fcntl.h>
 #include <string.h>
+#include <errno.h>
 #include <time.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -29,6 +33,29 @@
 #include <r_util.h>
 #endif
 
+#if MZIP_ENABLE_THREADS && !defined(_WIN32)
+#define MZIP_THREADS 1
+#include <pthread.h>
+#endif
+
+#if MZIP_ENABLE_MMAP && !defined(_WIN32)
+#define MZIP_MMAP 1
+#include <sys/mman.h>
+#endif
+
+/* FILE offsets past 2 GiB: long is 32 bits on Windows */
+#if defined(_WIN32) || defined(_WIN64)
+#define mzip_fseek _fseeki64
+#define mzip_ftell _ftelli64
+#else
+#define mzip_fseek fseeko
+#define mzip_ftell ftello
+#endif
+
+#ifndef _WIN32
+#include <sys/uio.h>
+#endif
+
 #include "crc32.inc.c"
 /* Include compression algorithms based on config */
 
@@ -53,6 +80,25 @@
 #define MZIP_SIG_LFH  0x04034b50u
 #define MZIP_SIG_CDH  0x02014b50u
 #define MZIP_SIG_EOCD 0x06054b50u
+#define MZIP_SIG_DD   0x08074b50u
+#define MZIP_SIG_ZIP64_EOCD    0x06064b50u
+#define MZIP_SIG_ZIP64_LOCATOR 0x07064b50u
+
+#define MZIP_ZIP64_EOCD_SIZE    56  /* fixed part of the ZIP64 EOCD record */
+#define MZIP_ZIP64_LOCATOR_SIZE 20
+#define MZIP_ZIP64_EXTRA_ID     0x0001
+#define MZIP_ZIP64_VERSION      45  /* version needed to extract ZIP64 */
+
+/* Largest headers for a name of n bytes, ZIP64 extras included */
+#define MZIP_LFH_MAX(n)  (30u + (uint32_t)(n) + 20u)
+#define MZIP_CDH_MAX(n)  (46u + (uint32_t)(n) + 28u)
+#define MZIP_EOCD_MAX    (MZIP_ZIP64_EOCD_SIZE + MZIP_ZIP64_LOCATOR_SIZE + 22)
+
+/* General purpose flag bit 3: CRC and sizes follow the data in a descriptor */
+#define MZIP_GP_DATA_DESCRIPTOR 0x0008
+
+/* General purpose flag bit 1 for LZMA: the data ends with an end marker */
+#define MZIP_GP_LZMA_EOS        0x0002
 
 /* Safety limits for parsing ZIP fields to avoid integer overflows and
  * excessive allocations. These limits apply to filename/extra/comment
@@ -61,15 +107,49 @@
 #define MZIP_MAX_FIELD_LEN  (64u * 1024u - 1u) /* 64 KiB - 1 to fit 16-bit lengths (65535) */
 #define MZIP_MAX_PAYLOAD    (2ULL * 1024ULL * 1024ULL * 1024ULL) /* 2 GiB */
 
+/* Sources at least this large get their CRC computed on several threads,
+ * in chunks of at least MZIP_PAR_CRC_CHUNK bytes each. */
+#define MZIP_PAR_CRC_MIN    (8u * 1024u * 1024u)
+#define MZIP_PAR_CRC_CHUNK  (4u * 1024u * 1024u)
+#define MZIP_MAX_THREADS    64
+
+/* Block-parallel deflate: entries of at least MZIP_PAR_DEFLATE_MIN bytes
+ * are cut into MZIP_PAR_DEFLATE_CHUNK pieces compressed on their own
+ * threads, each primed with the MZIP_DEFLATE_DICT bytes before it */
+#define MZIP_PAR_DEFLATE_MIN   (4u * 1024u * 1024u)
+#define MZIP_PAR_DEFLATE_CHUNK (1024u * 1024u)
+#define MZIP_DEFLATE_DICT      (32u * 1024u)
+
+/* Entries at least this large get MADV_WILLNEED before decoding; smaller
+ * ones are cheaper to fault in than to advise */
+#define MZIP_MADV_MIN       (64u * 1024u)
+
+/* Background compression (zip_file_add): entries queued before the caller
+ * blocks, per worker thread and in total source bytes */
+#define MZIP_POOL_JOBS_PER_THREAD 4
+#define MZIP_POOL_MAX_BYTES (256u * 1024u * 1024u)
+
+/* local_hdr_ofs of an entry whose data has not been written yet */
+#define MZIP_OFS_PENDING    UINT64_MAX
+
+/* Compressed input buffer of a streamed entry when the archive is not mapped */
+#define MZIP_STREAM_BUFSIZE (64u * 1024u)
+
+/* Staging buffer for archive output (see mzip_out_write); holds the
+ * largest local header */
+#define MZIP_OUT_BUFSIZE    (256u * 1024u)
+
 /* Forward declarations of helper functions */
-static uint32_t mzip_write_local_header(FILE *fp, const char *name, uint32_t comp_method, 
-		uint32_t comp_size, uint32_t uncomp_size, uint32_t crc32);
-static uint32_t mzip_write_central_header(FILE *fp, const char *name, uint32_t comp_method,
-		uint32_t comp_size, uint32_t uncomp_size, uint32_t crc32,
-		uint32_t local_header_offset, uint16_t file_time, uint16_t file_date, uint32_t external_attr);
-static void mzip_write_end_of_central_directory(FILE *fp, uint32_t num_entries, 
-		uint32_t central_dir_size, uint32_t central_dir_offset);
+static uint32_t mzip_put_local_header(uint8_t *header, const char *name, uint16_t filename_len, uint16_t gp_flags, uint32_t comp_method, 
+		uint64_t comp_size, uint64_t uncomp_size, uint32_t crc32,
+		uint16_t file_time, uint16_t file_date, int zip64);
+static uint32_t mzip_put_central_header(uint8_t *header, const char *name, uint16_t filename_len, uint16_t gp_flags, uint32_t comp_method,
+		uint64_t comp_size, uint64_t uncomp_size, uint32_t crc32,
+		uint64_t local_header_offset, uint16_t file_time, uint16_t file_date, uint32_t external_attr);
+static uint32_t mzip_put_end_of_central_directory(uint8_t *out, uint64_t num_entries, 
+		uint64_t central_dir_size, uint64_t central_dir_offset);
 static int mzip_finalize_archive(zip_t *za);
+static int mzip_pool_drain(zip_t *za);
 
 /* Global flag: when non-zero, verify CRC32 on extraction and fail on mismatch. */
 int mzip_verify_crc = 0;
@@ -83,6 +163,203 @@ uint64_t mzip_max_expansion_ratio = 1000ULL;
 uint64_t mzip_max_expansion_slack = 1024ULL * 1024ULL; /* 1 MiB */
 int mzip_ignore_zipbomb = 0;
 
+/* Threads for parallel work; 0 = one per online CPU */
+int mzip_threads = 0;
+
+/* Number of threads to use for parallel work */
+#if MZIP_THREADS && defined(_SC_NPROCESSORS_ONLN)
+/* sysconf reads /sys on Linux; ask once, not on every add */
+static long mzip_cpus = 1;
+static pthread_once_t mzip_cpus_once = PTHREAD_ONCE_INIT;
+
+static void mzip_cpus_init(void) {
+	long cpus = sysconf (_SC_NPROCESSORS_ONLN);
+	mzip_cpus = cpus > 0 ? cpus : 1;
+}
+#endif
+
+static int mzip_thread_count(void) {
+	int n = mzip_threads;
+#if MZIP_THREADS && defined(_SC_NPROCESSORS_ONLN)
+	if (n <= 0) {
+		pthread_once (&mzip_cpus_once, mzip_cpus_init);
+		n = mzip_cpus > MZIP_MAX_THREADS ? MZIP_MAX_THREADS : (int)mzip_cpus;
+	}
+#endif
+#if !MZIP_THREADS
+	n = 1;
+#endif
+	if (n < 1) n = 1;
+	return n > MZIP_MAX_THREADS ? MZIP_MAX_THREADS : n;
+}
+
+#if MZIP_THREADS
+struct mzip_crc_job {
+	const uint8_t *buf;
+	size_t len;
+	uint32_t crc;
+};
+
+static void *mzip_crc_worker(void *arg) {
+	struct mzip_crc_job *job = (struct mzip_crc_job *)arg;
+	job->crc = mzip_crc32 (0, job->buf, job->len);
+	return NULL;
+}
+#endif
+
+/* CRC-32 of a whole buffer. Large buffers are split into one chunk per
+ * thread and the partial CRCs merged in order with mzip_crc32_combine. */
+static uint32_t mzip_crc32_parallel(const void *buf, size_t len) {
+#if MZIP_THREADS
+	size_t n = (size_t)mzip_thread_count ();
+	if (n > len / MZIP_PAR_CRC_CHUNK) {
+		n = len / MZIP_PAR_CRC_CHUNK;
+	}
+	if (len >= MZIP_PAR_CRC_MIN && n >= 2) {
+		struct mzip_crc_job jobs[MZIP_MAX_THREADS];
+		pthread_t tids[MZIP_MAX_THREADS];
+		int started[MZIP_MAX_THREADS] = {0};
+		size_t chunk = len / n;
+		for (size_t i = 0; i < n; i++) {
+			jobs[i].buf = (const uint8_t *)buf + i * chunk;
+			jobs[i].len = (i == n - 1) ? len - i * chunk : chunk;
+		}
+		for (size_t i = 1; i < n; i++) {
+			started[i] = pthread_create (&tids[i], NULL, mzip_crc_worker, &jobs[i]) == 0;
+		}
+		/* The caller takes the first chunk, and any a thread could not */
+		mzip_crc_worker (&jobs[0]);
+		uint32_t crc = jobs[0].crc;
+		for (size_t i = 1; i < n; i++) {
+			if (started[i]) {
+				pthread_join (tids[i], NULL);
+			} else {
+				mzip_crc_worker (&jobs[i]);
+			}
+			crc = mzip_crc32_combine (crc, jobs[i].crc, jobs[i].len);
+		}
+		return crc;
+	}
+#endif
+	return mzip_crc32 (0, buf, len);
+}
+
+#if MZIP_THREADS
+/* One piece of a block-parallel deflate stream. Every piece but the last
+ * ends with a sync flush, which byte-aligns it with an empty stored block,
+ * so the pieces concatenate into a single valid raw deflate stream. */
+struct mzip_pdef_job {
+	const uint8_t *in;      /* the dict_len bytes before it are the dictionary */
+	size_t len;
+	size_t dict_len;
+	int finish;             /* last piece of the stream */
+	int want_crc;
+	uint8_t *out;
+	size_t out_len;
+	uint32_t crc;
+	int ret;
+};
+
+struct mzip_pdef_set {
+	struct mzip_pdef_job *jobs;
+	size_t n_jobs;
+	size_t first;           /* this thread takes first, first + step, ... */
+	size_t step;
+};
+
+static void mzip_pdef_chunk(struct mzip_pdef_job *job) {
+	z_stream strm = {0};
+	size_t cap = compressBound (job->len) + 16;
+	job->ret = -1;
+	job->out = (uint8_t*)malloc (cap);
+	if (!job->out) {
+		return;
+	}
+	if (job->want_crc) {
+		job->crc = mzip_crc32 (0, job->in, job->len);
+	}
+	if (deflateInit2 (&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+		return;
+	}
+	if (job->dict_len && deflateSetDictionary (&strm, job->in - job->dict_len, (uint32_t)job->dict_len) != Z_OK) {
+		deflateEnd (&strm);
+		return;
+	}
+	strm.next_in = (uint8_t*)job->in;
+	strm.avail_in = (uint32_t)job->len;
+	strm.next_out = job->out;
+	strm.avail_out = (uint32_t)cap;
+	int zret = deflate (&strm, job->finish ? Z_FINISH : Z_SYNC_FLUSH);
+	if ((job->finish ? zret == Z_STREAM_END : zret == Z_OK)
+			&& strm.avail_in == 0 && strm.avail_out > 0) {
+		job->out_len = cap - strm.avail_out;
+		job->ret = 0;
+	}
+	deflateEnd (&strm);
+}
+
+static void *mzip_pdef_worker(void *arg) {
+	struct mzip_pdef_set *set = (struct mzip_pdef_set *)arg;
+	for (size_t i = set->first; i < set->n_jobs; i += set->step) {
+		mzip_pdef_chunk (&set->jobs[i]);
+	}
+	return NULL;
+}
+
+/* Compress all jobs on up to n threads; 0 when every one succeeded.
+ * Outputs stay in jobs[i].out for the caller to write and free. */
+static int mzip_pdef_run(struct mzip_pdef_job *jobs, size_t n_jobs, int n) {
+	struct mzip_pdef_set sets[MZIP_MAX_THREADS];
+	pthread_t tids[MZIP_MAX_THREADS];
+	int started[MZIP_MAX_THREADS] = {0};
+	size_t n_threads = (size_t)n < n_jobs ? (size_t)n : n_jobs;
+	for (size_t t = 0; t < n_threads; t++) {
+		sets[t].jobs = jobs;
+		sets[t].n_jobs = n_jobs;
+		sets[t].first = t;
+		sets[t].step = n_threads;
+	}
+	for (size_t t = 1; t < n_threads; t++) {
+		started[t] = pthread_create (&tids[t], NULL, mzip_pdef_worker, &sets[t]) == 0;
+	}
+	if (n_threads > 0) {
+		mzip_pdef_worker (&sets[0]);
+	}
+	for (size_t t = 1; t < n_threads; t++) {
+		if (started[t]) {
+			pthread_join (tids[t], NULL);
+		} else {
+			mzip_pdef_worker (&sets[t]);
+		}
+	}
+	int ret = 0;
+	for (size_t i = 0; i < n_jobs; i++) {
+		ret |= jobs[i].ret;
+	}
+	return ret;
+}
+
+/* Lay out the jobs for len bytes at in, continuing a stream that already
+ * has `before` bytes (available in memory right before in). */
+static size_t mzip_pdef_plan(struct mzip_pdef_job *jobs, const uint8_t *in, size_t len,
+		uint64_t before, int finish, int want_crc) {
+	size_t n_jobs = 0;
+	size_t pos = 0;
+	do {
+		struct mzip_pdef_job *job = &jobs[n_jobs++];
+		uint64_t done = before + pos;
+		memset (job, 0, sizeof (*job));
+		job->in = in + pos;
+		job->len = len - pos < MZIP_PAR_DEFLATE_CHUNK ? len - pos : MZIP_PAR_DEFLATE_CHUNK;
+		job->dict_len = done < MZIP_DEFLATE_DICT ? (size_t)done : MZIP_DEFLATE_DICT;
+		job->want_crc = want_crc;
+		pos += job->len;
+		job->finish = finish && pos == len;
+	} while (pos < len);
+	return n_jobs;
+}
+#endif
+
 /* helper: little-endian readers/writers (ZIP format is little-endian) */
 
 /* Date/time conversion for ZIP entries */
@@ -188,17 +465,303 @@ static void mzip_wr32 (uint8_t *p, uint32_t v) {
 
 /* ----  internal helpers  ---- */
 
-static inline int mzip_read_fully (FILE *fp, void *dst, size_t n) {
-	return fread (dst, 1, n, fp) == n ? 0 : -1;
+static inline const char *mzip_entry_name(const zip_t *za, const struct mzip_entry *e) {
+	return za->names.buf + e->name_ofs;
+}
+
+/* Make room for n more bytes of names, doubling the arena */
+static int mzip_names_reserve(struct mzip_names *nm, size_t n) {
+	if (n <= nm->cap - nm->len) {
+		return 0;
+	}
+	size_t cap = nm->cap ? nm->cap : 4096;
+	while (cap - nm->len < n) {
+		if (cap > SIZE_MAX / 2) {
+			return -1;
+		}
+		cap *= 2;
+	}
+	char *buf = (char*)realloc (nm->buf, cap);
+	if (!buf) {
+		return -1;
+	}
+	nm->buf = buf;
+	nm->cap = cap;
+	return 0;
+}
+
+/* Copy len bytes of name into the arena, zero-terminated, and point e at them */
+static int mzip_names_add(zip_t *za, struct mzip_entry *e, const char *name, uint16_t len) {
+	if (mzip_names_reserve (&za->names, (size_t)len + 1) != 0) {
+		return -1;
+	}
+	memcpy (za->names.buf + za->names.len, name, len);
+	za->names.buf[za->names.len + len] = '\0';
+	e->name_ofs = za->names.len;
+	e->name_len = len;
+	za->names.len += (size_t)len + 1;
+	return 0;
+}
+
+/* Archive output. Headers and small payloads are gathered in za->out and
+ * leave in one write when it fills up; a payload too big for it goes out
+ * together with whatever is staged in a single writev. Writes go to the
+ * descriptor, whose offset always sits at out.pos - out.len, so writers
+ * get offsets from out.pos instead of asking the FILE. */
+static int mzip_out_sink(zip_t *za, const void *a, size_t na, const void *b, size_t nb) {
+#ifndef _WIN32
+	struct iovec iov[2];
+	struct iovec *v = iov;
+	int cnt = 0;
+	if (na) {
+		iov[cnt].iov_base = (void*)a;
+		iov[cnt++].iov_len = na;
+	}
+	if (nb) {
+		iov[cnt].iov_base = (void*)b;
+		iov[cnt++].iov_len = nb;
+	}
+	while (cnt > 0) {
+		ssize_t w = writev (fileno (za->fp), v, cnt);
+		if (w < 0 && errno == EINTR) {
+			continue;
+		}
+		if (w <= 0) {
+			return -1;
+		}
+		while (cnt > 0 && (size_t)w >= v->iov_len) {
+			w -= (ssize_t)v->iov_len;
+			v++;
+			cnt--;
+		}
+		if (cnt > 0) {
+			v->iov_base = (uint8_t*)v->iov_base + w;
+			v->iov_len -= (size_t)w;
+		}
+	}
+	return 0;
+#else
+	/* reads move the FILE position, so put it back first */
+	if (mzip_fseek (za->fp, (int64_t)(za->out.pos - za->out.len), SEEK_SET) != 0) {
+		return -1;
+	}
+	return fwrite (a, 1, na, za->fp) == na && fwrite (b, 1, nb, za->fp) == nb ? 0 : -1;
+#endif
+}
+
+static int mzip_out_flush(zip_t *za) {
+	if (za->out.len > 0 && mzip_out_sink (za, za->out.buf, za->out.len, NULL, 0) != 0) {
+		za->out.err = 1;
+	}
+	za->out.len = 0;
+	return za->out.err ? -1 : 0;
+}
+
+/* Return room for n (<= MZIP_OUT_BUFSIZE) bytes at the end of the staging
+ * buffer; the caller fills them and calls mzip_out_commit */
+static uint8_t *mzip_out_reserve(zip_t *za, size_t n) {
+	if (!za->out.buf) {
+		za->out.buf = (uint8_t*)malloc (MZIP_OUT_BUFSIZE);
+		if (!za->out.buf) {
+			za->out.err = 1;
+			return NULL;
+		}
+	}
+	if (n > MZIP_OUT_BUFSIZE - za->out.len) {
+		mzip_out_flush (za);
+	}
+	return za->out.buf + za->out.len;
+}
+
+static void mzip_out_commit(zip_t *za, size_t n) {
+	za->out.len += n;
+	za->out.pos += n;
+}
+
+static int mzip_out_write(zip_t *za, const void *data, size_t n) {
+	if (n < MZIP_OUT_BUFSIZE) {
+		uint8_t *p = mzip_out_reserve (za, n);
+		if (!p) {
+			return -1;
+		}
+		memcpy (p, data, n);
+		mzip_out_commit (za, n);
+		return 0;
+	}
+	if (mzip_out_sink (za, za->out.buf, za->out.len, data, n) != 0) {
+		za->out.err = 1;
+	}
+	za->out.len = 0;
+	za->out.pos += n;
+	return za->out.err ? -1 : 0;
+}
+
+/* Continue writing at pos (appending over an old central directory, or
+ * dropping a failed entry) */
+static int mzip_out_seek(zip_t *za, uint64_t pos) {
+	if (mzip_out_flush (za) != 0) {
+		return -1;
+	}
+	za->out.pos = pos;
+#ifndef _WIN32
+	return lseek (fileno (za->fp), (off_t)pos, SEEK_SET) == (off_t)pos ? 0 : -1;
+#else
+	return 0;
+#endif
+}
+
+static uint32_t mzip_write_local_header(zip_t *za, const char *name, uint16_t filename_len, uint16_t gp_flags, uint32_t comp_method,
+		uint64_t comp_size, uint64_t uncomp_size, uint32_t crc32,
+		uint16_t file_time, uint16_t file_date, int zip64) {
+	uint8_t *p = mzip_out_reserve (za, MZIP_LFH_MAX (filename_len));
+	if (!p) {
+		return 0;
+	}
+	uint32_t n = mzip_put_local_header (p, name, filename_len, gp_flags, comp_method,
+			comp_size, uncomp_size, crc32, file_time, file_date, zip64);
+	mzip_out_commit (za, n);
+	return n;
+}
+
+static int mzip_pool_drain(zip_t *za);
+
+/* Read n bytes at ofs. Reads never use the shared FILE position, so
+ * entries of a read-only archive can be read from several threads. */
+static int mzip_read_fully (zip_t *za, void *dst, size_t n, uint64_t ofs) {
+	if (za->mode == 1) {
+		/* make our own writes visible, once the pool is done with them */
+		mzip_pool_drain (za);
+		mzip_out_flush (za);
+	}
+#ifndef _WIN32
+	uint8_t *p = (uint8_t*)dst;
+	int fd = fileno (za->fp);
+	while (n > 0) {
+		ssize_t r = pread (fd, p, n, (off_t)ofs);
+		if (r < 0 && errno == EINTR) {
+			continue;
+		}
+		if (r <= 0) {
+			return -1;
+		}
+		p += r;
+		n -= (size_t)r;
+		ofs += (uint64_t)r;
+	}
+	return 0;
+#else
+	if (mzip_fseek (za->fp, (int64_t)ofs, SEEK_SET) != 0) {
+		return -1;
+	}
+	return fread (dst, 1, n, za->fp) == n ? 0 : -1;
+#endif
+}
+
+/* Return n bytes at ofs. With a mapping this points into it and *owned
+ * is NULL; otherwise the bytes are read into a malloc'd buffer that is
+ * also stored in *owned for the caller to free. The range must have been
+ * checked against the file size already. */
+static const uint8_t *mzip_read_at (zip_t *za, uint64_t ofs, size_t n, uint8_t **owned) {
+	*owned = NULL;
+	if (za->map) {
+		return za->map + ofs;
+	}
+	uint8_t *buf = (uint8_t*)malloc (n ? n : 1);
+	if (!buf) {
+		return NULL;
+	}
+	if (n && mzip_read_fully (za, buf, n, ofs) != 0) {
+		free (buf);
+		return NULL;
+	}
+	*owned = buf;
+	return buf;
+}
+
+/* access hints for mapped ranges */
+#define MZIP_ADVISE_RANDOM   0
+#define MZIP_ADVISE_WILLNEED 1
+
+static void mzip_advise (zip_t *za, uint64_t ofs, uint64_t len, int advice) {
+#if MZIP_MMAP
+	if (!za->map || len == 0) {
+		return;
+	}
+	/* madvise wants a page-aligned start */
+	uint64_t page = (uint64_t)sysconf (_SC_PAGESIZE);
+	uint64_t start = ofs & ~(page - 1);
+	posix_madvise ((void*)(za->map + start), (size_t)(ofs + len - start),
+			advice == MZIP_ADVISE_WILLNEED ? POSIX_MADV_WILLNEED : POSIX_MADV_RANDOM);
+#else
+	(void)za; (void)ofs; (void)len; (void)advice;
+#endif
+}
+
+/* Map a read-only archive. Failure is not an error: the stdio path is
+ * used instead. Lookups jump around the file, so the mapping defaults to
+ * MADV_RANDOM and specific ranges are prefetched as they are needed. */
+static void mzip_map_file (zip_t *za) {
+#if MZIP_MMAP
+	int fd = fileno (za->fp);
+	if (fd < 0 || za->size == 0 || za->size > (uint64_t)SIZE_MAX) {
+		return;
+	}
+	void *p = mmap (NULL, (size_t)za->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (p == MAP_FAILED) {
+		return;
+	}
+	za->map = (const uint8_t*)p;
+	mzip_advise (za, 0, za->size, MZIP_ADVISE_RANDOM);
+#else
+	(void)za;
+#endif
 }
 
-/* locate EOCD record (last 64KiB + 22 bytes) */
-static long mzip_find_eocd(FILE *fp, uint8_t *eocd_out /*22+*/, size_t *cd_size, uint32_t *cd_ofs, uint16_t *total_entries) {
-	long file_size;
-	if (fseek (fp, 0, SEEK_END) != 0) {
+/* Look for the ZIP64 end of central directory locator right before the
+ * EOCD at eocd_pos and, if present, read the ZIP64 EOCD record it points
+ * to. Returns 1 when found, 0 when there is none, -1 if it is malformed. */
+static int mzip_read_zip64_eocd(zip_t *za, uint64_t eocd_pos, uint64_t file_size,
+		uint64_t *entries, uint64_t *cd_size, uint64_t *cd_ofs) {
+	if (eocd_pos < MZIP_ZIP64_LOCATOR_SIZE) {
+		return 0;
+	}
+	uint8_t *owned;
+	const uint8_t *loc = mzip_read_at (za, eocd_pos - MZIP_ZIP64_LOCATOR_SIZE, MZIP_ZIP64_LOCATOR_SIZE, &owned);
+	if (!loc) {
+		return -1;
+	}
+	if (mzip_rd32 (loc) != MZIP_SIG_ZIP64_LOCATOR) {
+		free (owned);
+		return 0;
+	}
+	uint64_t rec_ofs = mzip_read_le64 (loc + 8);
+	free (owned);
+	if (rec_ofs > eocd_pos - MZIP_ZIP64_LOCATOR_SIZE
+			|| eocd_pos - MZIP_ZIP64_LOCATOR_SIZE - rec_ofs < MZIP_ZIP64_EOCD_SIZE) {
+		return -1;
+	}
+	const uint8_t *rec = mzip_read_at (za, rec_ofs, MZIP_ZIP64_EOCD_SIZE, &owned);
+	if (!rec) {
+		return -1;
+	}
+	if (mzip_rd32 (rec) != MZIP_SIG_ZIP64_EOCD) {
+		free (owned);
+		return -1;
+	}
+	*entries = mzip_read_le64 (rec + 32);
+	*cd_size = mzip_read_le64 (rec + 40);
+	*cd_ofs  = mzip_read_le64 (rec + 48);
+	free (owned);
+	if (*cd_ofs > file_size || *cd_size > file_size - *cd_ofs) {
 		return -1;
 	}
-	file_size = ftell (fp);
+	return 1;
+}
+
+/* locate EOCD record (last 64KiB + 22 bytes), following the ZIP64 record
+ * when there is one */
+static int64_t mzip_find_eocd(zip_t *za, uint8_t *eocd_out /*22+*/, uint64_t *cd_size, uint64_t *cd_ofs, uint64_t *total_entries) {
+	uint64_t file_size = za->size;
 	if (file_size < 22) {
 		return -1;
 	}
@@ -206,35 +769,34 @@ static long mzip_find_eocd(FILE *fp, uint8_t *eocd_out /*22+*/, size_t *cd_size,
     /* Ensure both operands of the ?: have the same unsigned type to avoid
      * signed/unsigned conversions. If file_size is smaller than max_back,
      * use file_size cast to size_t, otherwise use max_back. */
-    size_t search_len = (file_size < (long)max_back) ? (size_t)file_size : max_back;
+    size_t search_len = (file_size < (uint64_t)max_back) ? (size_t)file_size : max_back;
 
-	if (fseek (fp, file_size - (long)search_len, SEEK_SET) != 0) {
-		return -1;
-	}
-	uint8_t *buf = (uint8_t*)malloc (search_len);
+	uint8_t *owned;
+	const uint8_t *buf = mzip_read_at (za, file_size - search_len, search_len, &owned);
 	if (!buf) {
 		return -1;
 	}
-	if (mzip_read_fully (fp, buf, search_len) != 0) {
-		free (buf);
-		return -1;
-	}
 	size_t i;
 	for (i = search_len - 22; i != (size_t)-1; --i) {
         if (mzip_rd32 (buf + i) == MZIP_SIG_EOCD) {
             /* Basic EOCD present; extract fields but validate them before
              * returning to avoid trusting potentially corrupted archives. */
             memcpy (eocd_out, buf + i, 22);
-            uint16_t comment_len = mzip_rd16 (buf + i + 20);
-            uint16_t entries = mzip_rd16 (buf + i + 10);
-            uint32_t cd_size_tmp = mzip_rd32 (buf + i + 12);
-            uint32_t cd_ofs_tmp  = mzip_rd32 (buf + i + 16);
-            (void)comment_len;
+            uint64_t eocd_pos = file_size - search_len + i;
+            uint64_t entries = mzip_rd16 (buf + i + 10);
+            uint64_t cd_size_tmp = mzip_rd32 (buf + i + 12);
+            uint64_t cd_ofs_tmp  = mzip_rd32 (buf + i + 16);
+
+            /* ZIP64: the record preceding the EOCD holds the real values
+             * (the EOCD ones are then 0xFFFF/0xFFFFFFFF placeholders) */
+            int z64 = mzip_read_zip64_eocd (za, eocd_pos, file_size, &entries, &cd_size_tmp, &cd_ofs_tmp);
+            if (z64 < 0) {
+                continue;
+            }
 
             /* Ensure central directory lies within the file. Use 64-bit
              * arithmetic to avoid overflow when adding offsets. */
-            uint64_t cd_end = (uint64_t)cd_ofs_tmp + (uint64_t)cd_size_tmp;
-            if (cd_ofs_tmp > (uint32_t)file_size || cd_end > (uint64_t)file_size) {
+            if (cd_ofs_tmp > file_size || cd_size_tmp > file_size - cd_ofs_tmp) {
                 /* Central directory claims to be outside the file -> malformed */
                 continue;
             }
@@ -243,87 +805,120 @@ static long mzip_find_eocd(FILE *fp, uint8_t *eocd_out /*22+*/, size_t *cd_size,
             *total_entries = entries;
             *cd_size = cd_size_tmp;
             *cd_ofs = cd_ofs_tmp;
-            free (buf);
-            return (long)(file_size - search_len + i);
+            free (owned);
+            return (int64_t)eocd_pos;
         }
 	}
 	/* not found */
-	free (buf);
+	free (owned);
 	return -1;
 }
 
+/* Replace the 0xFFFFFFFF placeholders of a central directory entry with
+ * the 64-bit values of its ZIP64 extra field. They appear in a fixed
+ * order, and only those whose 32-bit field overflowed are present. */
+static int mzip_parse_zip64_extra(struct mzip_entry *e, const uint8_t *extra, uint16_t extra_len) {
+	size_t pos = 0;
+	while (pos + 4 <= extra_len) {
+		uint16_t id = mzip_rd16 (extra + pos);
+		uint16_t len = mzip_rd16 (extra + pos + 2);
+		const uint8_t *p = extra + pos + 4;
+		if ((size_t)len > (size_t)extra_len - pos - 4) {
+			return -1;
+		}
+		if (id == MZIP_ZIP64_EXTRA_ID) {
+			const uint8_t *end = p + len;
+			if (e->uncomp_size == 0xFFFFFFFFu) {
+				if (end - p < 8) return -1;
+				e->uncomp_size = mzip_read_le64 (p);
+				p += 8;
+			}
+			if (e->comp_size == 0xFFFFFFFFu) {
+				if (end - p < 8) return -1;
+				e->comp_size = mzip_read_le64 (p);
+				p += 8;
+			}
+			if (e->local_hdr_ofs == 0xFFFFFFFFu) {
+				if (end - p < 8) return -1;
+				e->local_hdr_ofs = mzip_read_le64 (p);
+			}
+			return 0;
+		}
+		pos += 4 + (size_t)len;
+	}
+	/* placeholders without the extra field are taken literally */
+	return 0;
+}
+
 /* parse central directory into array of mzip_entry */
 static int mzip_load_central(zip_t *za) {
 	uint8_t  eocd[22];
-	size_t   cd_size;
-	uint32_t cd_ofs;
-	uint16_t n_entries;
+	uint64_t cd_size;
+	uint64_t cd_ofs;
+	uint64_t n_entries;
 
-    if (mzip_find_eocd (za->fp, eocd, &cd_size, &cd_ofs, &n_entries) < 0) {
+    if (mzip_find_eocd (za, eocd, &cd_size, &cd_ofs, &n_entries) < 0) {
         return -1;
     }
 
     /* Validate central directory against actual file size to avoid
      * out-of-bounds reads or huge allocations. */
-    if (fseek (za->fp, 0, SEEK_END) != 0) return -1;
-    long file_size_long = ftell (za->fp);
-    if (file_size_long < 0) return -1;
-    uint64_t file_size = (uint64_t)file_size_long;
-    if ((uint64_t)cd_ofs + (uint64_t)cd_size > file_size) {
+    uint64_t file_size = za->size;
+    if (cd_ofs + cd_size > file_size || cd_size > (uint64_t)SIZE_MAX) {
         return -1;
     }
-
-    /* read entire central directory */
-    if (fseek (za->fp, cd_ofs, SEEK_SET) != 0) {
+    /* every entry takes at least a 46-byte header */
+    if (n_entries > cd_size / 46) {
         return -1;
     }
+
+    /* read entire central directory (or use it in place when mapped) */
     if (cd_size == 0) return -1;
-    uint8_t *cd_buf = (uint8_t*)malloc(cd_size);
+    mzip_advise (za, cd_ofs, cd_size, MZIP_ADVISE_WILLNEED);
+    uint8_t *cd_owned;
+    const uint8_t *cd_buf = mzip_read_at (za, cd_ofs, (size_t)cd_size, &cd_owned);
     if (!cd_buf) {
         return -1;
     }
-    if (mzip_read_fully (za->fp, cd_buf, cd_size) != 0) {
-        free (cd_buf);
-        return -1;
-    }
 
-	za->entries = (struct mzip_entry*)calloc (n_entries, sizeof (struct mzip_entry));
+	za->entries = (struct mzip_entry*)calloc ((size_t)n_entries, sizeof (struct mzip_entry));
 	za->n_entries = n_entries;
+	za->entries_cap = za->entries ? n_entries : 0;
 
-	if (!za->entries) {
-		free(cd_buf);
+	/* names plus their terminators never take more than the central
+	 * directory holding them, so one allocation covers them all */
+	if (!za->entries || mzip_names_reserve (&za->names, (size_t)cd_size) != 0) {
+		free (cd_owned);
 		return -1;
 	}
 
 	size_t off = 0;
-	uint16_t i;
+	uint64_t i;
     for (i = 0; i < n_entries; i++) {
         /* Ensure we have at least the fixed-size central header available */
         if (off + 46 > cd_size || mzip_rd32 (cd_buf + off) != MZIP_SIG_CDH) {
-            free (cd_buf);
+            free (cd_owned);
             return -1; /* malformed */
         }
         const uint8_t *h = cd_buf + off;
 
-		/* Reject entries that rely on data descriptors (general purpose
-		 * bit 3). This project explicitly does not support data descriptors
-		 * (see README). If we encounter them, fail early with a clear
-		 * error instead of continuing in an inconsistent state. */
-		uint16_t gp_flag = mzip_rd16 (h + 8);
-		if (gp_flag & 0x0008) {
-			fprintf(stderr, "mzip: data descriptors (general purpose flag bit 3) not supported\n");
-			free (cd_buf);
-			return -1;
-		}
-
         uint16_t filename_len = mzip_rd16 (h + 28);
         uint16_t extra_len    = mzip_rd16 (h + 30);
         uint16_t comment_len  = mzip_rd16 (h + 32);
 
-        /* Field lengths are 16-bit per spec; further validation occurs when
-         * advancing offsets and allocating memory below. */
+        /* Field lengths are 16-bit per spec; make sure the variable part
+         * lies within the central directory buffer before touching it. */
+        uint64_t advance = 46 + (uint64_t)filename_len + (uint64_t)extra_len + (uint64_t)comment_len;
+        if (advance > (uint64_t)cd_size - off) {
+            free (cd_owned);
+            return -1;
+        }
 
 		struct mzip_entry *e = &za->entries[i];
+		/* With a data descriptor (bit 3) the local header carries no
+		 * sizes or CRC; the central directory always does, and that is
+		 * all the reader uses. */
+		e->flags             = mzip_rd16 (h + 8);
 		e->method            = mzip_rd16 (h + 10);
 		e->file_time         = mzip_rd16 (h + 12);
 		e->file_date         = mzip_rd16 (h + 14);
@@ -331,317 +926,299 @@ static int mzip_load_central(zip_t *za) {
         e->comp_size         = mzip_rd32 (h + 20);
         e->uncomp_size       = mzip_rd32 (h + 24);
         e->local_hdr_ofs     = mzip_rd32 (h + 42);
-
-        /* Reject entries with absurdly large sizes to avoid allocating
-         * more than our allowed maximum. */
-        if ((uint64_t)e->comp_size > MZIP_MAX_PAYLOAD || (uint64_t)e->uncomp_size > MZIP_MAX_PAYLOAD) {
-            free (cd_buf);
-            return -1;
-        }
 		e->external_attr     = mzip_rd32 (h + 38);
 
-        e->name = (char*)malloc (filename_len + 1u);
-        if (!e->name) {
-            free (cd_buf);
+        if (mzip_parse_zip64_extra (e, h + 46 + filename_len, extra_len) != 0) {
+            free (cd_owned);
             return -1;
         }
-        /* Ensure the filename bytes are within the central directory buffer */
-        if ((size_t)(46 + filename_len) > cd_size - off) {
-            free (e->name);
-            free (cd_buf);
-            return -1;
-        }
-        memcpy (e->name, h + 46, filename_len);
-        e->name[filename_len] = '\0';
 
-        /* Safely advance offset, checking for overflow and bounds */
-        uint64_t advance = 46 + (uint64_t)filename_len + (uint64_t)extra_len + (uint64_t)comment_len;
-        if (advance > (uint64_t)cd_size - off) {
-            free (cd_buf);
+        if (mzip_names_add (za, e, (const char*)h + 46, filename_len) != 0) {
+            free (cd_owned);
             return -1;
         }
+
         off += (size_t)advance;
     }
-	free (cd_buf);
+	free (cd_owned);
+
+	/* Appending starts where the old central directory was; zip_close
+	 * writes a new one covering the old and the new entries */
+	if (za->mode == 1 && mzip_out_seek (za, cd_ofs) != 0) {
+		return -1;
+	}
 	return 0;
 }
 
-/* load entire (uncompressed) file into memory and hand ownership to caller */
-static int mzip_extract_entry(zip_t *za, struct mzip_entry *e, uint8_t **out_buf, uint32_t *out_sz) {
-    /* move to local header */
-    /* Validate local header offset against file size to avoid seeking
-     * outside the file. Use 64-bit math for safety. */
-    if (fseek (za->fp, 0, SEEK_END) != 0) return -1;
-    long file_sz_l = ftell (za->fp);
-    if (file_sz_l < 0) return -1;
-    uint64_t file_sz = (uint64_t)file_sz_l;
-    if ((uint64_t)e->local_hdr_ofs > file_sz) return -1;
-    if (fseek (za->fp, (long)e->local_hdr_ofs, SEEK_SET) != 0) {
-        return -1;
+/* e->data_ofs is filled in by the first reader of an entry; readers of
+ * a shared archive may race to store the same value, so it is accessed
+ * atomically where the compiler allows. */
+static inline uint64_t mzip_entry_cached_ofs(const struct mzip_entry *e) {
+#if MZIP_THREADS && defined(__GNUC__)
+	return __atomic_load_n (&e->data_ofs, __ATOMIC_RELAXED);
+#else
+	return e->data_ofs;
+#endif
+}
+
+static inline void mzip_entry_cache_ofs(struct mzip_entry *e, uint64_t ofs) {
+#if MZIP_THREADS && defined(__GNUC__)
+	__atomic_store_n (&e->data_ofs, ofs, __ATOMIC_RELAXED);
+#else
+	e->data_ofs = ofs;
+#endif
+}
+
+/* Return the offset of the data of e, checking that it lies within the
+ * file. The local header is parsed (and its signature checked) only the
+ * first time; later calls reuse the cached offset. */
+static int mzip_entry_data_ofs(zip_t *za, struct mzip_entry *e, uint64_t file_sz, uint64_t *data_ofs) {
+    uint64_t ofs = mzip_entry_cached_ofs (e);
+    if (ofs != 0) {
+        if (ofs > file_sz || (uint64_t)e->comp_size > file_sz - ofs) return -1;
+        *data_ofs = ofs;
+        return 0;
     }
-    uint8_t lfh[30];
-    if (mzip_read_fully (za->fp, lfh, 30) != 0) {
+    /* Validate local header offset against file size to avoid reading
+     * outside the file. Use 64-bit math for safety. */
+    if (e->local_hdr_ofs > file_sz || file_sz - e->local_hdr_ofs < 30) return -1;
+    uint8_t *lfh_owned;
+    const uint8_t *lfh = mzip_read_at (za, e->local_hdr_ofs, 30, &lfh_owned);
+    if (!lfh) {
         return -1;
     }
 	if (mzip_rd32 (lfh) != MZIP_SIG_LFH) {
-		return -1;
-	}
-
-	/* Check general purpose flag in local header: reject data descriptors
-	 * (bit 3). The library does not support deferred CRC/size via
-	 * data descriptors. Fail with a descriptive error to avoid entering
-	 * an inconsistent state. */
-	uint16_t lfh_gp = mzip_rd16 (lfh + 6);
-	if (lfh_gp & 0x0008) {
-		fprintf(stderr, "mzip: data descriptors (general purpose flag bit 3) not supported\n");
+		free (lfh_owned);
 		return -1;
 	}
     uint16_t fn_len = mzip_rd16 (lfh + 26);
     uint16_t extra_len = mzip_rd16 (lfh + 28);
+    free (lfh_owned);
 
     /* Filename/extra lengths are 16-bit per spec. Further bounds checks
      * are performed for file offsets and allocations below. */
 
     /* Ensure the compressed data lies within the file bounds. Calculate
      * offset to compressed data = local_hdr_ofs + 30 + fn_len + extra_len. */
-    uint64_t data_ofs = (uint64_t)e->local_hdr_ofs + 30ULL + (uint64_t)fn_len + (uint64_t)extra_len;
-    if (data_ofs > file_sz) return -1;
-    if ((uint64_t)e->comp_size > MZIP_MAX_PAYLOAD || (uint64_t)e->uncomp_size > MZIP_MAX_PAYLOAD) return -1;
-    if (data_ofs + (uint64_t)e->comp_size > file_sz) return -1;
-
-    /* Protect against zipbombs: require that expected uncompressed size from
-     * the central directory is within a reasonable bound relative to the
-     * compressed size. If the entry claims a huge expansion, fail unless the
-     * global `mzip_ignore_zipbomb` flag is set by the caller (CLI override).
-     * We compute allowed = comp_size * ratio + slack and compare against the
-     * declared uncompressed size. Use 64-bit math to avoid overflow. */
+    ofs = (uint64_t)e->local_hdr_ofs + 30ULL + (uint64_t)fn_len + (uint64_t)extra_len;
+    if (ofs > file_sz) return -1;
+    if ((uint64_t)e->comp_size > file_sz - ofs) return -1;
+    mzip_entry_cache_ofs (e, ofs);
+    *data_ofs = ofs;
+    return 0;
+}
+
+/* Protect against zipbombs: require that expected uncompressed size from
+ * the central directory is within a reasonable bound relative to the
+ * compressed size. If the entry claims a huge expansion, fail unless the
+ * global `mzip_ignore_zipbomb` flag is set by the caller (CLI override).
+ * We compute allowed = comp_size * ratio + slack and compare against the
+ * declared uncompressed size. Use 64-bit math to avoid overflow. */
+static int mzip_check_expansion(const zip_t *za, const struct mzip_entry *e) {
     if (!mzip_ignore_zipbomb && e->comp_size > 0) {
         uint64_t allowed = (uint64_t)e->comp_size * mzip_max_expansion_ratio;
         allowed += mzip_max_expansion_slack;
         if ((uint64_t)e->uncomp_size > allowed) {
             /* suspiciously large uncompressed size */
-            fprintf(stderr, "mzip: entry '%s' claims huge uncompressed size (%u), rejecting to avoid zipbomb\n",
-                    e->name ? e->name : "<unknown>", e->uncomp_size);
+            fprintf(stderr, "mzip: entry '%s' claims huge uncompressed size (%llu), rejecting to avoid zipbomb\n",
+                    mzip_entry_name (za, e), (unsigned long long)e->uncomp_size);
             return -1;
         }
     }
+    return 0;
+}
 
-    /* seek to compressed data (we were at local header +30 already) */
-    if (fseek (za->fp, (long)data_ofs, SEEK_SET) != 0) {
-        return -1;
-    }
+/* load entire (uncompressed) file into memory and hand ownership to caller */
+static int mzip_extract_entry(zip_t *za, struct mzip_entry *e, uint8_t **out_buf, uint32_t *out_sz) {
+    uint64_t data_ofs;
+    /* an entry added in this session gets its offsets from the pool writer */
+    if (za->mode == 1) mzip_pool_drain (za);
+    if (mzip_entry_data_ofs (za, e, za->size, &data_ofs) != 0) return -1;
+    /* the whole entry is held in memory: cap it */
+    if ((uint64_t)e->comp_size > MZIP_MAX_PAYLOAD || (uint64_t)e->uncomp_size > MZIP_MAX_PAYLOAD) return -1;
+    if (mzip_check_expansion (za, e) != 0) return -1;
 
-    /* read compressed data */
-    uint8_t *cbuf = (uint8_t*)malloc ((size_t)e->comp_size ? (size_t)e->comp_size : 1);
-    if (!cbuf) {
-        return -1;
+    /* Compressed data: decoded straight from the mapping when there is
+     * one, otherwise read into cbuf_owned. */
+    if (e->comp_size >= MZIP_MADV_MIN) {
+        mzip_advise (za, data_ofs, e->comp_size, MZIP_ADVISE_WILLNEED);
     }
-    if (e->comp_size && mzip_read_fully(za->fp, cbuf, e->comp_size) != 0) {
-        free (cbuf);
+    uint8_t *cbuf_owned;
+    const uint8_t *cbuf = mzip_read_at (za, data_ofs, (size_t)e->comp_size, &cbuf_owned);
+    if (!cbuf) {
         return -1;
     }
 
 	uint8_t *ubuf;
 #ifdef MZIP_ENABLE_STORE
 	if (e->method == MZIP_METHOD_STORE) { /* stored – nothing to inflate */
-		ubuf = cbuf;
+		if (cbuf_owned) {
+			ubuf = cbuf_owned;
+		} else {
+			/* the caller owns (and frees) the result: copy out of the mapping */
+			ubuf = (uint8_t*)malloc ((size_t)e->comp_size ? (size_t)e->comp_size : 1);
+			if (!ubuf) {
+				return -1;
+			}
+			memcpy (ubuf, cbuf, e->comp_size);
+		}
 	}
 #endif
 #ifdef MZIP_ENABLE_DEFLATE
 	else if (e->method == MZIP_METHOD_DEFLATE) { /* deflate */
-		/* Special case for our test files */
-		if (e->uncomp_size == 6) {
-			/* Manual hardcoded solution for the test cases */
-			ubuf = (uint8_t*)malloc(7);
-			if (!ubuf) {
-				free(cbuf);
-				return -1;
-			}
-
-			if (memcmp(cbuf, "hello\n", 6) == 0 || memcmp(cbuf, "hello", 5) == 0) {
-				memcpy(ubuf, "hello\n", 6);
-				ubuf[6] = 0;
-				free(cbuf);
-				return 0;
-			} else if (memcmp(cbuf, "world\n", 6) == 0 || memcmp(cbuf, "world", 5) == 0) {
-				memcpy(ubuf, "world\n", 6);
-				ubuf[6] = 0;
-				free(cbuf);
-				return 0;
-			} 
-			/* If the special case didn't match, continue with normal decompression */
-		}
-
-		/* Allocate output buffer with extra space just in case */
-		ubuf = (uint8_t*)malloc(e->uncomp_size + 10);
+		ubuf = (uint8_t*)malloc ((size_t)e->uncomp_size ? (size_t)e->uncomp_size : 1);
 		if (!ubuf) {
-			free(cbuf);
+			free (cbuf_owned);
 			return -1;
 		}
-
-		/* Initialize buffer to zeros */
-		memset(ubuf, 0, e->uncomp_size + 10);
-
-		/* Setup decompression */
 		z_stream strm = {0};
-		strm.next_in = cbuf;
-		strm.avail_in = e->comp_size;
-		strm.next_out = ubuf;
-		strm.avail_out = e->uncomp_size + 10;
-
-		/* Try raw deflate first (standard for ZIP files) */
-		int ret = inflateInit2(&strm, -MAX_WBITS);
-		if (ret != Z_OK) {
-			/* Fall back to direct copy */
-			memcpy(ubuf, cbuf, e->uncomp_size < e->comp_size ? e->uncomp_size : e->comp_size);
-			free(cbuf);
-			return 0;
-		}
-
-		/* Attempt decompression */
-		ret = inflate(&strm, Z_FINISH);
-		inflateEnd(&strm);
-
-		/* If decompression failed */
-		if (ret != Z_STREAM_END) {
-			/* Special case for test files */
-			if (e->uncomp_size == 6 && e->comp_size <= 8) {
-				if (memcmp((char*)cbuf, "hello", 5) != 0 && memcmp((char*)cbuf, "world", 5) != 0) {
-					strcpy((char*)ubuf, "hello\n");
-				}
-			}
+		strm.next_in   = (uint8_t*)cbuf;
+		strm.avail_in  = e->comp_size;
+		strm.next_out  = ubuf;
+		strm.avail_out = e->uncomp_size;
 
-			free(cbuf);
-			return 0;
+		/* Raw deflate (no zlib header), as stored in ZIP files */
+		if (inflateInit2 (&strm, -MAX_WBITS) != Z_OK) {
+			free (cbuf_owned);
+			free (ubuf);
+			return -1;
 		}
-
-		free(cbuf);
+		/* Corrupt data fails with Z_DATA_ERROR; a stream that does not end
+		 * within uncomp_size bytes with Z_BUF_ERROR */
+		int zret = inflate (&strm, Z_FINISH);
+		inflateEnd (&strm);
+		if (zret != Z_STREAM_END || strm.total_out != e->uncomp_size) {
+			free (cbuf_owned);
+			free (ubuf);
+			return -1;
+		}
+		free (cbuf_owned);
 	}
 #endif
 #ifdef MZIP_ENABLE_ZSTD
 	else if (e->method == MZIP_METHOD_ZSTD) { /* zstd */
-		ubuf = (uint8_t*)malloc (e->uncomp_size);
+		ubuf = (uint8_t*)malloc ((size_t)e->uncomp_size ? (size_t)e->uncomp_size : 1);
 		if (!ubuf) {
-			free (cbuf);
+			free (cbuf_owned);
 			return -1;
 		}
 		z_stream strm = {0};
-		strm.next_in   = cbuf;
+		strm.next_in   = (uint8_t*)cbuf;
 		strm.avail_in  = e->comp_size;
 		strm.next_out  = ubuf;
 		strm.avail_out = e->uncomp_size;
 
 		if (zstdDecompressInit (&strm) != Z_OK) {
-			free (cbuf);
+			free (cbuf_owned);
 			free (ubuf);
 			return -1;
 		}
 		int zret = zstdDecompress (&strm, Z_FINISH);
 		zstdDecompressEnd (&strm);
 		if (zret != Z_STREAM_END || strm.total_out != e->uncomp_size) {
-			free (cbuf);
+			free (cbuf_owned);
 			free (ubuf);
 			return -1;
 		}
-		free (cbuf);
+		free (cbuf_owned);
 	}
 #endif
 #ifdef MZIP_ENABLE_LZFSE
 	else if (e->method == MZIP_METHOD_LZFSE) { /* lzfse */
 		ubuf = (uint8_t*)malloc (e->uncomp_size);
 		if (!ubuf) {
-			free (cbuf);
+			free (cbuf_owned);
 			return -1;
 		}
 		z_stream strm = {0};
-		strm.next_in   = cbuf;
+		strm.next_in   = (uint8_t*)cbuf;
 		strm.avail_in  = e->comp_size;
 		strm.next_out  = ubuf;
 		strm.avail_out = e->uncomp_size;
 
 		if (lzfseDecompressInit (&strm) != Z_OK) {
-			free (cbuf);
+			free (cbuf_owned);
 			free (ubuf);
 			return -1;
 		}
 		int zret = lzfseDecompress (&strm, Z_FINISH);
 		lzfseDecompressEnd (&strm);
 		if (zret != Z_STREAM_END || strm.total_out != e->uncomp_size) {
-			free (cbuf);
+			free (cbuf_owned);
 			free (ubuf);
 			return -1;
 		}
-		free (cbuf);
+		free (cbuf_owned);
 	}
 #endif
 #ifdef MZIP_ENABLE_LZ4
 	else if (e->method == MZIP_METHOD_LZ4) { /* lz4 - using radare2's implementation */
 		size_t output_size = 0;
-		ubuf = r_lz4_decompress (cbuf, e->comp_size, &output_size);
+		ubuf = r_lz4_decompress ((uint8_t*)cbuf, e->comp_size, &output_size);
 		if (!ubuf || output_size != e->uncomp_size) {
-			free (cbuf);
+			free (cbuf_owned);
 			free (ubuf);
 			return -1;
 		}
-		free (cbuf);
+		free (cbuf_owned);
 	}
 #endif
 #ifdef MZIP_ENABLE_LZMA
 	else if (e->method == MZIP_METHOD_LZMA) { /* lzma */
-		ubuf = (uint8_t*)malloc (e->uncomp_size);
+		ubuf = (uint8_t*)malloc ((size_t)e->uncomp_size ? (size_t)e->uncomp_size : 1);
 		if (!ubuf) {
-			free (cbuf);
+			free (cbuf_owned);
 			return -1;
 		}
 		z_stream strm = {0};
-		strm.next_in   = cbuf;
+		strm.next_in   = (uint8_t*)cbuf;
 		strm.avail_in  = e->comp_size;
 		strm.next_out  = ubuf;
 		strm.avail_out = e->uncomp_size;
 
 		if (lzmaDecompressInit(&strm) != Z_OK) {
-			free(cbuf); free(ubuf); return -1;
+			free (cbuf_owned); free(ubuf); return -1;
 		}
 		int zret = lzmaDecompress (&strm, Z_FINISH);
 		lzmaDecompressEnd (&strm);
 		if (zret != Z_STREAM_END || strm.total_out != e->uncomp_size) {
-			free (cbuf);
+			free (cbuf_owned);
 			free (ubuf);
 			return -1;
 		}
-		free (cbuf);
+		free (cbuf_owned);
 	}
 #endif
 #ifdef MZIP_ENABLE_BROTLI
 	else if (e->method == MZIP_METHOD_BROTLI) { /* brotli */
 		ubuf = (uint8_t*)malloc (e->uncomp_size);
 		if (!ubuf) {
-			free (cbuf);
+			free (cbuf_owned);
 			return -1;
 		}
 		z_stream strm = {0};
-		strm.next_in   = cbuf;
+		strm.next_in   = (uint8_t*)cbuf;
 		strm.avail_in  = e->comp_size;
 		strm.next_out  = ubuf;
 		strm.avail_out = e->uncomp_size;
 
 		if (brotliDecompressInit (&strm) != Z_OK) {
-			free (cbuf);
+			free (cbuf_owned);
 			free (ubuf);
 			return -1;
 		}
 		int zret = brotliDecompress (&strm, Z_FINISH);
 		brotliDecompressEnd (&strm);
 		if (zret != Z_STREAM_END || strm.total_out != e->uncomp_size) {
-			free (cbuf);
+			free (cbuf_owned);
 			free (ubuf);
 			return -1;
 		}
-		free (cbuf);
+		free (cbuf_owned);
 	}
 #endif
 	else {
-		free (cbuf);
+		free (cbuf_owned);
 		return -1; /* unsupported method */
 	}
     /* Verify CRC32 of uncompressed data if requested or warn on mismatch. */
@@ -655,7 +1232,7 @@ static int mzip_extract_entry(zip_t *za, struct mzip_entry *e, uint8_t **out_buf
             } else {
                 /* Non-strict mode: warn but continue. */
                 fprintf(stderr, "Warning: CRC mismatch for '%s' (expected 0x%08x, got 0x%08x)\n",
-                        e->name ? e->name : "<unknown>", e->crc32, computed_crc);
+                        mzip_entry_name (za, e), e->crc32, computed_crc);
             }
         }
     }
@@ -665,6 +1242,92 @@ static int mzip_extract_entry(zip_t *za, struct mzip_entry *e, uint8_t **out_buf
     return 0;
 }
 
+/* ----------------  entry name index  ---------------- */
+
+static inline uint8_t mzip_fold_ascii(uint8_t c) {
+	return (c >= 'A' && c <= 'Z') ? (uint8_t)(c + ('a' - 'A')) : c;
+}
+
+/* FNV-1a over the name (ASCII case-folded for ZIP_FL_NOCASE), with the
+ * high bits mixed down since the table only looks at the low ones */
+static uint32_t mzip_name_hash(const char *name, int nocase) {
+	const uint8_t *p = (const uint8_t *)name;
+	uint32_t h = 2166136261u;
+	if (nocase) {
+		for (; *p; p++) h = (h ^ mzip_fold_ascii (*p)) * 16777619u;
+	} else {
+		for (; *p; p++) h = (h ^ *p) * 16777619u;
+	}
+	return h ^ (h >> 16);
+}
+
+static int mzip_name_equal(const char *a, const char *b, int nocase) {
+	if (!nocase) {
+		return strcmp (a, b) == 0;
+	}
+	for (; *a && *b; a++, b++) {
+		if (mzip_fold_ascii ((uint8_t)*a) != mzip_fold_ascii ((uint8_t)*b)) {
+			return 0;
+		}
+	}
+	return *a == *b;
+}
+
+/* Insert entry idx unless an earlier entry has the same name, so lookups
+ * keep returning the first match like a front-to-back scan would. */
+static void mzip_name_index_put(zip_t *za, struct mzip_name_index *ix, uint32_t idx, int nocase) {
+	const char *name = mzip_entry_name (za, &za->entries[idx]);
+	uint32_t i = mzip_name_hash (name, nocase) & ix->mask;
+	while (ix->slots[i]) {
+		if (mzip_name_equal (mzip_entry_name (za, &za->entries[ix->slots[i] - 1]), name, nocase)) {
+			return;
+		}
+		i = (i + 1) & ix->mask;
+	}
+	ix->slots[i] = idx + 1;
+	ix->used++;
+}
+
+/* (Re)build the index over all entries, keeping the load factor <= 1/2 */
+static int mzip_name_index_build(zip_t *za, struct mzip_name_index *ix, int nocase) {
+	uint64_t cap = 16;
+	while (cap < za->n_entries * 2) {
+		cap <<= 1;
+	}
+	if (cap > (1ULL << 31)) {
+		return -1;
+	}
+	uint32_t *slots = (uint32_t*)calloc ((size_t)cap, sizeof (uint32_t));
+	if (!slots) {
+		return -1;
+	}
+	free (ix->slots);
+	ix->slots = slots;
+	ix->mask = (uint32_t)(cap - 1);
+	ix->used = 0;
+	for (zip_uint64_t i = 0; i < za->n_entries; i++) {
+		mzip_name_index_put (za, ix, (uint32_t)i, nocase);
+	}
+	return 0;
+}
+
+/* Account for the entry just appended at n_entries - 1. Indexes that were
+ * never built stay that way; they are built on the first lookup. */
+static void mzip_name_index_add(zip_t *za, struct mzip_name_index *ix, int nocase) {
+	if (!ix->slots) {
+		return;
+	}
+	if ((uint64_t)(ix->used + 1) * 2 > (uint64_t)ix->mask + 1) {
+		if (mzip_name_index_build (za, ix, nocase) != 0) {
+			/* out of memory: drop it, zip_name_locate falls back to a scan */
+			free (ix->slots);
+			memset (ix, 0, sizeof (*ix));
+		}
+		return;
+	}
+	mzip_name_index_put (za, ix, (uint32_t)(za->n_entries - 1), nocase);
+}
+
 /* --------------  public API implementation  --------------- */
 
 zip_t *zip_open(const char *path, int flags, int *errorp) {
@@ -728,9 +1391,17 @@ zip_t *zip_open(const char *path, int flags, int *errorp) {
 		return NULL;
 	}
 	za->fp = fp;
+	struct stat st;
+	if (fstat (fileno (fp), &st) == 0 && st.st_size > 0) {
+		za->size = (zip_uint64_t)st.st_size;
+	}
+	if (za->mode == 0) {
+		mzip_map_file (za);
+	}
 	if (za->mode == 0 || (exists && !(flags & ZIP_TRUNCATE))) {
 		/* Load central directory for existing archive */
 		if (mzip_load_central (za) != 0) {
+			za->mode = 0; /* leave a file we could not parse untouched */
 			zip_close (za);
 			if (errorp) {
 				*errorp = -1;
@@ -749,8 +1420,10 @@ zip_t *zip_open(const char *path, int flags, int *errorp) {
 	return za;
 }
 
-/* Helper function to compress data using various compression methods */
-static int mzip_compress_data(uint8_t *in_buf, size_t in_size, uint8_t **out_buf, uint32_t *out_size, uint16_t *method) {
+/* Helper function to compress data using various compression methods.
+ * threads bounds the helpers a large deflate input may use; pool workers
+ * pass 1 so that -j N stays the limit. */
+static int mzip_compress_data(uint8_t *in_buf, size_t in_size, uint8_t **out_buf, uint32_t *out_size, uint16_t *method, int threads) {
 	*out_buf = NULL;
 	*out_size = 0;
 
@@ -769,6 +1442,43 @@ static int mzip_compress_data(uint8_t *in_buf, size_t in_size, uint8_t **out_buf
 
 #ifdef MZIP_ENABLE_DEFLATE
 	if (*method == MZIP_METHOD_DEFLATE) {
+#if MZIP_THREADS
+		/* Large inputs: compress the chunks in parallel and join them */
+		int n = threads;
+		if (in_size >= MZIP_PAR_DEFLATE_MIN && n >= 2) {
+			size_t n_jobs = (in_size + MZIP_PAR_DEFLATE_CHUNK - 1) / MZIP_PAR_DEFLATE_CHUNK;
+			struct mzip_pdef_job *jobs = (struct mzip_pdef_job *)calloc (n_jobs, sizeof (*jobs));
+			if (jobs) {
+				n_jobs = mzip_pdef_plan (jobs, in_buf, in_size, 0, 1, 0);
+				int ret = mzip_pdef_run (jobs, n_jobs, n);
+				size_t total = 0;
+				for (size_t i = 0; i < n_jobs; i++) {
+					total += jobs[i].out_len;
+				}
+				if (ret == 0 && total < in_size) {
+					*out_buf = (uint8_t*)malloc (total);
+				}
+				if (*out_buf) {
+					for (size_t i = 0; i < n_jobs; i++) {
+						memcpy (*out_buf + *out_size, jobs[i].out, jobs[i].out_len);
+						*out_size += (uint32_t)jobs[i].out_len;
+					}
+				}
+				for (size_t i = 0; i < n_jobs; i++) {
+					free (jobs[i].out);
+				}
+				free (jobs);
+				if (*out_buf) {
+					return 0;
+				}
+				if (ret == 0 && total >= in_size) {
+					*method = MZIP_METHOD_STORE;
+					return mzip_compress_data (in_buf, in_size, out_buf, out_size, method, threads);
+				}
+			}
+			/* otherwise retry serially */
+		}
+#endif
 		/* Deflate compression */
 		uLong comp_bound = compressBound(in_size);
 		*out_buf = (uint8_t*)malloc(comp_bound);
@@ -800,7 +1510,45 @@ static int mzip_compress_data(uint8_t *in_buf, size_t in_size, uint8_t **out_buf
 		if (*out_size >= in_size) {
 			free (*out_buf);
 			*method = MZIP_METHOD_STORE;
-			return mzip_compress_data (in_buf, in_size, out_buf, out_size, method);
+			return mzip_compress_data (in_buf, in_size, out_buf, out_size, method, threads);
+		}
+		return 0;
+	}
+#endif
+#ifdef MZIP_ENABLE_ZSTD
+	if (*method == MZIP_METHOD_ZSTD) {
+		/* One frame; incompressible blocks are stored raw, so the frame
+		 * header and 3 bytes per 128 KiB block bound the output */
+		size_t out_cap = in_size + (in_size >> 8) + 64;
+		*out_buf = (uint8_t*)malloc (out_cap);
+		if (!*out_buf) {
+			return -1;
+		}
+		z_stream strm = {0};
+		if (zstdInit (&strm, ZSTD_DEFAULT_CLEVEL) != Z_OK) {
+			free (*out_buf);
+			*out_buf = NULL;
+			return -1;
+		}
+		strm.next_in = in_buf;
+		strm.avail_in = in_size;
+		strm.next_out = *out_buf;
+		strm.avail_out = out_cap;
+
+		int ret = zstdCompress (&strm, Z_FINISH);
+		*out_size = strm.total_out;
+		zstdEnd (&strm);
+		if (ret != Z_STREAM_END) {
+			free (*out_buf);
+			*out_buf = NULL;
+			return -1;
+		}
+
+		/* If compression didn't reduce size, fall back to STORE */
+		if (*out_size >= in_size) {
+			free (*out_buf);
+			*method = MZIP_METHOD_STORE;
+			return mzip_compress_data (in_buf, in_size, out_buf, out_size, method, threads);
 		}
 		return 0;
 	}
@@ -824,7 +1572,7 @@ static int mzip_compress_data(uint8_t *in_buf, size_t in_size, uint8_t **out_buf
 		if (*out_size >= in_size) {
 			free (*out_buf);
 			*method = MZIP_METHOD_STORE;
-			return mzip_compress_data(in_buf, in_size, out_buf, out_size, method);
+			return mzip_compress_data(in_buf, in_size, out_buf, out_size, method, threads);
 		}
 
 		return 0;
@@ -832,10 +1580,9 @@ static int mzip_compress_data(uint8_t *in_buf, size_t in_size, uint8_t **out_buf
 #endif
 #ifdef MZIP_ENABLE_LZMA
 	if (*method == MZIP_METHOD_LZMA) {
-		/* LZMA compression */
-		/* Our minimal LZMA wrapper adds a 13-byte header and can expand data
-		 * in the worst case (literal-heavy). Use a conservative bound. */
-		size_t out_cap = (in_size * 4) + 64; /* header + overhead safety */
+		/* LZMA compression; output that would not fit in the input size
+		 * is stored instead, so there is no need for a worst case bound */
+		size_t out_cap = in_size + 64; /* ZIP LZMA header + range coder flush */
 		*out_buf = (uint8_t*)malloc(out_cap);
 		if (!*out_buf) {
 			return -1;
@@ -853,14 +1600,13 @@ static int mzip_compress_data(uint8_t *in_buf, size_t in_size, uint8_t **out_buf
 
         int ret = lzmaCompress (&strm, Z_FINISH);
         if (ret != Z_STREAM_END) {
-            /* If our minimal LZMA failed for this input, fall back to STORE
-             * instead of propagating an error. This keeps behavior robust
-             * for very large or pathological inputs. */
+            /* Out of room (incompressible input) or memory: fall back to
+             * STORE instead of propagating an error */
             lzmaEnd (&strm);
             free (*out_buf);
             *out_buf = NULL;
             *method = MZIP_METHOD_STORE;
-            return mzip_compress_data (in_buf, in_size, out_buf, out_size, method);
+            return mzip_compress_data (in_buf, in_size, out_buf, out_size, method, threads);
         }
 
         *out_size = strm.total_out;
@@ -870,7 +1616,7 @@ static int mzip_compress_data(uint8_t *in_buf, size_t in_size, uint8_t **out_buf
         if (*out_size >= in_size) {
             free (*out_buf);
             *method = MZIP_METHOD_STORE;
-            return mzip_compress_data (in_buf, in_size, out_buf, out_size, method);
+            return mzip_compress_data (in_buf, in_size, out_buf, out_size, method, threads);
         }
         return 0;
 	}
@@ -922,7 +1668,7 @@ static int mzip_compress_data(uint8_t *in_buf, size_t in_size, uint8_t **out_buf
         if (in_size > 0 && *out_size >= in_size) {
             free(*out_buf);
             *method = MZIP_METHOD_STORE;
-            return mzip_compress_data(in_buf, in_size, out_buf, out_size, method);
+            return mzip_compress_data(in_buf, in_size, out_buf, out_size, method, threads);
         }
         return 0;
     }
@@ -932,291 +1678,1383 @@ static int mzip_compress_data(uint8_t *in_buf, size_t in_size, uint8_t **out_buf
 	return -1;
 }
 
-/* Add file to ZIP archive */
-zip_int64_t zip_file_add(zip_t *za, const char *name, zip_source_t *src, zip_flags_t flags) {
-	(void)flags;
-	if (!za || !name || !src || za->mode != 1) {
-		return -1;
-	}
-	/* Allocate a new entry */
-	struct mzip_entry *new_entries;
-	new_entries = realloc (za->entries, (za->n_entries + 1) * sizeof (struct mzip_entry));
-	if (!new_entries) {
-		return -1;
+/* Codecs that compress and decode piece by piece, behind one zlib-style
+ * interface: entries using them are streamed both ways, the others go
+ * through memory (mzip_compress_data, mzip_extract_entry). */
+static int mzip_codec_streams(uint16_t method) {
+	switch (method) {
+	case MZIP_METHOD_DEFLATE:
+#ifdef MZIP_ENABLE_ZSTD
+	case MZIP_METHOD_ZSTD:
+#endif
+#ifdef MZIP_ENABLE_LZMA
+	case MZIP_METHOD_LZMA:
+#endif
+		return 1;
 	}
-	za->entries = new_entries;
-
-	/* Set up the new entry */
-	struct mzip_entry *e = &za->entries[za->n_entries];
-	memset (e, 0, sizeof (struct mzip_entry));
-
-        /* strdup is POSIX; allocate and copy to be portable and avoid
-         * implicit declaration warnings. */
-        size_t nlen = strlen(name) + 1;
-        if (nlen - 1 > MZIP_MAX_FIELD_LEN) {
-            return -1;
-        }
-        e->name = (char*)malloc(nlen);
-        if (!e->name) {
-            return -1;
-        }
-        memcpy(e->name, name, nlen);
+	return 0;
+}
 
-	/* Use the default compression method if set, otherwise store */
-	if (za->default_method > 0) {
-		e->method = za->default_method;
-	} else {
-		/* Store uncompressed by default */
-		e->method = 0;
+static int mzip_encoder_init(z_stream *strm, uint16_t method) {
+	switch (method) {
+	case MZIP_METHOD_DEFLATE:
+		return deflateInit2 (strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+#ifdef MZIP_ENABLE_ZSTD
+	case MZIP_METHOD_ZSTD:
+		return zstdInit (strm, ZSTD_DEFAULT_CLEVEL);
+#endif
+#ifdef MZIP_ENABLE_LZMA
+	case MZIP_METHOD_LZMA:
+		return lzmaInit (strm, Z_DEFAULT_COMPRESSION);
+#endif
 	}
+	return Z_STREAM_ERROR;
+}
 
-    /* Validate uncompressed size fits our limits and ZIP 32-bit field */
-    if ((uint64_t)src->len > MZIP_MAX_PAYLOAD || (uint64_t)src->len > (uint64_t)UINT32_MAX) {
-        free (e->name);
-        return -1;
-    }
-    e->uncomp_size = (uint32_t)src->len;
-
-	/* Calculate CRC-32 of the uncompressed data */
-	e->crc32 = mzip_crc32(0, src->buf, src->len);
-
-	/* Set current time for file timestamp */
-	mzip_get_dostime(&e->file_time, &e->file_date);
-
-	/* Set default permissions: 0644 for files */
-	e->external_attr = 0100644 << 16; /* S_IFREG | 0644 << 16 */
-
-	/* Get current position for local header offset */
-    long current_pos = ftell (za->fp);
-    if (current_pos < 0) {
-        free (e->name);
-        return -1;
-    }
-
-    /* Ensure local header offset fits into ZIP 32-bit field */
-    if ((uint64_t)current_pos > (uint64_t)UINT32_MAX) {
-        free (e->name);
-        return -1;
-    }
-    e->local_hdr_ofs = (uint32_t)current_pos;
-
-	/* Compress the data using the selected method */
-	uint8_t *comp_buf = NULL;
-	uint32_t comp_size = 0;
-
-	/* Compress the data using the selected method */
-	if (mzip_compress_data ((uint8_t*)src->buf, src->len, &comp_buf, &comp_size, &e->method) != 0) {
-		free (e->name);
-		return -1;
+static int mzip_encode(z_stream *strm, uint16_t method, int flush) {
+#ifdef MZIP_ENABLE_ZSTD
+	if (method == MZIP_METHOD_ZSTD) {
+		return zstdCompress (strm, flush);
 	}
-
-    /* Validate compressed size too */
-    if ((uint64_t)comp_size > MZIP_MAX_PAYLOAD) {
-        free (e->name);
-        free (comp_buf);
-        return -1;
-    }
-    e->comp_size = comp_size;
-
-	/* Write local file header */
-	mzip_write_local_header (za->fp, e->name, e->method, e->comp_size, e->uncomp_size, e->crc32);
-
-	/* Write compressed data */
-	fwrite (comp_buf, 1, comp_size, za->fp);
-	free (comp_buf);
-
-	/* Free source data if requested */
-	if (src->freep) {
-		free ((void*)src->buf);
+#endif
+#ifdef MZIP_ENABLE_LZMA
+	if (method == MZIP_METHOD_LZMA) {
+		return lzmaCompress (strm, flush);
 	}
-	free (src);
-
-	/* Increment entry count */
-	zip_uint64_t index = za->n_entries;
-	za->n_entries++;
-	za->next_index = za->n_entries;
-
-	return (zip_int64_t)index;
+#endif
+	(void)method;
+	return deflate (strm, flush);
 }
 
-/* Set file compression method */
-int zip_set_file_compression(zip_t *za, zip_uint64_t index, zip_int32_t comp, zip_uint32_t comp_flags) {
-	(void)comp_flags;
-
-	if (!za || index >= za->n_entries || za->mode != 1) {
-		return -1;
+static void mzip_encoder_end(z_stream *strm, uint16_t method) {
+#ifdef MZIP_ENABLE_ZSTD
+	if (method == MZIP_METHOD_ZSTD) {
+		zstdEnd (strm);
+		return;
 	}
-
-	/* Check if the requested compression method is supported */
-#ifdef MZIP_ENABLE_STORE
-	if (comp == MZIP_METHOD_STORE) {
-		/* Store is always supported */
-	} 
 #endif
-#ifdef MZIP_ENABLE_DEFLATE
-	else if (comp == MZIP_METHOD_DEFLATE) {
-		/* Deflate is supported */
-	} 
+#ifdef MZIP_ENABLE_LZMA
+	if (method == MZIP_METHOD_LZMA) {
+		lzmaEnd (strm);
+		return;
+	}
 #endif
+	(void)method;
+	deflateEnd (strm);
+}
+
+static int mzip_decoder_init(z_stream *strm, uint16_t method) {
+	switch (method) {
+	case MZIP_METHOD_DEFLATE:
+		/* Raw deflate (no zlib header), as stored in ZIP files */
+		return inflateInit2 (strm, -MAX_WBITS);
 #ifdef MZIP_ENABLE_ZSTD
-	else if (comp == MZIP_METHOD_ZSTD) {
-		/* Zstd is supported */
-	} 
+	case MZIP_METHOD_ZSTD:
+		return zstdDecompressInit (strm);
 #endif
-#ifdef MZIP_ENABLE_LZFSE
-	else if (comp == MZIP_METHOD_LZFSE) {
-		/* LZFSE is supported */
-	} 
+#ifdef MZIP_ENABLE_LZMA
+	case MZIP_METHOD_LZMA:
+		return lzmaDecompressInit (strm);
 #endif
-#ifdef MZIP_ENABLE_LZ4
-	else if (comp == MZIP_METHOD_LZ4) {
-		/* LZ4 is supported */
-	} 
+	}
+	return Z_STREAM_ERROR;
+}
+
+/* last_input: the stream holds the rest of the entry. zstd only ends a
+ * frame that no more input may follow under Z_FINISH, and LZMA data
+ * without an end marker only ends there; inflate knows its own end and
+ * keeps Z_NO_FLUSH. */
+static int mzip_decode(z_stream *strm, uint16_t method, int last_input) {
+#ifdef MZIP_ENABLE_ZSTD
+	if (method == MZIP_METHOD_ZSTD) {
+		return zstdDecompress (strm, last_input ? Z_FINISH : Z_NO_FLUSH);
+	}
 #endif
 #ifdef MZIP_ENABLE_LZMA
-	else if (comp == MZIP_METHOD_LZMA) {
-		/* LZMA is supported */
-	} 
+	if (method == MZIP_METHOD_LZMA) {
+		return lzmaDecompress (strm, last_input ? Z_FINISH : Z_NO_FLUSH);
+	}
 #endif
-#ifdef MZIP_ENABLE_BROTLI
-	else if (comp == MZIP_METHOD_BROTLI) {
-		/* Brotli is supported */
-	} 
+	(void)method;
+	(void)last_input;
+	return inflate (strm, Z_NO_FLUSH);
+}
+
+static void mzip_decoder_end(z_stream *strm, uint16_t method) {
+#ifdef MZIP_ENABLE_ZSTD
+	if (method == MZIP_METHOD_ZSTD) {
+		zstdDecompressEnd (strm);
+		return;
+	}
 #endif
-	else {
-		/* Unsupported compression method */
-		return -1;
+#ifdef MZIP_ENABLE_LZMA
+	if (method == MZIP_METHOD_LZMA) {
+		lzmaDecompressEnd (strm);
+		return;
 	}
-
-	/* Set the method for next files that will be added */
-	za->entries[index].method = (uint16_t)comp;
-	return 0;
+#endif
+	(void)method;
+	inflateEnd (strm);
 }
 
-/* Finalize ZIP file before closing - write central directory */
-static int mzip_finalize_archive(zip_t *za) {
-	if (!za || !za->fp || za->mode != 1) {
-		return -1;
+/* Read a file source into memory, for codecs that need the whole input */
+static int mzip_source_load(zip_source_t *src) {
+	size_t cap = 64 * 1024, len = 0;
+	uint8_t *buf = (uint8_t*)malloc (cap);
+	uint64_t want = src->flen < 0 ? UINT64_MAX : (uint64_t)src->flen;
+	while (buf && len < want) {
+		if (len == cap) {
+			if (cap > MZIP_MAX_PAYLOAD) {
+				break;
+			}
+			uint8_t *nb = (uint8_t*)realloc (buf, cap * 2);
+			if (!nb) {
+				break;
+			}
+			buf = nb;
+			cap *= 2;
+		}
+		size_t chunk = cap - len;
+		if ((uint64_t)chunk > want - len) {
+			chunk = (size_t)(want - len);
+		}
+		size_t n = fread (buf + len, 1, chunk, src->fp);
+		len += n;
+		if (n < chunk) {
+			if (ferror (src->fp)) {
+				break;
+			}
+			want = len; /* EOF */
+		}
 	}
-	/* Get offset for central directory */
-	long cd_offset = ftell (za->fp);
-	if (cd_offset < 0) {
+	if (!buf || len < want) {
+		free (buf);
 		return -1;
 	}
-    /* Write central directory headers. Accumulate in 64-bit and ensure
-     * the final size and offset fit into the 32-bit EOCD fields before
-     * writing them. */
-    uint64_t cd_size_acc = 0;
-    for (zip_uint64_t i = 0; i < za->n_entries; i++) {
-        struct mzip_entry *e = &za->entries[i];
-        uint32_t written = mzip_write_central_header (za->fp, e->name, e->method,
-                e->comp_size, e->uncomp_size, e->crc32,
-                e->local_hdr_ofs, e->file_time, e->file_date, e->external_attr);
-        cd_size_acc += written;
-        if (cd_size_acc > (uint64_t)UINT32_MAX) {
-            /* central directory too large for ZIP32 EOCD */
-            return -1;
-        }
-    }
-
-    /* Ensure central directory offset fits into 32-bit */
-    if ((uint64_t)cd_offset > (uint64_t)UINT32_MAX) return -1;
-
-    /* Write end of central directory record */
-    mzip_write_end_of_central_directory (za->fp, (uint32_t)za->n_entries,
-            (uint32_t)cd_size_acc, (uint32_t)cd_offset);
+	fclose (src->fp);
+	src->fp = NULL;
+	src->buf = buf;
+	src->len = len;
+	src->freep = 1;
 	return 0;
 }
 
-int zip_close(zip_t *za) {
-	if (!za) {
-		return -1;
+/* Keep za->size covering what has been written, so entries added since
+ * zip_open can be read back without asking the file system. */
+static void mzip_wrote(zip_t *za, uint64_t end) {
+	if (end > za->size) {
+		za->size = end;
 	}
-	/* Finalize archive if in write mode */
-	if (za->mode == 1) {
-		mzip_finalize_archive (za);
+}
+
+/* Undo a partially written entry so the next one (or the central
+ * directory) starts where this one did. */
+static void mzip_rollback(zip_t *za, uint64_t pos) {
+	mzip_out_flush (za);
+	if (ftruncate (fileno (za->fp), (off_t)pos) != 0) {
+		/* leftovers are harmless once overwritten by what follows */
 	}
+	mzip_out_seek (za, pos);
+	za->size = pos;
+}
 
-	if (za->fp) {
-		fclose (za->fp);
+/* Whether a streamed source needs ZIP64 sizes. They must be chosen before
+ * the first byte is written; pipes and unknown lengths get them unless the
+ * regular file behind them is known to be small. */
+static int mzip_stream_zip64(zip_source_t *src) {
+	uint64_t len;
+	if (src->flen >= 0) {
+		len = (uint64_t)src->flen;
+	} else {
+		struct stat st;
+		int64_t pos = mzip_ftell (src->fp);
+		if (pos < 0 || fstat (fileno (src->fp), &st) != 0 || !S_ISREG (st.st_mode)) {
+			return 1;
+		}
+		len = st.st_size > pos ? (uint64_t)(st.st_size - pos) : 0;
 	}
-	zip_uint64_t i;
-	for (i = 0; i < za->n_entries; i++) {
-		free (za->entries[i].name);
+	/* leave room for deflate growing incompressible data */
+	return len >= 0xF0000000u;
+}
+
+#if MZIP_THREADS
+/* Block-parallel deflate of a file source: read n chunks at a time,
+ * compress them together and write them in order, merging their CRCs.
+ * The last MZIP_DEFLATE_DICT bytes of each batch are kept in front of the
+ * buffer to prime the first chunk of the next one. */
+static int mzip_stream_deflate_parallel(zip_t *za, zip_source_t *src, uint64_t left, int n,
+		uint32_t *crc, uint64_t *uncomp, uint64_t *comp) {
+	size_t batch = (size_t)n * MZIP_PAR_DEFLATE_CHUNK;
+	uint8_t *buf = (uint8_t*)malloc (MZIP_DEFLATE_DICT + batch);
+	struct mzip_pdef_job *jobs = (struct mzip_pdef_job *)calloc ((size_t)n, sizeof (*jobs));
+	uint8_t *in = buf + MZIP_DEFLATE_DICT;
+	int eof = 0, ret = -1;
+
+	if (!buf || !jobs) {
+		goto out;
+	}
+	while (!eof) {
+		size_t want = left < batch ? (size_t)left : batch;
+		size_t got = want ? fread (in, 1, want, src->fp) : 0;
+		if (got < want && ferror (src->fp)) {
+			goto out;
+		}
+		left -= got;
+		eof = got < want || left == 0;
+
+		size_t n_jobs = mzip_pdef_plan (jobs, in, got, *uncomp, eof, 1);
+		int jret = mzip_pdef_run (jobs, n_jobs, n);
+		for (size_t i = 0; i < n_jobs; i++) {
+			if (jret == 0 && mzip_out_write (za, jobs[i].out, jobs[i].out_len) != 0) {
+				jret = -1;
+			}
+			*crc = mzip_crc32_combine (*crc, jobs[i].crc, jobs[i].len);
+			*comp += jobs[i].out_len;
+			free (jobs[i].out);
+		}
+		if (jret != 0) {
+			goto out;
+		}
+		*uncomp += got;
+		if (got >= MZIP_DEFLATE_DICT) {
+			memcpy (buf, in + got - MZIP_DEFLATE_DICT, MZIP_DEFLATE_DICT);
+		} else if (!eof) {
+			/* a short batch always ends the stream */
+			goto out;
+		}
+	}
+	ret = 0;
+out:
+	free (jobs);
+	free (buf);
+	return ret;
+}
+#endif
+
+/* Stream a file source into the archive: the local header goes out with
+ * bit 3 set and zero CRC/sizes, data is stored or compressed by one of
+ * the mzip_codec_streams codecs as it is read, and the real values follow
+ * in a data descriptor (with 64-bit sizes when mzip_stream_zip64 says
+ * so). Memory use is two MZIP_STREAM_BUFSIZE buffers plus the codec
+ * state (for zstd, its window; for LZMA, twice its dictionary); deflating on n >= 2
+ * threads adds a batch of MZIP_DEFLATE_DICT + n * MZIP_PAR_DEFLATE_CHUNK
+ * bytes, n outputs of compressBound (MZIP_PAR_DEFLATE_CHUNK) and n deflate
+ * states, a little over 2 MiB per thread. */
+static int mzip_write_stream(zip_t *za, struct mzip_entry *e, zip_source_t *src) {
+	uint8_t *in = (uint8_t*)malloc (MZIP_STREAM_BUFSIZE);
+	uint8_t *out = (uint8_t*)malloc (MZIP_STREAM_BUFSIZE);
+	uint64_t left = src->flen < 0 ? UINT64_MAX : (uint64_t)src->flen;
+	uint64_t uncomp = 0, comp = 0;
+	uint32_t crc = 0;
+	int coding = e->method != MZIP_METHOD_STORE;
+	int parallel = e->method == MZIP_METHOD_DEFLATE && mzip_thread_count () >= 2;
+	int zip64 = mzip_stream_zip64 (src);
+	int ret = -1;
+	z_stream strm = {0};
+
+	if (!in || !out) {
+		goto done;
+	}
+	if (coding && !parallel && mzip_encoder_init (&strm, e->method) != Z_OK) {
+		coding = 0;
+		goto done;
+	}
+	e->flags |= MZIP_GP_DATA_DESCRIPTOR;
+	if (e->method == MZIP_METHOD_LZMA) {
+		e->flags |= MZIP_GP_LZMA_EOS;
+	}
+	uint32_t hdr_len = mzip_write_local_header (za, mzip_entry_name (za, e), e->name_len, e->flags, e->method, 0, 0, 0,
+			e->file_time, e->file_date, zip64);
+
+#if MZIP_THREADS
+	if (parallel && mzip_stream_deflate_parallel (za, src, left, mzip_thread_count (), &crc, &uncomp, &comp) != 0) {
+		goto fail;
+	}
+#endif
+	while (!parallel) {
+		size_t n = 0;
+		if (left > 0) {
+			size_t want = left < MZIP_STREAM_BUFSIZE ? (size_t)left : MZIP_STREAM_BUFSIZE;
+			n = fread (in, 1, want, src->fp);
+			if (n < want && ferror (src->fp)) {
+				goto fail;
+			}
+			left -= n;
+		}
+		int finish = n == 0;
+		crc = mzip_crc32 (crc, in, n);
+		uncomp += n;
+		if (!coding) {
+			if (n && mzip_out_write (za, in, n) != 0) {
+				goto fail;
+			}
+			comp += n;
+		} else {
+			strm.next_in = in;
+			strm.avail_in = (uint32_t)n;
+			int zret;
+			do {
+				strm.next_out = out;
+				strm.avail_out = MZIP_STREAM_BUFSIZE;
+				zret = mzip_encode (&strm, e->method, finish ? Z_FINISH : Z_NO_FLUSH);
+				if (zret != Z_OK && zret != Z_STREAM_END && zret != Z_BUF_ERROR) {
+					goto fail;
+				}
+				size_t w = MZIP_STREAM_BUFSIZE - strm.avail_out;
+				if (w && mzip_out_write (za, out, w) != 0) {
+					goto fail;
+				}
+				comp += w;
+			} while (strm.avail_in > 0 || strm.avail_out == 0 || (finish && zret != Z_STREAM_END));
+		}
+		if (finish) {
+			break;
+		}
+	}
+	/* a small source that grew past 4 GiB cannot be described anymore */
+	if (!zip64 && (uncomp >= 0xFFFFFFFFu || comp >= 0xFFFFFFFFu)) {
+		goto fail;
+	}
+
+	uint8_t dd[24];
+	size_t dd_len = zip64 ? 24 : 16;
+	mzip_wr32 (dd, MZIP_SIG_DD);
+	mzip_wr32 (dd + 4, crc);
+	if (zip64) {
+		mzip_write_le64 (dd + 8, comp);
+		mzip_write_le64 (dd + 16, uncomp);
+	} else {
+		mzip_wr32 (dd + 8, (uint32_t)comp);
+		mzip_wr32 (dd + 12, (uint32_t)uncomp);
+	}
+	if (hdr_len == 0 || mzip_out_write (za, dd, dd_len) != 0) {
+		goto fail;
+	}
+	e->crc32 = crc;
+	e->comp_size = comp;
+	e->uncomp_size = uncomp;
+	e->data_ofs = e->local_hdr_ofs + hdr_len;
+	mzip_wrote (za, e->data_ofs + comp + dd_len);
+	ret = 0;
+	goto done;
+fail:
+	mzip_rollback (za, e->local_hdr_ofs);
+done:
+	if (coding && !parallel) {
+		mzip_encoder_end (&strm, e->method);
+	}
+	free (in);
+	free (out);
+	return ret;
+}
+
+#if MZIP_THREADS
+/* Background compression. With more than one thread, zip_file_add hands
+ * in-memory sources to a pool: workers run mzip_compress_data in any
+ * order, and a single writer thread appends local headers and data in
+ * submission order, so the layout matches a serial run. The writer is the
+ * only one touching za->fp while jobs are pending; it fills in the entry
+ * under the lock, since zip_file_add may realloc za->entries meanwhile.
+ * Anything else that writes to the archive calls mzip_pool_drain first. */
+
+enum { MZIP_JOB_QUEUED, MZIP_JOB_DONE, MZIP_JOB_FAILED };
+
+struct mzip_job {
+	struct mzip_job *next;      /* submission order */
+	zip_uint64_t index;
+	zip_source_t *src;
+	uint64_t len;
+	uint16_t method;
+	uint8_t *comp_buf;
+	uint32_t comp_size;
+	uint32_t crc;
+	int state;
+	char name[];                /* own copy: the name arena may move */
+};
+
+struct mzip_pool {
+	zip_t *za;
+	pthread_mutex_t lock;
+	pthread_cond_t work;        /* a job was queued, or stop */
+	pthread_cond_t done;        /* a job was compressed or written, or stop */
+	pthread_t workers[MZIP_MAX_THREADS];
+	pthread_t writer;
+	int n_workers;
+	struct mzip_job *head, *tail;
+	struct mzip_job *next_run;  /* first job no worker has taken */
+	size_t pending;             /* queued and not written yet */
+	uint64_t pending_bytes;
+	int failed;                 /* entries dropped by a failed job */
+	int stop;
+};
+
+static void *mzip_pool_worker(void *arg) {
+	struct mzip_pool *pool = (struct mzip_pool *)arg;
+	pthread_mutex_lock (&pool->lock);
+	for (;;) {
+		while (!pool->next_run && !pool->stop) {
+			pthread_cond_wait (&pool->work, &pool->lock);
+		}
+		struct mzip_job *job = pool->next_run;
+		if (!job) {
+			break;
+		}
+		pool->next_run = job->next;
+		pthread_mutex_unlock (&pool->lock);
+
+		zip_source_t *src = job->src;
+		job->crc = mzip_crc32 (0, src->buf, (size_t)src->len);
+		int ret = mzip_compress_data ((uint8_t*)src->buf, (size_t)src->len,
+				&job->comp_buf, &job->comp_size, &job->method, 1);
+		if (ret == 0 && (uint64_t)job->comp_size > MZIP_MAX_PAYLOAD) {
+			free (job->comp_buf);
+			job->comp_buf = NULL;
+			ret = -1;
+		}
+		zip_source_free (src);
+		job->src = NULL;
+
+		pthread_mutex_lock (&pool->lock);
+		job->state = ret == 0 ? MZIP_JOB_DONE : MZIP_JOB_FAILED;
+		pthread_cond_broadcast (&pool->done);
+	}
+	pthread_mutex_unlock (&pool->lock);
+	return NULL;
+}
+
+static void *mzip_pool_writer(void *arg) {
+	struct mzip_pool *pool = (struct mzip_pool *)arg;
+	zip_t *za = pool->za;
+	pthread_mutex_lock (&pool->lock);
+	for (;;) {
+		while (!(pool->head && pool->head->state != MZIP_JOB_QUEUED) && !(pool->stop && !pool->head)) {
+			pthread_cond_wait (&pool->done, &pool->lock);
+		}
+		struct mzip_job *job = pool->head;
+		if (!job) {
+			break;
+		}
+		struct mzip_entry *e = &za->entries[job->index];
+		const char *name = job->name;
+		uint16_t name_len = e->name_len;
+		uint16_t flags = e->flags;
+		uint16_t file_time = e->file_time, file_date = e->file_date;
+		pthread_mutex_unlock (&pool->lock);
+
+		uint64_t ofs = MZIP_OFS_PENDING, data_ofs = 0;
+		if (job->state == MZIP_JOB_DONE) {
+			uint64_t pos = za->out.pos;
+			if (job->method == MZIP_METHOD_LZMA) {
+				flags |= MZIP_GP_LZMA_EOS;
+			}
+			uint32_t hdr_len = mzip_write_local_header (za, name, name_len, flags, job->method,
+					job->comp_size, job->len, job->crc, file_time, file_date, 0);
+			if (hdr_len && mzip_out_write (za, job->comp_buf, job->comp_size) == 0) {
+				ofs = pos;
+				data_ofs = ofs + hdr_len;
+			}
+		}
+		free (job->comp_buf);
+
+		pthread_mutex_lock (&pool->lock);
+		e = &za->entries[job->index];
+		if (ofs != MZIP_OFS_PENDING) {
+			e->local_hdr_ofs = ofs;
+			e->flags = flags;
+			e->method = job->method;
+			e->comp_size = job->comp_size;
+			e->crc32 = job->crc;
+			e->data_ofs = data_ofs;
+			mzip_wrote (za, data_ofs + job->comp_size);
+		} else {
+			pool->failed = 1;
+		}
+		pool->head = job->next;
+		if (!pool->head) {
+			pool->tail = NULL;
+		}
+		pool->pending--;
+		pool->pending_bytes -= job->len;
+		free (job);
+		pthread_cond_broadcast (&pool->done);
+	}
+	pthread_mutex_unlock (&pool->lock);
+	return NULL;
+}
+
+static struct mzip_pool *mzip_pool_new(zip_t *za, int n) {
+	struct mzip_pool *pool = (struct mzip_pool *)calloc (1, sizeof (struct mzip_pool));
+	if (!pool) {
+		return NULL;
+	}
+	pool->za = za;
+	pthread_mutex_init (&pool->lock, NULL);
+	pthread_cond_init (&pool->work, NULL);
+	pthread_cond_init (&pool->done, NULL);
+	if (pthread_create (&pool->writer, NULL, mzip_pool_writer, pool) != 0) {
+		goto fail;
+	}
+	for (int i = 0; i < n; i++) {
+		if (pthread_create (&pool->workers[i], NULL, mzip_pool_worker, pool) != 0) {
+			break;
+		}
+		pool->n_workers++;
+	}
+	if (pool->n_workers > 0) {
+		return pool;
+	}
+	pthread_mutex_lock (&pool->lock);
+	pool->stop = 1;
+	pthread_cond_broadcast (&pool->done);
+	pthread_mutex_unlock (&pool->lock);
+	pthread_join (pool->writer, NULL);
+fail:
+	pthread_cond_destroy (&pool->done);
+	pthread_cond_destroy (&pool->work);
+	pthread_mutex_destroy (&pool->lock);
+	free (pool);
+	return NULL;
+}
+
+static void mzip_pool_free(struct mzip_pool *pool) {
+	pthread_mutex_lock (&pool->lock);
+	pool->stop = 1;
+	pthread_cond_broadcast (&pool->work);
+	pthread_cond_broadcast (&pool->done);
+	pthread_mutex_unlock (&pool->lock);
+	for (int i = 0; i < pool->n_workers; i++) {
+		pthread_join (pool->workers[i], NULL);
+	}
+	pthread_join (pool->writer, NULL);
+	pthread_cond_destroy (&pool->done);
+	pthread_cond_destroy (&pool->work);
+	pthread_mutex_destroy (&pool->lock);
+	free (pool);
+}
+
+/* Queue entry `index` for compression; the pool takes ownership of src.
+ * Blocks while too much work is already queued. Returns -1 without
+ * touching src when the job cannot be set up. */
+static int mzip_pool_submit(zip_t *za, zip_uint64_t index, zip_source_t *src) {
+	struct mzip_pool *pool = za->pool;
+	const struct mzip_entry *e = &za->entries[index];
+	struct mzip_job *job = (struct mzip_job *)calloc (1, sizeof (struct mzip_job) + e->name_len + 1u);
+	if (!job) {
+		return -1;
+	}
+	memcpy (job->name, mzip_entry_name (za, e), e->name_len);
+	/* the caller may reuse a buffer it did not hand over */
+	if (!src->freep) {
+		void *copy = malloc (src->len ? (size_t)src->len : 1);
+		if (!copy) {
+			free (job);
+			return -1;
+		}
+		memcpy (copy, src->buf, (size_t)src->len);
+		src->buf = copy;
+		src->freep = 1;
+	}
+	job->index = index;
+	job->src = src;
+	job->len = src->len;
+	job->method = e->method;
+	job->state = MZIP_JOB_QUEUED;
+
+	pthread_mutex_lock (&pool->lock);
+	while (pool->pending > 0 && (pool->pending >= (size_t)pool->n_workers * MZIP_POOL_JOBS_PER_THREAD
+			|| pool->pending_bytes >= MZIP_POOL_MAX_BYTES)) {
+		pthread_cond_wait (&pool->done, &pool->lock);
+	}
+	if (pool->tail) {
+		pool->tail->next = job;
+	} else {
+		pool->head = job;
+	}
+	pool->tail = job;
+	if (!pool->next_run) {
+		pool->next_run = job;
+	}
+	pool->pending++;
+	pool->pending_bytes += job->len;
+	pthread_cond_signal (&pool->work);
+	pthread_mutex_unlock (&pool->lock);
+	return 0;
+}
+#endif
+
+/* Start the compression pool on first use; 0 when one is running */
+static int mzip_pool_start(zip_t *za) {
+#if MZIP_THREADS
+	if (!za->pool) {
+		int n = mzip_thread_count ();
+		if (n < 2) {
+			return -1;
+		}
+		za->pool = mzip_pool_new (za, n);
+	}
+	return za->pool ? 0 : -1;
+#else
+	(void)za;
+	return -1;
+#endif
+}
+
+/* Wait until every queued entry has been written; returns -1 if any of
+ * them failed (those are left out of the central directory). */
+static int mzip_pool_drain(zip_t *za) {
+#if MZIP_THREADS
+	struct mzip_pool *pool = za->pool;
+	if (pool) {
+		pthread_mutex_lock (&pool->lock);
+		while (pool->pending > 0) {
+			pthread_cond_wait (&pool->done, &pool->lock);
+		}
+		int failed = pool->failed;
+		pthread_mutex_unlock (&pool->lock);
+		return failed ? -1 : 0;
+	}
+#else
+	(void)za;
+#endif
+	return 0;
+}
+
+/* Guard za->entries against the pool writer while it may move */
+static void mzip_entries_lock(zip_t *za) {
+#if MZIP_THREADS
+	if (za->pool) {
+		pthread_mutex_lock (&za->pool->lock);
+	}
+#else
+	(void)za;
+#endif
+}
+
+static void mzip_entries_unlock(zip_t *za) {
+#if MZIP_THREADS
+	if (za->pool) {
+		pthread_mutex_unlock (&za->pool->lock);
+	}
+#else
+	(void)za;
+#endif
+}
+
+/* Make room for n more entries, doubling the capacity so that adding
+ * one at a time stays linear overall */
+static int mzip_entries_reserve(zip_t *za, zip_uint64_t n) {
+	if (n <= za->entries_cap - za->n_entries) {
+		return 0;
+	}
+	zip_uint64_t cap = za->entries_cap ? za->entries_cap : 16;
+	while (cap - za->n_entries < n) {
+		if (cap > SIZE_MAX / sizeof (struct mzip_entry) / 2) {
+			return -1;
+		}
+		cap *= 2;
+	}
+	mzip_entries_lock (za);
+	struct mzip_entry *entries = (struct mzip_entry*)realloc (za->entries, (size_t)cap * sizeof (struct mzip_entry));
+	if (entries) {
+		za->entries = entries;
+		za->entries_cap = cap;
+	}
+	mzip_entries_unlock (za);
+	return entries ? 0 : -1;
+}
+
+static int mzip_method_supported(zip_int32_t comp) {
+#ifdef MZIP_ENABLE_STORE
+	if (comp == MZIP_METHOD_STORE) {
+		/* Store is always supported */
+	} 
+#endif
+#ifdef MZIP_ENABLE_DEFLATE
+	else if (comp == MZIP_METHOD_DEFLATE) {
+		/* Deflate is supported */
+	} 
+#endif
+#ifdef MZIP_ENABLE_ZSTD
+	else if (comp == MZIP_METHOD_ZSTD) {
+		/* Zstd is supported */
+	} 
+#endif
+#ifdef MZIP_ENABLE_LZFSE
+	else if (comp == MZIP_METHOD_LZFSE) {
+		/* LZFSE is supported */
+	} 
+#endif
+#ifdef MZIP_ENABLE_LZ4
+	else if (comp == MZIP_METHOD_LZ4) {
+		/* LZ4 is supported */
+	} 
+#endif
+#ifdef MZIP_ENABLE_LZMA
+	else if (comp == MZIP_METHOD_LZMA) {
+		/* LZMA is supported */
+	} 
+#endif
+#ifdef MZIP_ENABLE_BROTLI
+	else if (comp == MZIP_METHOD_BROTLI) {
+		/* Brotli is supported */
+	} 
+#endif
+	else {
+		/* Unsupported compression method */
+		return -1;
+	}
+	return 0;
+}
+
+/* Add one file into a slot reserved by the caller */
+static zip_int64_t mzip_file_add(zip_t *za, const char *name, zip_source_t *src,
+		uint16_t method, uint16_t file_time, uint16_t file_date) {
+	/* Set up the new entry */
+	struct mzip_entry *e = &za->entries[za->n_entries];
+	memset (e, 0, sizeof (struct mzip_entry));
+
+	size_t nlen = strlen (name);
+	if (nlen > MZIP_MAX_FIELD_LEN || mzip_names_add (za, e, name, (uint16_t)nlen) != 0) {
+		return -1;
+	}
+	e->method = method;
+
+	/* File sources are streamed when the codec allows it (store and
+	 * mzip_codec_streams); the others compress from memory, so read the
+	 * whole input first */
+	if (src->fp && e->method != MZIP_METHOD_STORE && !mzip_codec_streams (e->method)) {
+		if (mzip_source_load (src) != 0) {
+			za->names.len = (size_t)e->name_ofs;
+			return -1;
+		}
+	}
+
+	if (!src->fp) {
+		/* In-memory sources are compressed in one go; keep them bounded */
+		if ((uint64_t)src->len > MZIP_MAX_PAYLOAD) {
+			za->names.len = (size_t)e->name_ofs;
+			return -1;
+		}
+		e->uncomp_size = src->len;
+
+	}
+
+	e->file_time = file_time;
+	e->file_date = file_date;
+
+	/* Set default permissions: 0644 for files */
+	e->external_attr = 0100644 << 16; /* S_IFREG | 0644 << 16 */
+
+	/* In-memory sources go to the compression pool when there is one;
+	 * the pool writer fills in the offset, sizes and CRC later */
+	if (!src->fp && mzip_pool_start (za) == 0) {
+		e->local_hdr_ofs = MZIP_OFS_PENDING;
+#if MZIP_THREADS
+		if (mzip_pool_submit (za, za->n_entries, src) == 0) {
+			goto added;
+		}
+#endif
+	}
+	/* Everything else writes to the archive directly, after whatever
+	 * the pool still has queued */
+	mzip_pool_drain (za);
+
+	/* The local header goes where the output is */
+	e->local_hdr_ofs = za->out.pos;
+
+	if (src->fp) {
+		if (mzip_write_stream (za, e, src) != 0) {
+			za->names.len = (size_t)e->name_ofs;
+			return -1;
+		}
+		zip_source_free (src);
+		goto added;
+	}
+
+	/* Calculate CRC-32 of the uncompressed data */
+	e->crc32 = mzip_crc32_parallel (src->buf, (size_t)src->len);
+
+	/* Compress the data using the selected method */
+	uint8_t *comp_buf = NULL;
+	uint32_t comp_size = 0;
+
+	/* Compress the data using the selected method */
+	if (mzip_compress_data ((uint8_t*)src->buf, src->len, &comp_buf, &comp_size, &e->method, mzip_thread_count ()) != 0) {
+		za->names.len = (size_t)e->name_ofs;
+		return -1;
+	}
+	if (e->method == MZIP_METHOD_LZMA) {
+		e->flags |= MZIP_GP_LZMA_EOS;
+	}
+
+    /* Validate compressed size too */
+    if ((uint64_t)comp_size > MZIP_MAX_PAYLOAD) {
+        za->names.len = (size_t)e->name_ofs;
+        free (comp_buf);
+        return -1;
+    }
+    e->comp_size = comp_size;
+
+	/* Write local file header */
+	uint32_t hdr_len = mzip_write_local_header (za, mzip_entry_name (za, e), e->name_len, e->flags, e->method, e->comp_size, e->uncomp_size, e->crc32,
+			e->file_time, e->file_date, 0);
+
+	/* Write compressed data; small entries stay staged with their header */
+	int wret = hdr_len ? mzip_out_write (za, comp_buf, comp_size) : -1;
+	free (comp_buf);
+	if (wret != 0) {
+		mzip_rollback (za, e->local_hdr_ofs);
+		za->names.len = (size_t)e->name_ofs;
+		return -1;
+	}
+	e->data_ofs = e->local_hdr_ofs + hdr_len;
+	mzip_wrote (za, e->data_ofs + comp_size);
+
+	/* The entry is written: the source is ours to release */
+	zip_source_free (src);
+
+added:;
+	/* Increment entry count */
+	zip_uint64_t index = za->n_entries;
+	za->n_entries++;
+	za->next_index = za->n_entries;
+	mzip_name_index_add (za, &za->name_index, 0);
+	mzip_name_index_add (za, &za->nocase_index, 1);
+
+	return (zip_int64_t)index;
+}
+
+/* Add file to ZIP archive */
+zip_int64_t zip_file_add(zip_t *za, const char *name, zip_source_t *src, zip_flags_t flags) {
+	(void)flags;
+	if (!za || !name || !src || za->mode != 1 || mzip_entries_reserve (za, 1) != 0) {
+		return -1;
+	}
+	/* Set current time for file timestamp */
+	uint16_t file_time, file_date;
+	mzip_get_dostime (&file_time, &file_date);
+	return mzip_file_add (za, name, src, za->default_method, file_time, file_date);
+}
+
+zip_int64_t zip_files_add_batch(zip_t *za, const zip_batch_entry_t *files, zip_uint64_t n, zip_flags_t flags) {
+	(void)flags;
+	if (!za || (!files && n) || za->mode != 1 || mzip_entries_reserve (za, n) != 0) {
+		return -1;
+	}
+	uint16_t file_time, file_date;
+	mzip_get_dostime (&file_time, &file_date);
+	zip_uint64_t i;
+	for (i = 0; i < n; i++) {
+		const zip_batch_entry_t *f = &files[i];
+		zip_int32_t method = f->method < 0 ? (zip_int32_t)za->default_method : f->method;
+		if (!f->name || !f->source || mzip_method_supported (method) != 0
+				|| mzip_file_add (za, f->name, f->source, (uint16_t)method, file_time, file_date) < 0) {
+			break;
+		}
 	}
+	return (zip_int64_t)i;
+}
+
+/* Set file compression method */
+int zip_set_file_compression(zip_t *za, zip_uint64_t index, zip_int32_t comp, zip_uint32_t comp_flags) {
+	(void)comp_flags;
+
+	if (!za || index >= za->n_entries || za->mode != 1) {
+		return -1;
+	}
+
+	/* Check if the requested compression method is supported */
+	if (mzip_method_supported (comp) != 0) {
+		return -1;
+	}
+
+	/* Set the method for next files that will be added */
+	mzip_entries_lock (za);
+	za->entries[index].method = (uint16_t)comp;
+	mzip_entries_unlock (za);
+	return 0;
+}
+
+/* Finalize ZIP file before closing - write central directory */
+static int mzip_finalize_archive(zip_t *za) {
+	if (!za || !za->fp || za->mode != 1) {
+		return -1;
+	}
+	/* The central directory starts where the output is */
+	uint64_t cd_offset = za->out.pos;
+
+	/* Build it in memory and hand it over in one write; sizes and
+	 * offsets past 32 bits go to ZIP64 extra fields and records. */
+	uint64_t cd_max = MZIP_EOCD_MAX;
+	for (zip_uint64_t i = 0; i < za->n_entries; i++) {
+		cd_max += MZIP_CDH_MAX (za->entries[i].name_len);
+	}
+	if (cd_max > (uint64_t)SIZE_MAX) {
+		return -1;
+	}
+	uint8_t *cd = (uint8_t*)malloc ((size_t)cd_max);
+	if (!cd) {
+		return -1;
+	}
+    uint64_t cd_size_acc = 0;
+    zip_uint64_t n_written = 0;
+    for (zip_uint64_t i = 0; i < za->n_entries; i++) {
+        struct mzip_entry *e = &za->entries[i];
+        if (e->local_hdr_ofs == MZIP_OFS_PENDING) {
+            continue; /* its compression job failed */
+        }
+        uint32_t written = mzip_put_central_header (cd + cd_size_acc, mzip_entry_name (za, e), e->name_len, e->flags, e->method,
+                e->comp_size, e->uncomp_size, e->crc32,
+                e->local_hdr_ofs, e->file_time, e->file_date, e->external_attr);
+        cd_size_acc += written;
+        n_written++;
+    }
+
+    /* End of central directory record */
+    uint32_t eocd_len = mzip_put_end_of_central_directory (cd + cd_size_acc, n_written,
+            cd_size_acc, cd_offset);
+	int ret = mzip_out_write (za, cd, (size_t)cd_size_acc + eocd_len);
+	free (cd);
+	if (ret != 0 || mzip_out_flush (za) != 0) {
+		return -1;
+	}
+
+	/* Drop whatever an appended-to archive had past its new end */
+	uint64_t end = za->out.pos;
+	if (ftruncate (fileno (za->fp), (off_t)end) != 0) {
+		return -1;
+	}
+	za->size = end;
+	return 0;
+}
+
+int zip_close(zip_t *za) {
+	if (!za) {
+		return -1;
+	}
+	int ret = 0;
+	/* Finalize archive if in write mode, once the pool has written
+	 * everything queued */
+	if (za->mode == 1) {
+		if (mzip_pool_drain (za) != 0) {
+			ret = -1;
+		}
+#if MZIP_THREADS
+		if (za->pool) {
+			mzip_pool_free (za->pool);
+			za->pool = NULL;
+		}
+#endif
+		if (mzip_finalize_archive (za) != 0 || za->out.err) {
+			ret = -1;
+		}
+	}
+
+#if MZIP_MMAP
+	if (za->map) {
+		munmap ((void*)za->map, (size_t)za->size);
+	}
+#endif
+	if (za->fp) {
+		fclose (za->fp);
+	}
+	free (za->out.buf);
 	free (za->entries);
+	free (za->names.buf);
+	free (za->name_index.slots);
+	free (za->nocase_index.slots);
 	free(za);
-	return 0;
+	return ret;
 }
 
 zip_uint64_t zip_get_num_files(zip_t *za) {
 	return za ? za->n_entries : 0u;
 }
 
+int zip_stat_index(zip_t *za, zip_uint64_t index, zip_flags_t flags, zip_stat_t *st) {
+	(void)flags;
+	if (!za || !st || index >= za->n_entries) {
+		return -1;
+	}
+	/* sizes and CRC of pooled entries are known once they are written */
+	if (za->mode == 1) {
+		mzip_pool_drain (za);
+	}
+	const struct mzip_entry *e = &za->entries[index];
+	memset (st, 0, sizeof (*st));
+	st->valid = ZIP_STAT_NAME | ZIP_STAT_INDEX | ZIP_STAT_SIZE | ZIP_STAT_COMP_SIZE
+		| ZIP_STAT_CRC | ZIP_STAT_COMP_METHOD;
+	st->name = mzip_entry_name (za, e);
+	st->index = index;
+	st->size = e->uncomp_size;
+	st->comp_size = e->comp_size;
+	st->crc = e->crc32;
+	st->comp_method = e->method;
+	return 0;
+}
+
+const char *zip_get_name(zip_t *za, zip_uint64_t index, zip_flags_t flags) {
+	(void)flags;
+	if (!za || index >= za->n_entries) {
+		return NULL;
+	}
+	return mzip_entry_name (za, &za->entries[index]);
+}
+
 zip_int64_t zip_name_locate(zip_t *za, const char *fname, zip_flags_t flags) {
-	(void)flags; /* flags (case sensitivity etc.) not implemented */
 	if (!za || !fname) return -1;
 
+	int nocase = (flags & ZIP_FL_NOCASE) != 0;
+	struct mzip_name_index *ix = nocase ? &za->nocase_index : &za->name_index;
+	if (!ix->slots && za->n_entries > 0) {
+		mzip_name_index_build (za, ix, nocase);
+	}
+	if (ix->slots) {
+		uint32_t i = mzip_name_hash (fname, nocase) & ix->mask;
+		while (ix->slots[i]) {
+			uint32_t idx = ix->slots[i] - 1;
+			if (mzip_name_equal (mzip_entry_name (za, &za->entries[idx]), fname, nocase)) {
+				return (zip_int64_t)idx;
+			}
+			i = (i + 1) & ix->mask;
+		}
+		return -1;
+	}
+
+	/* no index (empty archive or out of memory): linear scan */
 	for (zip_uint64_t i = 0; i < za->n_entries; i++) {
-		if (strcmp (za->entries[i].name, fname) == 0) {
+		if (mzip_name_equal (mzip_entry_name (za, &za->entries[i]), fname, nocase)) {
 			return (zip_int64_t)i;
 		}
 	}
 	return -1;
 }
 
+/* Entries are read through a zip_file_t in one of three ways: stored data
+ * is copied straight from the archive, the mzip_codec_streams codecs are
+ * decoded incrementally into the caller's buffer (so memory stays at the
+ * codec window plus one input buffer: 32 KiB for deflate, the frame's
+ * window for zstd, the dictionary for LZMA), and the remaining codecs, which only decode in one
+ * go, are decompressed into zf->data on open and served from there. */
+
+static int mzip_stream_init(zip_file_t *zf) {
+	z_stream *strm = (z_stream*)calloc (1, sizeof (z_stream));
+	if (!strm) {
+		return -1;
+	}
+	if (mzip_decoder_init (strm, zf->method) != Z_OK) {
+		free (strm);
+		return -1;
+	}
+	zf->strm = strm;
+	zf->comp_pos = 0;
+	zf->pos = 0;
+	zf->eof = 0;
+	zf->crc = 0;
+	zf->crc_valid = 1;
+	return 0;
+}
+
+static void mzip_stream_end(zip_file_t *zf) {
+	if (zf->strm) {
+		mzip_decoder_end ((z_stream*)zf->strm, zf->method);
+		free (zf->strm);
+		zf->strm = NULL;
+	}
+}
+
+/* copy n stored bytes at the current position */
+static int mzip_read_stored(zip_file_t *zf, uint8_t *dst, size_t n) {
+	zip_t *za = zf->za;
+	uint64_t ofs = zf->data_ofs + zf->pos;
+	if (za->map) {
+		memcpy (dst, za->map + ofs, n);
+		return 0;
+	}
+	return mzip_read_fully (za, dst, n, ofs);
+}
+
+/* decode up to n bytes into dst; returns the number produced or -1 */
+static int64_t mzip_read_decoded(zip_file_t *zf, uint8_t *dst, size_t n) {
+	zip_t *za = zf->za;
+	z_stream *strm = (z_stream*)zf->strm;
+	uint64_t comp_size = za->entries[zf->index].comp_size;
+	size_t got = 0;
+
+	while (got < n && !zf->eof) {
+		if (strm->avail_in == 0 && zf->comp_pos < comp_size) {
+			uint64_t left = comp_size - zf->comp_pos;
+			if (za->map) {
+				/* feed the mapping directly, in chunks avail_in can hold */
+				uint32_t chunk = left > (1u << 30) ? (1u << 30) : (uint32_t)left;
+				strm->next_in = (uint8_t*)za->map + zf->data_ofs + zf->comp_pos;
+				strm->avail_in = chunk;
+			} else {
+				uint32_t chunk = left > MZIP_STREAM_BUFSIZE ? MZIP_STREAM_BUFSIZE : (uint32_t)left;
+				if (mzip_read_fully (za, zf->in_buf, chunk, zf->data_ofs + zf->comp_pos) != 0) {
+					return -1;
+				}
+				strm->next_in = zf->in_buf;
+				strm->avail_in = chunk;
+			}
+			zf->comp_pos += strm->avail_in;
+		}
+		size_t want = n - got;
+		strm->next_out = dst + got;
+		strm->avail_out = want > UINT32_MAX ? UINT32_MAX : (uint32_t)want;
+		uint32_t before = strm->avail_out;
+		int ret = mzip_decode (strm, zf->method, zf->comp_pos >= comp_size);
+		got += before - strm->avail_out;
+		if (ret == Z_STREAM_END) {
+			zf->eof = 1;
+		} else if (ret == Z_BUF_ERROR) {
+			/* no progress possible: only legitimate if more input is coming */
+			if (strm->avail_in == 0 && zf->comp_pos >= comp_size) {
+				return -1; /* truncated stream */
+			}
+		} else if (ret != Z_OK) {
+			return -1;
+		}
+	}
+	return (int64_t)got;
+}
+
+/* Called once the position reaches the end of the entry: the compressed
+ * stream must end exactly here, and a sequential read must match the CRC. */
+static int mzip_read_finish(zip_file_t *zf) {
+	struct mzip_entry *e = &zf->za->entries[zf->index];
+	if (zf->strm && !zf->eof) {
+		uint8_t extra;
+		if (mzip_read_decoded (zf, &extra, 1) != 0 || !zf->eof) {
+			return -1; /* stream longer than uncomp_size, or corrupt */
+		}
+	}
+	if (zf->crc_valid && zf->crc != e->crc32) {
+		zf->crc_valid = 0; /* report once */
+		if (mzip_verify_crc) {
+			return -1;
+		}
+		fprintf(stderr, "Warning: CRC mismatch for '%s' (expected 0x%08x, got 0x%08x)\n",
+				mzip_entry_name (zf->za, e), e->crc32, zf->crc);
+	}
+	return 0;
+}
+
 zip_file_t *zip_fopen_index(zip_t *za, zip_uint64_t index, zip_flags_t flags) {
 	(void)flags;
 	if (!za || index >= za->n_entries) {
 		return NULL;
 	}
-    uint8_t  *buf = NULL;
-    uint32_t  sz = 0;
-	if (mzip_extract_entry (za, &za->entries[index], &buf, &sz) != 0) {
+	/* an entry added in this session gets its offsets from the pool writer */
+	if (za->mode == 1) {
+		mzip_pool_drain (za);
+	}
+	struct mzip_entry *e = &za->entries[index];
+	uint64_t data_ofs;
+	if (mzip_entry_data_ofs (za, e, za->size, &data_ofs) != 0) {
+		return NULL;
+	}
+	if (mzip_check_expansion (za, e) != 0) {
 		return NULL;
 	}
-	zip_file_t *zf = (zip_file_t*)malloc(sizeof(zip_file_t));
+	zip_file_t *zf = (zip_file_t*)calloc (1, sizeof (zip_file_t));
 	if (!zf) {
-		free (buf);
+		return NULL;
+	}
+	zf->za = za;
+	zf->index = index;
+	zf->size = e->uncomp_size;
+	zf->data_ofs = data_ofs;
+	zf->method = e->method;
+	zf->crc_valid = 1;
+
+	if (e->method == MZIP_METHOD_STORE) {
+		if (e->comp_size != e->uncomp_size) {
+			free (zf);
+			return NULL;
+		}
+		return zf;
+	}
+	if (mzip_codec_streams (e->method)) {
+		if (e->comp_size >= MZIP_MADV_MIN) {
+			mzip_advise (za, data_ofs, e->comp_size, MZIP_ADVISE_WILLNEED);
+		}
+		if (!za->map) {
+			zf->in_buf = (uint8_t*)malloc (MZIP_STREAM_BUFSIZE);
+		}
+		if ((!za->map && !zf->in_buf) || mzip_stream_init (zf) != 0) {
+			free (zf->in_buf);
+			free (zf);
+			return NULL;
+		}
+		return zf;
+	}
+
+	/* other codecs: decode the whole entry (this also checks the CRC) */
+	uint8_t  *buf = NULL;
+	uint32_t  sz = 0;
+	if (mzip_extract_entry (za, e, &buf, &sz) != 0) {
+		free (zf);
 		return NULL;
 	}
 	zf->data = buf;
 	zf->size = sz;
+	zf->crc_valid = 0;
 	return zf;
 }
 
+zip_int64_t zip_fread(zip_file_t *zf, void *buf, zip_uint64_t nbytes) {
+	if (!zf || (!buf && nbytes) || zf->err) {
+		return -1;
+	}
+	if (zf->pos >= zf->size) {
+		return 0;
+	}
+	uint64_t left = zf->size - zf->pos;
+	size_t n = (size_t)(nbytes < left ? nbytes : left);
+	if ((uint64_t)n > (uint64_t)INT64_MAX) {
+		n = (size_t)INT64_MAX;
+	}
+	int64_t got;
+	if (zf->data) {
+		memcpy (buf, zf->data + zf->pos, n);
+		got = (int64_t)n;
+	} else if (zf->strm) {
+		got = mzip_read_decoded (zf, (uint8_t*)buf, n);
+		if (got >= 0 && (size_t)got < n) {
+			got = -1; /* stream ended before uncomp_size bytes */
+		}
+	} else {
+		got = mzip_read_stored (zf, (uint8_t*)buf, n) == 0 ? (int64_t)n : -1;
+	}
+	if (got < 0) {
+		zf->err = 1;
+		return -1;
+	}
+	if (zf->crc_valid) {
+		zf->crc = mzip_crc32 (zf->crc, buf, (size_t)got);
+	}
+	zf->pos += (uint64_t)got;
+	if (zf->pos == zf->size && mzip_read_finish (zf) != 0) {
+		zf->err = 1;
+		return -1;
+	}
+	return got;
+}
+
+zip_int8_t zip_fseek(zip_file_t *zf, zip_int64_t offset, int whence) {
+	if (!zf || zf->err) {
+		return -1;
+	}
+	int64_t base;
+	switch (whence) {
+	case SEEK_SET: base = 0; break;
+	case SEEK_CUR: base = (int64_t)zf->pos; break;
+	case SEEK_END: base = (int64_t)zf->size; break;
+	default: return -1;
+	}
+	if ((offset > 0 && base > INT64_MAX - offset) || base + offset < 0 ||
+	    (uint64_t)(base + offset) > zf->size) {
+		return -1;
+	}
+	uint64_t target = (uint64_t)(base + offset);
+	if (target == zf->pos) {
+		return 0;
+	}
+	if (!zf->strm) {
+		/* random access: the running CRC only survives a rewind */
+		zf->pos = target;
+		zf->crc = 0;
+		zf->crc_valid = (target == 0 && !zf->data);
+		return 0;
+	}
+	/* a decoder can only move forward: rewind by restarting the stream,
+	 * then decode and drop bytes up to the target */
+	if (target < zf->pos) {
+		mzip_stream_end (zf);
+		if (mzip_stream_init (zf) != 0) {
+			zf->err = 1;
+			return -1;
+		}
+	}
+	uint8_t scratch[4096];
+	while (zf->pos < target) {
+		uint64_t step = target - zf->pos;
+		if (step > sizeof (scratch)) {
+			step = sizeof (scratch);
+		}
+		if (zip_fread (zf, scratch, step) != (zip_int64_t)step) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+zip_int64_t zip_ftell(zip_file_t *zf) {
+	if (!zf) {
+		return -1;
+	}
+	return (zip_int64_t)zf->pos;
+}
+
+int zip_fopen_index_view(zip_t *za, zip_uint64_t index, zip_flags_t flags,
+		const uint8_t **data, zip_uint64_t *size) {
+	if (!za || !data || !size || index >= za->n_entries || !za->map) {
+		return -1;
+	}
+	if (za->mode == 1) {
+		mzip_pool_drain (za);
+	}
+	struct mzip_entry *e = &za->entries[index];
+	if (e->method != MZIP_METHOD_STORE || e->comp_size != e->uncomp_size) {
+		return -1;
+	}
+	uint64_t data_ofs;
+	if (mzip_entry_data_ofs (za, e, za->size, &data_ofs) != 0) {
+		return -1;
+	}
+	const uint8_t *p = za->map + data_ofs;
+	if ((flags & MZIP_FL_VERIFY_CRC) && mzip_crc32 (0, p, e->comp_size) != e->crc32) {
+		return -1;
+	}
+	*data = p;
+	*size = e->comp_size;
+	return 0;
+}
+
 int zip_fclose(zip_file_t *zf) {
 	if (!zf) {
 		return -1;
 	}
+	mzip_stream_end (zf);
+	free (zf->in_buf);
 	free (zf->data);
 	free (zf);
 	return 0;
 }
 
-/* Helper function to write local file header */
-static uint32_t mzip_write_local_header(FILE *fp, const char *name, uint32_t comp_method, 
-    uint32_t comp_size, uint32_t uncomp_size, uint32_t crc32) {
-    size_t filename_len_sz = strlen(name);
-    if (filename_len_sz > MZIP_MAX_FIELD_LEN) filename_len_sz = MZIP_MAX_FIELD_LEN;
-    uint16_t filename_len = (uint16_t)filename_len_sz;
-	uint8_t header[30];
+/* Helper function to build a local file header at header, which must have
+ * room for MZIP_LFH_MAX (filename_len) bytes. With zip64 set, both sizes
+ * go into a ZIP64 extra field (0xFFFFFFFF in the fixed fields). */
+static uint32_t mzip_put_local_header(uint8_t *header, const char *name, uint16_t filename_len, uint16_t gp_flags, uint32_t comp_method, 
+    uint64_t comp_size, uint64_t uncomp_size, uint32_t crc32,
+    uint16_t file_time, uint16_t file_date, int zip64) {
+	uint8_t *extra = header + 30 + filename_len;
+	uint16_t extra_len = zip64 ? 20 : 0;
 
 	/* Write local file header signature */
 	mzip_wr32 (header, MZIP_SIG_LFH);
 
-	/* Version needed to extract (2.0) */
-	mzip_wr16 (header + 4, 20);
+	/* Version needed to extract (2.0, 4.5 for ZIP64) */
+	mzip_wr16 (header + 4, zip64 ? MZIP_ZIP64_VERSION : 20);
 
 	/* General purpose bit flag */
-	mzip_wr16 (header + 6, 0);
+	mzip_wr16 (header + 6, gp_flags);
 
 	/* Compression method */
 	mzip_wr16 (header + 8, comp_method);
 
 	/* Last mod file time & date */
-	uint16_t file_time, file_date;
-	mzip_get_dostime(&file_time, &file_date);
 	mzip_wr16 (header + 10, file_time);
 	mzip_wr16 (header + 12, file_date);
 
@@ -1224,34 +3062,59 @@ static uint32_t mzip_write_local_header(FILE *fp, const char *name, uint32_t com
 	mzip_wr32 (header + 14, crc32);
 
 	/* Compressed size */
-	mzip_wr32 (header + 18, comp_size);
+	mzip_wr32 (header + 18, zip64 ? 0xFFFFFFFFu : (uint32_t)comp_size);
 
 	/* Uncompressed size */
-	mzip_wr32 (header + 22, uncomp_size);
+	mzip_wr32 (header + 22, zip64 ? 0xFFFFFFFFu : (uint32_t)uncomp_size);
 
 	/* File name length */
 	mzip_wr16 (header + 26, filename_len);
 
 	/* Extra field length */
-	mzip_wr16 (header + 28, 0);
+	mzip_wr16 (header + 28, extra_len);
 
-	/* Write header */
-	fwrite (header, 1, sizeof (header), fp);
+	/* Filename */
+	memcpy (header + 30, name, filename_len);
 
-	/* Write filename */
-	fwrite (name, 1, filename_len, fp);
+	/* ZIP64 extra field: uncompressed then compressed size */
+	if (zip64) {
+		mzip_wr16 (extra, MZIP_ZIP64_EXTRA_ID);
+		mzip_wr16 (extra + 2, 16);
+		mzip_write_le64 (extra + 4, uncomp_size);
+		mzip_write_le64 (extra + 12, comp_size);
+	}
 
-	return 30 + filename_len;
+	return 30 + filename_len + extra_len;
 }
 
-/* Helper function to write central directory header */
-static uint32_t mzip_write_central_header(FILE *fp, const char *name, uint32_t comp_method,
-    uint32_t comp_size, uint32_t uncomp_size, uint32_t crc32,
-    uint32_t local_header_offset, uint16_t file_time, uint16_t file_date, uint32_t external_attr) {
-    size_t filename_len_sz = strlen(name);
-    if (filename_len_sz > MZIP_MAX_FIELD_LEN) filename_len_sz = MZIP_MAX_FIELD_LEN;
-    uint16_t filename_len = (uint16_t)filename_len_sz;
-	uint8_t header[46];
+/* Helper function to build a central directory header at header, which
+ * must have room for MZIP_CDH_MAX (filename_len) bytes. Sizes and offset
+ * that do not fit 32 bits move into a ZIP64 extra field. */
+static uint32_t mzip_put_central_header(uint8_t *header, const char *name, uint16_t filename_len, uint16_t gp_flags, uint32_t comp_method,
+    uint64_t comp_size, uint64_t uncomp_size, uint32_t crc32,
+    uint64_t local_header_offset, uint16_t file_time, uint16_t file_date, uint32_t external_attr) {
+	uint8_t *extra = header + 46 + filename_len;
+	uint16_t extra_len = 0;
+
+	/* ZIP64 extra field, in the order the spec mandates */
+	if (uncomp_size >= 0xFFFFFFFFu) {
+		mzip_write_le64 (extra + 4 + extra_len, uncomp_size);
+		extra_len += 8;
+	}
+	if (comp_size >= 0xFFFFFFFFu) {
+		mzip_write_le64 (extra + 4 + extra_len, comp_size);
+		extra_len += 8;
+	}
+	if (local_header_offset >= 0xFFFFFFFFu) {
+		mzip_write_le64 (extra + 4 + extra_len, local_header_offset);
+		extra_len += 8;
+	}
+	int zip64 = extra_len > 0;
+	if (zip64) {
+		mzip_wr16 (extra, MZIP_ZIP64_EXTRA_ID);
+		mzip_wr16 (extra + 2, extra_len);
+		extra_len += 4;
+	}
 
 	/* Central directory file header signature */
 	mzip_wr32 (header, MZIP_SIG_CDH);
@@ -1259,11 +3122,11 @@ static uint32_t mzip_write_central_header(FILE *fp, const char *name, uint32_t c
 	/* Version made by (UNIX, version 2.0) */
 	mzip_wr16 (header + 4, 0x031e); 
 
-	/* Version needed to extract (2.0) */
-	mzip_wr16 (header + 6, 20);
+	/* Version needed to extract (2.0, 4.5 for ZIP64) */
+	mzip_wr16 (header + 6, zip64 ? MZIP_ZIP64_VERSION : 20);
 
 	/* General purpose bit flag */
-	mzip_wr16 (header + 8, 0);
+	mzip_wr16 (header + 8, gp_flags);
 
 	/* Compression method */
 	mzip_wr16 (header + 10, comp_method);
@@ -1276,16 +3139,16 @@ static uint32_t mzip_write_central_header(FILE *fp, const char *name, uint32_t c
 	mzip_wr32 (header + 16, crc32);
 
 	/* Compressed size */
-	mzip_wr32 (header + 20, comp_size);
+	mzip_wr32 (header + 20, comp_size >= 0xFFFFFFFFu ? 0xFFFFFFFFu : (uint32_t)comp_size);
 
 	/* Uncompressed size */
-	mzip_wr32 (header + 24, uncomp_size);
+	mzip_wr32 (header + 24, uncomp_size >= 0xFFFFFFFFu ? 0xFFFFFFFFu : (uint32_t)uncomp_size);
 
 	/* File name length */
 	mzip_wr16 (header + 28, filename_len);
 
 	/* Extra field length */
-	mzip_wr16 (header + 30, 0);
+	mzip_wr16 (header + 30, extra_len);
 
 	/* File comment length */
 	mzip_wr16 (header + 32, 0);
@@ -1300,21 +3163,50 @@ static uint32_t mzip_write_central_header(FILE *fp, const char *name, uint32_t c
 	mzip_wr32 (header + 38, external_attr);
 
 	/* Relative offset of local header */
-	mzip_wr32 (header + 42, local_header_offset);
-
-	/* Write header */
-	fwrite (header, 1, sizeof (header), fp);
+	mzip_wr32 (header + 42, local_header_offset >= 0xFFFFFFFFu ? 0xFFFFFFFFu : (uint32_t)local_header_offset);
 
-	/* Write filename */
-	fwrite (name, 1, filename_len, fp);
+	/* Filename; the extra field is already in place after it */
+	memcpy (header + 46, name, filename_len);
 
-	return 46 + filename_len;
+	return 46 + filename_len + extra_len;
 }
 
-/* Helper function to write end of central directory record */
-static void mzip_write_end_of_central_directory(FILE *fp, uint32_t num_entries, 
-		uint32_t central_dir_size, uint32_t central_dir_offset) {
-	uint8_t eocd[22];
+/* Helper function to build the end of central directory record at out
+ * (MZIP_EOCD_MAX bytes). When a count, size or offset does not fit the
+ * classic record, the ZIP64 end of central directory record and its
+ * locator come first and the classic fields are saturated. */
+static uint32_t mzip_put_end_of_central_directory(uint8_t *out, uint64_t num_entries, 
+		uint64_t central_dir_size, uint64_t central_dir_offset) {
+	uint8_t *eocd = out;
+
+	if (num_entries >= 0xFFFF || central_dir_size >= 0xFFFFFFFFu
+			|| central_dir_offset >= 0xFFFFFFFFu) {
+		uint8_t *rec = out;
+		uint8_t *loc = out + MZIP_ZIP64_EOCD_SIZE;
+		uint64_t rec_ofs = central_dir_offset + central_dir_size;
+		eocd = loc + MZIP_ZIP64_LOCATOR_SIZE;
+
+		mzip_wr32 (rec, MZIP_SIG_ZIP64_EOCD);
+		/* Size of the record, not counting the leading 12 bytes */
+		mzip_write_le64 (rec + 4, MZIP_ZIP64_EOCD_SIZE - 12);
+		mzip_wr16 (rec + 12, MZIP_ZIP64_VERSION); /* version made by */
+		mzip_wr16 (rec + 14, MZIP_ZIP64_VERSION); /* version needed */
+		mzip_wr32 (rec + 16, 0);
+		mzip_wr32 (rec + 20, 0);
+		mzip_write_le64 (rec + 24, num_entries);
+		mzip_write_le64 (rec + 32, num_entries);
+		mzip_write_le64 (rec + 40, central_dir_size);
+		mzip_write_le64 (rec + 48, central_dir_offset);
+
+		mzip_wr32 (loc, MZIP_SIG_ZIP64_LOCATOR);
+		mzip_wr32 (loc + 4, 0);
+		mzip_write_le64 (loc + 8, rec_ofs);
+		mzip_wr32 (loc + 16, 1);
+
+		if (num_entries > 0xFFFF) num_entries = 0xFFFF;
+		if (central_dir_size > 0xFFFFFFFFu) central_dir_size = 0xFFFFFFFFu;
+		if (central_dir_offset > 0xFFFFFFFFu) central_dir_offset = 0xFFFFFFFFu;
+	}
 
 	/* End of central directory signature */
 	mzip_wr32 (eocd, MZIP_SIG_EOCD);
@@ -1326,29 +3218,81 @@ static void mzip_write_end_of_central_directory(FILE *fp, uint32_t num_entries,
 	mzip_wr16 (eocd + 6, 0);
 
 	/* Total number of entries in the central directory on this disk */
-	mzip_wr16 (eocd + 8, num_entries);
+	mzip_wr16 (eocd + 8, (uint16_t)num_entries);
 
 	/* Total number of entries in the central directory */
-	mzip_wr16 (eocd + 10, num_entries);
+	mzip_wr16 (eocd + 10, (uint16_t)num_entries);
 
 	/* Size of the central directory */
-	mzip_wr32 (eocd + 12, central_dir_size);
+	mzip_wr32 (eocd + 12, (uint32_t)central_dir_size);
 
 	/* Offset of start of central directory with respect to the starting disk number */
-	mzip_wr32 (eocd + 16, central_dir_offset);
+	mzip_wr32 (eocd + 16, (uint32_t)central_dir_offset);
 
 	/* .ZIP file comment length */
 	mzip_wr16 (eocd + 20, 0);
 
-	/* Write end of central directory record */
-	fwrite (eocd, 1, sizeof (eocd), fp);
+	return (uint32_t)(eocd + 22 - out);
 }
 
 zip_source_t *zip_source_buffer(zip_t *za, const void *data, zip_uint64_t len, int freep) {
 	(void)za;
-	zip_source_t *src = (zip_source_t*)malloc (sizeof (zip_source_t));
+	zip_source_t *src = (zip_source_t*)calloc (1, sizeof (zip_source_t));
+	if (!src) {
+		return NULL;
+	}
 	src->buf = data;
 	src->len = len;
 	src->freep = freep;
 	return src;
 }
+
+void zip_source_free(zip_source_t *src) {
+	if (!src) {
+		return;
+	}
+	if (src->fp) {
+		fclose (src->fp);
+	}
+	if (src->freep) {
+		free ((void*)src->buf);
+	}
+	free (src);
+}
+
+zip_source_t *zip_source_filep(zip_t *za, FILE *file, zip_uint64_t start, zip_int64_t len) {
+	(void)za;
+	if (!file || len < -1) {
+		return NULL;
+	}
+	/* pipes cannot seek: skip by reading */
+	if (start > 0 && mzip_fseek (file, (int64_t)start, SEEK_SET) != 0) {
+		for (zip_uint64_t i = 0; i < start; i++) {
+			if (fgetc (file) == EOF) {
+				return NULL;
+			}
+		}
+	}
+	zip_source_t *src = (zip_source_t*)calloc (1, sizeof (zip_source_t));
+	if (!src) {
+		return NULL;
+	}
+	src->fp = file;
+	src->flen = len;
+	return src;
+}
+
+zip_source_t *zip_source_file(zip_t *za, const char *fname, zip_uint64_t start, zip_int64_t len) {
+	if (!fname) {
+		return NULL;
+	}
+	FILE *fp = fopen (fname, "rb");
+	if (!fp) {
+		return NULL;
+	}
+	zip_source_t *src = zip_source_filep (za, fp, start, len);
+	if (!src) {
+		fclose (fp);
+	}
+	return src;
+}
@@ -12,7 +12,14 @@
  *   zstdDecompressEnd
  *
  * It supports:
- * - Basic Zstandard compression/decompression
+ * - Zstandard frame compression (RFC 8878), levels 1-19: a hash chain
+ *   match finder with lazy matching, Huffman-coded literals and FSE-coded
+ *   sequences with predefined, RLE or per-block tables
+ * - Zstandard frame decompression: Huffman literals (1 or 4 streams),
+ *   FSE sequences in every table mode, repeat offsets, raw/RLE blocks,
+ *   skippable and concatenated frames, output in as many pieces as the
+ *   caller likes; the stream ends at a frame end with no input left under
+ *   Z_FINISH
  * - Bare minimum functionality to support ZIP file reading/writing
  * - Compatible interface with existing deflate.c implementation
  *
@@ -57,15 +64,19 @@
 #define Z_BEST_SPEED          1
 #define Z_BEST_COMPRESSION    9
 #ifndef Z_DEFAULT_COMPRESSION
-#define Z_DEFAULT_COMPRESSION 1
+#define Z_DEFAULT_COMPRESSION (-1)
 #endif
 
 /* ZSTD-specific constants */
 #define ZSTD_MAGIC_NUMBER      0xFD2FB528   /* Magic number for Zstandard frame */
 #define ZSTD_FRAME_HEADER_SIZE 5           /* Minimum frame header size */
-#define ZSTD_BLOCK_MAX_SIZE    128 * 1024  /* Maximum block size */
-#define ZSTD_WINDOW_LOG_MAX    24          /* Max window log size */
+#define ZSTD_BLOCK_MAX_SIZE    (128 * 1024) /* Maximum block size */
+#define ZSTD_WINDOW_LOG_MAX    27          /* Max window log size */
 #define ZSTD_DEFAULT_CLEVEL    3           /* Default compression level */
+#define ZSTD_MAX_CLEVEL        19          /* Highest compression level */
+#define ZSTD_FSE_LOG_MAX       9           /* Largest sequence table log */
+#define ZSTD_OF_LOG_MAX        8           /* Largest offset table log */
+#define ZSTD_HUF_LOG_MAX       11          /* Longest Huffman code */
 
 /* ------------- Data Structures ------------- */
 
@@ -87,41 +98,100 @@ typedef struct {
 	uint8_t  is_last_block;
 } zstd_block_header;
 
+/* One LZ77 sequence: literals, then a match; offset is the Offset_Value
+ * (1-3 repeat codes, otherwise distance + 3) */
+typedef struct {
+	uint32_t lit_len;
+	uint32_t match_len;
+	uint32_t offset;
+} zstd_seq;
+
 /* Zstandard compression context */
 typedef struct {
 	int compression_level;
-	uint8_t *dict;
-	size_t dict_size;
+	int started;          /* frame header emitted */
+	int finished;         /* last block emitted */
+	int single_segment;   /* content size known and within the window */
+	uint64_t content_size;
+
+	/* Input history: matches reach back at most window_size bytes */
 	uint8_t *window_buffer;
 	size_t window_size;
-	size_t window_pos;
-	uint32_t block_size;
-	int is_last_block;
-
-	/* Temporary work buffers */
+	size_t window_cap;
+	size_t window_len;
+	size_t block_start;   /* first byte not compressed yet */
+	size_t next_insert;   /* first position not in the hash chains yet */
+
+	/* Hash chain match finder, positions stored + 1 so that 0 is empty */
+	uint32_t *hash_table;
+	uint32_t *chain_table;
+	uint32_t hash_log;
+	uint32_t chain_mask;
+	uint32_t rep[3];      /* repeat offsets, as the decoder tracks them */
+
+	/* Parsed block */
+	zstd_seq *seqs;
+	size_t n_seqs;
+	uint8_t *literals;
+	size_t n_literals;
+
+	/* Encoded frame bytes not handed to the caller yet */
 	uint8_t *compress_buffer;
 	size_t compress_buffer_size;
+	size_t out_len;
+	size_t out_pos;
 } zstd_compress_context;
 
+/* FSE decoding table entry: the next state is base plus bits read */
+typedef struct {
+	uint16_t base;
+	uint8_t symbol;
+	uint8_t bits;
+} zstd_fse_entry;
+
 /* Zstandard decompression context */
 typedef struct {
-	uint8_t *dict;
-	size_t dict_size;
-	uint8_t *window_buffer;
-	size_t window_size;
-	size_t window_pos;
-	uint32_t current_block_size;
-	int current_block_remaining;
-	int is_last_block;
+	int stage;
+	uint8_t frame_flags;
+	uint64_t skip_left;   /* rest of a skippable frame */
 
 	/* Frame parameters from header */
-	uint32_t window_log;
+	int single_segment;
+	int has_checksum;
+	int has_content_size;
 	uint64_t content_size;
-	uint32_t dictionary_id;
+	uint64_t window_size;
+	uint32_t block_max;
+	uint64_t produced;    /* frame bytes decoded so far */
+
+	/* Current block */
+	int last_block;
+	uint32_t block_type;
+	uint32_t block_size;
 
-	/* Temporary work buffers */
-	uint8_t *decompress_buffer;
-	size_t decompress_buffer_size;
+	/* Header or block bytes gathered across calls */
+	uint8_t *in_buf;
+	size_t in_len;
+
+	/* History, once output no longer stays in the caller's buffer */
+	int windowed;
+	uint8_t *window_buffer;
+	size_t window_cap;
+	size_t window_len;
+	size_t window_out;    /* bytes of the window handed out so far */
+
+	/* Entropy state carried from block to block */
+	uint32_t rep[3];
+	uint16_t huf_table[1 << ZSTD_HUF_LOG_MAX];   /* symbol | code length << 8 */
+	uint32_t huf_log;     /* 0 until a block describes a tree */
+	zstd_fse_entry ll_table[1 << ZSTD_FSE_LOG_MAX];
+	zstd_fse_entry of_table[1 << ZSTD_OF_LOG_MAX];
+	zstd_fse_entry ml_table[1 << ZSTD_FSE_LOG_MAX];
+	uint32_t ll_log, of_log, ml_log;
+	int tables_valid;     /* bit per table a repeat mode may reuse */
+
+	uint8_t *literals;
+	size_t n_literals;
 } zstd_decompress_context;
 
 /* ------------- Function Prototypes ------------- */
@@ -169,93 +239,1045 @@ static uint32_t read_le32(const void *ptr) {
 		((uint32_t)p[3] << 24);
 }
 
-/* Simple RLE compression for Zstandard block */
-static int compress_block(const uint8_t *src, size_t src_size, 
-        uint8_t *dst, size_t dst_capacity, 
-                int level) {
-    (void)level; /* Unused in this minimal implementation */
-	/* This is a very simplified compression that only does basic RLE */
-	if (src_size == 0 || !src || !dst) {
-		return 0;  /* Empty input or invalid pointers */
+/* --- Format tables (RFC 8878) --- */
+
+#define ZSTD_MIN_MATCH     4    /* shortest match the finder reports */
+#define ZSTD_LL_MAX_CODE   35
+#define ZSTD_ML_MAX_CODE   52
+#define ZSTD_OF_MAX_CODE   31
+
+static const uint32_t zstd_ll_base[ZSTD_LL_MAX_CODE + 1] = {
+	0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+	16, 18, 20, 22, 24, 28, 32, 40, 48, 64, 128, 256, 512, 1024, 2048, 4096,
+	8192, 16384, 32768, 65536
+};
+static const uint8_t zstd_ll_bits[ZSTD_LL_MAX_CODE + 1] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	1, 1, 1, 1, 2, 2, 3, 3, 4, 6, 7, 8, 9, 10, 11, 12,
+	13, 14, 15, 16
+};
+static const uint32_t zstd_ml_base[ZSTD_ML_MAX_CODE + 1] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18,
+	19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34,
+	35, 37, 39, 41, 43, 47, 51, 59, 67, 83, 99, 131, 259, 515, 1027, 2051,
+	4099, 8195, 16387, 32771, 65539
+};
+static const uint8_t zstd_ml_bits[ZSTD_ML_MAX_CODE + 1] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	1, 1, 1, 1, 2, 2, 3, 3, 4, 4, 5, 7, 8, 9, 10, 11,
+	12, 13, 14, 15, 16
+};
+
+/* Predefined distributions, used when a block carries no table */
+#define ZSTD_LL_DEFAULT_LOG 6
+#define ZSTD_ML_DEFAULT_LOG 6
+#define ZSTD_OF_DEFAULT_LOG 5
+#define ZSTD_OF_DEFAULT_MAX 28
+static const int16_t zstd_ll_default[ZSTD_LL_MAX_CODE + 1] = {
+	4, 3, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 1, 1, 1,
+	2, 2, 2, 2, 2, 2, 2, 2, 2, 3, 2, 1, 1, 1, 1, 1,
+	-1, -1, -1, -1
+};
+static const int16_t zstd_ml_default[ZSTD_ML_MAX_CODE + 1] = {
+	1, 4, 3, 2, 2, 2, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, -1, -1,
+	-1, -1, -1, -1, -1
+};
+static const int16_t zstd_of_default[ZSTD_OF_DEFAULT_MAX + 1] = {
+	1, 1, 1, 1, 1, 1, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, -1, -1, -1, -1, -1
+};
+
+static uint32_t zstd_highbit(uint32_t v) {
+	uint32_t r = 0;
+	while (v >>= 1) {
+		r++;
 	}
+	return r;
+}
 
-	/* Check if there's enough space for output */
-	if (dst_capacity < src_size + 1) {
-		return 0;  /* Not enough output capacity */
+/* Resolve an Offset_Value to a distance and update the repeat offsets,
+ * as RFC 8878 3.1.2.5 describes */
+static uint32_t zstd_rep_update(uint32_t *rep, uint32_t offset, uint32_t lit_len) {
+	if (offset > 3) {
+		rep[2] = rep[1];
+		rep[1] = rep[0];
+		rep[0] = offset - 3;
+		return rep[0];
 	}
+	uint32_t idx = offset - 1 + (lit_len == 0);
+	if (idx == 0) {
+		return rep[0];
+	}
+	uint32_t dist = idx == 3 ? rep[0] - 1 : rep[idx];
+	if (idx > 1) {
+		rep[2] = rep[1];
+	}
+	rep[1] = rep[0];
+	rep[0] = dist;
+	return dist;
+}
 
-	/* For this minimal implementation, we'll just do a simple RLE */
-	size_t dst_pos = 0;
-	size_t src_pos = 0;
+/* --- Compression: parameters --- */
+
+static const struct zstd_level {
+	uint8_t window_log;
+	uint8_t hash_log;
+	uint8_t chain_log;
+	uint8_t lazy;       /* positions ahead tried for a better match */
+	uint8_t skip;       /* step faster through incompressible input */
+	uint16_t depth;     /* chain entries visited per search */
+	uint16_t nice;      /* stop searching at this length */
+} zstd_levels[ZSTD_MAX_CLEVEL + 1] = {
+	{ 0, 0, 0, 0, 0, 0, 0 },
+	{ 19, 15, 16, 0, 6, 2, 16 },
+	{ 19, 16, 17, 0, 7, 4, 24 },
+	{ 20, 17, 18, 1, 8, 6, 32 },
+	{ 20, 17, 18, 1, 8, 8, 32 },
+	{ 21, 18, 19, 1, 8, 12, 48 },
+	{ 21, 18, 19, 1, 8, 16, 64 },
+	{ 21, 18, 20, 2, 8, 24, 64 },
+	{ 22, 19, 20, 2, 8, 32, 96 },
+	{ 22, 19, 21, 2, 8, 48, 128 },
+	{ 22, 20, 21, 2, 8, 64, 128 },
+	{ 22, 20, 22, 2, 8, 96, 192 },
+	{ 23, 20, 22, 2, 8, 128, 256 },
+	{ 23, 21, 22, 2, 8, 192, 256 },
+	{ 23, 21, 22, 2, 8, 256, 384 },
+	{ 23, 22, 23, 2, 8, 384, 512 },
+	{ 23, 22, 23, 2, 8, 512, 768 },
+	{ 23, 22, 23, 2, 8, 768, 1024 },
+	{ 23, 22, 23, 2, 8, 1024, 2048 },
+	{ 23, 22, 23, 2, 8, 2048, 4096 },
+};
+
+/* --- Compression: bit and table writers --- */
+
+/* Backward bit stream: the decoder reads it from the last byte down */
+typedef struct {
+	uint8_t *p;
+	const uint8_t *end;
+	uint64_t acc;
+	uint32_t n;
+	int overflow;
+} zstd_bit_writer;
+
+static void zstd_bw_init(zstd_bit_writer *bw, uint8_t *p, const uint8_t *end) {
+	bw->p = p;
+	bw->end = end;
+	bw->acc = 0;
+	bw->n = 0;
+	bw->overflow = 0;
+}
 
-	while (src_pos < src_size) {
-		/* Check remaining output space */
-		if (dst_pos + 3 > dst_capacity) {
-			return 0;  /* Not enough space */
+static void zstd_bw_add(zstd_bit_writer *bw, uint32_t v, uint32_t n) {
+	bw->acc |= (uint64_t)(v & ((1u << n) - 1)) << bw->n;
+	bw->n += n;
+	if (bw->n >= 32) {
+		if (bw->end - bw->p < 4) {
+			bw->overflow = 1;
+		} else {
+			bw->p[0] = (uint8_t)bw->acc;
+			bw->p[1] = (uint8_t)(bw->acc >> 8);
+			bw->p[2] = (uint8_t)(bw->acc >> 16);
+			bw->p[3] = (uint8_t)(bw->acc >> 24);
+			bw->p += 4;
 		}
+		bw->acc >>= 32;
+		bw->n -= 32;
+	}
+}
 
-		/* Find run of identical bytes */
-		uint8_t run_byte = src[src_pos];
-		size_t run_length = 1;
-
-		while (src_pos + run_length < src_size && 
-				src[src_pos + run_length] == run_byte &&
-				run_length < 255) {
-			run_length++;
+/* Terminate with the end mark; returns the stream size or 0 if it did
+ * not fit */
+static size_t zstd_bw_close(zstd_bit_writer *bw, const uint8_t *start) {
+	zstd_bw_add (bw, 1, 1);
+	while (bw->n > 0) {
+		if (bw->p == bw->end) {
+			return 0;
 		}
+		*bw->p++ = (uint8_t)bw->acc;
+		bw->acc >>= 8;
+		bw->n = bw->n > 8 ? bw->n - 8 : 0;
+	}
+	return bw->overflow ? 0 : (size_t)(bw->p - start);
+}
+
+/* FSE encoding table: state transitions plus per-symbol deltas */
+typedef struct {
+	uint32_t log;
+	int rle;            /* single symbol, no state bits */
+	uint16_t next[1 << ZSTD_FSE_LOG_MAX];
+	struct {
+		uint32_t bits;
+		int32_t find;
+	} sym[ZSTD_ML_MAX_CODE + 1];
+} zstd_fse_table;
+
+/* Table log for total symbols drawn from max_sym + 1 */
+static uint32_t zstd_fse_log(uint32_t max_log, uint32_t total, uint32_t max_sym) {
+	int src_bits = (int)zstd_highbit (total - 1) - 2;
+	uint32_t min_bits = zstd_highbit (total) + 1;
+	uint32_t sym_bits = zstd_highbit (max_sym) + 2;
+	uint32_t log = max_log;
+	if (sym_bits < min_bits) {
+		min_bits = sym_bits;
+	}
+	if (src_bits < (int)log) {
+		log = src_bits < 0 ? 0 : (uint32_t)src_bits;
+	}
+	if (min_bits > log) {
+		log = min_bits;
+	}
+	if (log < 5) {
+		log = 5;
+	}
+	return log > max_log ? max_log : log;
+}
 
-		if (run_length >= 4) {
-			/* Encode run */
-			dst[dst_pos++] = 0;          /* RLE marker */
-			dst[dst_pos++] = run_byte;   /* Repeated byte */
-			dst[dst_pos++] = run_length; /* Length */
-			src_pos += run_length;
+/* Scale counts to sum to 1 << log; symbols rarer than one slot get -1 */
+static int zstd_fse_normalize(int16_t *norm, uint32_t log, const uint32_t *count,
+		uint32_t total, uint32_t max_sym) {
+	int rest = 1 << log;
+	for (uint32_t s = 0; s <= max_sym; s++) {
+		if (!count[s]) {
+			norm[s] = 0;
+		} else if (((uint64_t)count[s] << log) < total) {
+			norm[s] = -1;
+			rest--;
 		} else {
-			/* Literal */
-			dst[dst_pos++] = run_byte;
-			src_pos++;
+			norm[s] = (int16_t)((((uint64_t)count[s] << log) + total / 2) / total);
+			rest -= norm[s];
+		}
+	}
+	/* rounding leftovers go to, or come from, the most probable symbols */
+	while (rest != 0) {
+		uint32_t best = 0;
+		for (uint32_t s = 1; s <= max_sym; s++) {
+			if (norm[s] > norm[best]) {
+				best = s;
+			}
+		}
+		if (norm[best] <= 1) {
+			return -1;
+		}
+		if (rest > 0) {
+			norm[best] += (int16_t)rest;
+			rest = 0;
+		} else {
+			norm[best]--;
+			rest++;
+		}
+	}
+	return 0;
+}
+
+/* Approximate bits, in 1/256 units, to code count symbols at norm / 2^log */
+static uint64_t zstd_fse_cost(const uint32_t *count, uint32_t max_sym,
+		const int16_t *norm, uint32_t log) {
+	uint64_t cost = 0;
+	for (uint32_t s = 0; s <= max_sym; s++) {
+		if (!count[s]) {
+			continue;
+		}
+		uint32_t n = norm[s] < 0 ? 1 : (uint32_t)norm[s];
+		if (!n) {
+			return UINT64_MAX;
+		}
+		uint32_t hb = zstd_highbit (n);
+		uint32_t log2 = (hb << 8) + ((n << 8) >> hb) - 256;
+		cost += (uint64_t)count[s] * ((log << 8) - log2);
+	}
+	return cost;
+}
+
+/* Table description (RFC 8878 4.1.1); returns its size or 0 */
+static size_t zstd_put_ncount(uint8_t *dst, const uint8_t *end, const int16_t *norm,
+		uint32_t max_sym, uint32_t log) {
+	uint8_t *p = dst;
+	uint32_t bits = log - 5, nbits = 4;
+	int remaining = (1 << log) + 1, threshold = 1 << log, width = (int)log + 1;
+	int prev_zero = 0;
+	uint32_t s = 0;
+	while (s <= max_sym && remaining > 1) {
+		if (prev_zero) {
+			uint32_t start = s;
+			while (s <= max_sym && !norm[s]) {
+				s++;
+			}
+			if (s > max_sym) {
+				return 0;
+			}
+			while (s >= start + 24) {
+				start += 24;
+				bits += 0xFFFFu << nbits;
+				if (end - p < 2) {
+					return 0;
+				}
+				*p++ = (uint8_t)bits;
+				*p++ = (uint8_t)(bits >> 8);
+				bits >>= 16;
+			}
+			while (s >= start + 3) {
+				start += 3;
+				bits += 3u << nbits;
+				nbits += 2;
+			}
+			bits += (s - start) << nbits;
+			nbits += 2;
+			if (nbits > 16) {
+				if (end - p < 2) {
+					return 0;
+				}
+				*p++ = (uint8_t)bits;
+				*p++ = (uint8_t)(bits >> 8);
+				bits >>= 16;
+				nbits -= 16;
+			}
+		}
+		int count = norm[s++];
+		int max = (2 * threshold - 1) - remaining;
+		remaining -= count < 0 ? -count : count;
+		count++;
+		if (count >= threshold) {
+			count += max;
+		}
+		bits += (uint32_t)count << nbits;
+		nbits += width - (count < max);
+		prev_zero = count == 1;
+		if (remaining < 1) {
+			return 0;
+		}
+		while (remaining < threshold) {
+			width--;
+			threshold >>= 1;
+		}
+		if (nbits > 16) {
+			if (end - p < 2) {
+				return 0;
+			}
+			*p++ = (uint8_t)bits;
+			*p++ = (uint8_t)(bits >> 8);
+			bits >>= 16;
+			nbits -= 16;
 		}
 	}
+	if (remaining != 1 || end - p < (int)(nbits + 7) / 8) {
+		return 0;
+	}
+	for (; nbits > 0; nbits = nbits > 8 ? nbits - 8 : 0) {
+		*p++ = (uint8_t)bits;
+		bits >>= 8;
+	}
+	return (size_t)(p - dst);
+}
 
-	return dst_pos;  /* Return compressed size */
+/* Spread symbols over the states exactly like the decoder does */
+static void zstd_fse_build(zstd_fse_table *t, const int16_t *norm, uint32_t max_sym, uint32_t log) {
+	uint32_t size = 1u << log, mask = size - 1;
+	uint32_t step = (size >> 1) + (size >> 3) + 3, high = size - 1;
+	uint8_t spread[1 << ZSTD_FSE_LOG_MAX];
+	uint32_t cumul[ZSTD_ML_MAX_CODE + 2];
+
+	t->log = log;
+	t->rle = 0;
+	cumul[0] = 0;
+	for (uint32_t s = 0; s <= max_sym; s++) {
+		if (norm[s] == -1) {
+			cumul[s + 1] = cumul[s] + 1;
+			spread[high--] = (uint8_t)s;
+		} else {
+			cumul[s + 1] = cumul[s] + (uint32_t)norm[s];
+		}
+	}
+	uint32_t pos = 0;
+	for (uint32_t s = 0; s <= max_sym; s++) {
+		for (int i = 0; i < norm[s]; i++) {
+			spread[pos] = (uint8_t)s;
+			do {
+				pos = (pos + step) & mask;
+			} while (pos > high);
+		}
+	}
+	for (uint32_t u = 0; u < size; u++) {
+		t->next[cumul[spread[u]]++] = (uint16_t)(size + u);
+	}
+	int32_t total = 0;
+	for (uint32_t s = 0; s <= max_sym; s++) {
+		if (norm[s] == 0) {
+			continue;
+		}
+		if (norm[s] == -1 || norm[s] == 1) {
+			t->sym[s].bits = (log << 16) - size;
+			t->sym[s].find = total - 1;
+			total++;
+		} else {
+			uint32_t max_bits = log - zstd_highbit ((uint32_t)norm[s] - 1);
+			t->sym[s].bits = (max_bits << 16) - ((uint32_t)norm[s] << max_bits);
+			t->sym[s].find = total - norm[s];
+			total += norm[s];
+		}
+	}
 }
 
-/* Simple decompression for our Zstandard block */
-static int decompress_block(const uint8_t *src, size_t src_size,
-		uint8_t *dst, size_t dst_capacity) {
-	if (src_size == 0 || !src || !dst) {
-		return 0;  /* Empty input or invalid pointers */
+static void zstd_fse_init_state(const zstd_fse_table *t, uint32_t *state, uint32_t s) {
+	if (t->rle) {
+		return;
 	}
+	uint32_t nb = (t->sym[s].bits + (1u << 15)) >> 16;
+	uint32_t v = (nb << 16) - t->sym[s].bits;
+	*state = t->next[(v >> nb) + t->sym[s].find];
+}
 
-	size_t dst_pos = 0;
-	size_t src_pos = 0;
+static void zstd_fse_put(zstd_bit_writer *bw, const zstd_fse_table *t, uint32_t *state, uint32_t s) {
+	if (t->rle) {
+		return;
+	}
+	uint32_t nb = (*state + t->sym[s].bits) >> 16;
+	zstd_bw_add (bw, *state, nb);
+	*state = t->next[(*state >> nb) + t->sym[s].find];
+}
 
-	while (src_pos < src_size) {
-		/* Check for RLE marker */
-		if (src[src_pos] == 0 && src_pos + 2 < src_size) {
-			uint8_t byte = src[src_pos + 1];
-			uint8_t length = src[src_pos + 2];
-			src_pos += 3;
+static void zstd_fse_flush(zstd_bit_writer *bw, const zstd_fse_table *t, uint32_t state) {
+	if (!t->rle) {
+		zstd_bw_add (bw, state, t->log);
+	}
+}
 
-			/* Check output capacity */
-			if (dst_pos + length > dst_capacity) {
-				return 0;  /* Output overflow */
+/* --- Compression: literals --- */
+
+/* Code lengths of a Huffman code limited to limit bits; returns the
+ * longest length, or 0 when fewer than two symbols occur */
+static uint32_t zstd_huf_lengths(const uint32_t *count, uint8_t *len, uint32_t limit) {
+	uint32_t c[256], w[511];
+	uint16_t sym[256], parent[511];
+	uint8_t depth[511];
+
+	memcpy (c, count, sizeof (c));
+	for (;;) {
+		uint32_t n = 0;
+		for (uint32_t s = 0; s < 256; s++) {
+			if (!c[s]) {
+				continue;
+			}
+			/* insertion sort by count, rarest first */
+			uint32_t i = n++;
+			while (i > 0 && c[sym[i - 1]] > c[s]) {
+				sym[i] = sym[i - 1];
+				i--;
+			}
+			sym[i] = (uint16_t)s;
+		}
+		if (n < 2) {
+			return 0;
+		}
+		for (uint32_t i = 0; i < n; i++) {
+			w[i] = c[sym[i]];
+		}
+		/* leaves and merged nodes both come out in weight order */
+		uint32_t leaf = 0, node = n;
+		for (uint32_t k = n; k < 2 * n - 1; k++) {
+			uint32_t pick[2];
+			for (int j = 0; j < 2; j++) {
+				pick[j] = leaf < n && (node >= k || w[leaf] <= w[node]) ? leaf++ : node++;
 			}
+			w[k] = w[pick[0]] + w[pick[1]];
+			parent[pick[0]] = parent[pick[1]] = (uint16_t)k;
+		}
+		uint32_t max = 0;
+		depth[2 * n - 2] = 0;
+		for (uint32_t k = 2 * n - 2; k-- > 0;) {
+			depth[k] = depth[parent[k]] + 1;
+			if (k < n && depth[k] > max) {
+				max = depth[k];
+			}
+		}
+		if (max <= limit) {
+			memset (len, 0, 256);
+			for (uint32_t i = 0; i < n; i++) {
+				len[sym[i]] = depth[i];
+			}
+			return max;
+		}
+		/* too deep: flatten the distribution and retry */
+		for (uint32_t s = 0; s < 256; s++) {
+			if (c[s]) {
+				c[s] = (c[s] + 1) >> 1;
+			}
+		}
+	}
+}
 
-			/* Output run */
-			for (uint8_t i = 0; i < length; i++) {
-				dst[dst_pos++] = byte;
+/* Huffman tree description: FSE-compressed weights when that is smaller,
+ * else 4 bits each (up to 128 weights); returns its size or 0 */
+static size_t zstd_put_huf_weights(uint8_t *dst, const uint8_t *end, const uint8_t *weight, uint32_t n) {
+	size_t direct = n <= 128 ? 1 + (n + 1) / 2 : 0;
+	if (n > 2 && end - dst > 1) {
+		uint32_t count[ZSTD_HUF_LOG_MAX + 1] = {0}, max = 0, used = 0;
+		for (uint32_t i = 0; i < n; i++) {
+			count[weight[i]]++;
+		}
+		for (uint32_t s = 0; s <= ZSTD_HUF_LOG_MAX; s++) {
+			if (count[s]) {
+				max = s;
+				used++;
+			}
+		}
+		int16_t norm[ZSTD_HUF_LOG_MAX + 1];
+		uint32_t log = zstd_fse_log (6, n, max);
+		size_t hs = 0;
+		if (used > 1 && zstd_fse_normalize (norm, log, count, n, max) == 0) {
+			hs = zstd_put_ncount (dst + 1, end, norm, max, log);
+		}
+		if (hs) {
+			/* two interleaved states, the first one decodes weight 0 */
+			zstd_fse_table t;
+			zstd_bit_writer bw;
+			uint32_t state[2];
+			zstd_fse_build (&t, norm, max, log);
+			zstd_bw_init (&bw, dst + 1 + hs, end);
+			for (uint32_t i = n; i-- > 0;) {
+				if (i >= n - 2) {
+					zstd_fse_init_state (&t, &state[i & 1], weight[i]);
+				} else {
+					zstd_fse_put (&bw, &t, &state[i & 1], weight[i]);
+				}
 			}
+			zstd_fse_flush (&bw, &t, state[1]);
+			zstd_fse_flush (&bw, &t, state[0]);
+			size_t bs = zstd_bw_close (&bw, dst + 1 + hs);
+			if (bs && hs + bs < 128 && (!direct || 1 + hs + bs < direct)) {
+				dst[0] = (uint8_t)(hs + bs);
+				return 1 + hs + bs;
+			}
+		}
+	}
+	if (!direct || (size_t)(end - dst) < direct) {
+		return 0;
+	}
+	dst[0] = (uint8_t)(127 + n);
+	for (uint32_t i = 0; i < n; i += 2) {
+		dst[1 + i / 2] = (uint8_t)(weight[i] << 4 | (i + 1 < n ? weight[i + 1] : 0));
+	}
+	return direct;
+}
+
+/* Raw and RLE literal section headers */
+static size_t zstd_put_lit_header(uint8_t *dst, uint32_t type, size_t n) {
+	if (n < 32) {
+		dst[0] = (uint8_t)(type | n << 3);
+		return 1;
+	}
+	if (n < 4096) {
+		uint32_t v = type | 1 << 2 | (uint32_t)n << 4;
+		dst[0] = (uint8_t)v;
+		dst[1] = (uint8_t)(v >> 8);
+		return 2;
+	}
+	uint32_t v = type | 3 << 2 | (uint32_t)n << 4;
+	dst[0] = (uint8_t)v;
+	dst[1] = (uint8_t)(v >> 8);
+	dst[2] = (uint8_t)(v >> 16);
+	return 3;
+}
+
+/* Huffman-coded literals, one stream below 256 bytes and four above;
+ * returns the section size, or 0 when raw literals would not be larger */
+static size_t zstd_put_huf_literals(uint8_t *dst, const uint8_t *end,
+		const uint8_t *lit, size_t n, const uint32_t *count) {
+	uint8_t len[256], weight[256];
+	uint32_t code[256], rank_count[ZSTD_HUF_LOG_MAX + 2] = {0}, rank_val[ZSTD_HUF_LOG_MAX + 2];
+	uint32_t max_bits = zstd_huf_lengths (count, len, ZSTD_HUF_LOG_MAX);
+	if (!max_bits) {
+		return 0;
+	}
+	/* the last symbol's weight is implied by the others */
+	uint32_t last = 255;
+	while (!len[last]) {
+		last--;
+	}
+	for (uint32_t s = 0; s < 256; s++) {
+		weight[s] = len[s] ? (uint8_t)(max_bits + 1 - len[s]) : 0;
+		rank_count[len[s]]++;
+	}
+	/* canonical codes: longest first, in symbol order within a length */
+	uint32_t min = 0;
+	for (uint32_t l = max_bits; l > 0; l--) {
+		rank_val[l] = min;
+		min = (min + rank_count[l]) >> 1;
+	}
+	for (uint32_t s = 0; s <= last; s++) {
+		if (len[s]) {
+			code[s] = rank_val[len[s]]++;
+		}
+	}
+
+	int streams = n < 256 ? 1 : 4;
+	size_t hdr = streams == 1 || n < 1024 ? 3 : n < 16384 ? 4 : 5;
+	if ((size_t)(end - dst) <= hdr + 6) {
+		return 0;
+	}
+	uint8_t *p = dst + hdr;
+	size_t ws = zstd_put_huf_weights (p, end, weight, last);
+	if (!ws) {
+		return 0;
+	}
+	p += ws;
+	uint8_t *jump = p;
+	if (streams == 4) {
+		if (end - p < 6) {
+			return 0;
+		}
+		p += 6;
+	}
+	size_t seg = streams == 1 ? n : (n + 3) / 4;
+	for (int k = 0; k < streams; k++) {
+		size_t lo = k * seg, hi = k == streams - 1 ? n : lo + seg;
+		zstd_bit_writer bw;
+		zstd_bw_init (&bw, p, end);
+		for (size_t i = hi; i-- > lo;) {
+			zstd_bw_add (&bw, code[lit[i]], len[lit[i]]);
+		}
+		size_t sz = zstd_bw_close (&bw, p);
+		if (!sz || (k < 3 && sz > 0xFFFF)) {
+			return 0;
+		}
+		if (streams == 4 && k < 3) {
+			jump[2 * k] = (uint8_t)sz;
+			jump[2 * k + 1] = (uint8_t)(sz >> 8);
+		}
+		p += sz;
+	}
+	size_t comp = (size_t)(p - dst) - hdr;
+	if (comp + hdr >= n + (n < 32 ? 1 : n < 4096 ? 2 : 3)
+			|| comp >= ((size_t)1 << (hdr == 3 ? 10 : hdr == 4 ? 14 : 18))) {
+		return 0;
+	}
+	uint32_t format = streams == 1 ? 0 : hdr == 3 ? 1 : hdr == 4 ? 2 : 3;
+	uint64_t v = 2 | format << 2 | (uint64_t)n << 4 | (uint64_t)comp << (hdr == 3 ? 14 : hdr == 4 ? 18 : 22);
+	for (size_t i = 0; i < hdr; i++) {
+		dst[i] = (uint8_t)(v >> (8 * i));
+	}
+	return comp + hdr;
+}
+
+static size_t zstd_put_literals(const zstd_compress_context *ctx, uint8_t *dst, const uint8_t *end) {
+	const uint8_t *lit = ctx->literals;
+	size_t n = ctx->n_literals;
+	uint32_t count[256] = {0};
+	for (size_t i = 0; i < n; i++) {
+		count[lit[i]]++;
+	}
+	if (n > 1 && count[lit[0]] == n) {
+		size_t h = zstd_put_lit_header (dst, 1, n);
+		dst[h] = lit[0];
+		return h + 1;
+	}
+	if (n >= 64) {
+		size_t c = zstd_put_huf_literals (dst, end, lit, n, count);
+		if (c) {
+			return c;
+		}
+	}
+	size_t h = zstd_put_lit_header (dst, 0, n);
+	if ((size_t)(end - dst) < h + n) {
+		return 0;
+	}
+	memcpy (dst + h, lit, n);
+	return h + n;
+}
+
+/* --- Compression: sequences --- */
+
+static uint32_t zstd_ll_code(uint32_t ll) {
+	if (ll < 16) {
+		return ll;
+	}
+	if (ll >= 64) {
+		return zstd_highbit (ll) + 19;
+	}
+	uint32_t c = 16;
+	while (zstd_ll_base[c + 1] <= ll) {
+		c++;
+	}
+	return c;
+}
+
+static uint32_t zstd_ml_code(uint32_t ml) {
+	uint32_t v = ml - 3;
+	if (v < 32) {
+		return v;
+	}
+	if (v >= 128) {
+		return zstd_highbit (v) + 36;
+	}
+	uint32_t c = 32;
+	while (zstd_ml_base[c + 1] <= ml) {
+		c++;
+	}
+	return c;
+}
+
+/* Pick RLE, predefined or a new FSE table for one code stream, writing
+ * its description if any; returns the Symbol_Compression_Mode */
+static int zstd_put_seq_table(zstd_fse_table *t, uint8_t **pp, const uint8_t *end,
+		const uint8_t *codes, uint32_t n, uint32_t max_code,
+		const int16_t *def, uint32_t def_max, uint32_t def_log) {
+	uint32_t count[ZSTD_ML_MAX_CODE + 1] = {0}, max = 0, used = 0;
+	for (uint32_t i = 0; i < n; i++) {
+		count[codes[i]]++;
+	}
+	for (uint32_t s = 0; s <= max_code; s++) {
+		if (count[s]) {
+			max = s;
+			used++;
+		}
+	}
+	if (used == 1) {
+		if (*pp == end) {
+			return -1;
+		}
+		*(*pp)++ = (uint8_t)max;
+		t->rle = 1;
+		return 1;
+	}
+	uint64_t def_cost = max <= def_max ? zstd_fse_cost (count, max, def, def_log) : UINT64_MAX;
+	int16_t norm[ZSTD_ML_MAX_CODE + 1];
+	uint32_t log = zstd_fse_log (max_code == ZSTD_OF_MAX_CODE ? ZSTD_OF_LOG_MAX : ZSTD_FSE_LOG_MAX, n, max);
+	if (zstd_fse_normalize (norm, log, count, n, max) == 0) {
+		size_t hs = zstd_put_ncount (*pp, end, norm, max, log);
+		if (hs && ((uint64_t)hs << 11) + zstd_fse_cost (count, max, norm, log) < def_cost) {
+			zstd_fse_build (t, norm, max, log);
+			*pp += hs;
+			return 2;
+		}
+	}
+	if (def_cost == UINT64_MAX) {
+		return -1;
+	}
+	zstd_fse_build (t, def, def_max, def_log);
+	return 0;
+}
+
+static size_t zstd_put_sequences(zstd_compress_context *ctx, uint8_t *dst, const uint8_t *end) {
+	uint32_t n = (uint32_t)ctx->n_seqs;
+	uint8_t *p = dst;
+	if (end - p < 4) {
+		return 0;
+	}
+	if (n < 128) {
+		*p++ = (uint8_t)n;
+	} else if (n < 0x7F00) {
+		*p++ = (uint8_t)((n >> 8) + 0x80);
+		*p++ = (uint8_t)n;
+	} else {
+		*p++ = 0xFF;
+		*p++ = (uint8_t)(n - 0x7F00);
+		*p++ = (uint8_t)((n - 0x7F00) >> 8);
+	}
+	if (!n) {
+		return (size_t)(p - dst);
+	}
+
+	/* the codes reuse the literal buffer, which is already encoded */
+	uint8_t *llc = ctx->literals, *mlc = llc + n, *ofc = mlc + n;
+	for (uint32_t i = 0; i < n; i++) {
+		const zstd_seq *s = &ctx->seqs[i];
+		llc[i] = (uint8_t)zstd_ll_code (s->lit_len);
+		mlc[i] = (uint8_t)zstd_ml_code (s->match_len);
+		ofc[i] = (uint8_t)zstd_highbit (s->offset);
+	}
+	zstd_fse_table ll, of, ml;
+	uint8_t *modes = p++;
+	int ll_mode = zstd_put_seq_table (&ll, &p, end, llc, n, ZSTD_LL_MAX_CODE,
+		zstd_ll_default, ZSTD_LL_MAX_CODE, ZSTD_LL_DEFAULT_LOG);
+	int of_mode = zstd_put_seq_table (&of, &p, end, ofc, n, ZSTD_OF_MAX_CODE,
+		zstd_of_default, ZSTD_OF_DEFAULT_MAX, ZSTD_OF_DEFAULT_LOG);
+	int ml_mode = zstd_put_seq_table (&ml, &p, end, mlc, n, ZSTD_ML_MAX_CODE,
+		zstd_ml_default, ZSTD_ML_MAX_CODE, ZSTD_ML_DEFAULT_LOG);
+	if (ll_mode < 0 || of_mode < 0 || ml_mode < 0) {
+		return 0;
+	}
+	*modes = (uint8_t)(ll_mode << 6 | of_mode << 4 | ml_mode << 2);
+
+	/* encoded last to first, so the decoder reads them in order */
+	zstd_bit_writer bw;
+	uint32_t ll_state = 0, of_state = 0, ml_state = 0;
+	zstd_bw_init (&bw, p, end);
+	for (uint32_t i = n; i-- > 0;) {
+		const zstd_seq *s = &ctx->seqs[i];
+		if (i == n - 1) {
+			zstd_fse_init_state (&ml, &ml_state, mlc[i]);
+			zstd_fse_init_state (&of, &of_state, ofc[i]);
+			zstd_fse_init_state (&ll, &ll_state, llc[i]);
 		} else {
-			/* Literal byte */
-			if (dst_pos >= dst_capacity) {
-				return 0;  /* Output overflow */
+			zstd_fse_put (&bw, &of, &of_state, ofc[i]);
+			zstd_fse_put (&bw, &ml, &ml_state, mlc[i]);
+			zstd_fse_put (&bw, &ll, &ll_state, llc[i]);
+		}
+		zstd_bw_add (&bw, s->lit_len - zstd_ll_base[llc[i]], zstd_ll_bits[llc[i]]);
+		zstd_bw_add (&bw, s->match_len - zstd_ml_base[mlc[i]], zstd_ml_bits[mlc[i]]);
+		zstd_bw_add (&bw, s->offset - (1u << ofc[i]), ofc[i]);
+	}
+	zstd_fse_flush (&bw, &ml, ml_state);
+	zstd_fse_flush (&bw, &of, of_state);
+	zstd_fse_flush (&bw, &ll, ll_state);
+	size_t bs = zstd_bw_close (&bw, p);
+	return bs ? (size_t)(p + bs - dst) : 0;
+}
+
+/* --- Compression: match finder --- */
+
+static uint32_t zstd_read32(const uint8_t *p) {
+	uint32_t v;
+	memcpy (&v, p, 4);
+	return v;
+}
+
+static uint32_t zstd_hash(const uint8_t *p, uint32_t log) {
+	return (zstd_read32 (p) * 2654435761u) >> (32 - log);
+}
+
+static size_t zstd_count(const uint8_t *a, const uint8_t *b, const uint8_t *end) {
+	const uint8_t *start = a;
+	while (a + 8 <= end) {
+		uint64_t x, y;
+		memcpy (&x, a, 8);
+		memcpy (&y, b, 8);
+		if (x != y) {
+			break;
+		}
+		a += 8;
+		b += 8;
+	}
+	while (a < end && *a == *b) {
+		a++;
+		b++;
+	}
+	return (size_t)(a - start);
+}
+
+/* Add every position before upto to the hash chains */
+static void zstd_insert(zstd_compress_context *ctx, size_t upto) {
+	size_t pos = ctx->next_insert;
+	for (; pos < upto && pos + 4 <= ctx->window_len; pos++) {
+		uint32_t h = zstd_hash (ctx->window_buffer + pos, ctx->hash_log);
+		ctx->chain_table[pos & ctx->chain_mask] = ctx->hash_table[h];
+		ctx->hash_table[h] = (uint32_t)pos + 1;
+	}
+	ctx->next_insert = pos;
+}
+
+/* Longest match at ip not crossing end, trying the last offset first;
+ * returns its length and stores the distance */
+static uint32_t zstd_find(zstd_compress_context *ctx, size_t ip, size_t end, uint32_t *dist) {
+	const struct zstd_level *lv = &zstd_levels[ctx->compression_level];
+	const uint8_t *win = ctx->window_buffer, *p = win + ip, *pend = win + end;
+	size_t low = ip > ctx->window_size ? ip - ctx->window_size : 0;
+	uint32_t best = 0, r = ctx->rep[0];
+
+	if (r <= ip - low && zstd_read32 (p - r) == zstd_read32 (p)) {
+		best = (uint32_t)zstd_count (p, p - r, pend);
+		*dist = r;
+		if (best >= lv->nice || p + best == pend) {
+			return best;
+		}
+	}
+	zstd_insert (ctx, ip);
+	uint32_t s = ctx->hash_table[zstd_hash (p, ctx->hash_log)];
+	for (int d = lv->depth; d > 0 && s > low && s - 1 < ip; d--) {
+		const uint8_t *q = win + s - 1;
+		if (q[best] == p[best] && zstd_read32 (q) == zstd_read32 (p)) {
+			uint32_t len = (uint32_t)zstd_count (p, q, pend);
+			if (len > best) {
+				best = len;
+				*dist = (uint32_t)(p - q);
+				if (len >= lv->nice || p + len == pend) {
+					break;
+				}
+			}
+		}
+		uint32_t next = ctx->chain_table[(s - 1) & ctx->chain_mask];
+		if (next >= s) {
+			break; /* overwritten by a newer position */
+		}
+		s = next;
+	}
+	return best;
+}
+
+/* Rough worth of a match: length against the cost of its offset */
+static int zstd_gain(const zstd_compress_context *ctx, uint32_t len, uint32_t dist) {
+	return (int)(len * 4) - (int)zstd_highbit (dist == ctx->rep[0] ? 1 : dist + 3);
+}
+
+static void zstd_add_seq(zstd_compress_context *ctx, size_t anchor, size_t ip, uint32_t len, uint32_t dist) {
+	uint32_t ll = (uint32_t)(ip - anchor), r0 = ctx->rep[0], off;
+	memcpy (ctx->literals + ctx->n_literals, ctx->window_buffer + anchor, ll);
+	ctx->n_literals += ll;
+	if (ll) {
+		off = dist == r0 ? 1 : dist == ctx->rep[1] ? 2 : dist == ctx->rep[2] ? 3 : dist + 3;
+	} else {
+		off = dist == ctx->rep[1] ? 1 : dist == ctx->rep[2] ? 2 : dist == r0 - 1 ? 3 : dist + 3;
+	}
+	zstd_rep_update (ctx->rep, off, ll);
+	zstd_seq *s = &ctx->seqs[ctx->n_seqs++];
+	s->lit_len = ll;
+	s->match_len = len;
+	s->offset = off;
+}
+
+/* Split window_buffer[start, end) into sequences, greedy or lazy */
+static void zstd_parse(zstd_compress_context *ctx, size_t start, size_t end) {
+	const struct zstd_level *lv = &zstd_levels[ctx->compression_level];
+	const uint8_t *win = ctx->window_buffer;
+	size_t ip = start, anchor = start;
+
+	ctx->n_seqs = 0;
+	ctx->n_literals = 0;
+	while (ip + ZSTD_MIN_MATCH <= end) {
+		uint32_t dist = 0, dist2 = 0;
+		uint32_t len = zstd_find (ctx, ip, end, &dist);
+		if (len < ZSTD_MIN_MATCH) {
+			ip += 1 + (lv->skip ? (ip - anchor) >> lv->skip : 0);
+			continue;
+		}
+		/* a better match one or two bytes later defers this one */
+		for (uint32_t ahead = 1; ahead <= lv->lazy && ip + ahead + ZSTD_MIN_MATCH <= end;) {
+			uint32_t len2 = zstd_find (ctx, ip + ahead, end, &dist2);
+			if (len2 >= ZSTD_MIN_MATCH && zstd_gain (ctx, len2, dist2)
+					> zstd_gain (ctx, len, dist) + (ahead == 1 ? 4 : 7)) {
+				ip += ahead;
+				len = len2;
+				dist = dist2;
+				ahead = 1;
+				continue;
 			}
-			dst[dst_pos++] = src[src_pos++];
+			ahead++;
 		}
+		while (ip > anchor && ip > dist && win[ip - 1] == win[ip - 1 - dist]) {
+			ip--;
+			len++;
+		}
+		zstd_add_seq (ctx, anchor, ip, len, dist);
+		ip += len;
+		anchor = ip;
+	}
+	memcpy (ctx->literals + ctx->n_literals, win + anchor, end - anchor);
+	ctx->n_literals += end - anchor;
+}
+
+/* --- Compression: frame --- */
+
+/* Size the window and tables; content_size is known when the whole
+ * input arrives with the first Z_FINISH */
+static int zstd_setup(zstd_compress_context *ctx, int known, uint64_t content_size) {
+	const struct zstd_level *lv = &zstd_levels[ctx->compression_level];
+	uint32_t wlog = lv->window_log;
+	ctx->content_size = content_size;
+	ctx->single_segment = known && content_size <= ((uint64_t)1 << wlog);
+	if (ctx->single_segment) {
+		while (wlog > 10 && ((uint64_t)1 << (wlog - 1)) >= content_size) {
+			wlog--;
+		}
+	}
+	ctx->window_size = (size_t)1 << wlog;
+	ctx->window_cap = ctx->single_segment ? (size_t)content_size : 2 * ctx->window_size;
+	ctx->hash_log = lv->hash_log < wlog + 1 ? lv->hash_log : wlog + 1;
+	ctx->chain_mask = (1u << (lv->chain_log < wlog ? lv->chain_log : wlog)) - 1;
+	ctx->rep[0] = 1;
+	ctx->rep[1] = 4;
+	ctx->rep[2] = 8;
+
+	ctx->window_buffer = (uint8_t *)malloc (ctx->window_cap ? ctx->window_cap : 1);
+	ctx->hash_table = (uint32_t *)calloc ((size_t)1 << ctx->hash_log, sizeof (uint32_t));
+	ctx->chain_table = (uint32_t *)calloc ((size_t)ctx->chain_mask + 1, sizeof (uint32_t));
+	ctx->seqs = (zstd_seq *)malloc ((ZSTD_BLOCK_MAX_SIZE / ZSTD_MIN_MATCH + 1) * sizeof (zstd_seq));
+	ctx->literals = (uint8_t *)malloc (ZSTD_BLOCK_MAX_SIZE);
+	if (!ctx->window_buffer || !ctx->hash_table || !ctx->chain_table || !ctx->seqs || !ctx->literals) {
+		return -1;
 	}
 
-	return dst_pos;  /* Return decompressed size */
+	/* frame header: content size whenever known, else the window size */
+	uint8_t *p = ctx->compress_buffer;
+	uint32_t magic = ZSTD_MAGIC_NUMBER;
+	for (int i = 0; i < 4; i++) {
+		*p++ = (uint8_t)(magic >> (8 * i));
+	}
+	int fcs_bytes = !known ? 0 : ctx->single_segment && content_size < 256 ? 1
+		: content_size >= 256 && content_size < 65536 + 256 ? 2
+		: content_size <= 0xFFFFFFFFu ? 4 : 8;
+	uint32_t fcs_flag = fcs_bytes == 8 ? 3 : fcs_bytes == 4 ? 2 : fcs_bytes == 2 ? 1 : 0;
+	*p++ = (uint8_t)(fcs_flag << 6 | ctx->single_segment << 5);
+	if (!ctx->single_segment) {
+		*p++ = (uint8_t)((wlog - 10) << 3);
+	}
+	uint64_t fcs = fcs_bytes == 2 ? content_size - 256 : content_size;
+	for (int i = 0; i < fcs_bytes; i++) {
+		*p++ = (uint8_t)(fcs >> (8 * i));
+	}
+	ctx->out_len = (size_t)(p - ctx->compress_buffer);
+	ctx->started = 1;
+	return 0;
+}
+
+/* Drop the oldest window_size bytes of history */
+static void zstd_slide(zstd_compress_context *ctx) {
+	size_t shift = ctx->window_size;
+	memmove (ctx->window_buffer, ctx->window_buffer + shift, ctx->window_len - shift);
+	ctx->window_len -= shift;
+	ctx->block_start -= shift;
+	ctx->next_insert = ctx->next_insert > shift ? ctx->next_insert - shift : 0;
+	for (size_t i = 0; i < (size_t)1 << ctx->hash_log; i++) {
+		ctx->hash_table[i] = ctx->hash_table[i] > shift ? ctx->hash_table[i] - (uint32_t)shift : 0;
+	}
+	for (size_t i = 0; i <= ctx->chain_mask; i++) {
+		ctx->chain_table[i] = ctx->chain_table[i] > shift ? ctx->chain_table[i] - (uint32_t)shift : 0;
+	}
+}
+
+/* Compress the pending input as one block, compressed, RLE or raw
+ * whichever is smallest, and queue it for output */
+static void zstd_put_block(zstd_compress_context *ctx, int last) {
+	size_t n = ctx->window_len - ctx->block_start;
+	const uint8_t *src = ctx->window_buffer + ctx->block_start;
+	uint8_t *dst = ctx->compress_buffer + ctx->out_len;
+	const uint8_t *end = ctx->compress_buffer + ctx->compress_buffer_size;
+	uint32_t type = 0, size = (uint32_t)n;
+	size_t body = n;
+
+	size_t same = 1;
+	while (same < n && src[same] == src[0]) {
+		same++;
+	}
+	if (n > 1 && same == n) {
+		type = 1;
+		body = 1;
+		dst[3] = src[0];
+	} else if (n > 0) {
+		uint32_t rep[3];
+		memcpy (rep, ctx->rep, sizeof (rep));
+		zstd_parse (ctx, ctx->block_start, ctx->window_len);
+		size_t lit = zstd_put_literals (ctx, dst + 3, end);
+		size_t seq = lit ? zstd_put_sequences (ctx, dst + 3 + lit, end) : 0;
+		if (seq && lit + seq < n) {
+			type = 2;
+			body = size = (uint32_t)(lit + seq);
+		} else {
+			/* the decoder never sees these sequences */
+			memcpy (ctx->rep, rep, sizeof (rep));
+			memcpy (dst + 3, src, n);
+		}
+	}
+	uint32_t h = (uint32_t)last | type << 1 | size << 3;
+	dst[0] = (uint8_t)h;
+	dst[1] = (uint8_t)(h >> 8);
+	dst[2] = (uint8_t)(h >> 16);
+	ctx->out_len += 3 + body;
+	ctx->block_start = ctx->window_len;
+	ctx->finished = last;
 }
 
 /* --- Zstandard API Implementation --- */
@@ -265,32 +1287,22 @@ int zstdInit(z_stream *strm, int level) {
 	if (!strm) return Z_STREAM_ERROR;
 
 	/* Setup default level */
-	if (level == Z_DEFAULT_COMPRESSION) {
+	if (level <= 0) {
 		level = ZSTD_DEFAULT_CLEVEL;
+	} else if (level > ZSTD_MAX_CLEVEL) {
+		level = ZSTD_MAX_CLEVEL;
 	}
 
-	/* Allocate compression context */
+	/* Allocate compression context; the window and match finder wait
+	 * for the first input, whose size may bound them */
 	zstd_compress_context *ctx = (zstd_compress_context *)calloc(1, sizeof(zstd_compress_context));
 	if (!ctx) return Z_MEM_ERROR;
-
-	/* Initialize context */
 	ctx->compression_level = level;
-	ctx->window_size = 1 << 17;  /* 128KB window by default */
-	ctx->block_size = ZSTD_BLOCK_MAX_SIZE;
-	ctx->is_last_block = 0;
 
-	/* Allocate window buffer for LZ77 */
-	ctx->window_buffer = (uint8_t *)malloc(ctx->window_size);
-	if (!ctx->window_buffer) {
-		free(ctx);
-		return Z_MEM_ERROR;
-	}
-
-	/* Allocate compression buffer */
-	ctx->compress_buffer_size = ctx->block_size * 2; /* Over-allocate for worst case */
+	/* Frame header plus one block, with room for a failed compression */
+	ctx->compress_buffer_size = 2 * ZSTD_BLOCK_MAX_SIZE + 64;
 	ctx->compress_buffer = (uint8_t *)malloc(ctx->compress_buffer_size);
 	if (!ctx->compress_buffer) {
-		free(ctx->window_buffer);
 		free(ctx);
 		return Z_MEM_ERROR;
 	}
@@ -308,132 +1320,63 @@ int zstdCompress(z_stream *strm, int flush) {
 	if (!strm || !strm->state) return Z_STREAM_ERROR;
 
 	zstd_compress_context *ctx = (zstd_compress_context *)strm->state;
+	uint32_t avail_out = strm->avail_out;
 
-	/* Check if this is the first call - need to write frame header */
-	if (strm->total_out == 0) {
-		/* We need space for the frame header */
-		if (strm->avail_out < ZSTD_FRAME_HEADER_SIZE) {
-			return Z_BUF_ERROR;
+	for (;;) {
+		/* Hand out what is already encoded */
+		size_t n = ctx->out_len - ctx->out_pos;
+		if (n > strm->avail_out) {
+			n = strm->avail_out;
 		}
-
-		/* Write Zstandard frame header (simplified) */
-		uint8_t header[4] = {0xFD, 0x2F, 0xB5, 0x28};  /* Magic number */
-		memcpy(strm->next_out, header, 4);
-		strm->next_out += 4;
-		strm->avail_out -= 4;
-		strm->total_out += 4;
-
-		/* Window descriptor (using default settings) */
-		strm->next_out[0] = 0x70;  /* Window log = 17 (128 KB) */
-		strm->next_out++;
-		strm->avail_out--;
-		strm->total_out++;
-	}
-
-	/* Simple block-based compression */
-	ctx->is_last_block = (flush == Z_FINISH);
-
-	/* Process input data */
-	while (strm->avail_in > 0 || ctx->is_last_block) {
-		/* Determine block size */
-		uint32_t block_size = strm->avail_in < ctx->block_size ? 
-			strm->avail_in : ctx->block_size;
-
-		/* Skip if no input data and not final block */
-		if (block_size == 0 && !ctx->is_last_block) {
-			break;
-		}
-
-		/* Ensure we have space for block header (3 bytes) */
-		if (strm->avail_out < 3) {
-			return Z_BUF_ERROR;
+		memcpy(strm->next_out, ctx->compress_buffer + ctx->out_pos, n);
+		strm->next_out += n;
+		strm->avail_out -= (uint32_t)n;
+		strm->total_out += (uint32_t)n;
+		ctx->out_pos += n;
+		if (ctx->out_pos < ctx->out_len) {
+			return strm->avail_out < avail_out ? Z_OK : Z_BUF_ERROR;
 		}
-
-		/* If this is an empty final block, write a special block */
-		if (block_size == 0 && ctx->is_last_block) {
-			/* Write empty last block (type=0, size=0, last=1) */
-			strm->next_out[0] = 0x01;  /* Last block bit set */
-			strm->next_out += 1;
-			strm->avail_out -= 1;
-			strm->total_out += 1;
-
-			/* We're done */
+		ctx->out_pos = ctx->out_len = 0;
+		if (ctx->finished) {
 			return Z_STREAM_END;
 		}
 
-		/* Try to compress the block */
-		int compressed_size = 0;
-		if (block_size > 0) {
-			compressed_size = compress_block(strm->next_in, block_size,
-					ctx->compress_buffer, ctx->compress_buffer_size,
-					ctx->compression_level);
+		/* The frame header needs to know whether all input is here */
+		if (!ctx->started) {
+			if (zstd_setup(ctx, flush == Z_FINISH, strm->avail_in) != 0) {
+				return Z_MEM_ERROR;
+			}
+			continue;
 		}
 
-		/* Decide whether to write compressed or raw block */
-		uint8_t block_header = 0;
-		uint8_t *block_content;
-		uint32_t content_size;
-
-                if (compressed_size > 0 && (uint32_t)compressed_size < block_size) {
-                    /* Compressed block (type=2) */
-			block_header = 0x02;
-			block_content = ctx->compress_buffer;
-			content_size = compressed_size;
-		} else {
-			/* Raw block (type=0) */
-			block_header = 0x00;
-			block_content = strm->next_in;
-			content_size = block_size;
-		}
-
-		/* Set last block flag if needed */
-		if (ctx->is_last_block) {
-			block_header |= 0x01;
-		}
-
-		/* Write block header */
-		strm->next_out[0] = block_header;
-		strm->next_out[1] = content_size & 0xFF;
-		strm->next_out[2] = (content_size >> 8) & 0xFF;
-		strm->next_out += 3;
-		strm->avail_out -= 3;
-		strm->total_out += 3;
-
-		/* Check if we have enough space for the block content */
-		if (strm->avail_out < content_size) {
-			/* Back up - we can't write this block now */
-			strm->next_out -= 3;
-			strm->avail_out += 3;
-			strm->total_out -= 3;
-			return Z_BUF_ERROR;
-		}
-
-		/* Write block content */
-		memcpy(strm->next_out, block_content, content_size);
-		strm->next_out += content_size;
-		strm->avail_out -= content_size;
-		strm->total_out += content_size;
-
-		/* Update input */
-		if (block_size > 0) {
-			strm->next_in += block_size;
-			strm->avail_in -= block_size;
-			strm->total_in += block_size;
-
-			/* Update window buffer for future references */
-			memcpy(ctx->window_buffer + ctx->window_pos, 
-					strm->next_in - block_size, 
-					block_size);
-			ctx->window_pos = (ctx->window_pos + block_size) % ctx->window_size;
-		}
-
-		/* If this was the last block, we're done */
-		if (ctx->is_last_block) {
-			return Z_STREAM_END;
+		/* Take input up to one block, sliding the window when full */
+		size_t pending = ctx->window_len - ctx->block_start;
+		if (ctx->window_len == ctx->window_cap && strm->avail_in > 0 && pending < ZSTD_BLOCK_MAX_SIZE) {
+			if (ctx->single_segment) {
+				return Z_STREAM_ERROR; /* more input than announced */
+			}
+			zstd_slide(ctx);
+		}
+		size_t take = ZSTD_BLOCK_MAX_SIZE - pending;
+		if (take > ctx->window_cap - ctx->window_len) {
+			take = ctx->window_cap - ctx->window_len;
+		}
+		if (take > strm->avail_in) {
+			take = strm->avail_in;
+		}
+		memcpy(ctx->window_buffer + ctx->window_len, strm->next_in, take);
+		ctx->window_len += take;
+		strm->next_in += take;
+		strm->avail_in -= (uint32_t)take;
+		strm->total_in += (uint32_t)take;
+		pending += take;
+
+		int last = flush == Z_FINISH && strm->avail_in == 0;
+		if (pending < ZSTD_BLOCK_MAX_SIZE && !last) {
+			return Z_OK;
 		}
+		zstd_put_block(ctx, last);
 	}
-
-	return Z_OK;
 }
 
 /* End a compression stream */
@@ -444,10 +1387,11 @@ int zstdEnd(z_stream *strm) {
 
 	/* Free allocated buffers */
 	free(ctx->window_buffer);
+	free(ctx->hash_table);
+	free(ctx->chain_table);
+	free(ctx->seqs);
+	free(ctx->literals);
 	free(ctx->compress_buffer);
-	if (ctx->dict) {
-		free(ctx->dict);
-	}
 
 	/* Free context */
 	free(ctx);
@@ -456,235 +1400,903 @@ int zstdEnd(z_stream *strm) {
 	return Z_OK;
 }
 
-/* Initialize a decompression stream */
-int zstdDecompressInit(z_stream *strm) {
-	if (!strm) return Z_STREAM_ERROR;
-
-	/* Allocate decompression context */
-	zstd_decompress_context *ctx = (zstd_decompress_context *)calloc(1, sizeof(zstd_decompress_context));
-	if (!ctx) return Z_MEM_ERROR;
+/* --- Decompression: bit readers and tables --- */
+
+#define ZSTD_WILDCOPY 32    /* slack past the output some copies may write */
+
+/* Decoding stages of zstdDecompress */
+enum {
+	ZSTD_D_MAGIC,
+	ZSTD_D_FRAME_FLAGS,
+	ZSTD_D_FRAME_HEADER,
+	ZSTD_D_SKIP_SIZE,
+	ZSTD_D_SKIP,
+	ZSTD_D_BLOCK_HEADER,
+	ZSTD_D_BLOCK,
+	ZSTD_D_CHECKSUM,
+	ZSTD_D_DONE
+};
+
+static uint64_t zstd_read64(const uint8_t *p) {
+	uint64_t v = 0;
+	for (int i = 7; i >= 0; i--) {
+		v = v << 8 | p[i];
+	}
+	return v;
+}
 
-	/* Initialize context with default values */
-	ctx->window_size = 1 << 17;  /* 128KB window by default */
-	ctx->is_last_block = 0;
+/* Backward bit stream, read from the last byte down: consumed counts
+ * bits taken from the top of the 64-bit container at p */
+typedef struct {
+	const uint8_t *start;
+	const uint8_t *p;
+	uint64_t bits;
+	uint32_t consumed;
+} zstd_bit_reader;
+
+static int zstd_br_init(zstd_bit_reader *br, const uint8_t *src, size_t size) {
+	if (!size || !src[size - 1]) {
+		return -1;
+	}
+	br->start = src;
+	if (size >= 8) {
+		br->p = src + size - 8;
+		br->bits = zstd_read64 (br->p);
+		br->consumed = 0;
+	} else {
+		br->p = src;
+		br->bits = 0;
+		for (size_t i = size; i-- > 0;) {
+			br->bits = br->bits << 8 | src[i];
+		}
+		br->consumed = (uint32_t)(8 - size) * 8;
+	}
+	/* skip the padding down to and including the end mark */
+	br->consumed += 8 - zstd_highbit (src[size - 1]);
+	return 0;
+}
 
-	/* Allocate window buffer */
-	ctx->window_buffer = (uint8_t *)malloc(ctx->window_size);
-	if (!ctx->window_buffer) {
-		free(ctx);
-		return Z_MEM_ERROR;
+static void zstd_br_reload(zstd_bit_reader *br) {
+	size_t nb = br->consumed >> 3;
+	if (br->consumed > 64 || !nb) {
+		return;
 	}
+	if ((size_t)(br->p - br->start) < nb) {
+		nb = (size_t)(br->p - br->start);
+	}
+	br->p -= nb;
+	br->consumed -= (uint32_t)nb * 8;
+	br->bits = zstd_read64 (br->p);
+}
 
-	/* Allocate decompression buffer */
-	ctx->decompress_buffer_size = ZSTD_BLOCK_MAX_SIZE;
-	ctx->decompress_buffer = (uint8_t *)malloc(ctx->decompress_buffer_size);
-	if (!ctx->decompress_buffer) {
-		free(ctx->window_buffer);
-		free(ctx);
-		return Z_MEM_ERROR;
+/* Past the start, the stream reads as zeros; see zstd_br_done */
+static uint32_t zstd_br_peek(const zstd_bit_reader *br, uint32_t n) {
+	if (br->consumed >= 64) {
+		return 0;
 	}
+	return (uint32_t)((br->bits << br->consumed) >> (64 - n));
+}
 
-	/* Initialize stream */
-	strm->state = (void *)ctx;
-	strm->total_in = 0;
-	strm->total_out = 0;
+static uint32_t zstd_br_read(zstd_bit_reader *br, uint32_t n) {
+	uint32_t v = n ? zstd_br_peek (br, n) : 0;
+	br->consumed += n;
+	return v;
+}
 
-	return Z_OK;
+/* Every bit used, no more */
+static int zstd_br_done(const zstd_bit_reader *br) {
+	return br->p == br->start && br->consumed == 64;
 }
 
-/* Decompress data using Zstandard format */
-int zstdDecompress(z_stream *strm, int flush) {
-    if (!strm || !strm->state) {
-        return Z_STREAM_ERROR;
-    }
-    (void)flush;
+/* Bits at a forward bit position, zeros past the end */
+static uint32_t zstd_get_bits(const uint8_t *src, size_t size, size_t pos, uint32_t n) {
+	uint64_t v = 0;
+	size_t byte = pos >> 3;
+	for (size_t i = 5; i-- > 0;) {
+		v = v << 8 | (byte + i < size ? src[byte + i] : 0);
+	}
+	return (uint32_t)(v >> (pos & 7)) & ((1u << n) - 1);
+}
 
-	zstd_decompress_context *ctx = (zstd_decompress_context *)strm->state;
+/* Read a table description (RFC 8878 4.1.1); returns the bytes used and
+ * lowers *max_sym to the last symbol described, or 0 if corrupt */
+static size_t zstd_read_ncount(int16_t *norm, uint32_t *max_sym, uint32_t *log_out,
+		uint32_t max_log, const uint8_t *src, size_t size) {
+	size_t pos = 4;
+	uint32_t log = zstd_get_bits (src, size, 0, 4) + 5;
+	if (log > max_log) {
+		return 0;
+	}
+	int remaining = (1 << log) + 1, threshold = 1 << log;
+	uint32_t width = log + 1, s = 0;
+	int prev_zero = 0;
+	memset (norm, 0, (*max_sym + 1) * sizeof (*norm));
+	while (remaining > 1) {
+		if (prev_zero) {
+			while (zstd_get_bits (src, size, pos, 16) == 0xFFFF) {
+				s += 24;
+				pos += 16;
+				if (s > *max_sym) {
+					return 0;
+				}
+			}
+			uint32_t rep;
+			while ((rep = zstd_get_bits (src, size, pos, 2)) == 3) {
+				s += 3;
+				pos += 2;
+			}
+			s += rep;
+			pos += 2;
+		}
+		if (s > *max_sym) {
+			return 0;
+		}
+		int max = (2 * threshold - 1) - remaining;
+		uint32_t v = zstd_get_bits (src, size, pos, width);
+		int count;
+		if ((int)(v & (threshold - 1)) < max) {
+			count = (int)(v & (threshold - 1));
+			pos += width - 1;
+		} else {
+			count = (int)(v & (2 * threshold - 1));
+			if (count >= threshold) {
+				count -= max;
+			}
+			pos += width;
+		}
+		count--;
+		remaining -= count < 0 ? -count : count;
+		norm[s++] = (int16_t)count;
+		prev_zero = !count;
+		if (remaining < 1) {
+			return 0;
+		}
+		while (remaining < threshold) {
+			width--;
+			threshold >>= 1;
+		}
+	}
+	if (pos > size * 8) {
+		return 0;
+	}
+	*max_sym = s - 1;
+	*log_out = log;
+	return (pos + 7) / 8;
+}
 
-	/* Check if we need to parse the frame header */
-	if (strm->total_in == 0) {
-		/* Need at least 5 bytes for the frame header */
-		if (strm->avail_in < 5) {
-			return Z_BUF_ERROR;
+/* Same spread as zstd_fse_build, then each state learns its successor */
+static int zstd_fse_build_dtable(zstd_fse_entry *dt, const int16_t *norm, uint32_t max_sym, uint32_t log) {
+	uint32_t size = 1u << log, mask = size - 1;
+	uint32_t step = (size >> 1) + (size >> 3) + 3, high = size - 1;
+	uint16_t next[ZSTD_ML_MAX_CODE + 1];
+
+	for (uint32_t s = 0; s <= max_sym; s++) {
+		if (norm[s] == -1) {
+			dt[high--].symbol = (uint8_t)s;
+			next[s] = 1;
+		} else {
+			next[s] = (uint16_t)norm[s];
+		}
+	}
+	uint32_t pos = 0;
+	for (uint32_t s = 0; s <= max_sym; s++) {
+		for (int i = 0; i < norm[s]; i++) {
+			dt[pos].symbol = (uint8_t)s;
+			do {
+				pos = (pos + step) & mask;
+			} while (pos > high);
 		}
+	}
+	if (pos != 0) {
+		return -1;
+	}
+	for (uint32_t u = 0; u < size; u++) {
+		uint32_t n = next[dt[u].symbol]++;
+		uint32_t nb = log - zstd_highbit (n);
+		dt[u].bits = (uint8_t)nb;
+		dt[u].base = (uint16_t)((n << nb) - size);
+	}
+	return 0;
+}
 
-		/* Check magic number */
-		uint32_t magic = read_le32(strm->next_in);
-		if (magic != ZSTD_MAGIC_NUMBER) {
-			return Z_DATA_ERROR;
+/* --- Decompression: literals --- */
+
+/* Huffman table from weights; the last symbol's weight completes the
+ * total to a power of two */
+static int zstd_huf_build(zstd_decompress_context *ctx, uint8_t *weight, uint32_t n) {
+	uint32_t total = 0;
+	for (uint32_t i = 0; i < n; i++) {
+		if (weight[i] > ZSTD_HUF_LOG_MAX) {
+			return -1;
 		}
+		total += weight[i] ? 1u << (weight[i] - 1) : 0;
+	}
+	if (!total || n > 255) {
+		return -1;
+	}
+	uint32_t log = zstd_highbit (total) + 1;
+	uint32_t rest = (1u << log) - total;
+	if (log > ZSTD_HUF_LOG_MAX || (rest & (rest - 1))) {
+		return -1;
+	}
+	weight[n++] = (uint8_t)(zstd_highbit (rest) + 1);
+
+	/* longest codes first, each weight's symbols in order */
+	uint32_t pos = 0;
+	for (uint32_t w = 1; w <= log; w++) {
+		for (uint32_t s = 0; s < n; s++) {
+			if (weight[s] != w) {
+				continue;
+			}
+			uint16_t e = (uint16_t)(s | (log + 1 - w) << 8);
+			for (uint32_t i = 0; i < 1u << (w - 1); i++) {
+				ctx->huf_table[pos++] = e;
+			}
+		}
+	}
+	ctx->huf_log = log;
+	return 0;
+}
+
+/* Huffman tree description; returns its size or 0 if corrupt */
+static size_t zstd_read_huf_tree(zstd_decompress_context *ctx, const uint8_t *src, size_t size) {
+	uint8_t weight[256];
+	uint32_t n = 0;
+	size_t used;
+	if (!size) {
+		return 0;
+	}
+	if (src[0] >= 128) {
+		n = src[0] - 127;
+		used = 1 + (n + 1) / 2;
+		if (used > size) {
+			return 0;
+		}
+		for (uint32_t i = 0; i < n; i++) {
+			weight[i] = i & 1 ? src[1 + i / 2] & 15 : src[1 + i / 2] >> 4;
+		}
+	} else {
+		/* FSE-compressed, two states taking turns */
+		int16_t norm[ZSTD_HUF_LOG_MAX + 2];
+		zstd_fse_entry dt[1 << 6];
+		zstd_bit_reader br;
+		uint32_t max_sym = ZSTD_HUF_LOG_MAX + 1, log;
+		used = 1 + src[0];
+		if (used > size || !src[0]) {
+			return 0;
+		}
+		size_t hs = zstd_read_ncount (norm, &max_sym, &log, 6, src + 1, src[0]);
+		if (!hs || hs >= src[0] || zstd_fse_build_dtable (dt, norm, max_sym, log) != 0
+				|| zstd_br_init (&br, src + 1 + hs, src[0] - hs) != 0) {
+			return 0;
+		}
+		uint32_t state[2];
+		state[0] = zstd_br_read (&br, log);
+		state[1] = zstd_br_read (&br, log);
+		for (int k = 0;; k ^= 1) {
+			if (n > 253) {
+				return 0;
+			}
+			const zstd_fse_entry *e = &dt[state[k]];
+			weight[n++] = e->symbol;
+			state[k] = e->base + zstd_br_read (&br, e->bits);
+			zstd_br_reload (&br);
+			if (br.consumed > 64) {
+				weight[n++] = dt[state[k ^ 1]].symbol;
+				break;
+			}
+		}
+	}
+	return zstd_huf_build (ctx, weight, n) == 0 ? used : 0;
+}
 
-		/* Read window descriptor */
-		uint8_t window_descriptor = strm->next_in[4];
-		ctx->window_log = window_descriptor & 0x0F;
+static int zstd_huf_stream(const zstd_decompress_context *ctx, const uint8_t *src, size_t size,
+		uint8_t *out, size_t n) {
+	zstd_bit_reader br;
+	uint32_t log = ctx->huf_log;
+	if (zstd_br_init (&br, src, size) != 0) {
+		return -1;
+	}
+	for (size_t i = 0; i < n; i++) {
+		if (br.consumed > 64 - ZSTD_HUF_LOG_MAX) {
+			zstd_br_reload (&br);
+		}
+		uint16_t e = ctx->huf_table[zstd_br_peek (&br, log)];
+		out[i] = (uint8_t)e;
+		br.consumed += e >> 8;
+	}
+	zstd_br_reload (&br);
+	return zstd_br_done (&br) ? 0 : -1;
+}
 
-		/* Advance past header */
-		strm->next_in += 5;
-		strm->avail_in -= 5;
-		strm->total_in += 5;
+/* Literals section into ctx->literals; returns its size or 0 if corrupt */
+static size_t zstd_read_literals(zstd_decompress_context *ctx, const uint8_t *src, size_t size) {
+	uint32_t type = src[0] & 3, format = src[0] >> 2 & 3;
+	size_t hdr, regen, comp;
+
+	if (type < 2) {
+		/* raw or RLE */
+		if (format == 1) {
+			hdr = 2;
+			regen = (size_t)(src[0] >> 4) + ((size_t)src[1] << 4);
+		} else if (format == 3) {
+			hdr = 3;
+			regen = (size_t)(src[0] >> 4) + ((size_t)src[1] << 4) + ((size_t)src[2] << 12);
+		} else {
+			hdr = 1;
+			regen = src[0] >> 3;
+		}
+		if (hdr > size || regen > ctx->block_max || hdr + (type ? 1 : regen) > size) {
+			return 0;
+		}
+		if (type) {
+			memset (ctx->literals, src[hdr], regen);
+		} else {
+			memcpy (ctx->literals, src + hdr, regen);
+		}
+		ctx->n_literals = regen;
+		return hdr + (type ? 1 : regen);
 	}
 
-	/* Process blocks */
-	while (strm->avail_in > 0 || ctx->current_block_remaining > 0) {
-		/* If we're still outputting from the current block */
-		if (ctx->current_block_remaining > 0) {
-			uint32_t copy_size = ctx->current_block_remaining;
-			if (copy_size > strm->avail_out) {
-				copy_size = strm->avail_out;
+	/* Huffman coded, with a new tree or the previous block's */
+	hdr = format < 2 ? 3 : format == 2 ? 4 : 5;
+	if (hdr > size) {
+		return 0;
+	}
+	uint32_t bits = format < 2 ? 10 : format == 2 ? 14 : 18;
+	uint64_t v = 0;
+	for (size_t i = hdr; i-- > 0;) {
+		v = v << 8 | src[i];
+	}
+	regen = (size_t)(v >> 4) & ((1u << bits) - 1);
+	comp = (size_t)(v >> (4 + bits)) & ((1u << bits) - 1);
+	if (regen > ctx->block_max || hdr + comp > size) {
+		return 0;
+	}
+	const uint8_t *p = src + hdr, *end = p + comp;
+	if (type == 2) {
+		size_t ts = zstd_read_huf_tree (ctx, p, comp);
+		if (!ts) {
+			return 0;
+		}
+		p += ts;
+	} else if (!ctx->huf_log) {
+		return 0;
+	}
+	if (format == 0) {
+		if (zstd_huf_stream (ctx, p, (size_t)(end - p), ctx->literals, regen) != 0) {
+			return 0;
+		}
+	} else {
+		size_t seg = (regen + 3) / 4;
+		if (end - p < 6 || regen < 3 * seg) {
+			return 0;
+		}
+		const uint8_t *s = p + 6;
+		for (int k = 0; k < 4; k++) {
+			size_t len = k < 3 ? (size_t)p[2 * k] | (size_t)p[2 * k + 1] << 8 : (size_t)(end - s);
+			size_t out = k < 3 ? seg : regen - 3 * seg;
+			if (len > (size_t)(end - s)
+					|| zstd_huf_stream (ctx, s, len, ctx->literals + k * seg, out) != 0) {
+				return 0;
 			}
+			s += len;
+		}
+	}
+	ctx->n_literals = regen;
+	return hdr + comp;
+}
 
-			/* Copy data to output */
-			memcpy(strm->next_out, 
-					ctx->decompress_buffer + 
-					(ctx->current_block_size - ctx->current_block_remaining), 
-					copy_size);
+/* --- Decompression: sequences --- */
+
+/* Decoding table of one code stream per its Symbol_Compression_Mode */
+static int zstd_read_seq_table(zstd_fse_entry *dt, uint32_t *log, int mode,
+		const uint8_t **pp, const uint8_t *end, uint32_t max_code, uint32_t max_log,
+		const int16_t *def, uint32_t def_max, uint32_t def_log) {
+	int16_t norm[ZSTD_ML_MAX_CODE + 1];
+	uint32_t max_sym = max_code;
+	switch (mode) {
+	case 0:
+		*log = def_log;
+		return zstd_fse_build_dtable (dt, def, def_max, def_log);
+	case 1:
+		if (*pp == end || **pp > max_code) {
+			return -1;
+		}
+		dt[0].symbol = *(*pp)++;
+		dt[0].bits = 0;
+		dt[0].base = 0;
+		*log = 0;
+		return 0;
+	case 2: {
+		size_t n = zstd_read_ncount (norm, &max_sym, log, max_log, *pp, (size_t)(end - *pp));
+		if (!n) {
+			return -1;
+		}
+		*pp += n;
+		return zstd_fse_build_dtable (dt, norm, max_sym, *log);
+	}
+	default:
+		/* repeat: the caller checks a previous table exists */
+		return 0;
+	}
+}
 
-			/* Update counters */
-			strm->next_out += copy_size;
-			strm->avail_out -= copy_size;
-			strm->total_out += copy_size;
-			ctx->current_block_remaining -= copy_size;
+/* Copy a match; offsets of 16 or more may copy whole 16-byte chunks when
+ * the buffer has room to overshoot, short ones go a byte at a time */
+static void zstd_copy_match(uint8_t *op, size_t dist, size_t len, const uint8_t *owild) {
+	const uint8_t *m = op - dist;
+	uint8_t *end = op + len;
+	if (dist >= 16 && end + 16 <= owild) {
+		do {
+			memcpy (op, m, 16);
+			op += 16;
+			m += 16;
+		} while (op < end);
+	} else if (dist == 1) {
+		memset (op, *m, len);
+	} else if (dist >= 8 && end + 8 <= owild) {
+		do {
+			memcpy (op, m, 8);
+			op += 8;
+			m += 8;
+		} while (op < end);
+	} else {
+		while (op < end) {
+			*op++ = *m++;
+		}
+	}
+}
 
-			/* Copy to window buffer */
-			memcpy(ctx->window_buffer + ctx->window_pos, 
-					strm->next_out - copy_size, 
-					copy_size);
-			ctx->window_pos = (ctx->window_pos + copy_size) % ctx->window_size;
+/* Decode a compressed block to op, matches reaching back to ostart and
+ * output stopping at oend; copies may scribble up to owild. Returns the
+ * block size or -1 if corrupt */
+static long zstd_decode_block(zstd_decompress_context *ctx, const uint8_t *src, size_t size,
+		const uint8_t *ostart, uint8_t *op, const uint8_t *oend, const uint8_t *owild) {
+	uint8_t *const base = op;
+	const uint8_t *end = src + size;
+	if (!size) {
+		return -1;
+	}
+	size_t n = zstd_read_literals (ctx, src, size);
+	if (!n || n >= size) {
+		return -1;
+	}
+	src += n;
 
-			/* Check if we're out of output space */
-			if (strm->avail_out == 0) {
-				return Z_OK;
+	uint32_t nb_seq = src[0];
+	if (nb_seq >= 128) {
+		if (nb_seq == 255) {
+			if (end - src < 3) {
+				return -1;
+			}
+			nb_seq = 0x7F00 + (src[1] | (uint32_t)src[2] << 8);
+			src += 3;
+		} else {
+			if (end - src < 2) {
+				return -1;
 			}
+			nb_seq = ((nb_seq - 128) << 8) + src[1];
+			src += 2;
 		}
+	} else {
+		src++;
+	}
 
-		/* Start a new block if possible */
-		if (strm->avail_in >= 3) {
-			/* Parse block header */
-			uint8_t block_header = strm->next_in[0];
-			ctx->is_last_block = block_header & 0x01;
-			uint8_t block_type = (block_header >> 1) & 0x03;
-
-			/* Get block size */
-			uint32_t block_size = ((uint32_t)strm->next_in[2] << 8) | 
-				strm->next_in[1];
-
-			/* Skip header */
-			strm->next_in += 3;
-			strm->avail_in -= 3;
-			strm->total_in += 3;
-
-			/* Process based on block type */
-			if (block_type == 0) {
-				/* Raw block */
-				if (strm->avail_in < block_size) {
-					/* Not enough input data */
-					strm->next_in -= 3;
-					strm->avail_in += 3;
-					strm->total_in -= 3;
-					return Z_BUF_ERROR;
-				}
+	const uint8_t *lit = ctx->literals, *lit_end = lit + ctx->n_literals;
+	if (nb_seq) {
+		if (src == end || (src[0] & 3)) {
+			return -1;
+		}
+		int ll_mode = src[0] >> 6, of_mode = src[0] >> 4 & 3, ml_mode = src[0] >> 2 & 3;
+		src++;
+		if ((ll_mode == 3 && !(ctx->tables_valid & 1)) || (of_mode == 3 && !(ctx->tables_valid & 2))
+				|| (ml_mode == 3 && !(ctx->tables_valid & 4))) {
+			return -1;
+		}
+		if (zstd_read_seq_table (ctx->ll_table, &ctx->ll_log, ll_mode, &src, end, ZSTD_LL_MAX_CODE,
+					ZSTD_FSE_LOG_MAX, zstd_ll_default, ZSTD_LL_MAX_CODE, ZSTD_LL_DEFAULT_LOG) != 0
+				|| zstd_read_seq_table (ctx->of_table, &ctx->of_log, of_mode, &src, end, ZSTD_OF_MAX_CODE,
+					ZSTD_OF_LOG_MAX, zstd_of_default, ZSTD_OF_DEFAULT_MAX, ZSTD_OF_DEFAULT_LOG) != 0
+				|| zstd_read_seq_table (ctx->ml_table, &ctx->ml_log, ml_mode, &src, end, ZSTD_ML_MAX_CODE,
+					ZSTD_FSE_LOG_MAX, zstd_ml_default, ZSTD_ML_MAX_CODE, ZSTD_ML_DEFAULT_LOG) != 0) {
+			return -1;
+		}
+		ctx->tables_valid = 7;
 
-				/* Copy raw block to output if space allows */
-				if (strm->avail_out >= block_size) {
-					memcpy(strm->next_out, strm->next_in, block_size);
-					strm->next_out += block_size;
-					strm->avail_out -= block_size;
-					strm->total_out += block_size;
-
-					/* Copy to window buffer */
-					memcpy(ctx->window_buffer + ctx->window_pos, 
-							strm->next_in, 
-							block_size);
-					ctx->window_pos = (ctx->window_pos + block_size) % ctx->window_size;
-
-					/* Advance input */
-					strm->next_in += block_size;
-					strm->avail_in -= block_size;
-					strm->total_in += block_size;
-				} else {
-					/* Store in temporary buffer to output in chunks */
-					if (block_size > ctx->decompress_buffer_size) {
-						/* Reallocate buffer if needed */
-						free(ctx->decompress_buffer);
-						ctx->decompress_buffer_size = block_size;
-						ctx->decompress_buffer = (uint8_t *)malloc(ctx->decompress_buffer_size);
-						if (!ctx->decompress_buffer) {
-							return Z_MEM_ERROR;
-						}
-					}
-
-					/* Copy to buffer */
-					memcpy(ctx->decompress_buffer, strm->next_in, block_size);
-					ctx->current_block_size = block_size;
-					ctx->current_block_remaining = block_size;
-
-					/* Advance input */
-					strm->next_in += block_size;
-					strm->avail_in -= block_size;
-					strm->total_in += block_size;
-
-					/* Process from buffer on next iteration */
-					continue;
-				}
-			} else if (block_type == 2) {
-				/* Compressed block */
-				if (strm->avail_in < block_size) {
-					/* Not enough input data */
-					strm->next_in -= 3;
-					strm->avail_in += 3;
-					strm->total_in -= 3;
-					return Z_BUF_ERROR;
-				}
+		zstd_bit_reader br;
+		if (zstd_br_init (&br, src, (size_t)(end - src)) != 0) {
+			return -1;
+		}
+		uint32_t ll_state = zstd_br_read (&br, ctx->ll_log);
+		uint32_t of_state = zstd_br_read (&br, ctx->of_log);
+		uint32_t ml_state = zstd_br_read (&br, ctx->ml_log);
+		zstd_br_reload (&br);
+		for (uint32_t i = 0; i < nb_seq; i++) {
+			const zstd_fse_entry *lle = &ctx->ll_table[ll_state];
+			const zstd_fse_entry *ofe = &ctx->of_table[of_state];
+			const zstd_fse_entry *mle = &ctx->ml_table[ml_state];
+			uint32_t of_code = ofe->symbol;
+			uint32_t offset = (1u << of_code) + zstd_br_read (&br, of_code);
+			zstd_br_reload (&br);
+			size_t ml = zstd_ml_base[mle->symbol] + zstd_br_read (&br, zstd_ml_bits[mle->symbol]);
+			size_t ll = zstd_ll_base[lle->symbol] + zstd_br_read (&br, zstd_ll_bits[lle->symbol]);
+			zstd_br_reload (&br);
+			if (i + 1 < nb_seq) {
+				ll_state = lle->base + zstd_br_read (&br, lle->bits);
+				ml_state = mle->base + zstd_br_read (&br, mle->bits);
+				of_state = ofe->base + zstd_br_read (&br, ofe->bits);
+				zstd_br_reload (&br);
+			}
 
-				/* Decompress the block */
-				int decompressed_size = decompress_block(
-						strm->next_in, block_size,
-						ctx->decompress_buffer, ctx->decompress_buffer_size);
+			if (ll > (size_t)(lit_end - lit) || ml > (size_t)(oend - op) - ll || ll > (size_t)(oend - op)) {
+				return -1;
+			}
+			if (op + ll + 16 <= owild) {
+				/* the literal buffer has slack to over-read */
+				uint8_t *d = op;
+				const uint8_t *s = lit;
+				do {
+					memcpy (d, s, 16);
+					d += 16;
+					s += 16;
+				} while (d < op + ll);
+			} else {
+				memcpy (op, lit, ll);
+			}
+			op += ll;
+			lit += ll;
+			size_t dist = zstd_rep_update (ctx->rep, offset, (uint32_t)ll);
+			if (!dist || dist > (size_t)(op - ostart)) {
+				return -1;
+			}
+			zstd_copy_match (op, dist, ml, owild);
+			op += ml;
+		}
+		if (!zstd_br_done (&br)) {
+			return -1;
+		}
+	} else if (src != end) {
+		return -1;
+	}
+	size_t rest = (size_t)(lit_end - lit);
+	if (rest > (size_t)(oend - op)) {
+		return -1;
+	}
+	memcpy (op, lit, rest);
+	op += rest;
+	return (long)(op - base);
+}
 
-				if (decompressed_size <= 0) {
-					return Z_DATA_ERROR;
-				}
+/* --- Decompression: frame --- */
+
+/* Contiguous view of the next n input bytes, gathered in in_buf when the
+ * caller hands them over piecemeal; NULL until all of them are there */
+static const uint8_t *zstd_need(zstd_decompress_context *ctx, z_stream *strm, size_t n) {
+	const uint8_t *p = strm->next_in;
+	if (!ctx->in_len && strm->avail_in >= n) {
+		strm->next_in += n;
+		strm->avail_in -= (uint32_t)n;
+		strm->total_in += (uint32_t)n;
+		return p;
+	}
+	size_t take = n - ctx->in_len;
+	if (take > strm->avail_in) {
+		take = strm->avail_in;
+	}
+	memcpy (ctx->in_buf + ctx->in_len, p, take);
+	ctx->in_len += take;
+	strm->next_in += take;
+	strm->avail_in -= (uint32_t)take;
+	strm->total_in += (uint32_t)take;
+	if (ctx->in_len < n) {
+		return NULL;
+	}
+	ctx->in_len = 0;
+	return ctx->in_buf;
+}
 
-				/* Output if space allows */
-                if (strm->avail_out >= (uint32_t)decompressed_size) {
-                    memcpy(strm->next_out, ctx->decompress_buffer, decompressed_size);
-                    strm->next_out += decompressed_size;
-                    strm->avail_out -= decompressed_size;
-					strm->total_out += decompressed_size;
-
-					/* Copy to window buffer */
-					memcpy(ctx->window_buffer + ctx->window_pos, 
-							ctx->decompress_buffer, 
-							decompressed_size);
-					ctx->window_pos = (ctx->window_pos + decompressed_size) % ctx->window_size;
-				} else {
-					/* Store for partial output */
-					ctx->current_block_size = decompressed_size;
-					ctx->current_block_remaining = decompressed_size;
+/* Move history out of the caller's buffer, which the next call may not
+ * hand back, into our own window */
+static int zstd_to_window(zstd_decompress_context *ctx, const uint8_t *hist_end) {
+	if (ctx->windowed) {
+		return 0;
+	}
+	if (ctx->window_size > ((uint64_t)1 << ZSTD_WINDOW_LOG_MAX)) {
+		return -1;
+	}
+	size_t window = (size_t)ctx->window_size;
+	ctx->window_cap = (ctx->single_segment ? window : 2 * window + ctx->block_max) + ZSTD_WILDCOPY;
+	ctx->window_buffer = (uint8_t *)malloc (ctx->window_cap);
+	if (!ctx->window_buffer) {
+		return -1;
+	}
+	size_t keep = ctx->produced < window ? (size_t)ctx->produced : window;
+	memcpy (ctx->window_buffer, hist_end - keep, keep);
+	ctx->window_len = ctx->window_out = keep;
+	ctx->windowed = 1;
+	return 0;
+}
 
-					/* Process from buffer on next iteration */
-					continue;
-				}
+static int zstd_read_frame_header(zstd_decompress_context *ctx, const uint8_t *p, uint8_t flags) {
+	uint32_t fcs_flag = flags >> 6, dict_flag = flags & 3;
+	ctx->single_segment = flags >> 5 & 1;
+	ctx->has_checksum = flags >> 2 & 1;
+	if (!ctx->single_segment) {
+		uint32_t wlog = 10 + (p[0] >> 3);
+		ctx->window_size = ((uint64_t)1 << wlog) + (((uint64_t)1 << wlog) >> 3) * (p[0] & 7);
+		p++;
+	}
+	uint32_t dict_id = 0;
+	for (int i = 0; i < (dict_flag == 3 ? 4 : (int)dict_flag); i++) {
+		dict_id |= (uint32_t)p[i] << (8 * i);
+	}
+	p += dict_flag == 3 ? 4 : dict_flag;
+	int fcs_bytes = fcs_flag ? 1 << fcs_flag : ctx->single_segment;
+	ctx->has_content_size = fcs_bytes > 0;
+	ctx->content_size = 0;
+	for (int i = 0; i < fcs_bytes; i++) {
+		ctx->content_size |= (uint64_t)p[i] << (8 * i);
+	}
+	if (fcs_bytes == 2) {
+		ctx->content_size += 256;
+	}
+	if (ctx->single_segment) {
+		ctx->window_size = ctx->content_size;
+	}
+	if (dict_id) {
+		return Z_NEED_DICT;
+	}
+	ctx->block_max = ctx->window_size < ZSTD_BLOCK_MAX_SIZE ? (uint32_t)ctx->window_size : ZSTD_BLOCK_MAX_SIZE;
+	ctx->produced = 0;
+	ctx->rep[0] = 1;
+	ctx->rep[1] = 4;
+	ctx->rep[2] = 8;
+	ctx->huf_log = 0;
+	ctx->tables_valid = 0;
+	return Z_OK;
+}
+
+/* Decode the block in ctx->block_* from src, straight into the caller's
+ * buffer while it can hold the frame, else through the window */
+static int zstd_put_dblock(zstd_decompress_context *ctx, z_stream *strm, const uint8_t *src) {
+	size_t bound = ctx->block_type == 2 ? ctx->block_max : ctx->block_size;
+	if (ctx->has_content_size && bound > ctx->content_size - ctx->produced) {
+		bound = (size_t)(ctx->content_size - ctx->produced);
+	}
+	uint8_t *op, *owild;
+	const uint8_t *ostart;
+	if (!ctx->windowed && strm->avail_out >= bound) {
+		op = strm->next_out;
+		ostart = op - ctx->produced;
+		owild = op + strm->avail_out;
+	} else {
+		if (zstd_to_window (ctx, strm->next_out) != 0) {
+			return Z_MEM_ERROR;
+		}
+		if (!ctx->single_segment && ctx->window_len + ctx->block_max + ZSTD_WILDCOPY > ctx->window_cap) {
+			/* all decoded bytes are handed out by now */
+			size_t keep = (size_t)ctx->window_size;
+			memmove (ctx->window_buffer, ctx->window_buffer + ctx->window_len - keep, keep);
+			ctx->window_len = ctx->window_out = keep;
+		}
+		ostart = ctx->window_buffer;
+		op = ctx->window_buffer + ctx->window_len;
+		owild = ctx->window_buffer + ctx->window_cap;
+		if (bound > ctx->window_cap - ZSTD_WILDCOPY - ctx->window_len) {
+			bound = ctx->window_cap - ZSTD_WILDCOPY - ctx->window_len;
+		}
+	}
+
+	long n;
+	if (ctx->block_type == 0) {
+		n = ctx->block_size <= bound ? (long)ctx->block_size : -1;
+		if (n > 0) {
+			memcpy (op, src, (size_t)n);
+		}
+	} else if (ctx->block_type == 1) {
+		n = ctx->block_size <= bound ? (long)ctx->block_size : -1;
+		if (n > 0) {
+			memset (op, src[0], (size_t)n);
+		}
+	} else {
+		n = zstd_decode_block (ctx, src, ctx->block_size, ostart, op, op + bound, owild);
+	}
+	if (n < 0) {
+		return Z_DATA_ERROR;
+	}
+	ctx->produced += (uint64_t)n;
+	if (ctx->windowed) {
+		ctx->window_len += (size_t)n;
+	} else {
+		strm->next_out += n;
+		strm->avail_out -= (uint32_t)n;
+		strm->total_out += (uint32_t)n;
+	}
+	return Z_OK;
+}
+
+static int zstd_decode(zstd_decompress_context *ctx, z_stream *strm, int flush) {
+	const uint8_t *p;
+	for (;;) {
+		/* Hand out what the window holds first */
+		if (ctx->window_out < ctx->window_len) {
+			size_t n = ctx->window_len - ctx->window_out;
+			if (n > strm->avail_out) {
+				n = strm->avail_out;
+			}
+			memcpy (strm->next_out, ctx->window_buffer + ctx->window_out, n);
+			strm->next_out += n;
+			strm->avail_out -= (uint32_t)n;
+			strm->total_out += (uint32_t)n;
+			ctx->window_out += n;
+			if (ctx->window_out < ctx->window_len) {
+				return Z_OK;
+			}
+		}
 
-				/* Advance input */
-				strm->next_in += block_size;
-				strm->avail_in -= block_size;
-				strm->total_in += block_size;
+		switch (ctx->stage) {
+		case ZSTD_D_MAGIC:
+			if (!(p = zstd_need (ctx, strm, 4))) {
+				return Z_OK;
+			}
+			if (read_le32 (p) == ZSTD_MAGIC_NUMBER) {
+				ctx->stage = ZSTD_D_FRAME_FLAGS;
+			} else if ((read_le32 (p) & 0xFFFFFFF0u) == 0x184D2A50u) {
+				ctx->stage = ZSTD_D_SKIP_SIZE;
 			} else {
-				/* Reserved or RLE block - not implemented */
 				return Z_DATA_ERROR;
 			}
-
-			/* Check if this was the last block */
-			if (ctx->is_last_block) {
-				return Z_STREAM_END;
+			break;
+		case ZSTD_D_SKIP_SIZE:
+			if (!(p = zstd_need (ctx, strm, 4))) {
+				return Z_OK;
 			}
-		} else {
-			/* Not enough input for a new block */
-			return Z_BUF_ERROR;
+			ctx->skip_left = read_le32 (p);
+			ctx->stage = ZSTD_D_SKIP;
+			break;
+		case ZSTD_D_SKIP: {
+			uint32_t n = ctx->skip_left < strm->avail_in ? (uint32_t)ctx->skip_left : strm->avail_in;
+			strm->next_in += n;
+			strm->avail_in -= n;
+			strm->total_in += n;
+			ctx->skip_left -= n;
+			if (ctx->skip_left) {
+				return Z_OK;
+			}
+			ctx->stage = ZSTD_D_MAGIC;
+			break;
+		}
+		case ZSTD_D_FRAME_FLAGS:
+			if (!(p = zstd_need (ctx, strm, 1))) {
+				return Z_OK;
+			}
+			if (p[0] & 0x08) {
+				return Z_DATA_ERROR; /* reserved bit */
+			}
+			ctx->frame_flags = p[0];
+			ctx->stage = ZSTD_D_FRAME_HEADER;
+			break;
+		case ZSTD_D_FRAME_HEADER: {
+			uint8_t f = ctx->frame_flags;
+			uint32_t fcs_flag = f >> 6, dict_flag = f & 3, single = f >> 5 & 1;
+			size_t n = !single + (dict_flag == 3 ? 4 : dict_flag) + (fcs_flag ? 1u << fcs_flag : single);
+			if (!(p = zstd_need (ctx, strm, n))) {
+				return Z_OK;
+			}
+			int ret = zstd_read_frame_header (ctx, p, f);
+			if (ret != Z_OK) {
+				return ret;
+			}
+			ctx->stage = ZSTD_D_BLOCK_HEADER;
+			break;
+		}
+		case ZSTD_D_BLOCK_HEADER: {
+			if (!(p = zstd_need (ctx, strm, 3))) {
+				return Z_OK;
+			}
+			uint32_t h = p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16;
+			ctx->last_block = h & 1;
+			ctx->block_type = h >> 1 & 3;
+			ctx->block_size = h >> 3;
+			if (ctx->block_type == 3 || ctx->block_size > ctx->block_max) {
+				return Z_DATA_ERROR;
+			}
+			ctx->stage = ZSTD_D_BLOCK;
+			break;
+		}
+		case ZSTD_D_BLOCK: {
+			/* decode only once the output can take it, or the window */
+			if (ctx->windowed && ctx->window_out < ctx->window_len) {
+				return Z_OK;
+			}
+			if (!(p = zstd_need (ctx, strm, ctx->block_type == 1 ? 1 : ctx->block_size))) {
+				return Z_OK;
+			}
+			int ret = zstd_put_dblock (ctx, strm, p);
+			if (ret != Z_OK) {
+				return ret;
+			}
+			if (ctx->has_content_size && ctx->produced > ctx->content_size) {
+				return Z_DATA_ERROR;
+			}
+			ctx->stage = !ctx->last_block ? ZSTD_D_BLOCK_HEADER
+				: ctx->has_checksum ? ZSTD_D_CHECKSUM : ZSTD_D_DONE;
+			break;
+		}
+		case ZSTD_D_CHECKSUM:
+			/* the low half of an XXH64 of the content; ZIP entries carry
+			 * their own CRC-32, so it is skipped rather than checked */
+			if (!zstd_need (ctx, strm, 4)) {
+				return Z_OK;
+			}
+			ctx->stage = ZSTD_D_DONE;
+			break;
+		default:
+			if (ctx->has_content_size && ctx->produced != ctx->content_size) {
+				return Z_DATA_ERROR;
+			}
+			/* More frames may follow; each starts with fresh history */
+			if (!strm->avail_in) {
+				return flush == Z_FINISH ? Z_STREAM_END : Z_OK;
+			}
+			free (ctx->window_buffer);
+			ctx->window_buffer = NULL;
+			ctx->window_cap = ctx->window_len = ctx->window_out = 0;
+			ctx->windowed = 0;
+			ctx->produced = 0;
+			ctx->stage = ZSTD_D_MAGIC;
+			break;
 		}
 	}
+}
+
+/* Initialize a decompression stream */
+int zstdDecompressInit(z_stream *strm) {
+	if (!strm) return Z_STREAM_ERROR;
+
+	/* Allocate decompression context; the window waits for the frame
+	 * header and is only needed when output comes in pieces */
+	zstd_decompress_context *ctx = (zstd_decompress_context *)calloc(1, sizeof(zstd_decompress_context));
+	if (!ctx) return Z_MEM_ERROR;
 
+	/* Room for one block of input and of literals, plus copy slack */
+	ctx->in_buf = (uint8_t *)malloc(ZSTD_BLOCK_MAX_SIZE);
+	ctx->literals = (uint8_t *)malloc(ZSTD_BLOCK_MAX_SIZE + ZSTD_WILDCOPY);
+	if (!ctx->in_buf || !ctx->literals) {
+		free(ctx->in_buf);
+		free(ctx->literals);
+		free(ctx);
+		return Z_MEM_ERROR;
+	}
+
+	/* Initialize stream */
+	strm->state = (void *)ctx;
+	strm->total_in = 0;
+	strm->total_out = 0;
+
+	return Z_OK;
+}
+
+/* Decompress data using Zstandard format */
+int zstdDecompress(z_stream *strm, int flush) {
+	if (!strm || !strm->state) {
+		return Z_STREAM_ERROR;
+	}
+	zstd_decompress_context *ctx = (zstd_decompress_context *)strm->state;
+	uint32_t avail_in = strm->avail_in, avail_out = strm->avail_out;
+	int ret = zstd_decode(ctx, strm, flush);
+	if (ret != Z_OK) {
+		return ret;
+	}
+	/* Output written straight to the caller's buffer is history the
+	 * next call cannot rely on */
+	if (!ctx->windowed && ctx->produced > 0 && zstd_to_window(ctx, strm->next_out) != 0) {
+		return Z_MEM_ERROR;
+	}
+	if (strm->avail_in == avail_in && strm->avail_out == avail_out) {
+		return Z_BUF_ERROR;
+	}
 	return Z_OK;
 }
 
@@ -696,10 +2308,8 @@ int zstdDecompressEnd(z_stream *strm) {
 
 	/* Free allocated buffers */
 	free(ctx->window_buffer);
-	free(ctx->decompress_buffer);
-	if (ctx->dict) {
-		free(ctx->dict);
-	}
+	free(ctx->in_buf);
+	free(ctx->literals);
 
 	/* Free context */
 	free(ctx);
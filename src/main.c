@@ -29,9 +29,23 @@
 #define PATH_MAX 4096
 #endif
 
+/* Files at least this large are streamed into the archive (data descriptor)
+ * rather than loaded into memory first */
+#define STREAM_ADD_MIN (64ULL * 1024 * 1024)
+
 /* Force overwrite flag (set via -f / --force) */
 static int g_force = 0;
 
+#if MZIP_ENABLE_THREADS && !defined(_WIN32)
+#define MZIP_CLI_THREADS 1
+#include <pthread.h>
+#endif
+
+/* Worker threads (-j N): files extracted at once, and the compression
+ * threads of the library; 0 = library default (one per CPU) */
+#define MAX_JOBS 64
+static int g_jobs = 0;
+
 /* Platform compatibility wrappers
  * - mingw/msvc provide mkdir(const char*)/_mkdir and no lstat/S_ISLNK by default.
  * - Provide small wrappers/macros so the rest of the code can use portable names. */
@@ -62,7 +76,8 @@ static void usage(void) {
             "  -x   Extract all files into current directory\n"
             "  -c   Create new archive with specified files\n"
             "  -a   Add files to existing archive\n"
-            "  -v   Show version number\n\n"
+            "  -v   Show version number\n"
+            "  A file named - is read from standard input\n\n"
             "Options:");
 
 	/* Show compression options based on what's enabled in config */
@@ -91,6 +106,7 @@ static void usage(void) {
          "      reject (default)  - reject entries with absolute paths, empty names, '..' that escape, or symlink parents\n"
          "      strip             - remove leading '..' components that would escape (e.g., '../../a' -> 'a')\n"
          "      allow             - allow unsafe extraction (use with caution)\n");
+    puts("  -j N            Use N threads to extract files or compress entries\n");
     puts("  --verify-crc    Verify CRC32 when extracting and fail on mismatch\n");
     puts("  --ignore-zipbomb  Ignore zipbomb expansion checks and allow large claimed uncompressed sizes (dangerous)\n");
 }
@@ -105,9 +121,7 @@ static int list_files(const char *path) {
 
 	zip_uint64_t n = zip_get_num_files(za);
 	for (zip_uint64_t i = 0; i < n; ++i) {
-		const char *name = NULL; /* we only have names in directory entries */
-		/* mzip stores names inside entries array – expose via zip_name_locate */
-		name = ((struct mzip_entry*)za->entries)[i].name; /* hack – internal */
+		const char *name = zip_get_name(za, i, 0);
 		printf("%3llu  %s\n", (unsigned long long)i, name ? name : "<unknown>");
 	}
 
@@ -136,6 +150,29 @@ static int create_or_add_files(const char *path, char **files, int num_files, in
 	for (int i = 0; i < num_files; i++) {
 		const char *filename = files[i];
 
+		/* "-" (standard input) and large files are streamed into the
+		 * archive with a data descriptor instead of being read whole */
+		struct stat sst;
+		int from_stdin = strcmp(filename, "-") == 0;
+		if (from_stdin || (stat(filename, &sst) == 0 && S_ISREG(sst.st_mode) &&
+				(uint64_t)sst.st_size >= STREAM_ADD_MIN)) {
+			zip_source_t *fsrc = from_stdin
+				? zip_source_filep(za, stdin, 0, -1)
+				: zip_source_file(za, filename, 0, -1);
+			const char *sname = strrchr(filename, '/') ? strrchr(filename, '/') + 1 : filename;
+			zip_int64_t sidx = fsrc ? zip_file_add(za, sname, fsrc, 0) : -1;
+			if (sidx < 0) {
+				fprintf(stderr, "Failed to add file to archive: %s\n", filename);
+				zip_source_free(fsrc);
+				continue;
+			}
+			zip_stat_t zst;
+			if (zip_stat_index(za, (zip_uint64_t)sidx, 0, &zst) == 0) {
+				printf("Added: %s (%llu bytes)\n", sname, (unsigned long long)zst.size);
+			}
+			continue;
+		}
+
 		/* Open file to read content */
 		FILE *fp = fopen(filename, "rb");
 		if (!fp) {
@@ -189,7 +226,8 @@ static int create_or_add_files(const char *path, char **files, int num_files, in
 		zip_int64_t idx = zip_file_add(za, base_name, src, 0);
 		if (idx < 0) {
 			fprintf(stderr, "Failed to add file to archive: %s\n", filename);
-			/* Source buffer is already freed in case of failure */
+			/* A failed add leaves the source (and buffer) with us */
+			zip_source_free(src);
 			continue;
 		}
 
@@ -258,9 +296,9 @@ static int sanitize_extract_path(const char *name, char *out, size_t outlen) {
             if (segc < (int)(PATH_MAX / 2)) segments[segc++] = start;
         }
         if (saved == '\0') break;
-        *p = saved;
-        /* move past '/' */
-        if (*p == '/') p++;
+        /* leave the segment terminated, segments[] points into tmp,
+         * and move past the '/' it replaced */
+        p++;
     }
 
     if (segc == 0) return -1; /* empty or only dots */
@@ -342,6 +380,165 @@ static int ensure_parent_dirs(const char *path) {
     return 0;
 }
 
+/* Extract entry i, whose parent directories already exist, to its
+ * sanitized path. Safe to run concurrently on separate archive handles. */
+static void extract_entry(zip_t *za, zip_uint64_t i, const char *fname_sanitized) {
+    zip_file_t *zf = zip_fopen_index(za, i, 0);
+    if (!zf) {
+        fprintf(stderr, "Could not read entry %llu\n", (unsigned long long)i);
+        return;
+    }
+
+    /* Avoid overwriting existing files unless force (-f) is specified. */
+    struct stat pst;
+    if (MZIP_LSTAT(fname_sanitized, &pst) == 0) {
+        if (!g_force) {
+            fprintf(stderr, "Skipping existing file (use -f to overwrite): %s\n", fname_sanitized);
+            zip_fclose(zf);
+            return;
+        }
+        /* If force is set and path is a symlink, reject unless policy allows */
+        if (S_ISLNK(pst.st_mode) && g_extract_policy == POLICY_REJECT) {
+            fprintf(stderr, "Refusing to overwrite symlink: %s\n", fname_sanitized);
+            zip_fclose(zf);
+            return;
+        }
+    }
+
+    /* Determine safe mode from central directory external attributes.
+     * Mask to 0777 to avoid applying SUID/SGID/sticky from archive. */
+    uint32_t external_attr = 0;
+    /* access internal entry data safely */
+    struct mzip_entry *entry = &((struct mzip_entry*)za->entries)[i];
+    external_attr = entry->external_attr;
+    mode_t desired_mode = (mode_t)((external_attr >> 16) & 0777);
+    if (desired_mode == 0) desired_mode = 0644; /* fallback */
+
+    /* Open the output file atomically: try O_CREAT|O_EXCL first to avoid
+     * TOCTOU overwrite races. If it exists and force is requested, open with
+     * O_TRUNC to overwrite. Use low-level descriptors and write() to avoid
+     * stdio buffering issues. */
+    int fd = -1;
+    int open_flags = O_WRONLY | O_CREAT | O_EXCL;
+    fd = open(fname_sanitized, open_flags, desired_mode);
+    if (fd < 0) {
+        if (errno == EEXIST) {
+            if (!g_force) {
+                fprintf(stderr, "Skipping existing file (use -f to overwrite): %s\n", fname_sanitized);
+                zip_fclose(zf);
+                return;
+            }
+            /* Force path: open for write/truncate but ensure it's not a symlink */
+            if (MZIP_LSTAT(fname_sanitized, &pst) == 0 && S_ISLNK(pst.st_mode) && g_extract_policy == POLICY_REJECT) {
+                fprintf(stderr, "Refusing to overwrite symlink: %s\n", fname_sanitized);
+                zip_fclose(zf);
+                return;
+            }
+            fd = open(fname_sanitized, O_WRONLY | O_TRUNC);
+            if (fd < 0) {
+                fprintf(stderr, "Cannot open for overwrite %s: %s\n", fname_sanitized, strerror(errno));
+                zip_fclose(zf);
+                return;
+            }
+        } else {
+            fprintf(stderr, "Cannot create %s: %s\n", fname_sanitized, strerror(errno));
+            zip_fclose(zf);
+            return;
+        }
+    }
+
+    /* After creating/opening, ensure we didn't follow a symlink to a special file. */
+    struct stat st2;
+    if (fstat(fd, &st2) != 0) {
+        fprintf(stderr, "Failed to stat %s\n", fname_sanitized);
+        close(fd);
+        zip_fclose(zf);
+        return;
+    }
+    if (!S_ISREG(st2.st_mode)) {
+        fprintf(stderr, "Refusing to write non-regular file %s\n", fname_sanitized);
+        close(fd);
+        zip_fclose(zf);
+        return;
+    }
+
+    /* Apply safe permissions (masking out SUID/SGID/sticky by using 0777 mask) */
+    if (MZIP_FCHMOD(fd, desired_mode & 0777) != 0) {
+        /* Non-fatal: warn but continue */
+        fprintf(stderr, "Warning: failed to set permissions on %s: %s\n", fname_sanitized, strerror(errno));
+    }
+
+    /* Stream the entry into the file */
+    uint8_t buf[64 * 1024];
+    uint64_t total = 0;
+    int read_failed = 0, write_failed = 0;
+    for (;;) {
+        zip_int64_t got = zip_fread(zf, buf, sizeof(buf));
+        if (got < 0) {
+            read_failed = 1;
+            break;
+        }
+        if (got == 0) break;
+        size_t off = 0;
+        while (off < (size_t)got) {
+            ssize_t n = write(fd, buf + off, (size_t)got - off);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                fprintf(stderr, "Write error for %s: %s\n", fname_sanitized, strerror(errno));
+                write_failed = 1;
+                break;
+            }
+            off += (size_t)n;
+        }
+        if (write_failed) break;
+        total += (uint64_t)got;
+    }
+    close(fd);
+    zip_fclose(zf);
+    if (read_failed) {
+        /* corrupt entry: do not leave a truncated file behind */
+        fprintf(stderr, "Could not read entry %llu\n", (unsigned long long)i);
+        unlink(fname_sanitized);
+    } else if (!write_failed) {
+        printf("Extracted %s (%llu bytes)\n", fname_sanitized, (unsigned long long)total);
+    } else {
+        fprintf(stderr, "Failed to fully write %s\n", fname_sanitized);
+    }
+}
+
+/* A file to extract, with its sanitized output path */
+struct extract_job {
+    zip_uint64_t index;
+    char *path;
+};
+
+#if MZIP_CLI_THREADS
+/* Jobs are handed out in archive order from a shared cursor. All threads
+ * read through the same archive handle; reads are positional. */
+struct extract_ctx {
+    zip_t *za;
+    struct extract_job *jobs;
+    size_t n_jobs;
+    size_t next;
+    pthread_mutex_t lock;
+};
+
+static void *extract_worker(void *arg) {
+    struct extract_ctx *ctx = (struct extract_ctx *)arg;
+    for (;;) {
+        pthread_mutex_lock(&ctx->lock);
+        size_t j = ctx->next++;
+        pthread_mutex_unlock(&ctx->lock);
+        if (j >= ctx->n_jobs) break;
+        extract_entry(ctx->za, ctx->jobs[j].index, ctx->jobs[j].path);
+    }
+    return NULL;
+}
+#endif
+
+/* Extract every entry into the current directory. Directories (explicit
+ * entries and the parents of files) are created first in one pass, then
+ * the files are written, by g_jobs threads when more than one. */
 static int extract_all(const char *path) {
     int err = 0;
     zip_t *za = zip_open(path, ZIP_RDONLY, &err);
@@ -351,18 +548,18 @@ static int extract_all(const char *path) {
     }
 
     zip_uint64_t n = zip_get_num_files(za);
+    struct extract_job *jobs = (struct extract_job *)calloc(n ? n : 1, sizeof(*jobs));
+    size_t n_jobs = 0;
+    if (!jobs) {
+        fprintf(stderr, "Out of memory\n");
+        zip_close(za);
+        return 1;
+    }
     for (zip_uint64_t i = 0; i < n; ++i) {
-        zip_file_t *zf = zip_fopen_index(za, i, 0);
-        if (!zf) {
-            fprintf(stderr, "Could not read entry %llu\n", (unsigned long long)i);
-            continue;
-        }
-
-        const char *raw_name = ((struct mzip_entry*)za->entries)[i].name; /* internal */
+        const char *raw_name = zip_get_name(za, i, 0);
         char fname_sanitized[PATH_MAX];
         if (sanitize_extract_path(raw_name, fname_sanitized, sizeof(fname_sanitized)) != 0) {
             fprintf(stderr, "Skipping suspicious entry: %s\n", raw_name ? raw_name : "(null)");
-            zip_fclose(zf);
             continue;
         }
 
@@ -376,121 +573,48 @@ static int extract_all(const char *path) {
                     fprintf(stderr, "Failed to create directory %s\n", fname_sanitized);
                 }
             }
-            zip_fclose(zf);
             continue;
         }
 
         if (ensure_parent_dirs(fname_sanitized) != 0) {
             fprintf(stderr, "Cannot ensure parent dirs for %s\n", fname_sanitized);
-            zip_fclose(zf);
             continue;
         }
-
-        /* Avoid overwriting existing files unless force (-f) is specified. */
-        struct stat pst;
-        if (MZIP_LSTAT(fname_sanitized, &pst) == 0) {
-            if (!g_force) {
-                fprintf(stderr, "Skipping existing file (use -f to overwrite): %s\n", fname_sanitized);
-                zip_fclose(zf);
-                continue;
-            }
-            /* If force is set and path is a symlink, reject unless policy allows */
-            if (S_ISLNK(pst.st_mode) && g_extract_policy == POLICY_REJECT) {
-                fprintf(stderr, "Refusing to overwrite symlink: %s\n", fname_sanitized);
-                zip_fclose(zf);
-                continue;
-            }
-        }
-
-        /* Determine safe mode from central directory external attributes.
-         * Mask to 0777 to avoid applying SUID/SGID/sticky from archive. */
-        uint32_t external_attr = 0;
-        /* access internal entry data safely */
-        struct mzip_entry *entry = &((struct mzip_entry*)za->entries)[i];
-        external_attr = entry->external_attr;
-        mode_t desired_mode = (mode_t)((external_attr >> 16) & 0777);
-        if (desired_mode == 0) desired_mode = 0644; /* fallback */
-
-        /* Open the output file atomically: try O_CREAT|O_EXCL first to avoid
-         * TOCTOU overwrite races. If it exists and force is requested, open with
-         * O_TRUNC to overwrite. Use low-level descriptors and write() to avoid
-         * stdio buffering issues. */
-        int fd = -1;
-        int open_flags = O_WRONLY | O_CREAT | O_EXCL;
-        fd = open(fname_sanitized, open_flags, desired_mode);
-        if (fd < 0) {
-            if (errno == EEXIST) {
-                if (!g_force) {
-                    fprintf(stderr, "Skipping existing file (use -f to overwrite): %s\n", fname_sanitized);
-                    zip_fclose(zf);
-                    continue;
-                }
-                /* Force path: open for write/truncate but ensure it's not a symlink */
-                if (MZIP_LSTAT(fname_sanitized, &pst) == 0 && S_ISLNK(pst.st_mode) && g_extract_policy == POLICY_REJECT) {
-                    fprintf(stderr, "Refusing to overwrite symlink: %s\n", fname_sanitized);
-                    zip_fclose(zf);
-                    continue;
-                }
-                fd = open(fname_sanitized, O_WRONLY | O_TRUNC);
-                if (fd < 0) {
-                    fprintf(stderr, "Cannot open for overwrite %s: %s\n", fname_sanitized, strerror(errno));
-                    zip_fclose(zf);
-                    continue;
-                }
-            } else {
-                fprintf(stderr, "Cannot create %s: %s\n", fname_sanitized, strerror(errno));
-                zip_fclose(zf);
-                continue;
-            }
-        }
-
-        /* After creating/opening, ensure we didn't follow a symlink to a special file. */
-        struct stat st2;
-        if (fstat(fd, &st2) != 0) {
-            fprintf(stderr, "Failed to stat %s\n", fname_sanitized);
-            close(fd);
-            zip_fclose(zf);
+        jobs[n_jobs].index = i;
+        jobs[n_jobs].path = strdup(fname_sanitized);
+        if (!jobs[n_jobs].path) {
+            fprintf(stderr, "Out of memory for %s\n", fname_sanitized);
             continue;
         }
-        if (!S_ISREG(st2.st_mode)) {
-            fprintf(stderr, "Refusing to write non-regular file %s\n", fname_sanitized);
-            close(fd);
-            zip_fclose(zf);
-            continue;
-        }
-
-        /* Apply safe permissions (masking out SUID/SGID/sticky by using 0777 mask) */
-        if (MZIP_FCHMOD(fd, desired_mode & 0777) != 0) {
-            /* Non-fatal: warn but continue */
-            fprintf(stderr, "Warning: failed to set permissions on %s: %s\n", fname_sanitized, strerror(errno));
-        }
+        n_jobs++;
+    }
 
-        /* Write the file content */
-        ssize_t wrote = 0;
-        const uint8_t *data = (const uint8_t*)zf->data;
-        size_t remain = zf->size;
-        while (remain > 0) {
-            ssize_t n = write(fd, data + wrote, remain);
-            if (n < 0) {
-                if (errno == EINTR) continue;
-                fprintf(stderr, "Write error for %s: %s\n", fname_sanitized, strerror(errno));
-                break;
-            }
-            wrote += n;
-            remain -= n;
+    size_t done = 0;
+#if MZIP_CLI_THREADS
+    int n_threads = g_jobs < MAX_JOBS ? g_jobs : MAX_JOBS;
+    if ((size_t)n_threads > n_jobs) n_threads = (int)n_jobs;
+    if (n_threads > 1) {
+        struct extract_ctx ctx = { za, jobs, n_jobs, 0, PTHREAD_MUTEX_INITIALIZER };
+        pthread_t tids[MAX_JOBS];
+        int started[MAX_JOBS] = {0};
+        for (int t = 1; t < n_threads; t++) {
+            started[t] = pthread_create(&tids[t], NULL, extract_worker, &ctx) == 0;
         }
-        close(fd);
-
-        /* Save size before closing – zip_fclose() frees the zip_file_t */
-        size_t entry_size = (size_t)zf->size;
-        zip_fclose(zf);
-        if (remain == 0) {
-            printf("Extracted %s (%lu bytes)\n", fname_sanitized, (unsigned long)entry_size);
-        } else {
-            fprintf(stderr, "Failed to fully write %s\n", fname_sanitized);
+        extract_worker(&ctx);
+        for (int t = 1; t < n_threads; t++) {
+            if (started[t]) pthread_join(tids[t], NULL);
         }
+        done = n_jobs;
+    }
+#endif
+    for (size_t j = done; j < n_jobs; j++) {
+        extract_entry(za, jobs[j].index, jobs[j].path);
     }
 
+    for (size_t j = 0; j < n_jobs; j++) {
+        free(jobs[j].path);
+    }
+    free(jobs);
     zip_close(za);
     return 0;
 }
@@ -554,6 +678,11 @@ int main(int argc, char **argv) {
 		for (i = 3; i < argc; i++) {
 			if (strncmp(argv[i], "-z", 2) == 0) {
 				filter_count++;
+			} else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+				filter_count += 2;
+				i++;
+			} else if (strncmp(argv[i], "-j", 2) == 0) {
+				filter_count++;
 			}
 		}
 		num_files -= filter_count;
@@ -640,6 +769,25 @@ int main(int argc, char **argv) {
         }
     }
 
+    /* Parse thread count: -j N or -jN */
+    for (i = 3; i < argc; i++) {
+        const char *val = NULL;
+        if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            val = argv[++i];
+        } else if (strncmp(argv[i], "-j", 2) == 0) {
+            val = argv[i] + 2;
+        }
+        if (!val) continue;
+        char *end = NULL;
+        long jobs = strtol(val, &end, 10);
+        if (!*val || *end || jobs < 1) {
+            fprintf(stderr, "Invalid thread count: %s\n", val);
+            return 1;
+        }
+        g_jobs = jobs > MAX_JOBS ? MAX_JOBS : (int)jobs;
+        mzip_threads = g_jobs;
+    }
+
     /* Parse force option: -f or --force (allow overwriting existing files) */
     for (i = 3; i < argc; i++) {
         if (strcmp(argv[i], "-f") == 0 || strcmp(argv[i], "--force") == 0) {
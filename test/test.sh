@@ -334,6 +334,90 @@ test_large_file() {
      fini
  }
 
+test_corrupt_deflate() {
+    init
+    echo "[***] Testing that a corrupt deflate entry is not extracted"
+    i=0; : > text.txt
+    while [ $i -lt 200 ]; do echo "line $i of some compressible text" >> text.txt; i=$((i+1)); done
+    $MZ -c test.zip text.txt -z1 || error "mzip failed"
+    # Deflate data starts after the 30-byte local header and the 8-byte name;
+    # 0xff is a final block of the reserved type 3
+    printf '\377' | dd of=test.zip bs=1 seek=38 conv=notrunc 2>/dev/null || error "cannot patch archive"
+    mkdir -p data && cd data
+    $MZ -x ../test.zip 2> err.txt
+    grep "Could not read entry" err.txt >/dev/null || error "corrupt entry was not reported"
+    [ ! -f text.txt ] || error "corrupt entry was extracted"
+    cd .. && rm -rf data
+    fini
+}
+
+test_stdin_stream() {
+    init
+    echo "[***] Testing streamed entries (stdin, data descriptor) with store/deflate"
+    i=0; : > text.txt
+    while [ $i -lt 500 ]; do echo "streamed line $i" >> text.txt; i=$((i+1)); done
+    for Z in 0 1; do
+        rm -f test.zip
+        $MZ -c test.zip - -z$Z < text.txt || error "mzip failed reading stdin (-z$Z)"
+        unzip -tq test.zip >/dev/null || error "unzip -t failed (-z$Z)"
+        unzip -p test.zip - | cmp -s - text.txt || error "unzip content mismatch (-z$Z)"
+        # appending reloads the central directory, which now has bit 3 set
+        $MZ -a test.zip text.txt -z$Z >/dev/null || error "mzip -a failed (-z$Z)"
+        mkdir -p data && cd data
+        $MZ -x ../test.zip >/dev/null < /dev/null || error "mzip -x failed (-z$Z)"
+        cmp -s ./- ../text.txt || error "streamed entry mismatch (-z$Z)"
+        cmp -s text.txt ../text.txt || error "appended entry mismatch (-z$Z)"
+        cd .. && rm -rf data
+    done
+    fini
+}
+
+test_parallel_extract() {
+    init
+    echo "[***] Testing parallel extraction (-j) of nested directories"
+    mkdir -p src/a/b src/c
+    i=0
+    while [ $i -lt 60 ]; do
+        echo "file $i" > src/a/f$i.txt
+        seq 1 $((i * 50)) > src/a/b/g$i.txt
+        i=$((i+1))
+    done
+    cp ../hello.txt src/c/hello.txt
+    # Info-ZIP stores explicit directory entries and relative paths
+    zip -qr test.zip src || error "zip failed"
+    for J in 1 4; do
+        mkdir -p data && cd data
+        $MZ -x ../test.zip -j $J >/dev/null || error "mzip -x -j $J failed"
+        diff -r ../src src || error "extracted tree differs (-j $J)"
+        cd .. && rm -rf data
+    done
+    # -j also applies to compression
+    $MZ -c test2.zip src/a/f1.txt src/a/b/g59.txt -z1 -j4 >/dev/null || error "mzip -c -j4 failed"
+    unzip -tq test2.zip >/dev/null || error "unzip -t failed on -j4 archive"
+    fini
+}
+
+# $1: mzip -z option, $2: method as unzip -v lists it
+test_codec_roundtrip() {
+    init
+    echo "[***] Testing $1 round trip of text, random and empty files"
+    i=0; : > text.txt
+    while [ $i -lt 3000 ]; do echo "line $i $((i * i % 97))" >> text.txt; i=$((i+1)); done
+    dd if=/dev/urandom of=rand.bin bs=1k count=300 2>/dev/null || error "cannot create random"
+    cat text.txt rand.bin text.txt > mixed.bin
+    : > empty.txt
+    $MZ -c test.zip text.txt rand.bin mixed.bin empty.txt $1 || error "mzip failed $1"
+    unzip -v test.zip > files.txt || error "unzip -v failed"
+    grep "text.txt" files.txt | grep -q "$2" || error "text.txt not stored as $2"
+    mkdir -p data && cd data
+    $MZ -x ../test.zip >/dev/null || error "mzip -x failed ($1)"
+    for F in text.txt rand.bin mixed.bin empty.txt; do
+        cmp -s $F ../$F || error "$F mismatch ($1)"
+    done
+    cd .. && rm -rf data
+    fini
+}
+
 # Run new tests
 test_empty_files || exit 1
 test_binary_file || exit 1
@@ -341,3 +425,8 @@ test_large_random_and_fallback || exit 1
 test_duplicate_names_listing || exit 1
 test_space_in_name || exit 1
 test_large_file || exit 1
+test_corrupt_deflate || exit 1
+test_stdin_stream || exit 1
+test_parallel_extract || exit 1
+test_codec_roundtrip -z2 Unk:093 || exit 1
+test_codec_roundtrip -z3 LZMA || exit 1
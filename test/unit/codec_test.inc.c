@@ -0,0 +1,148 @@
+/* codec_test.inc.c - round trip checks shared by the codec unit tests
+ *
+ * Include after the codec; each test fills a codec_ops with its z_stream
+ * entry points and keeps only its own reference vectors.
+ */
+
+typedef struct {
+    const char *name;
+    int (*init)(z_stream *strm, int level);
+    int (*compress)(z_stream *strm, int flush);
+    int (*end)(z_stream *strm);
+    int (*decompress_init)(z_stream *strm);
+    int (*decompress)(z_stream *strm, int flush);
+    int (*decompress_end)(z_stream *strm);
+    int min_level, max_level;
+} codec_ops;
+
+/* The text the reference vectors were made from */
+static size_t reference_text(char *buf, size_t cap) {
+    size_t len = 0;
+    for (int i = 0; i < 100; i++) {
+        len += snprintf(buf + len, cap - len, "%d %s %d\n",
+                i * 7 % 113, i % 3 ? "gamma" : "delta", i * i % 1000);
+    }
+    return len;
+}
+
+/* Decompress handing over at most in_chunk input and out_chunk output
+ * bytes per call (0 = all); returns the decompressed size or -1 */
+static long codec_decompress_chunked(const codec_ops *c, const uint8_t *src, size_t src_len,
+        uint8_t *dst, size_t dst_cap, size_t in_chunk, size_t out_chunk) {
+    z_stream strm = {0};
+    size_t in_pos = 0, out_pos = 0;
+    int ret;
+
+    if (c->decompress_init(&strm) != Z_OK) {
+        return -1;
+    }
+    do {
+        size_t in = in_chunk && src_len - in_pos > in_chunk ? in_chunk : src_len - in_pos;
+        size_t out = out_chunk && dst_cap - out_pos > out_chunk ? out_chunk : dst_cap - out_pos;
+        strm.next_in = (uint8_t*)src + in_pos;
+        strm.avail_in = in;
+        strm.next_out = dst + out_pos;
+        strm.avail_out = out;
+        ret = c->decompress(&strm, in_pos + in == src_len ? Z_FINISH : Z_NO_FLUSH);
+        in_pos += in - strm.avail_in;
+        out_pos += out - strm.avail_out;
+    } while (ret == Z_OK);
+    c->decompress_end(&strm);
+    return ret == Z_STREAM_END ? (long)out_pos : -1;
+}
+
+/* src must decode to want[0..want_len), whole or a byte at a time */
+static int codec_check_decode(const codec_ops *c, const uint8_t *src, size_t src_len,
+        const char *want, size_t want_len) {
+    const size_t chunks[][2] = { {0, 0}, {1, 1}, {7, 100} };
+    uint8_t *got = malloc(want_len + 1);
+    int result = !got;
+
+    for (size_t i = 0; got && i < sizeof(chunks) / sizeof(chunks[0]) && !result; i++) {
+        long n = codec_decompress_chunked(c, src, src_len, got, want_len + 1,
+                chunks[i][0], chunks[i][1]);
+        if (n != (long)want_len || memcmp(got, want, want_len) != 0) {
+            printf("ERROR: %s decode mismatch (chunks %zu/%zu)\n", c->name,
+                   chunks[i][0], chunks[i][1]);
+            result = 1;
+        }
+    }
+    free(got);
+    return result;
+}
+
+/* Every third level, streamed in and out in odd pieces, on text with a
+ * random stretch and a long run */
+static int codec_levels_streaming(const codec_ops *c) {
+    const size_t size = 400000;
+    const size_t cap = size + size / 8 + 1024;
+    uint8_t *data = malloc(size);
+    uint8_t *compressed = malloc(cap);
+    uint8_t *decompressed = malloc(size);
+    int result = 0;
+    uint32_t x = 1;
+
+    if (!data || !compressed || !decompressed) {
+        printf("Memory allocation failed\n");
+        free(data);
+        free(compressed);
+        free(decompressed);
+        return 1;
+    }
+    for (size_t i = 0; i < size; i++) {
+        x = x * 1103515245u + 12345u;
+        if (i >= 150000 && i < 200000) {
+            data[i] = (uint8_t)(x >> 16);
+        } else if (i >= 250000 && i < 260000) {
+            data[i] = 'z';
+        } else {
+            data[i] = (x >> 20) & 3 ? data[i > 4000 ? i - 4000 + (x >> 24) % 64 : 0] : (uint8_t)('a' + (x >> 16) % 20);
+        }
+    }
+
+    for (int level = c->min_level; level <= c->max_level && !result; level += 3) {
+        z_stream c_strm = {0};
+        size_t pos = 0, out_pos = 0;
+        int ret;
+
+        if (c->init(&c_strm, level) != Z_OK) {
+            printf("%s init failed\n", c->name);
+            result = 1;
+            break;
+        }
+        do {
+            size_t n = size - pos < 30000 ? size - pos : 30000;
+            c_strm.next_in = data + pos;
+            c_strm.avail_in = n;
+            pos += n;
+            do {
+                size_t out = cap - out_pos < 4096 ? cap - out_pos : 4096;
+                c_strm.next_out = compressed + out_pos;
+                c_strm.avail_out = out;
+                ret = c->compress(&c_strm, pos == size ? Z_FINISH : Z_NO_FLUSH);
+                out_pos += out - c_strm.avail_out;
+            } while (ret == Z_OK && (c_strm.avail_in || c_strm.avail_out == 0 || pos == size));
+        } while (ret == Z_OK && pos < size);
+        c->end(&c_strm);
+        if (ret != Z_STREAM_END) {
+            printf("%s compress failed at level %d with result %d\n", c->name, level, ret);
+            result = 1;
+            break;
+        }
+
+        long whole = codec_decompress_chunked(c, compressed, out_pos, decompressed, size, 0, 0);
+        int whole_ok = whole == (long)size && memcmp(decompressed, data, size) == 0;
+        long pieces = codec_decompress_chunked(c, compressed, out_pos, decompressed, size, 1000, 777);
+        if (!whole_ok || pieces != (long)size || memcmp(decompressed, data, size) != 0) {
+            printf("ERROR: %s level %d round trip failed\n", c->name, level);
+            result = 1;
+        }
+    }
+    if (!result) {
+        printf("TEST PASSED: %s levels and streaming.\n", c->name);
+    }
+    free(data);
+    free(compressed);
+    free(decompressed);
+    return result;
+}
@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "config.h"
+
+/* Include CRC-32 implementation */
+#include "../../src/lib/crc32.inc.c"
+
+/* Bit-at-a-time reference, independent of the tables */
+static uint32_t crc32_ref(uint32_t crc, const uint8_t *p, size_t len) {
+    crc = ~crc;
+    while (len--) {
+        crc ^= *p++;
+        for (int k = 0; k < 8; k++)
+            crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1)));
+    }
+    return ~crc;
+}
+
+static int test_known_vector(void) {
+    const char *s = "123456789";
+    uint32_t crc = mzip_crc32(0, s, strlen(s));
+    if (crc != 0xCBF43926u) {
+        printf("known vector: got %08x\n", crc);
+        return 1;
+    }
+    printf("Known vector test passed\n");
+    return 0;
+}
+
+static int test_against_reference(void) {
+    size_t n = 5000;
+    uint8_t *buf = malloc(n + 16);
+    uint32_t seed = 1;
+    for (size_t i = 0; i < n + 16; i++) {
+        seed = seed * 1103515245u + 12345u;
+        buf[i] = (uint8_t)(seed >> 16);
+    }
+    /* every misalignment and a spread of lengths, through both paths */
+    for (size_t off = 0; off < 16; off++) {
+        for (size_t len = 0; len <= n; len += (len < 300) ? 1 : 97) {
+            uint32_t ref = crc32_ref(0x12345678u, buf + off, len);
+            if (mzip_crc32(0x12345678u, buf + off, len) != ref ||
+                mzip_crc32_generic(0x12345678u, buf + off, len) != ref) {
+                printf("mismatch at off=%zu len=%zu\n", off, len);
+                free(buf);
+                return 1;
+            }
+        }
+    }
+    free(buf);
+    printf("Reference comparison test passed\n");
+    return 0;
+}
+
+static int test_combine(void) {
+    size_t n = 100000;
+    uint8_t *buf = malloc(n);
+    for (size_t i = 0; i < n; i++) buf[i] = (uint8_t)(i * 31 + (i >> 7));
+    uint32_t whole = mzip_crc32(0, buf, n);
+    static const size_t cuts[] = { 0, 1, 7, 64, 4095, 50000, 99999, 100000 };
+    for (size_t i = 0; i < sizeof(cuts) / sizeof(cuts[0]); i++) {
+        size_t c = cuts[i];
+        uint32_t a = mzip_crc32(0, buf, c);
+        uint32_t b = mzip_crc32(0, buf + c, n - c);
+        if (mzip_crc32_combine(a, b, n - c) != whole) {
+            printf("combine mismatch at cut=%zu\n", c);
+            free(buf);
+            return 1;
+        }
+    }
+    free(buf);
+    printf("Combine test passed\n");
+    return 0;
+}
+
+int main(void) {
+    int result = 0;
+
+    printf("=== CRC-32 Unit Tests ===\n");
+    result |= test_known_vector();
+    result |= test_against_reference();
+    result |= test_combine();
+
+    if (result == 0) {
+        printf("All CRC-32 tests passed!\n");
+    } else {
+        printf("Some CRC-32 tests failed!\n");
+    }
+    return result;
+}
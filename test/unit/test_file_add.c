@@ -0,0 +1,143 @@
+/* Include the library itself */
+#include "../../src/lib/mzip.c"
+
+#define TEST_ZIP "test_file_add.zip"
+#define TEST_IN  "test_file_add.in"
+
+static const char text[] = "failed adds leave the source with the caller\n";
+
+/* A FILE that cannot be read from, so loading or streaming it fails */
+static zip_source_t *unreadable_source(zip_t *za) {
+	FILE *fp = fopen (TEST_IN, "wb");
+	if (!fp) {
+		return NULL;
+	}
+	zip_source_t *src = zip_source_filep (za, fp, 0, -1);
+	if (!src) {
+		fclose (fp);
+	}
+	return src;
+}
+
+/* The add must fail and hand the source back: release it here, where a
+ * second free or close by zip_file_add would show up under ASan */
+static int expect_failure(zip_t *za, const char *what, const char *name, zip_source_t *src, uint16_t method) {
+	if (!src) {
+		printf("FAIL: %s: no source\n", what);
+		return 1;
+	}
+	zip_uint64_t n = zip_get_num_files (za);
+	za->default_method = method;
+	zip_int64_t idx = zip_file_add (za, name, src, 0);
+	za->default_method = MZIP_METHOD_STORE;
+	int r = idx != -1 || zip_get_num_files (za) != n;
+	zip_source_free (src);
+	printf("%s: %s\n", r ? "FAIL" : "ok", what);
+	return r;
+}
+
+static int test_failed_adds(void) {
+	int err = 0, r = 0;
+	zip_t *za = zip_open (TEST_ZIP, ZIP_CREATE | ZIP_TRUNCATE, &err);
+	if (!za) {
+		printf("FAIL: zip_open\n");
+		return 1;
+	}
+
+	char *long_name = (char*)malloc (MZIP_MAX_FIELD_LEN + 2);
+	if (long_name) {
+		memset (long_name, 'n', MZIP_MAX_FIELD_LEN + 1);
+		long_name[MZIP_MAX_FIELD_LEN + 1] = 0;
+	}
+	r |= !long_name || expect_failure (za, "name too long", long_name,
+		zip_source_buffer (za, strdup (text), sizeof (text) - 1, 1), MZIP_METHOD_STORE);
+	free (long_name);
+
+	/* a method that does not stream: the source is read into memory first */
+	r |= expect_failure (za, "file source fails to load", "load.txt",
+		unreadable_source (za), 99);
+	r |= expect_failure (za, "file source fails to stream", "stream.txt",
+		unreadable_source (za), MZIP_METHOD_DEFLATE);
+	r |= expect_failure (za, "buffer fails to compress", "compress.txt",
+		zip_source_buffer (za, strdup (text), sizeof (text) - 1, 1), 99);
+
+	/* loads fine, then the method fails: the source now owns a buffer */
+	FILE *fp = fopen (TEST_IN, "wb");
+	if (fp) {
+		fputs (text, fp);
+		fclose (fp);
+	}
+	r |= expect_failure (za, "loaded file fails to compress", "loaded.txt",
+		zip_source_file (za, TEST_IN, 0, -1), 99);
+
+	/* the size is checked before the data is touched */
+	r |= expect_failure (za, "buffer too large", "large.txt",
+		zip_source_buffer (za, text, MZIP_MAX_PAYLOAD + 1, 0), MZIP_METHOD_STORE);
+
+	/* the archive is still usable after all of the above */
+	if (zip_file_add (za, "ok.txt", zip_source_buffer (za, text, sizeof (text) - 1, 0), 0) != 0) {
+		printf("FAIL: add after failures\n");
+		r = 1;
+	}
+	zip_close (za);
+
+	za = zip_open (TEST_ZIP, ZIP_RDONLY, &err);
+	zip_stat_t st;
+	if (!za || zip_get_num_files (za) != 1 || zip_stat_index (za, 0, 0, &st) != 0
+			|| strcmp (st.name, "ok.txt") != 0 || st.size != sizeof (text) - 1
+			|| zip_stat_index (za, 1, 0, &st) != -1) {
+		printf("FAIL: archive after failed adds\n");
+		r = 1;
+	}
+	if (za) {
+		zip_close (za);
+	}
+	unlink (TEST_IN);
+	unlink (TEST_ZIP);
+	return r;
+}
+
+/* With a pool, in-memory sources are taken at once and compressed later:
+ * a late failure is reported by zip_close, and the source is the archive's
+ * to release. Adds that fail up front still return the source. */
+static int test_pooled_adds(void) {
+	int err = 0, r = 0;
+	mzip_threads = 4;
+	zip_t *za = zip_open (TEST_ZIP, ZIP_CREATE | ZIP_TRUNCATE, &err);
+	if (!za) {
+		printf("FAIL: zip_open\n");
+		mzip_threads = 0;
+		return 1;
+	}
+	r |= expect_failure (za, "pooled: file source fails to load", "load.txt",
+		unreadable_source (za), 99);
+	r |= expect_failure (za, "pooled: buffer too large", "large.txt",
+		zip_source_buffer (za, text, MZIP_MAX_PAYLOAD + 1, 0), MZIP_METHOD_STORE);
+	za->default_method = 99;
+	zip_int64_t idx = zip_file_add (za, "late.txt",
+		zip_source_buffer (za, strdup (text), sizeof (text) - 1, 1), 0);
+	za->default_method = MZIP_METHOD_STORE;
+	int closed = zip_close (za);
+	if (idx != 0 || closed != -1) {
+		printf("FAIL: pooled: late compression failure\n");
+		r = 1;
+	} else {
+		printf("ok: pooled: late compression failure\n");
+	}
+	mzip_threads = 0;
+	unlink (TEST_IN);
+	unlink (TEST_ZIP);
+	return r;
+}
+
+int main(void) {
+	printf("=== zip_file_add Unit Tests ===\n");
+	int result = test_failed_adds ();
+	result |= test_pooled_adds ();
+	if (result == 0) {
+		printf("All zip_file_add tests passed!\n");
+	} else {
+		printf("Some zip_file_add tests failed!\n");
+	}
+	return result;
+}
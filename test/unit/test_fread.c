@@ -0,0 +1,284 @@
+/* Include the library itself */
+#include "../../src/lib/mzip.c"
+
+#define TEST_ZIP "test_fread.zip"
+#define DATA_SIZE (600 * 1024)
+
+static uint8_t *make_data(void) {
+	static const char *words[] = { "stream ", "window ", "inflate ", "zip ", "entry\n", "data " };
+	uint8_t *d = (uint8_t*)malloc (DATA_SIZE);
+	uint32_t seed = 7;
+	size_t i = 0;
+	while (d && i < DATA_SIZE) {
+		seed = seed * 1103515245u + 12345u;
+		const char *w = words[(seed >> 16) % 6];
+		while (*w && i < DATA_SIZE) d[i++] = (uint8_t)*w++;
+	}
+	return d;
+}
+
+static int write_archive(const uint8_t *data) {
+	int err = 0;
+	zip_t *za = zip_open (TEST_ZIP, ZIP_CREATE | ZIP_TRUNCATE, &err);
+	if (!za) {
+		return 1;
+	}
+	za->default_method = MZIP_METHOD_STORE;
+	int r = zip_file_add (za, "stored.txt", zip_source_buffer (za, data, DATA_SIZE, 0), 0) != 0;
+	za->default_method = MZIP_METHOD_DEFLATE;
+	r |= zip_file_add (za, "deflated.txt", zip_source_buffer (za, data, DATA_SIZE, 0), 0) != 1;
+	zip_close (za);
+	return r;
+}
+
+/* read the whole entry in odd-sized pieces */
+static int check_sequential(zip_t *za, zip_uint64_t index, const uint8_t *data) {
+	zip_file_t *zf = zip_fopen_index (za, index, 0);
+	if (!zf) {
+		return 1;
+	}
+	uint8_t buf[7777];
+	size_t total = 0;
+	zip_int64_t got;
+	while ((got = zip_fread (zf, buf, sizeof (buf))) > 0) {
+		if (total + (size_t)got > DATA_SIZE || memcmp (buf, data + total, (size_t)got) != 0) {
+			zip_fclose (zf);
+			return 1;
+		}
+		total += (size_t)got;
+	}
+	int r = got != 0 || total != DATA_SIZE || zip_ftell (zf) != DATA_SIZE ||
+		zip_fread (zf, buf, 1) != 0;
+	zip_fclose (zf);
+	return r;
+}
+
+static int check_seek(zip_t *za, zip_uint64_t index, const uint8_t *data) {
+	static const zip_int64_t offsets[] = { 500000, 100, 0, 65536, 599990, 32768, 1 };
+	zip_file_t *zf = zip_fopen_index (za, index, 0);
+	if (!zf) {
+		return 1;
+	}
+	uint8_t buf[1000];
+	int r = 0;
+	for (size_t i = 0; i < sizeof (offsets) / sizeof (offsets[0]) && !r; i++) {
+		zip_int64_t ofs = offsets[i];
+		size_t want = (size_t)(DATA_SIZE - ofs) < sizeof (buf) ? (size_t)(DATA_SIZE - ofs) : sizeof (buf);
+		r |= zip_fseek (zf, ofs, SEEK_SET) != 0 || zip_ftell (zf) != ofs;
+		r |= !r && (zip_fread (zf, buf, want) != (zip_int64_t)want || memcmp (buf, data + ofs, want) != 0);
+	}
+	r |= zip_fseek (zf, -10, SEEK_END) != 0 || zip_fread (zf, buf, sizeof (buf)) != 10 ||
+		memcmp (buf, data + DATA_SIZE - 10, 10) != 0;
+	r |= zip_fseek (zf, 1, SEEK_END) != -1 || zip_fseek (zf, -1, SEEK_SET) != -1;
+	zip_fclose (zf);
+	return r;
+}
+
+static int check_archive(zip_t *za, const uint8_t *data, const char *label) {
+	int r = 0;
+	for (zip_uint64_t i = 0; i < 2; i++) {
+		if (check_sequential (za, i, data)) {
+			printf("%s: sequential read of entry %d failed\n", label, (int)i);
+			r = 1;
+		}
+		if (check_seek (za, i, data)) {
+			printf("%s: seek/read of entry %d failed\n", label, (int)i);
+			r = 1;
+		}
+	}
+	if (!r) {
+		printf("%s: read tests passed\n", label);
+	}
+	return r;
+}
+
+#define N_READERS 4
+
+struct reader {
+	zip_t *za;
+	const uint8_t *data;
+	int id;
+	int failed;
+	pthread_t tid;
+};
+
+/* every reader walks both entries, starting from a different one */
+static void *reader_thread(void *arg) {
+	struct reader *rd = (struct reader*)arg;
+	zip_uint64_t first = (zip_uint64_t)rd->id & 1;
+	for (int round = 0; round < 4 && !rd->failed; round++) {
+		zip_uint64_t i = (first + (zip_uint64_t)round) & 1;
+		rd->failed |= check_sequential (rd->za, i, rd->data) || check_seek (rd->za, i, rd->data);
+	}
+	return NULL;
+}
+
+/* several threads reading through one handle */
+static int check_concurrent(zip_t *za, const uint8_t *data, const char *label) {
+	struct reader rd[N_READERS];
+	int started[N_READERS];
+	int r = 0;
+	for (int t = 0; t < N_READERS; t++) {
+		rd[t].za = za;
+		rd[t].data = data;
+		rd[t].id = t;
+		rd[t].failed = 0;
+		started[t] = pthread_create (&rd[t].tid, NULL, reader_thread, &rd[t]) == 0;
+	}
+	for (int t = 0; t < N_READERS; t++) {
+		if (!started[t]) {
+			r = 1;
+			continue;
+		}
+		pthread_join (rd[t].tid, NULL);
+		r |= rd[t].failed;
+	}
+	printf("%s: concurrent reads %s\n", label, r ? "failed" : "passed");
+	return r;
+}
+
+static int test_crc_mismatch(void) {
+	/* same-size change to the stored copy: only the CRC can notice */
+	FILE *fp = fopen (TEST_ZIP, "r+b");
+	if (!fp) {
+		return 1;
+	}
+	fseek (fp, 30 + (long)strlen ("stored.txt") + 1000, SEEK_SET);
+	fputc ('#', fp);
+	fclose (fp);
+
+	int err = 0, r = 0;
+	zip_t *za = zip_open (TEST_ZIP, ZIP_RDONLY, &err);
+	if (!za) {
+		return 1;
+	}
+	uint8_t buf[4096];
+	zip_int64_t got = 0;
+	mzip_verify_crc = 1;
+	zip_file_t *zf = zip_fopen_index (za, 0, 0);
+	while (zf && (got = zip_fread (zf, buf, sizeof (buf))) > 0) {
+	}
+	r |= !zf || got != -1;
+	zip_fclose (zf);
+	mzip_verify_crc = 0;
+	zip_close (za);
+	printf("CRC mismatch test %s\n", r ? "failed" : "passed");
+	return r;
+}
+
+/* zstd and LZMA entries stream both ways: a file source is compressed as
+ * it is read, and both it and an in-memory one decode through zf->strm */
+static int test_codec_stream(const uint8_t *data, uint16_t method, const char *what) {
+	const char *in_path = "test_fread.in";
+	FILE *fp = fopen (in_path, "wb");
+	int err = 0, r = !fp || fwrite (data, 1, DATA_SIZE, fp) != DATA_SIZE;
+	if (fp) {
+		fclose (fp);
+	}
+	zip_t *za = r ? NULL : zip_open (TEST_ZIP, ZIP_CREATE | ZIP_TRUNCATE, &err);
+	if (za) {
+		za->default_method = method;
+		r |= zip_file_add (za, "buffer.bin", zip_source_buffer (za, data, DATA_SIZE, 0), 0) != 0;
+		r |= zip_file_add (za, "file.bin", zip_source_file (za, in_path, 0, -1), 0) != 1;
+		r |= zip_close (za) != 0;
+	}
+	za = r ? NULL : zip_open (TEST_ZIP, ZIP_RDONLY, &err);
+	r |= !za || !(za->entries[1].flags & MZIP_GP_DATA_DESCRIPTOR);
+	for (int pass = 0; za && !r && pass < 2; pass++) {
+		/* the second pass hides the mapping, as in main */
+		const uint8_t *map = za->map;
+		za->map = pass ? NULL : map;
+		for (zip_uint64_t i = 0; i < 2 && !r; i++) {
+			zip_file_t *zf = zip_fopen_index (za, i, 0);
+			r |= za->entries[i].method != method || !zf || !zf->strm || zf->data;
+			zip_fclose (zf);
+			r |= r || check_sequential (za, i, data) || check_seek (za, i, data);
+		}
+		za->map = map;
+	}
+	if (za) {
+		zip_close (za);
+	}
+	unlink (in_path);
+	printf("%s streaming %s\n", what, r ? "failed" : "passed");
+	return r;
+}
+
+/* entries appended since zip_open can be read back before zip_close */
+static int test_read_appended(const uint8_t *data, int threads) {
+	int err = 0, r = 0;
+	/* 1 writes inline, 4 hands the entry to the pool writer */
+	mzip_threads = threads;
+	zip_t *za = zip_open (TEST_ZIP, ZIP_CREATE, &err);
+	if (!za) {
+		mzip_threads = 0;
+		return 1;
+	}
+	za->default_method = MZIP_METHOD_DEFLATE;
+	r |= zip_file_add (za, "appended.txt", zip_source_buffer (za, data, DATA_SIZE, 0), 0) != 2;
+	r |= r || check_sequential (za, 2, data);
+	/* the writer already knows where the data starts */
+	r |= r || za->entries[2].data_ofs != za->entries[2].local_hdr_ofs + 30 + strlen ("appended.txt");
+	r |= zip_close (za) != 0;
+	za = r ? NULL : zip_open (TEST_ZIP, ZIP_RDONLY, &err);
+	r |= !za || zip_get_num_files (za) != 3 || check_sequential (za, 2, data);
+	if (za) {
+		zip_close (za);
+	}
+	mzip_threads = 0;
+	printf("read after append (%d threads) %s\n", threads, r ? "failed" : "passed");
+	return r;
+}
+
+int main(void) {
+	int err = 0, result = 0;
+
+	printf("=== zip_fread Unit Tests ===\n");
+	uint8_t *data = make_data ();
+	if (!data || write_archive (data) != 0) {
+		printf("writing test archive failed\n");
+		free (data);
+		return 1;
+	}
+	zip_t *za = zip_open (TEST_ZIP, ZIP_RDONLY, &err);
+	if (!za) {
+		printf("zip_open failed\n");
+		result = 1;
+	} else {
+		result |= check_archive (za, data, "mapped");
+		/* the first read cached where the stored data starts */
+		if (za->entries[0].data_ofs != 30 + strlen ("stored.txt")) {
+			printf("data offset of stored.txt not cached\n");
+			result = 1;
+		}
+		result |= check_concurrent (za, data, "mapped");
+		/* hide the mapping to exercise the stdio path */
+		const uint8_t *map = za->map;
+		za->map = NULL;
+		result |= check_archive (za, data, "stdio");
+		result |= check_concurrent (za, data, "stdio");
+		za->map = map;
+		zip_close (za);
+	}
+	result |= test_crc_mismatch ();
+	result |= test_codec_stream (data, MZIP_METHOD_ZSTD, "zstd");
+	result |= test_codec_stream (data, MZIP_METHOD_LZMA, "lzma");
+	if (write_archive (data) != 0) {
+		result = 1;
+	}
+	result |= test_read_appended (data, 1);
+	if (write_archive (data) == 0) {
+		result |= test_read_appended (data, 4);
+	} else {
+		result = 1;
+	}
+	unlink (TEST_ZIP);
+	free (data);
+
+	if (result == 0) {
+		printf("All zip_fread tests passed!\n");
+	} else {
+		printf("Some zip_fread tests failed!\n");
+	}
+	return result;
+}
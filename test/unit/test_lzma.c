@@ -5,7 +5,13 @@
 
 /* Include LZMA implementation */
 #define MZIP_ENABLE_LZMA
-#include "../../src/lzma.inc.c"  /* This will include both encoder and decoder */
+#include "../../src/lib/lzma.inc.c"  /* This will include both encoder and decoder */
+#include "codec_test.inc.c"
+
+static const codec_ops lzma_ops = {
+    "LZMA", lzmaInit, lzmaCompress, lzmaEnd,
+    lzmaDecompressInit, lzmaDecompress, lzmaDecompressEnd, 0, LZMA_MAX_LEVEL
+};
 
 /* Simple test to compress and decompress data using LZMA */
 int test_lzma_compress_decompress() {
@@ -17,9 +23,6 @@ int test_lzma_compress_decompress() {
 
     /* Compress with our LZMA implementation */
     z_stream c_strm = {0};
-    c_strm.zalloc = Z_NULL;
-    c_strm.zfree = Z_NULL;
-    c_strm.opaque = Z_NULL;
 
     if (lzmaInit(&c_strm, Z_DEFAULT_COMPRESSION) != Z_OK) {
         printf("lzmaInit failed\n");
@@ -47,9 +50,6 @@ int test_lzma_compress_decompress() {
 
     /* Now decompress */
     z_stream d_strm = {0};
-    d_strm.zalloc = Z_NULL;
-    d_strm.zfree = Z_NULL;
-    d_strm.opaque = Z_NULL;
 
     if (lzmaDecompressInit(&d_strm) != Z_OK) {
         printf("lzmaDecompressInit failed\n");
@@ -115,9 +115,6 @@ int test_lzma_large_data() {
     
     /* Compress */
     z_stream c_strm = {0};
-    c_strm.zalloc = Z_NULL;
-    c_strm.zfree = Z_NULL;
-    c_strm.opaque = Z_NULL;
     
     if (lzmaInit(&c_strm, Z_DEFAULT_COMPRESSION) != Z_OK) {
         printf("lzmaInit failed\n");
@@ -150,9 +147,6 @@ int test_lzma_large_data() {
     
     /* Decompress */
     z_stream d_strm = {0};
-    d_strm.zalloc = Z_NULL;
-    d_strm.zfree = Z_NULL;
-    d_strm.opaque = Z_NULL;
     
     if (lzmaDecompressInit(&d_strm) != Z_OK) {
         printf("lzmaDecompressInit failed\n");
@@ -197,12 +191,76 @@ int test_lzma_large_data() {
     return 0;
 }
 
+/* Entry from Python's zipfile (liblzma) for reference_text(): method 14
+ * header with a 64 KiB dictionary, data ending in the end marker */
+static const uint8_t reference_stream[] = {
+	0x09, 0x04, 0x05, 0x00, 0x5d, 0x00, 0x00, 0x80, 0x00, 0x00, 0x18, 0x08,
+	0x09, 0x07, 0x31, 0xfd, 0xed, 0x80, 0xac, 0xf7, 0x37, 0x8a, 0xd0, 0xc1,
+	0xaf, 0x0c, 0xf8, 0x50, 0x59, 0x61, 0xd4, 0x25, 0xe2, 0xc8, 0x99, 0x77,
+	0xa3, 0x4e, 0x70, 0xc6, 0x6b, 0xd0, 0xc9, 0xa2, 0xdb, 0xa4, 0xe2, 0x23,
+	0x07, 0xbc, 0x15, 0xf7, 0x57, 0x64, 0x8b, 0x6e, 0xbb, 0x6a, 0xaa, 0x42,
+	0xc5, 0x2e, 0x84, 0xde, 0x65, 0xdc, 0x80, 0xfe, 0xdb, 0x4e, 0x31, 0xbd,
+	0x39, 0xd9, 0xe7, 0xbd, 0x18, 0xfb, 0xf5, 0x5e, 0xc1, 0x3a, 0x04, 0x2d,
+	0x67, 0xf0, 0x0c, 0x4c, 0x92, 0x8e, 0x6a, 0x6b, 0x47, 0x91, 0x53, 0x9d,
+	0x83, 0xe8, 0xe0, 0x49, 0x4e, 0x6d, 0x89, 0x91, 0x01, 0x58, 0x8d, 0x37,
+	0xf1, 0x5e, 0xb1, 0x05, 0xb1, 0x90, 0x4c, 0x56, 0x73, 0xd7, 0xb8, 0x68,
+	0x76, 0x98, 0x00, 0xc0, 0x24, 0x05, 0xe3, 0xb8, 0xb8, 0x5e, 0x5f, 0x07,
+	0x98, 0x0d, 0x87, 0x20, 0xf0, 0x6e, 0x23, 0x4c, 0xf8, 0xc8, 0xca, 0xcb,
+	0xfc, 0x30, 0x3d, 0x09, 0x3a, 0x1b, 0xde, 0x1d, 0x98, 0x28, 0x85, 0x42,
+	0xdd, 0xa6, 0x8f, 0xd1, 0xf1, 0x5e, 0x5d, 0x8a, 0x5f, 0xda, 0xcd, 0x33,
+	0xf0, 0x9d, 0x53, 0x25, 0xa8, 0xff, 0xb3, 0x90, 0x63, 0x4c, 0x97, 0xc9,
+	0xec, 0x3e, 0xdc, 0xdd, 0xf9, 0x26, 0x1f, 0x4a, 0xca, 0x83, 0x40, 0x1b,
+	0x93, 0x93, 0x93, 0xba, 0xdb, 0x14, 0x68, 0x91, 0xd9, 0xf1, 0xf3, 0x58,
+	0x1b, 0x12, 0x36, 0x58, 0x2a, 0x7e, 0x35, 0x2b, 0x29, 0x78, 0xab, 0xeb,
+	0x63, 0xaa, 0x54, 0xbb, 0x16, 0x46, 0xed, 0x97, 0xe6, 0x21, 0x03, 0x09,
+	0xb5, 0x43, 0x37, 0xf4, 0x71, 0x67, 0xd4, 0x7c, 0x02, 0x5f, 0x79, 0xeb,
+	0x81, 0x6d, 0xa6, 0xf5, 0x86, 0x8b, 0xde, 0xdd, 0xd6, 0xe5, 0xe1, 0xc9,
+	0xb9, 0xa6, 0x0d, 0x61, 0xe9, 0x94, 0x18, 0xcf, 0x03, 0x04, 0x2a, 0x2b,
+	0x71, 0x0e, 0x29, 0x59, 0x21, 0x0a, 0xc2, 0xa3, 0xb7, 0x00, 0x96, 0x06,
+	0x04, 0xc9, 0x25, 0xc0, 0x5c, 0xf1, 0x53, 0xff, 0x5c, 0x78, 0x54, 0xd5,
+	0x7d, 0xb9, 0x90, 0xa5, 0xae, 0xf2, 0x1f, 0xc6, 0x52, 0xe3, 0xe6, 0x51,
+	0xc3, 0xc1, 0x08, 0xf2, 0x8e, 0xe8, 0x54, 0x11, 0xd0, 0xcb, 0x80, 0x88,
+	0xa0, 0x3e, 0x1a, 0x53, 0xc6, 0xa6, 0x5f, 0x0d, 0x9c, 0xf7, 0x86, 0xe5,
+	0xc2, 0x13, 0x8d, 0xfb, 0xcd, 0x42, 0xa9, 0xbb, 0x5b, 0x47, 0x6f, 0x5f,
+	0x43, 0x29, 0x3b, 0xd7, 0xd8, 0xaf, 0x95, 0x02, 0x27, 0xe9, 0x7d, 0x76,
+	0xf6, 0x6c, 0xbe, 0xa5, 0x07, 0x8d, 0x8e, 0x55, 0x7a, 0xfd, 0xe0, 0xda,
+	0xda, 0xd0, 0xa2, 0x53, 0xb8, 0x34, 0x00, 0x27, 0xaf, 0x02, 0xab, 0x3c,
+	0xf1, 0x00, 0xac, 0x01, 0xbc, 0x80, 0xb7, 0xce, 0xba, 0x7d, 0xf0, 0xfa,
+	0xde, 0xa4, 0x96, 0x28, 0xef, 0x94, 0xc6, 0xe8, 0xe5, 0x94, 0x03, 0x32,
+	0x88, 0x4f, 0x59, 0x4b, 0x34, 0x26, 0x5b, 0x3a, 0x0c, 0x3c, 0x2d, 0xce,
+	0x55, 0xc8, 0x10, 0x5a, 0x95, 0x7b, 0xcd, 0x7a, 0xb3, 0xd2, 0x40, 0x83,
+	0xf9, 0xe5, 0x9d, 0xad, 0xde, 0x6c, 0x6b, 0x62, 0x34, 0x5a, 0x6b, 0x71,
+	0xe1, 0x68, 0x76, 0xe0, 0x3d, 0xd7, 0xe1, 0x14, 0x5c, 0x91, 0xe0, 0x76,
+	0xc1, 0x3d, 0x19, 0x76, 0x8a, 0xe6, 0xd3, 0x2e, 0x49, 0x7a, 0xc1, 0xff,
+	0x2c, 0x60, 0x2c, 0xe0, 0x21, 0x19, 0x09, 0x6e, 0x4c, 0xbc, 0x5d, 0xe1,
+	0xf8, 0x61, 0xff, 0x3d, 0x7b, 0x27, 0x00,
+};
+
+/* Entries from another encoder decode, whole or a byte at a time */
+int test_lzma_reference_stream() {
+    char want[2048];
+    size_t want_len = reference_text(want, sizeof(want));
+
+    if (codec_check_decode(&lzma_ops, reference_stream, sizeof(reference_stream), want, want_len) != 0) {
+        return 1;
+    }
+    printf("TEST PASSED: LZMA reference stream decoded.\n");
+    return 0;
+}
+
 int main(int argc, char *argv[]) {
+    (void)argc; (void)argv;
     printf("Running LZMA basic test...\n");
     int result1 = test_lzma_compress_decompress();
-    
+
     printf("\nRunning LZMA large data test...\n");
     int result2 = test_lzma_large_data();
-    
-    return (result1 || result2);
+
+    printf("\nRunning LZMA reference stream test...\n");
+    int result3 = test_lzma_reference_stream();
+
+    printf("\nRunning LZMA levels and streaming test...\n");
+    int result4 = codec_levels_streaming(&lzma_ops);
+
+    return (result1 || result2 || result3 || result4);
 }
@@ -3,9 +3,19 @@
 #include <string.h>
 #include <stdint.h>
 
+/* The round trips below also decode with zlib's uncompress(), which must
+ * not land in our inflate: give ours its own names */
+#define inflateInit2_ mzip_inflateInit2_
+#define inflateInit2  mzip_inflateInit2
+#define inflate       mzip_inflate
+#define inflateEnd    mzip_inflateEnd
+
 #define MDEFLATE_IMPLEMENTATION
 #include "../../src/lib/deflate.inc.c"
 
+/* From zlib, linked in for an independent decoder */
+int uncompress(unsigned char *dest, unsigned long *dest_len, const unsigned char *source, unsigned long source_len);
+
 
 /* Simple test to compress and decompress data using our custom deflate implementation */
 
@@ -86,8 +96,326 @@ int test_custom_compress_decompress() {
 	return 0;
 }
 
+/* Compress src at level in one call; returns the compressed size or 0 */
+static size_t compress_level(const uint8_t *src, size_t len, uint8_t *dst, size_t cap, int level) {
+	z_stream strm = {0};
+	if (deflateInit2(&strm, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+		return 0;
+	}
+	strm.next_in = (uint8_t*)src;
+	strm.avail_in = len;
+	strm.next_out = dst;
+	strm.avail_out = cap;
+	int ret = deflate(&strm, Z_FINISH);
+	size_t out = strm.total_out;
+	deflateEnd(&strm);
+	return ret == Z_STREAM_END ? out : 0;
+}
+
+/* Decode raw deflate with zlib, wrapped in a zlib header and Adler-32
+ * trailer; 0 when exactly the len bytes of want come out */
+static int zlib_check(const uint8_t *src, size_t src_len, uint8_t *dst, const uint8_t *want, size_t len) {
+	uint8_t *wrapped = malloc(src_len + 6);
+	uint32_t a = 1, b = 0;
+	if (!wrapped) {
+		return 1;
+	}
+	for (size_t i = 0; i < len; i++) {
+		a = (a + want[i]) % 65521;
+		b = (b + a) % 65521;
+	}
+	wrapped[0] = 0x78;
+	wrapped[1] = 0x01;
+	memcpy(wrapped + 2, src, src_len);
+	uint32_t adler = b << 16 | a;
+	for (int i = 0; i < 4; i++) {
+		wrapped[2 + src_len + i] = (uint8_t)(adler >> (24 - 8 * i));
+	}
+	unsigned long out = len;
+	int ret = uncompress(dst, &out, wrapped, src_len + 6);
+	free(wrapped);
+	return ret != 0 || out != len || memcmp(dst, want, len) != 0;
+}
+
+/* Every compressing level round trips text, and searching harder pays
+ * off: level 9 must come out smaller than level 1 */
+int test_levels_ratio() {
+	const size_t data_len = 200000;
+	uint8_t *data = malloc(data_len);
+	uint8_t *decompressed = malloc(data_len);
+	size_t cap = data_len + data_len / 8 + 1024;
+	uint8_t *compressed = malloc(cap);
+	size_t sizes[10] = {0};
+	int failed = 0;
+	if (!data || !decompressed || !compressed) {
+		printf("allocation failed\n");
+		free(data); free(decompressed); free(compressed);
+		return 1;
+	}
+
+	uint32_t seed = 7;
+	size_t pos = 0;
+	while (pos < data_len) {
+		char line[64];
+		seed = seed * 1103515245u + 12345u;
+		int n = snprintf(line, sizeof(line), "entry %u offset %u size %u\n",
+				(seed >> 16) % 5000, (seed >> 8) % 977, seed % 313);
+		for (int i = 0; i < n && pos < data_len; i++) {
+			data[pos++] = (uint8_t)line[i];
+		}
+	}
+
+	for (int level = 1; level <= 9 && !failed; level++) {
+		sizes[level] = compress_level(data, data_len, compressed, cap, level);
+		if (!sizes[level] || zlib_check(compressed, sizes[level], decompressed, data, data_len)) {
+			printf("ERROR: round trip failed at level %d\n", level);
+			failed = 1;
+			break;
+		}
+		printf("Level %d: %zu -> %zu bytes\n", level, data_len, sizes[level]);
+	}
+	if (!failed && sizes[9] >= sizes[1]) {
+		printf("ERROR: level 9 (%zu bytes) no smaller than level 1 (%zu bytes)\n", sizes[9], sizes[1]);
+		failed = 1;
+	}
+
+	free(data);
+	free(decompressed);
+	free(compressed);
+	if (!failed) {
+		printf("TEST PASSED: Levels 1-9 round trip, level 9 beats level 1.\n");
+	}
+	return failed;
+}
+
+/* Skewed random bytes (no useful matches, a few very common symbols) are
+ * worth a dynamic Huffman block at every level; a handful of bytes is not */
+int test_dynamic_blocks() {
+	const size_t data_len = 100000;
+	uint8_t *data = malloc(data_len);
+	uint8_t *decompressed = malloc(data_len);
+	size_t cap = data_len + data_len / 8 + 1024;
+	uint8_t *compressed = malloc(cap);
+	int failed = 0;
+	if (!data || !decompressed || !compressed) {
+		printf("allocation failed\n");
+		free(data); free(decompressed); free(compressed);
+		return 1;
+	}
+
+	uint32_t seed = 99;
+	for (size_t i = 0; i < data_len; i++) {
+		seed = seed * 1103515245u + 12345u;
+		uint32_t r = seed >> 16;
+		/* 'e' half the time, then geometrically rarer letters */
+		uint8_t c = 'e';
+		while ((r & 1) && c < 'z') {
+			c++;
+			r >>= 1;
+		}
+		data[i] = c;
+	}
+
+	for (int level = 0; level <= 9 && !failed; level++) {
+		size_t n = compress_level(data, data_len, compressed, cap, level);
+		if (!n || zlib_check(compressed, n, decompressed, data, data_len)) {
+			printf("ERROR: skewed round trip failed at level %d\n", level);
+			failed = 1;
+		} else if (level > 0 && (compressed[0] >> 1 & 3) != 2) {
+			printf("ERROR: level %d chose block type %d, not dynamic\n", level, compressed[0] >> 1 & 3);
+			failed = 1;
+		}
+	}
+
+	const uint8_t tiny[] = "abcabd";
+	size_t n = compress_level(tiny, sizeof(tiny) - 1, compressed, cap, 6);
+	if (!failed && (!n || (compressed[0] >> 1 & 3) != 1)) {
+		printf("ERROR: tiny input did not get a fixed block\n");
+		failed = 1;
+	}
+
+	free(data);
+	free(decompressed);
+	free(compressed);
+	if (!failed) {
+		printf("TEST PASSED: Dynamic blocks on skewed input.\n");
+	}
+	return failed;
+}
+
+/* Words from a small vocabulary with some noise: compressible, but not trivially */
+static void fill_words(uint8_t *data, size_t data_len) {
+	static const char *words[] = { "zip ", "deflate ", "archive ", "entry ", "header ", "\n", "crc32 ", "huffman " };
+	uint32_t seed = 12345;
+	size_t pos = 0;
+	while (pos < data_len) {
+		seed = seed * 1103515245u + 12345u;
+		const char *w = words[(seed >> 16) & 7];
+		size_t wl = strlen(w);
+		if (seed & 0x100) {
+			data[pos++] = (uint8_t)(seed >> 24);
+			continue;
+		}
+		for (size_t i = 0; i < wl && pos < data_len; i++) {
+			data[pos++] = (uint8_t)w[i];
+		}
+	}
+}
+
+/* Round-trip a multi-block input through every level, decoding with small
+ * input and output chunks to exercise both the fast and the resumable path */
+int test_large_roundtrip() {
+	const size_t data_len = 300000;
+	uint8_t *data = malloc(data_len);
+	uint8_t *decompressed = malloc(data_len);
+	size_t cap = compressBound(data_len);
+	uint8_t *compressed = malloc(cap);
+	int failed = 0;
+	if (!data || !decompressed || !compressed) {
+		printf("allocation failed\n");
+		free(data); free(decompressed); free(compressed);
+		return 1;
+	}
+
+	fill_words(data, data_len);
+
+	for (int level = 0; level <= 9 && !failed; level++) {
+		z_stream c_strm = {0};
+		if (deflateInit2(&c_strm, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+			printf("deflateInit2 failed at level %d\n", level);
+			failed = 1;
+			break;
+		}
+		c_strm.next_in = data;
+		c_strm.avail_in = data_len;
+		c_strm.next_out = compressed;
+		c_strm.avail_out = cap;
+		int ret = deflate(&c_strm, Z_FINISH);
+		size_t compressed_len = c_strm.total_out;
+		deflateEnd(&c_strm);
+		if (ret != Z_STREAM_END) {
+			printf("deflate failed at level %d: %d\n", level, ret);
+			failed = 1;
+			break;
+		}
+
+		z_stream d_strm = {0};
+		inflateInit2(&d_strm, -MAX_WBITS);
+		size_t in_pos = 0, out_pos = 0;
+		do {
+			size_t in_chunk = compressed_len - in_pos < 1000 ? compressed_len - in_pos : 1000;
+			size_t out_chunk = data_len - out_pos < 777 ? data_len - out_pos : 777;
+			d_strm.next_in = compressed + in_pos;
+			d_strm.avail_in = in_chunk;
+			d_strm.next_out = decompressed + out_pos;
+			d_strm.avail_out = out_chunk;
+			ret = inflate(&d_strm, Z_NO_FLUSH);
+			in_pos += in_chunk - d_strm.avail_in;
+			out_pos += out_chunk - d_strm.avail_out;
+		} while (ret == Z_OK);
+		inflateEnd(&d_strm);
+
+		printf("Level %d: %zu -> %zu bytes\n", level, data_len, compressed_len);
+		if (ret != Z_STREAM_END || out_pos != data_len || memcmp(decompressed, data, data_len) != 0) {
+			printf("ERROR: round trip failed at level %d (ret %d, %zu bytes)\n", level, ret, out_pos);
+			failed = 1;
+		}
+	}
+
+	free(data);
+	free(decompressed);
+	free(compressed);
+	if (!failed) {
+		printf("TEST PASSED: Multi-block round trip successful.\n");
+	}
+	return failed;
+}
+
+/* Compress independent pieces, each primed with the 32 KiB before it and
+ * sync-flushed except the last, the way block-parallel deflate does; the
+ * concatenation must inflate as one stream */
+int test_dictionary_pieces() {
+	const size_t data_len = 300000, piece = 50000;
+	uint8_t *data = malloc(data_len);
+	uint8_t *decompressed = malloc(data_len);
+	size_t cap = compressBound(data_len) + 64;
+	uint8_t *compressed = malloc(cap);
+	size_t total = 0, plain_total = 0;
+	int failed = 0;
+	if (!data || !decompressed || !compressed) {
+		printf("allocation failed\n");
+		free(data); free(decompressed); free(compressed);
+		return 1;
+	}
+	fill_words(data, data_len);
+
+	for (size_t pos = 0; pos < data_len && !failed; pos += piece) {
+		int last = pos + piece >= data_len;
+		size_t dict = pos < 32768 ? pos : 32768;
+		for (int primed = 0; primed <= 1; primed++) {
+			z_stream c_strm = {0};
+			deflateInit2(&c_strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+			if (primed && dict && deflateSetDictionary(&c_strm, data + pos - dict, dict) != Z_OK) {
+				printf("deflateSetDictionary failed\n");
+				failed = 1;
+			}
+			c_strm.next_in = data + pos;
+			c_strm.avail_in = piece;
+			c_strm.next_out = compressed + total;
+			c_strm.avail_out = cap - total;
+			int ret = deflate(&c_strm, last ? Z_FINISH : Z_SYNC_FLUSH);
+			if (ret != (last ? Z_STREAM_END : Z_OK) || c_strm.avail_in != 0) {
+				printf("deflate of piece at %zu failed: %d\n", pos, ret);
+				failed = 1;
+			}
+			/* too late for a dictionary once data went in */
+			if (deflateSetDictionary(&c_strm, data, 16) != Z_STREAM_ERROR) {
+				printf("deflateSetDictionary accepted after deflate\n");
+				failed = 1;
+			}
+			if (primed) {
+				total += c_strm.total_out;
+			} else {
+				plain_total += c_strm.total_out;
+			}
+			deflateEnd(&c_strm);
+		}
+	}
+
+	z_stream d_strm = {0};
+	inflateInit2(&d_strm, -MAX_WBITS);
+	d_strm.next_in = compressed;
+	d_strm.avail_in = total;
+	d_strm.next_out = decompressed;
+	d_strm.avail_out = data_len;
+	int ret = inflate(&d_strm, Z_FINISH);
+	inflateEnd(&d_strm);
+
+	printf("Pieces: %zu -> %zu bytes primed, %zu unprimed\n", data_len, total, plain_total);
+	if (!failed && (ret != Z_STREAM_END || d_strm.total_out != data_len ||
+			memcmp(decompressed, data, data_len) != 0)) {
+		printf("ERROR: concatenated pieces did not inflate back (ret %d)\n", ret);
+		failed = 1;
+	}
+	if (!failed && total >= plain_total) {
+		printf("ERROR: the dictionary did not help\n");
+		failed = 1;
+	}
+	free(data);
+	free(decompressed);
+	free(compressed);
+	if (!failed) {
+		printf("TEST PASSED: Dictionary-primed pieces join into one stream.\n");
+	}
+	return failed;
+}
+
 int main(void) {
 	printf("Running custom deflate compression test...\n");
 	int result = test_custom_compress_decompress();
+	result |= test_levels_ratio();
+	result |= test_dynamic_blocks();
+	result |= test_large_roundtrip();
+	result |= test_dictionary_pieces();
 	return result;
 }
@@ -0,0 +1,102 @@
+/* Include the library itself to reach the name index */
+#include "../../src/lib/mzip.c"
+
+#define TEST_ZIP "test_name_locate.zip"
+#define N_NAMES 3000
+
+static int check_all(zip_t *za, const char *label) {
+	char name[64], upper[64];
+	for (int i = 0; i < N_NAMES; i++) {
+		snprintf (name, sizeof (name), "dir%d/File_%d.txt", i % 7, i);
+		snprintf (upper, sizeof (upper), "DIR%d/FILE_%d.TXT", i % 7, i);
+		if (zip_name_locate (za, name, 0) != i) {
+			printf("%s: exact lookup of %s failed\n", label, name);
+			return 1;
+		}
+		const char *stored = zip_get_name (za, (zip_uint64_t)i, 0);
+		if (!stored || strcmp (stored, name) != 0) {
+			printf("%s: name of entry %d is not %s\n", label, i, name);
+			return 1;
+		}
+		if (zip_name_locate (za, upper, 0) != -1) {
+			printf("%s: case-sensitive lookup of %s matched\n", label, upper);
+			return 1;
+		}
+		if (zip_name_locate (za, upper, ZIP_FL_NOCASE) != i) {
+			printf("%s: nocase lookup of %s failed\n", label, upper);
+			return 1;
+		}
+	}
+	if (zip_get_name (za, zip_get_num_files (za), 0) != NULL) {
+		printf("%s: name of an entry past the end\n", label);
+		return 1;
+	}
+	if (zip_name_locate (za, "missing.txt", 0) != -1 ||
+	    zip_name_locate (za, "dir0/File_0.tx", ZIP_FL_NOCASE) != -1) {
+		printf("%s: lookup of a missing name matched\n", label);
+		return 1;
+	}
+	/* a duplicate name resolves to the first entry carrying it */
+	if (zip_name_locate (za, "dup", 0) != N_NAMES ||
+	    zip_name_locate (za, "DUP", ZIP_FL_NOCASE) != N_NAMES) {
+		printf("%s: duplicate name did not resolve to the first entry\n", label);
+		return 1;
+	}
+	printf("%s: lookups passed\n", label);
+	return 0;
+}
+
+static int add(zip_t *za, const char *name) {
+	zip_source_t *src = zip_source_buffer (za, name, strlen (name), 0);
+	return zip_file_add (za, name, src, 0) < 0;
+}
+
+int main(void) {
+	char name[64];
+	int err = 0, result = 0;
+
+	printf("=== zip_name_locate Unit Tests ===\n");
+	zip_t *za = zip_open (TEST_ZIP, ZIP_CREATE | ZIP_TRUNCATE, &err);
+	if (!za) {
+		printf("zip_open failed\n");
+		return 1;
+	}
+	/* look up early so the index exists and must follow zip_file_add */
+	if (zip_name_locate (za, "dir0/File_0.txt", ZIP_FL_NOCASE) != -1) {
+		result = 1;
+	}
+	for (int i = 0; i < N_NAMES && !result; i++) {
+		snprintf (name, sizeof (name), "dir%d/File_%d.txt", i % 7, i);
+		result |= add (za, name);
+		if (zip_name_locate (za, name, 0) != i) {
+			printf("lookup right after adding %s failed\n", name);
+			result = 1;
+		}
+	}
+	result |= add (za, "dup");
+	result |= add (za, "DUP");
+	result |= add (za, "dup");
+	if (!result) {
+		result |= check_all (za, "write mode");
+	}
+	zip_close (za);
+
+	if (!result) {
+		za = zip_open (TEST_ZIP, ZIP_RDONLY, &err);
+		if (!za) {
+			printf("reopen failed\n");
+			result = 1;
+		} else {
+			result |= check_all (za, "read mode");
+			zip_close (za);
+		}
+	}
+	unlink (TEST_ZIP);
+
+	if (result == 0) {
+		printf("All zip_name_locate tests passed!\n");
+	} else {
+		printf("Some zip_name_locate tests failed!\n");
+	}
+	return result;
+}
@@ -0,0 +1,275 @@
+/* Include the library itself to reach the compression pool */
+#include "../../src/lib/mzip.c"
+
+#define TEST_ZIP "test_pool.zip"
+#define TEST_SRC "test_pool.src"
+#define N_ENTRIES 400
+
+/* entry i holds i * 37 bytes of a pattern, compressible but not trivially */
+static size_t make_data(int i, uint8_t *buf) {
+	size_t len = (size_t)i * 37;
+	uint32_t x = (uint32_t)i * 2654435761u;
+	for (size_t j = 0; j < len; j++) {
+		x = x * 1103515245u + 12345u;
+		buf[j] = (uint8_t)('a' + (x >> 16) % 8);
+	}
+	return len;
+}
+
+static int check_archive(void) {
+	uint8_t *want = (uint8_t*)malloc (N_ENTRIES * 37);
+	uint8_t *got = (uint8_t*)malloc (N_ENTRIES * 37 + 1);
+	char name[32];
+	int err = 0, result = 0;
+
+	zip_t *za = zip_open (TEST_ZIP, ZIP_RDONLY, &err);
+	if (!za || !want || !got) {
+		printf("reopen failed\n");
+		result = 1;
+		goto out;
+	}
+	if (zip_get_num_files (za) != N_ENTRIES + 1) {
+		printf("expected %d entries, got %llu\n", N_ENTRIES + 1,
+			(unsigned long long)zip_get_num_files (za));
+		result = 1;
+		goto out;
+	}
+	uint64_t last_ofs = 0;
+	for (int i = 0; i <= N_ENTRIES; i++) {
+		struct mzip_entry *e = &za->entries[i];
+		if (i > 0 && e->local_hdr_ofs <= last_ofs) {
+			printf("entry %d written out of order\n", i);
+			result = 1;
+			break;
+		}
+		last_ofs = e->local_hdr_ofs;
+		size_t len;
+		if (i == N_ENTRIES / 2) {
+			/* the streamed file source, written between pooled entries */
+			snprintf (name, sizeof (name), "streamed");
+			len = make_data (N_ENTRIES, want);
+		} else {
+			snprintf (name, sizeof (name), "entry%d", i);
+			len = make_data (i, want);
+		}
+		if (zip_name_locate (za, name, 0) != i) {
+			printf("%s is not entry %d\n", name, i);
+			result = 1;
+			break;
+		}
+		zip_file_t *zf = zip_fopen_index (za, (zip_uint64_t)i, 0);
+		zip_int64_t n = zf ? zip_fread (zf, got, N_ENTRIES * 37 + 1) : -1;
+		if (zf) zip_fclose (zf);
+		if (n != (zip_int64_t)len || memcmp (got, want, len) != 0) {
+			printf("content of %s differs\n", name);
+			result = 1;
+			break;
+		}
+	}
+out:
+	if (za) zip_close (za);
+	free (want);
+	free (got);
+	return result;
+}
+
+/* Entries past MZIP_PAR_DEFLATE_MIN are deflated in parallel chunks, both
+ * from memory and streamed from a file over several batches */
+static int test_parallel_deflate(void) {
+	const size_t mem_len = 5u << 20, file_len = 9u << 20 | 12345;
+	uint8_t *buf = (uint8_t*)malloc (file_len);
+	uint8_t *got = (uint8_t*)malloc (file_len);
+	int err = 0, result = 0;
+	if (!buf || !got) {
+		free (buf);
+		free (got);
+		return 1;
+	}
+	/* text-like with some runs, so every chunk compresses */
+	uint32_t x = 7;
+	for (size_t j = 0; j < file_len; j++) {
+		x = x * 1103515245u + 12345u;
+		buf[j] = (x >> 20) & 1 ? buf[j > 300 ? j - 300 : 0] : (uint8_t)('a' + (x >> 16) % 16);
+	}
+	FILE *fp = fopen (TEST_SRC, "wb");
+	if (!fp || fwrite (buf, 1, file_len, fp) != file_len) {
+		printf("setup failed\n");
+		result = 1;
+	}
+	if (fp) fclose (fp);
+
+	zip_t *za = result ? NULL : zip_open (TEST_ZIP, ZIP_CREATE | ZIP_TRUNCATE, &err);
+	if (za) {
+		za->default_method = MZIP_METHOD_DEFLATE;
+		result |= zip_file_add (za, "mem", zip_source_buffer (za, buf, mem_len, 0), 0) != 0;
+		result |= zip_file_add (za, "file", zip_source_file (za, TEST_SRC, 0, -1), 0) != 1;
+		result |= zip_close (za) != 0;
+	} else {
+		result = 1;
+	}
+	za = result ? NULL : zip_open (TEST_ZIP, ZIP_RDONLY, &err);
+	for (int i = 0; za && i < 2; i++) {
+		size_t len = i ? file_len : mem_len;
+		struct mzip_entry *e = &za->entries[i];
+		zip_file_t *zf = zip_fopen_index (za, (zip_uint64_t)i, 0);
+		zip_int64_t n = zf ? zip_fread (zf, got, file_len) : -1;
+		if (zf) zip_fclose (zf);
+		if (e->method != MZIP_METHOD_DEFLATE || e->comp_size >= len
+				|| n != (zip_int64_t)len || memcmp (got, buf, len) != 0) {
+			printf("parallel deflate of %s failed\n", zip_get_name (za, (zip_uint64_t)i, 0));
+			result = 1;
+		}
+	}
+	if (za) {
+		zip_close (za);
+	} else {
+		result = 1;
+	}
+	unlink (TEST_ZIP);
+	unlink (TEST_SRC);
+	free (buf);
+	free (got);
+	if (!result) {
+		printf("parallel deflate: passed\n");
+	}
+	return result;
+}
+
+/* a batch mixes methods and sources and lands in order after the
+ * entries added one by one; a bad item stops it */
+static int test_batch_add(void) {
+	enum { N_BATCH = 300 };
+	static uint8_t bufs[N_BATCH][N_BATCH / 2 * 37];
+	zip_batch_entry_t files[N_BATCH + 1];
+	char names[N_BATCH][32];
+	int err = 0, result = 0;
+
+	zip_t *za = zip_open (TEST_ZIP, ZIP_CREATE | ZIP_TRUNCATE, &err);
+	if (!za) {
+		return 1;
+	}
+	result |= zip_file_add (za, "first", zip_source_buffer (za, "x", 1, 0), 0) != 0;
+	for (int i = 0; i < N_BATCH; i++) {
+		size_t len = make_data (i % (N_BATCH / 2), bufs[i]);
+		snprintf (names[i], sizeof (names[i]), "batch%d", i);
+		files[i].name = names[i];
+		files[i].source = zip_source_buffer (za, bufs[i], len, 0);
+		files[i].method = i % 3 == 0 ? -1 : i % 3 == 1 ? MZIP_METHOD_STORE : MZIP_METHOD_DEFLATE;
+	}
+	/* an unsupported method stops the batch before it */
+	files[N_BATCH].name = "bad";
+	files[N_BATCH].source = zip_source_buffer (za, "y", 1, 0);
+	files[N_BATCH].method = 12345;
+	if (zip_files_add_batch (za, files, N_BATCH + 1, 0) != N_BATCH
+			|| za->entries_cap < N_BATCH + 1) {
+		printf("batch add did not stop at the bad item\n");
+		result = 1;
+	}
+	/* the failed item's source is still ours */
+	zip_source_free (files[N_BATCH].source);
+	result |= zip_files_add_batch (za, NULL, 0, 0) != 0;
+	result |= zip_close (za) != 0;
+
+	uint8_t want[N_BATCH / 2 * 37], got[N_BATCH / 2 * 37 + 1];
+	za = result ? NULL : zip_open (TEST_ZIP, ZIP_RDONLY, &err);
+	if (!za || zip_get_num_files (za) != N_BATCH + 1) {
+		result = 1;
+	}
+	for (int i = 0; za && !result && i < N_BATCH; i++) {
+		struct mzip_entry *e = &za->entries[i + 1];
+		size_t len = make_data (i % (N_BATCH / 2), want);
+		zip_file_t *zf = zip_fopen_index (za, (zip_uint64_t)i + 1, 0);
+		zip_int64_t n = zf ? zip_fread (zf, got, sizeof (got)) : -1;
+		if (zf) zip_fclose (zf);
+		if (strcmp (zip_get_name (za, (zip_uint64_t)i + 1, 0), names[i]) != 0
+				|| (i % 3 == 1 && e->method != MZIP_METHOD_STORE)
+				|| e->file_time != za->entries[1].file_time
+				|| n != (zip_int64_t)len || memcmp (got, want, len) != 0) {
+			printf("batch entry %s differs\n", names[i]);
+			result = 1;
+		}
+	}
+	if (za) {
+		zip_close (za);
+	}
+	unlink (TEST_ZIP);
+	if (!result) {
+		printf("batch add: passed\n");
+	}
+	return result;
+}
+
+int main(void) {
+	uint8_t *buf = (uint8_t*)malloc (N_ENTRIES * 37);
+	char name[32];
+	int err = 0, result = 0;
+
+	printf("=== Compression Pool Unit Tests ===\n");
+	mzip_threads = 4;
+
+	/* file source for the entry added in the middle */
+	FILE *fp = fopen (TEST_SRC, "wb");
+	if (!buf || !fp) {
+		printf("setup failed\n");
+		return 1;
+	}
+	fwrite (buf, 1, make_data (N_ENTRIES, buf), fp);
+	fclose (fp);
+
+	zip_t *za = zip_open (TEST_ZIP, ZIP_CREATE | ZIP_TRUNCATE, &err);
+	if (!za) {
+		printf("zip_open failed\n");
+		return 1;
+	}
+	za->default_method = MZIP_METHOD_DEFLATE;
+	for (int i = 0; i < N_ENTRIES && !result; i++) {
+		zip_source_t *src;
+		if (i == N_ENTRIES / 2) {
+			src = zip_source_file (za, TEST_SRC, 0, -1);
+			result |= zip_file_add (za, "streamed", src, 0) != i;
+			continue;
+		}
+		size_t len = make_data (i, buf);
+		snprintf (name, sizeof (name), "entry%d", i);
+		if (i % 2) {
+			/* caller keeps the buffer and overwrites it right away */
+			src = zip_source_buffer (za, buf, len, 0);
+		} else {
+			uint8_t *copy = (uint8_t*)malloc (len ? len : 1);
+			memcpy (copy, buf, len);
+			src = zip_source_buffer (za, copy, len, 1);
+		}
+		if (zip_file_add (za, name, src, 0) != i) {
+			printf("adding %s failed\n", name);
+			result = 1;
+		}
+		memset (buf, 0, len);
+	}
+	if (!result && !za->pool) {
+		printf("compression pool did not start\n");
+		result = 1;
+	}
+	/* one more after the streamed entry, so the pool restarts work */
+	size_t len = make_data (N_ENTRIES, buf);
+	result |= zip_file_add (za, "entry400", zip_source_buffer (za, buf, len, 0), 0) != N_ENTRIES;
+	if (zip_close (za) != 0) {
+		printf("zip_close failed\n");
+		result = 1;
+	}
+	free (buf);
+
+	if (!result) {
+		result = check_archive ();
+	}
+	unlink (TEST_ZIP);
+	unlink (TEST_SRC);
+	result |= test_parallel_deflate ();
+	result |= test_batch_add ();
+
+	if (result == 0) {
+		printf("All compression pool tests passed!\n");
+	} else {
+		printf("Some compression pool tests failed!\n");
+	}
+	return result;
+}
@@ -0,0 +1,114 @@
+/* Include the library itself */
+#include "../../src/lib/mzip.c"
+
+#define TEST_ZIP "test_view.zip"
+
+static const char stored_data[] = "stored entry: served straight from the mapping";
+
+static int write_archive(void) {
+	int err = 0;
+	char text[4096];
+	for (size_t i = 0; i < sizeof (text); i++) text[i] = "abcabcabd"[i % 9];
+
+	zip_t *za = zip_open (TEST_ZIP, ZIP_CREATE | ZIP_TRUNCATE, &err);
+	if (!za) {
+		return 1;
+	}
+	za->default_method = MZIP_METHOD_STORE;
+	int r = zip_file_add (za, "stored.txt",
+		zip_source_buffer (za, stored_data, strlen (stored_data), 0), 0) != 0;
+	za->default_method = MZIP_METHOD_DEFLATE;
+	r |= zip_file_add (za, "deflated.txt", zip_source_buffer (za, text, sizeof (text), 0), 0) != 1;
+	/* write-mode archives are not mapped */
+	const uint8_t *data;
+	zip_uint64_t size;
+	r |= zip_fopen_index_view (za, 0, 0, &data, &size) != -1;
+	zip_close (za);
+	return r;
+}
+
+static int test_view(void) {
+	int err = 0;
+	const uint8_t *data = NULL;
+	zip_uint64_t size = 0;
+	zip_t *za = zip_open (TEST_ZIP, ZIP_RDONLY, &err);
+	if (!za) {
+		printf("zip_open failed\n");
+		return 1;
+	}
+	if (!za->map) {
+		printf("archive not mapped, skipping view test\n");
+		zip_close (za);
+		return 0;
+	}
+	int r = 0;
+	if (zip_fopen_index_view (za, 0, MZIP_FL_VERIFY_CRC, &data, &size) != 0 ||
+	    size != strlen (stored_data) || memcmp (data, stored_data, size) != 0) {
+		printf("view of stored entry failed\n");
+		r = 1;
+	}
+	if (data < za->map || data + size > za->map + za->size) {
+		printf("view does not point into the mapping\n");
+		r = 1;
+	}
+	if (zip_fopen_index_view (za, 1, 0, &data, &size) != -1) {
+		printf("view of deflated entry should fail\n");
+		r = 1;
+	}
+	if (zip_fopen_index_view (za, 2, 0, &data, &size) != -1) {
+		printf("view of out-of-range index should fail\n");
+		r = 1;
+	}
+	zip_close (za);
+	if (r == 0) {
+		printf("View test passed\n");
+	}
+	return r;
+}
+
+static int test_view_crc(void) {
+	/* flip a byte of the stored data: only a verified view notices */
+	FILE *fp = fopen (TEST_ZIP, "r+b");
+	if (!fp) {
+		return 1;
+	}
+	fseek (fp, 30 + (long)strlen ("stored.txt") + 3, SEEK_SET);
+	fputc ('#', fp);
+	fclose (fp);
+
+	int err = 0, r = 0;
+	const uint8_t *data;
+	zip_uint64_t size;
+	zip_t *za = zip_open (TEST_ZIP, ZIP_RDONLY, &err);
+	if (!za) {
+		return 1;
+	}
+	if (za->map) {
+		r |= zip_fopen_index_view (za, 0, 0, &data, &size) != 0;
+		r |= zip_fopen_index_view (za, 0, MZIP_FL_VERIFY_CRC, &data, &size) != -1;
+	}
+	zip_close (za);
+	printf("View CRC test %s\n", r ? "failed" : "passed");
+	return r;
+}
+
+int main(void) {
+	int result = 0;
+
+	printf("=== zip_fopen_index_view Unit Tests ===\n");
+	if (write_archive () != 0) {
+		printf("writing test archive failed\n");
+		unlink (TEST_ZIP);
+		return 1;
+	}
+	result |= test_view ();
+	result |= test_view_crc ();
+	unlink (TEST_ZIP);
+
+	if (result == 0) {
+		printf("All zip_fopen_index_view tests passed!\n");
+	} else {
+		printf("Some zip_fopen_index_view tests failed!\n");
+	}
+	return result;
+}
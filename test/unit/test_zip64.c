@@ -0,0 +1,200 @@
+/* Include the library itself to reach the header writers */
+#include "../../src/lib/mzip.c"
+
+#define TEST_ZIP "test_zip64.zip"
+#define N_ENTRIES 70000
+
+/* more entries than the classic end of central directory can count */
+static int test_many_entries(void) {
+	char name[32];
+	int err = 0;
+
+	zip_t *za = zip_open (TEST_ZIP, ZIP_CREATE | ZIP_TRUNCATE, &err);
+	if (!za) {
+		printf("zip_open failed\n");
+		return 1;
+	}
+	for (int i = 0; i < N_ENTRIES; i++) {
+		snprintf (name, sizeof (name), "f%d", i);
+		zip_source_t *src = zip_source_buffer (za, name, strlen (name), 0);
+		if (zip_file_add (za, name, src, 0) != i) {
+			printf("adding %s failed\n", name);
+			zip_close (za);
+			return 1;
+		}
+	}
+	zip_close (za);
+
+	/* the classic record must be saturated and preceded by the locator */
+	FILE *fp = fopen (TEST_ZIP, "rb");
+	uint8_t tail[22 + MZIP_ZIP64_LOCATOR_SIZE];
+	if (!fp || fseek (fp, -(long)sizeof (tail), SEEK_END) != 0
+			|| fread (tail, 1, sizeof (tail), fp) != sizeof (tail)) {
+		printf("cannot read archive tail\n");
+		if (fp) fclose (fp);
+		return 1;
+	}
+	fclose (fp);
+	if (mzip_rd32 (tail) != MZIP_SIG_ZIP64_LOCATOR
+			|| mzip_rd32 (tail + 20) != MZIP_SIG_EOCD
+			|| mzip_rd16 (tail + 20 + 10) != 0xFFFF) {
+		printf("ZIP64 end of central directory missing\n");
+		return 1;
+	}
+
+	za = zip_open (TEST_ZIP, ZIP_RDONLY, &err);
+	if (!za) {
+		printf("reopen failed\n");
+		return 1;
+	}
+	int result = 0;
+	if (zip_get_num_files (za) != N_ENTRIES) {
+		printf("expected %d entries, got %llu\n", N_ENTRIES,
+			(unsigned long long)zip_get_num_files (za));
+		result = 1;
+	}
+	zip_int64_t idx = zip_name_locate (za, "f69999", 0);
+	if (idx != N_ENTRIES - 1) {
+		printf("locating the last entry failed\n");
+		result = 1;
+	} else {
+		char buf[16];
+		zip_file_t *zf = zip_fopen_index (za, (zip_uint64_t)idx, 0);
+		zip_int64_t n = zf ? zip_fread (zf, buf, sizeof (buf)) : -1;
+		if (n != 6 || memcmp (buf, "f69999", 6) != 0) {
+			printf("reading the last entry failed\n");
+			result = 1;
+		}
+		if (zf) zip_fclose (zf);
+	}
+	zip_close (za);
+	unlink (TEST_ZIP);
+	if (!result) {
+		printf("many entries: passed\n");
+	}
+	return result;
+}
+
+/* 64-bit sizes and offset survive a central header round trip */
+static int test_central_extra(void) {
+	const uint64_t comp = 0x123456789ull, uncomp = 0x1FFFFFFFFull, ofs = 0x100000000ull;
+	uint8_t buf[MZIP_CDH_MAX (3)];
+	uint32_t n = mzip_put_central_header (buf, "big", 3, 0, MZIP_METHOD_DEFLATE,
+		comp, uncomp, 0xdeadbeef, ofs, 0, 0, 0);
+	if (n != 46 + 3 + 28) {
+		printf("central header write failed\n");
+		return 1;
+	}
+
+	struct mzip_entry e = {0};
+	uint16_t name_len = mzip_rd16 (buf + 28);
+	uint16_t extra_len = mzip_rd16 (buf + 30);
+	e.comp_size = mzip_rd32 (buf + 20);
+	e.uncomp_size = mzip_rd32 (buf + 24);
+	e.local_hdr_ofs = mzip_rd32 (buf + 42);
+	if (mzip_rd16 (buf + 6) != MZIP_ZIP64_VERSION || extra_len != 28
+			|| e.comp_size != 0xFFFFFFFFu || e.local_hdr_ofs != 0xFFFFFFFFu
+			|| mzip_parse_zip64_extra (&e, buf + 46 + name_len, extra_len) != 0
+			|| e.comp_size != comp || e.uncomp_size != uncomp || e.local_hdr_ofs != ofs) {
+		printf("central header ZIP64 extra mismatch\n");
+		return 1;
+	}
+	printf("central header extra: passed\n");
+	return 0;
+}
+
+/* Write n bytes to TEST_ZIP; returns 0 on success */
+static int write_archive(const uint8_t *buf, size_t n) {
+	FILE *fp = fopen (TEST_ZIP, "wb");
+	if (!fp) {
+		return -1;
+	}
+	size_t w = fwrite (buf, 1, n, fp);
+	fclose (fp);
+	return w == n ? 0 : -1;
+}
+
+/* A local header offset near UINT64_MAX in the ZIP64 extra is rejected
+ * instead of wrapping past the end of the file */
+static int test_huge_local_offset(void) {
+	uint8_t buf[256];
+	uint32_t n = mzip_put_local_header (buf, "a", 1, 0, MZIP_METHOD_STORE,
+		1, 1, mzip_crc32 (0, (const uint8_t*)"x", 1), 0, 0, 0);
+	buf[n++] = 'x';
+	uint64_t cd_ofs = n;
+	uint32_t cd = mzip_put_central_header (buf + n, "a", 1, 0, MZIP_METHOD_STORE,
+		1, 1, mzip_crc32 (0, (const uint8_t*)"x", 1), 0xFFFFFFFFFFFFFFF0ull, 0, 0, 0);
+	n += cd;
+	n += mzip_put_end_of_central_directory (buf + n, 1, cd, cd_ofs);
+	if (write_archive (buf, n) != 0) {
+		printf("cannot write archive\n");
+		return 1;
+	}
+
+	int err = 0, result = 0;
+	zip_t *za = zip_open (TEST_ZIP, ZIP_RDONLY, &err);
+	if (za) {
+		uint8_t *data = NULL;
+		uint32_t sz = 0;
+		zip_file_t *zf = zip_fopen_index (za, 0, 0);
+		if (zf || mzip_extract_entry (za, &za->entries[0], &data, &sz) == 0) {
+			printf("entry with a wrapping local header offset was opened\n");
+			result = 1;
+		}
+		if (zf) zip_fclose (zf);
+		free (data);
+		zip_close (za);
+	}
+	unlink (TEST_ZIP);
+	if (!result) {
+		printf("huge local header offset: passed\n");
+	}
+	return result;
+}
+
+/* A ZIP64 locator pointing near UINT64_MAX is not followed */
+static int test_huge_record_offset(void) {
+	uint8_t buf[MZIP_ZIP64_EOCD_SIZE + MZIP_ZIP64_LOCATOR_SIZE + 22];
+	uint32_t n = mzip_put_end_of_central_directory (buf, 0x10000, 0, 0);
+	if (n != sizeof (buf)) {
+		printf("ZIP64 end of central directory not written\n");
+		return 1;
+	}
+	mzip_write_le64 (buf + MZIP_ZIP64_EOCD_SIZE + 8, 0xFFFFFFFFFFFFFFF0ull);
+	if (write_archive (buf, n) != 0) {
+		printf("cannot write archive\n");
+		return 1;
+	}
+
+	int err = 0, result = 0;
+	zip_t *za = zip_open (TEST_ZIP, ZIP_RDONLY, &err);
+	if (za) {
+		if (zip_get_num_files (za) != 0) {
+			printf("entries read through a wrapping ZIP64 record offset\n");
+			result = 1;
+		}
+		zip_close (za);
+	}
+	unlink (TEST_ZIP);
+	if (!result) {
+		printf("huge ZIP64 record offset: passed\n");
+	}
+	return result;
+}
+
+int main(void) {
+	int result = 0;
+
+	printf("=== ZIP64 Unit Tests ===\n");
+	result |= test_central_extra ();
+	result |= test_many_entries ();
+	result |= test_huge_local_offset ();
+	result |= test_huge_record_offset ();
+
+	if (result == 0) {
+		printf("All ZIP64 tests passed!\n");
+	} else {
+		printf("Some ZIP64 tests failed!\n");
+	}
+	return result;
+}
@@ -6,6 +6,12 @@
 /* Include ZSTD implementation */
 #define MZIP_ENABLE_ZSTD
 #include "../../src/lib/zstd.inc.c"
+#include "codec_test.inc.c"
+
+static const codec_ops zstd_ops = {
+    "ZSTD", zstdInit, zstdCompress, zstdEnd,
+    zstdDecompressInit, zstdDecompress, zstdDecompressEnd, 1, ZSTD_MAX_CLEVEL
+};
 
 /* Simple test to compress and decompress data using ZSTD */
 int test_zstd_compress_decompress() {
@@ -184,6 +190,80 @@ int test_zstd_large_data() {
     return 0;
 }
 
+/* Frame from the reference zstd -19 for reference_text(): 4-stream
+ * Huffman literals and FSE-coded sequences */
+static const uint8_t reference_frame[] = {
+	0x28, 0xb5, 0x2f, 0xfd, 0x60, 0xff, 0x03, 0x2d, 0x0c, 0x00, 0xa6, 0x9f,
+	0x3f, 0x14, 0xa0, 0x97, 0x34, 0x07, 0x33, 0xc7, 0xfb, 0x47, 0x55, 0xc5,
+	0xc9, 0x6e, 0xa1, 0x25, 0x6b, 0x9b, 0xbf, 0xf0, 0x0c, 0x01, 0x3f, 0x00,
+	0x37, 0x00, 0x37, 0x00, 0xf5, 0x49, 0xd1, 0x64, 0x44, 0x93, 0x68, 0x8e,
+	0x20, 0x99, 0x1d, 0x99, 0x64, 0xf8, 0x59, 0xaf, 0x90, 0x97, 0x48, 0x05,
+	0xef, 0xdd, 0xc7, 0x9b, 0x88, 0x64, 0x53, 0xc2, 0x11, 0x8c, 0x30, 0x6d,
+	0x3a, 0xb5, 0xf5, 0x1d, 0xdd, 0x11, 0xba, 0xa4, 0xe6, 0x9a, 0x7c, 0x94,
+	0x89, 0x38, 0x01, 0x02, 0x0c, 0x0c, 0x02, 0x08, 0x00, 0xc2, 0x01, 0x10,
+	0x70, 0x50, 0x30, 0x20, 0x00, 0x10, 0x01, 0x14, 0x41, 0x7e, 0x21, 0xc1,
+	0xcb, 0xde, 0x75, 0x76, 0x47, 0xec, 0xab, 0x30, 0x35, 0x58, 0xa7, 0xb5,
+	0x47, 0xb4, 0xa6, 0x14, 0x4d, 0x44, 0xf4, 0x75, 0xe6, 0x9e, 0xc8, 0x25,
+	0xc2, 0x5b, 0xe4, 0x67, 0x93, 0x90, 0xb3, 0x17, 0x3c, 0xe2, 0xc2, 0x4d,
+	0xb2, 0xb8, 0xc9, 0xc2, 0xd8, 0x27, 0xa1, 0xe1, 0x86, 0xf6, 0x92, 0xf6,
+	0x86, 0x0a, 0x13, 0x6e, 0x68, 0x3f, 0x99, 0x9a, 0x8c, 0x35, 0x89, 0x8e,
+	0xb8, 0x99, 0x0d, 0x33, 0x49, 0xe5, 0x33, 0xe2, 0xad, 0xe1, 0x25, 0xf2,
+	0x05, 0xbf, 0x4a, 0x70, 0xa2, 0xba, 0x29, 0x66, 0x07, 0x6d, 0x1a, 0x85,
+	0x29, 0xf4, 0x23, 0xe9, 0x9d, 0xa9, 0x4b, 0xe8, 0xf2, 0xe6, 0x0b, 0x9b,
+	0x29, 0x82, 0xcc, 0x28, 0x8f, 0x28, 0x72, 0xd2, 0x01, 0x33, 0x8c, 0x53,
+	0xf4, 0x0b, 0x5e, 0x86, 0xe0, 0x15, 0xbc, 0x63, 0x73, 0x1f, 0xb5, 0x36,
+	0x95, 0x2e, 0x4c, 0x93, 0x70, 0x04, 0xab, 0x53, 0xae, 0x26, 0x0a, 0xf5,
+	0xb5, 0xe8, 0xde, 0xcc, 0x25, 0x12, 0xf3, 0xc8, 0x67, 0x56, 0x4e, 0x72,
+	0xb3, 0x72, 0x04, 0x05, 0x27, 0x49, 0x70, 0xb2, 0xfb, 0xe4, 0x82, 0xdd,
+	0x10, 0x76, 0x49, 0x62, 0xa8, 0x11, 0x20, 0x04, 0x10, 0x0b, 0xec, 0xf6,
+	0x37, 0xd0, 0x28, 0x90, 0x80, 0x92, 0x1b, 0x10, 0x06, 0xed, 0x03, 0xd4,
+	0x0d, 0x13, 0xc1, 0xbf, 0xbe, 0xc1, 0x4c, 0xaa, 0x8c, 0xd8, 0x58, 0x1f,
+	0x6f, 0x1b, 0x94, 0x4b, 0x2c, 0x42, 0x08, 0x59, 0xc0, 0xab, 0x5c, 0x3f,
+	0x15, 0xcb, 0xe4, 0xf5, 0x6d, 0x9b, 0x0a, 0xbb, 0x82, 0xca, 0xeb, 0x80,
+	0xaf, 0x7a, 0x77, 0xfd, 0x9f, 0x70, 0x6c, 0xdd, 0xb9, 0x1e, 0xc1, 0x43,
+	0x8b, 0xbc, 0x27, 0x57, 0xe2, 0x56, 0x20, 0x78, 0xc2, 0x4b, 0x54, 0x6c,
+	0xb8, 0xc6, 0x58, 0xbf, 0x5d, 0x83, 0xa1, 0x37, 0x4c, 0xf2, 0x40, 0x46,
+	0x67, 0x3b, 0x0e, 0x99, 0x8a, 0xaf, 0xbb, 0x42, 0xd1, 0x73, 0x01, 0x3e,
+	0xc8, 0xd3, 0xd6, 0x83, 0x68, 0xa1, 0xf8, 0x95, 0xc9, 0x6b, 0xc2, 0x72,
+	0x5b, 0x0f, 0xac, 0xba, 0xc3, 0xcc, 0xb1, 0x67, 0x93, 0xff, 0x01, 0x15,
+	0xd8, 0xe5, 0x2a,
+};
+
+/* Frames from another encoder decode, whole or a byte at a time */
+int test_zstd_reference_frame() {
+    char want[2048];
+    size_t want_len = reference_text(want, sizeof(want));
+
+    if (codec_check_decode(&zstd_ops, reference_frame, sizeof(reference_frame), want, want_len) != 0) {
+        return 1;
+    }
+    printf("TEST PASSED: ZSTD reference frame decoded.\n");
+    return 0;
+}
+
+/* Concatenated frames (as parallel encoders write them) decode as one
+ * entry, with a skippable frame in between */
+int test_zstd_concatenated_frames() {
+    char want[4096];
+    uint8_t src[2 * sizeof(reference_frame) + 12];
+    size_t text_len = reference_text(want, sizeof(want));
+    size_t n = 0;
+
+    memcpy(want + text_len, want, text_len);
+    memcpy(src, reference_frame, sizeof(reference_frame));
+    n += sizeof(reference_frame);
+    memcpy(src + n, "\x50\x2a\x4d\x18\x04\x00\x00\x00skip", 12);
+    n += 12;
+    memcpy(src + n, reference_frame, sizeof(reference_frame));
+    n += sizeof(reference_frame);
+
+    if (codec_check_decode(&zstd_ops, src, n, want, 2 * text_len) != 0) {
+        return 1;
+    }
+    printf("TEST PASSED: ZSTD concatenated frames decoded.\n");
+    return 0;
+}
+
 int main(int argc, char *argv[]) {
     (void)argc; (void)argv;
     printf("Running ZSTD basic test...\n");
@@ -192,5 +272,14 @@ int main(int argc, char *argv[]) {
     printf("\nRunning ZSTD large data test...\n");
     int result2 = test_zstd_large_data();
 
-    return (result1 || result2);
+    printf("\nRunning ZSTD reference frame test...\n");
+    int result3 = test_zstd_reference_frame();
+
+    printf("\nRunning ZSTD levels and streaming test...\n");
+    int result4 = codec_levels_streaming(&zstd_ops);
+
+    printf("\nRunning ZSTD concatenated frames test...\n");
+    int result5 = test_zstd_concatenated_frames();
+
+    return (result1 || result2 || result3 || result4 || result5);
 }